@@ -14,11 +14,13 @@
 #include "helpers.h"
 #include "mem_range_repo.h"
 #include "readalias_ioctls.h"
+#include "sweep.h"
+#include "multisource.h"
+#include "masksearch.h"
+#include "linearsolve.h"
+#include "journal.h"
 
 
-//Controls debug prints in find_alias functions
-//#define FIND_ALIAS_DEBUG
-
 //bundles all mem ranges together with the ones filtered for
 //searching aliases
 struct mem_layout {
@@ -33,6 +35,9 @@ void free_mem_layout(struct mem_layout m) {
     if(m.filtered_ranges) free(m.filtered_ranges);
 }
 
+//the journal of `find` is stored next to the output file, with this suffix
+#define FAI_JOURNAL_SUFFIX ".fai-journal"
+
 //physical address and the corresponding memory range
 struct mem_range_pa {
     uint64_t pa;
@@ -70,20 +75,174 @@ int store_valid_aliases(char* path, struct mem_range_pa* source , uint64_t*  ali
     
 }
 
+/**
+ * @brief Solve the alias function of each memory range in `source`, starting from the found aliases, and serialize
+ * them to file. Ranges without a valid alias will not be serialized. If the alias function of a range cannot be
+ * solved, only the xor mask found by the sweep is serialized for it
+ * @param top_pa : exclusive end of the highest memory range in the iomem map
+ * @returns 0 on success
+*/
+static int store_linear_aliases(char* path, struct mem_range_pa* source, uint64_t* alias_pa, size_t len,
+    struct mem_layout mem_layout, uint64_t top_pa, bool access_reserved) {
+    struct linear_alias* results = NULL;
+    size_t results_len = 0;
+    //ranges that are stored with the mask of the sweep
+    size_t fallbacks = 0;
+    for( size_t i = 0; i < len; i++ ) {
+        if( alias_pa[i] == 0 ) {
+            continue;
+        }
+        //solve each memory range only once, even if there are multiple source pas in it
+        bool solved = false;
+        for( size_t j = 0; j < i; j++ ) {
+            solved |= alias_pa[j] != 0 && source[j].mr.start == source[i].mr.start;
+        }
+        if( solved ) {
+            continue;
+        }
+        size_t range_first_result = results_len;
+        if( !solve_linear_alias(source[i].pa, alias_pa[i], &source[i].mr, mem_layout.filtered_ranges, mem_layout.filtered_ranges_len,
+            top_pa, access_reserved, &results, &results_len) ) {
+            continue;
+        }
+        //drop the parts that have been solved and fall back to the mask of the sweep for the whole range
+        printf("Alias function of [0x%jx,0x%jx[ is only solved for %ju part(s), dropping them and storing the xor mask 0x%jx"
+            " of the sweep instead\n", source[i].mr.start, source[i].mr.end, results_len - range_first_result,
+            source[i].pa ^ alias_pa[i]);
+        fallbacks += 1;
+        results_len = range_first_result;
+        struct linear_alias* tmp = realloc(results, sizeof(struct linear_alias) * (results_len + 1));
+        if( !tmp ) {
+            err_log("failed to alloc linear alias results\n");
+            free(results);
+            return -1;
+        }
+        results = tmp;
+        results[results_len] = (struct linear_alias){
+            .mr = source[i].mr,
+            .mask = source[i].pa ^ alias_pa[i],
+            .is_mask = true,
+        };
+        results[results_len].mr.alias_fn = NULL;
+        results_len += 1;
+    }
+
+    if( fallbacks ) {
+        printf("%ju memory range(s) fell back to the xor mask of the sweep\n", fallbacks);
+    }
+
+    mem_range_t* mr = malloc(sizeof(mem_range_t) * results_len);
+    uint64_t* alias_masks = malloc(sizeof(uint64_t) * results_len);
+    if( results_len && (!mr || !alias_masks) ) {
+        err_log("failed to alloc csv rows\n");
+        free(mr);
+        free(alias_masks);
+        free(results);
+        return -1;
+    }
+    for( size_t i = 0; i < results_len; i++ ) {
+        mr[i] = results[i].mr;
+        mr[i].alias_fn = results[i].is_mask ? NULL : &results[i].fn;
+        alias_masks[i] = results[i].mask;
+    }
+    int res = write_csv(path, mr, alias_masks, results_len);
+    free(mr);
+    free(alias_masks);
+    free(results);
+    return res;
+}
+
+
+//pages per PFN_STATE ioctl when searching for an accessible page
+#define PFN_WINDOW_PAGES 4096
+
+//records the resume point of the sweep in the journal entry of the current source pa
+static void journal_sweep_progress(void* arg, uint64_t done_pa) {
+    journal_t* journal = arg;
+    journal_entry(journal, journal_current(journal))->pos = done_pa;
+    journal_sync(journal, false);
+}
+
+/**
+ * @brief Let the sweep continue at the resume point of the current journal entry and report its progress to the journal
+ * @param journal : NULL to sweep without journal
+*/
+static void sweep_params_set_journal(struct sweep_params* params, journal_t* journal) {
+    if( !journal ) {
+        return;
+    }
+    params->resume_pa = journal_entry(journal, journal_current(journal))->pos;
+    params->on_progress = journal_sweep_progress;
+    params->progress_arg = journal;
+}
+
+/**
+ * @brief Record the search result of source pa `idx`
+ * @param alias_pa : 0 if no alias has been found
+*/
+static void journal_finish(journal_t* journal, size_t idx, uint64_t alias_pa) {
+    struct journal_entry* je = journal_entry(journal, idx);
+    je->result = alias_pa;
+    je->state = alias_pa ? JOURNAL_DONE : JOURNAL_FAILED;
+    journal_sync(journal, true);
+}
+
+//journal of the sources of a single pass sweep
+struct single_pass_journal {
+    journal_t* journal;
+    //journal entry of each swept source
+    const size_t* source_idx;
+    const uint64_t* sweep_alias;
+    size_t len;
+};
+
+//records the aliases found so far and the resume point of the single pass sweep in the entries of the swept sources
+static void journal_single_pass_progress(void* arg, uint64_t done_pa) {
+    struct single_pass_journal* spj = arg;
+    for( size_t i = 0; i < spj->len; i++ ) {
+        struct journal_entry* je = journal_entry(spj->journal, spj->source_idx[i]);
+        if( je->state != JOURNAL_RUNNING ) {
+            continue;
+        }
+        if( spj->sweep_alias[i] ) {
+            je->result = spj->sweep_alias[i];
+            je->state = JOURNAL_DONE;
+        } else {
+            je->pos = done_pa;
+        }
+    }
+    journal_sync(spj->journal, false);
+}
+
+static void journal_add_stats(journal_t* journal, page_stats_t stats) {
+    if( !journal ) {
+        return;
+    }
+    struct journal_entry* je = journal_entry(journal, journal_current(journal));
+    je->reserved_pages += stats.reserved_pages;
+    je->map_failed += stats.map_failed;
+}
 
 /**
  * @brief Tries to find an alias for `source_pa`. Since we assume
  * deactivated scrambling, simply write the marker value once an then scan
- * for it
+ * for it. The scan runs inside the kernel module, only matches are reported back
  * 
  * @param source_pa search alias for this physical address
  * @param out_alias out param. On success filled with pa of alias
+ * @param threads : number of threads that sweep `sys_ram`, see `sweep_find_alias`
+ * @param journal : Optional. Resume the sweep of the current journal entry and record its progress
+ * @param metrics : Optional. JSON lines output for the progress and the lib metrics of the sweep
  * @return int 0 on success
  */
-int find_alias_no_scrambling(uint64_t source_pa, uint64_t* out_alias, mem_range_t* sys_ram, size_t sys_ram_len, bool access_reserved) {
+int find_alias_no_scrambling(uint64_t source_pa, uint64_t* out_alias, mem_range_t* sys_ram, size_t sys_ram_len, bool access_reserved, size_t threads,
+    journal_t* journal, FILE* metrics) {
     const size_t msg_len = 64;
-    uint8_t m1[msg_len], buf1[msg_len];
-    get_rand_bytes(m1, msg_len);
+    uint8_t m1[msg_len];
+    if( gen_rand_bytes(m1, msg_len) ) {
+        err_log("failed to generate marker value\n");
+        return -1;
+    }
 
     page_stats_t tmp;
     //write m1 to source_pa
@@ -94,95 +253,51 @@ int find_alias_no_scrambling(uint64_t source_pa, uint64_t* out_alias, mem_range_
 
     //write marker value only once. Without scramblign we can simple search for another occurence
     //of this value
-    if( memcpy_topa(source_pa, m1, msg_len, &tmp, true) ) {
+    struct pamemcpy_cfg write_cfg = {
+        .out_stats = {0},
+        .access_reserved = access_reserved,
+        .err_on_access_fail = true,
+        .flush_method = FM_WBINVD,
+    };
+    //FM_WBINVD falls back to flushing the written range if the cpu cannot flush the whole cache
+    if( memcpy_topa_ext(source_pa, m1, msg_len, &write_cfg) ) {
         err_log("memcpy_topa for 0x%jx failed\n", source_pa);
         return -1;
     }
-    if( wbinvd_ac() ) {
-        err_log("wbinvd_ac() failed");
-        return -1;
-    }
 
-    size_t total_memory_bytes = 0;
-    for( size_t i = 0; i < sys_ram_len; i++) {
-        total_memory_bytes += sys_ram[i].end - sys_ram[i].start;
-    }
-    size_t total_processed_bytes = 0;
-    const size_t print_progress_interval = 1 << 30;
-  
-  
-    page_stats_t total_page_stats = {0};
-    struct pamemcpy_cfg memcpy_cfg = {
-        .out_stats = {0},
+    struct sweep_params params = {
+        .mode = SWEEP_SCAN,
+        .source_pa = source_pa,
+        .marker = m1,
+        .marker_len = msg_len,
+        .ranges = sys_ram,
+        .ranges_len = sys_ram_len,
         .access_reserved = access_reserved,
-        .err_on_access_fail = true,
-        .flush_method = FM_CLFLUSH,
+        .threads = threads,
+        .metrics = metrics,
     };
-    for( size_t sys_ram_idx = 0; sys_ram_idx < sys_ram_len; sys_ram_idx++) {
-        mem_range_t* mr = sys_ram+sys_ram_idx;
-        printf("[%ju/%ju[: Searching mem range %s [0x%jx,0x%jx[ (%.2f GiB)\n",
-        sys_ram_idx, sys_ram_len, mr->name, mr->start, mr->end, (double)(mr->end - mr->start)/(1<<30));
-        uint64_t aligned_start = mr->start;
-        if((aligned_start % 4096) != 0) {
-            aligned_start += (4096 - (mr->start % 4096));
-        }
-        printf("aligned_start = 0x%jx\n", aligned_start);
-        for( uint64_t alias_candidate_pa = aligned_start; alias_candidate_pa < mr->end; alias_candidate_pa += 4096) {
-            //printf("doing pa = 0x%jx\n", target_pa);
-            if( (total_processed_bytes % print_progress_interval) == print_progress_interval) {
-                printf("Total progress %0.2f\n", (double)total_processed_bytes/total_memory_bytes);
-            }
-            total_processed_bytes += 4096;
-            if( alias_candidate_pa == source_pa) {
-            continue;
-            }
-
-
-            //read alias_candidate_pa
-            if( memcpy_frompa_ext(buf1, alias_candidate_pa, msg_len, &memcpy_cfg) ) {
-                err_log("memcpy_frompa for 0x%jx failed\n", alias_candidate_pa);
-                //return -1;
-                continue;
-            }
-
-#ifdef FIND_ALIAS_DEBUG
-            printf("alias_candidate: 0x%jx\n", alias_candidate_pa);
-            printf("m1: ");
-            hexdump(m1, msg_len);
-            printf("buf1: ");
-            hexdump(buf1, msg_len);
-
-#endif
-           
-
-            if( 0 == memcmp(m1, buf1, msg_len) ) {
-                uint64_t pa_xor = source_pa ^ alias_candidate_pa;
-                printf("Found alias for 0x%jx at 0x%jx! xor diff = 0x%jx\n", source_pa, alias_candidate_pa, pa_xor);
-                printf("buf1: ");
-                hexdump(buf1, msg_len);
-                printf("buf2: ");
-
-                *out_alias = alias_candidate_pa;
-                printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n",
-                    total_page_stats.reserved_pages, total_page_stats.map_failed);
-                return 0;
-            }
-        }
-
-        printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n",
-            memcpy_cfg.out_stats.reserved_pages, memcpy_cfg.out_stats.map_failed);
-
-        total_page_stats.reserved_pages += memcpy_cfg.out_stats.reserved_pages;
-        total_page_stats.map_failed += memcpy_cfg.out_stats.map_failed;
-        memcpy_cfg.out_stats.map_failed = 0;
-        memcpy_cfg.out_stats.reserved_pages = 0;
+    if( gen_rand_bytes(&params.seed, sizeof(params.seed)) ) {
+        err_log("failed to generate worker seed\n");
+        return -1;
+    }
+    sweep_params_set_journal(&params, journal);
+    struct sweep_result result;
+    if( sweep_find_alias(&params, &result) ) {
+        err_log("sweep for 0x%jx failed\n", source_pa);
+        return -1;
     }
-  
     printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n",
-        total_page_stats.reserved_pages, total_page_stats.map_failed);
-    //if we reach the end of this function, we have not found an alias. Thus, return error_code
-    return -1;
-
+        result.stats.reserved_pages, result.stats.map_failed);
+    journal_add_stats(journal, result.stats);
+    //if we have not found an alias, return error_code
+    if( !result.found ) {
+        return -1;
+    }
+    printf("Found alias for 0x%jx at 0x%jx! xor diff = 0x%jx\n", source_pa, result.alias_pa, source_pa ^ result.alias_pa);
+    printf("marker: ");
+    hexdump(m1, msg_len);
+    *out_alias = result.alias_pa;
+    return 0;
 }
 
 
@@ -194,161 +309,52 @@ int find_alias_no_scrambling(uint64_t source_pa, uint64_t* out_alias, mem_range_
  * @param source_pa search alias for this physical address
  * @param out_alias out param. On success filled with pa of alias
  * @param access_reserved : If true, try go access pages marked as reserved. Might lead to crashes, especially when writing to them
+ * @param threads : number of threads that sweep `sys_ram`, see `sweep_find_alias`
+ * @param journal : Optional. Resume the sweep of the current journal entry and record its progress
+ * @param metrics : Optional. JSON lines output for the progress and the lib metrics of the sweep
  * @return int 0 on success
  */
-int find_alias_scrambling(uint64_t source_pa, uint64_t* out_alias, mem_range_t* sys_ram, size_t sys_ram_len,bool access_reserved) {
-    const size_t msg_len = 64;
-    uint8_t m1[msg_len], m2[msg_len], mxor[msg_len], buf1[msg_len], buf2[msg_len], bufxor[msg_len];
-    get_rand_bytes(m1, msg_len);
-    get_rand_bytes(m2, msg_len);
-    for(size_t i = 0; i < msg_len; i++) {
-        mxor[i] = m1[i] ^ m2[i];
-    }
-
-    size_t total_memory_bytes = 0;
-    for( size_t i = 0; i < sys_ram_len; i++) {
-        total_memory_bytes += sys_ram[i].end - sys_ram[i].start;
-    }
-    size_t total_processed_bytes = 0;
-    const size_t print_progress_interval = 1 << 30;
-  
-  
-    page_stats_t total_page_stats = {0};
-    for( size_t sys_ram_idx = 0; sys_ram_idx < sys_ram_len; sys_ram_idx++) {
-        mem_range_t* mr = sys_ram+sys_ram_idx;
-        printf("[%ju/%ju[: Searching mem range %s [0x%jx,0x%jx[ (%.2f GiB)\n",
-        sys_ram_idx, sys_ram_len, mr->name, mr->start, mr->end, (double)(mr->end - mr->start)/(1<<30));
-        page_stats_t local_page_stats = {0};
-        struct pamemcpy_cfg memcpy_cfg = {
-            .out_stats = {0},
-            .err_on_access_fail = true,
-            .access_reserved = access_reserved,
-            .flush_method = FM_CLFLUSH,
-        };
-        uint64_t aligned_start = mr->start;
-        if((aligned_start % 4096) != 0) {
-            aligned_start += (4096 - (mr->start % 4096));
-        }
-        printf("aligned_start = 0x%jx\n", aligned_start);
-        for( uint64_t alias_candidate_pa = aligned_start; alias_candidate_pa < mr->end; alias_candidate_pa += 4096) {
-            //printf("doing pa = 0x%jx\n", target_pa);
-            if( (total_processed_bytes % print_progress_interval) == print_progress_interval) {
-                printf("Total progress %0.2f\n", (double)total_processed_bytes/total_memory_bytes);
-            }
-            total_processed_bytes += 4096;
-            if( alias_candidate_pa == source_pa) {
-            continue;
-            }
-
-            //write m1 to source_pa
-            if( clflush_range(alias_candidate_pa, msg_len, &local_page_stats, true) ) {
-                err_log("flush_range for 0x%jx failed\n", alias_candidate_pa)
-                //return -1;
-                continue;
-            }
-            if( memcpy_topa_ext(source_pa, m1, msg_len, &memcpy_cfg) ) {
-                err_log("memcpy_topa for 0x%jx failed\n", source_pa);
-                //return -1;
-                continue;
-            }
-
-            if( memcpy_frompa_ext(buf1, alias_candidate_pa, msg_len, &memcpy_cfg) ) {
-                err_log("memcpy_frompa for 0x%jx failed\n", alias_candidate_pa);
-                //return -1;
-                continue;
-            }
-            if( clflush_range(alias_candidate_pa, msg_len, &local_page_stats, true) ) {
-                err_log("flush_range for target_pa 0x%jx failed\n", alias_candidate_pa);
-                //return -1;
-                continue;
-            }
-
-
-            //write m2 to source_pa
-            if( memcpy_topa_ext(source_pa, m2, msg_len, &memcpy_cfg) ) {
-                err_log("memcpy_topa for source_pa 0x%jx failed\n", source_pa);
-                //return -1;
-                continue;
-            }
-            if( clflush_range(source_pa, msg_len, &local_page_stats, true) ) {
-                err_log("flush_range for source_pa 0x%jx failed\n", source_pa);
-                //return -1;
-                continue;
-            }
-
-            //read from target_pa
-            if( memcpy_frompa_ext(buf2, alias_candidate_pa, msg_len, &memcpy_cfg) ) {
-                err_log("memcpy_frompa for target_pa 0x%jx failed\n", alias_candidate_pa);
-                continue;
-            }
-
-            /*
-            * We wrote  m1 and m2 to source_pa and read them through alias_candidate_pa
-            * buf1 and buf2 contain the values read through surce_pa.
-            * To account for memory scrambling, we dont compare them directly but check if
-            * buf1^buf2 matches m1^m2
-            */
-
-
-#ifdef FIND_ALIAS_DEBUG
-        printf("alias_candidate: 0x%jx\n", alias_candidate_pa);
-        printf("m1: ");
-        hexdump(m1, msg_len);
-        printf("buf1: ");
-        hexdump(buf1, msg_len);
-
-        printf("m2: ");
-        hexdump(m2, msg_len);
-        printf("buf2: ");
-        hexdump(buf2, msg_len);
-
-        printf("m1 ^ m2: ");
-        hexdump(mxor, msg_len);
-#endif
-           
-            int found_matching_xor = 1;
-            for(size_t i = 0; i < msg_len; i++) {
-                bufxor[i] = buf1[i] ^ buf2[i];
-                if( mxor[i] != bufxor[i]) {
-                    found_matching_xor = 0;
-                }
-            }
-#ifdef FIND_ALIAS_DEBUG
-            printf("buf1 ^ buf2: ");
-            hexdump(bufxor, msg_len);
-#endif
-
-            if( found_matching_xor ) {
-                uint64_t pa_xor = source_pa ^ alias_candidate_pa;
-                printf("Found alias for 0x%jx at 0x%jx! xor diff = 0x%jx\n", source_pa, alias_candidate_pa, pa_xor);
-                printf("buf1: ");
-                hexdump(buf1, msg_len);
-                printf("buf2: ");
-                hexdump(buf2, msg_len);
-                 printf("got xor: ");
-                hexdump(mxor, msg_len);
-                printf("want xor: ");
-                hexdump(mxor, msg_len);
-
-                *out_alias = alias_candidate_pa;
-                printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n",
-                    total_page_stats.reserved_pages, total_page_stats.map_failed);
-                return 0;
-            }
-        }
-        printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n",
-            local_page_stats.reserved_pages, local_page_stats.map_failed);
-        total_page_stats.reserved_pages += local_page_stats.reserved_pages;
-        total_page_stats.map_failed += local_page_stats.map_failed;
+int find_alias_scrambling(uint64_t source_pa, uint64_t* out_alias, mem_range_t* sys_ram, size_t sys_ram_len, bool access_reserved, size_t threads,
+    journal_t* journal, FILE* metrics) {
+    /*
+     * The kernel writes m1 to source_pa, reads the candidates, writes m2 to source_pa and reads them again.
+     * To account for memory scrambling, it does not compare the reads with the messages directly but checks if
+     * buf1^buf2 matches m1^m2
+     */
+    struct sweep_params params = {
+        .mode = SWEEP_PROBE,
+        .source_pa = source_pa,
+        .marker = NULL,
+        .marker_len = 0,
+        .ranges = sys_ram,
+        .ranges_len = sys_ram_len,
+        .access_reserved = access_reserved,
+        .threads = threads,
+        .metrics = metrics,
+    };
+    if( gen_rand_bytes(&params.seed, sizeof(params.seed)) ) {
+        err_log("failed to generate worker seed\n");
+        return -1;
+    }
+    sweep_params_set_journal(&params, journal);
+    struct sweep_result result;
+    if( sweep_find_alias(&params, &result) ) {
+        err_log("sweep for source_pa 0x%jx failed\n", source_pa);
+        return -1;
     }
-  
     printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n",
-        total_page_stats.reserved_pages, total_page_stats.map_failed);
-    //if we reach the end of this function, we have not found an alias. Thus, return error_code
-    return -1;
-
+        result.stats.reserved_pages, result.stats.map_failed);
+    journal_add_stats(journal, result.stats);
+    //if we have not found an alias, return error_code
+    if( !result.found ) {
+        return -1;
+    }
+    printf("Found alias for 0x%jx at 0x%jx! xor diff = 0x%jx\n", source_pa, result.alias_pa, source_pa ^ result.alias_pa);
+    *out_alias = result.alias_pa;
+    return 0;
 }
 
+
 /**
  * @brief Helper functions that returns true if `addr` is part of
  * one of the given memory ranges
@@ -377,19 +383,23 @@ bool is_in_mem_ranges(uint64_t addr, mem_range_t* mem_ranges, size_t mem_ranges_
  */
 static int find_accessible_pa_in_mem_range(mem_range_t* mr, uint64_t* out_pa, bool access_reserved) {
     uint64_t aligned_start = mr->start + (4096 - (mr->start % 4096));
-    struct pamemcpy_cfg cfg = {
-        .access_reserved = access_reserved,
-        .err_on_access_fail = true,
-        .flush_method = FM_NONE,
-        .out_stats = {0},
-    };
-    for( uint64_t candidate = aligned_start; candidate < mr->end; candidate += 4096) {
-        char buf[64];
-        if( memcpy_frompa_ext(buf, candidate, sizeof(buf), &cfg)) {
-            continue;
+    //query the page state for PFN_WINDOW_PAGES pages at once instead of trying to access each page
+    uint64_t inaccessible[PFN_BITMAP_WORDS(PFN_WINDOW_PAGES)];
+    for( uint64_t window = aligned_start; window < mr->end; window += PFN_WINDOW_PAGES * 4096) {
+        size_t pages = (mr->end - window + 4095) / 4096;
+        if( pages > PFN_WINDOW_PAGES ) {
+            pages = PFN_WINDOW_PAGES;
+        }
+        if( get_pfn_state(window, pages, access_reserved, NULL, NULL, inaccessible, NULL) ) {
+            err_log("failed to get page state for 0x%jx\n", window);
+            return -1;
+        }
+        for( size_t i = 0; i < pages; i++ ) {
+            if( !pfn_bitmap_test(inaccessible, i) ) {
+                *out_pa = window + i * 4096;
+                return 0;
+            }
         }
-        *out_pa = candidate;
-        return 0;
     }
     return -1;
 }
@@ -480,6 +490,23 @@ struct cli_flags {
     bool no_scrambling;
     //write output to this path
     char* output_path;
+    //If true, seed the generator for the alias test messages with `seed`
+    bool have_seed;
+    uint64_t seed;
+    //number of threads that sweep the memory ranges
+    size_t threads;
+    //If true, search the aliases of all source pas with a single sweep
+    bool single_pass;
+    //try masks with up to this many flipped address bits before sweeping. 0 disables this
+    uint64_t max_mask_weight;
+    //If true, solve the alias function of each memory range instead of storing a single mask
+    bool linear;
+    //If true, continue the search recorded in the journal next to `output_path`
+    bool resume;
+    //If true, discard the journal next to `output_path`
+    bool restart;
+    //Optional. Append the progress and the lib metrics of each sweep to this file, as JSON lines
+    char* metrics_path;
 };
 
 int parse_cli_flags(int argc, char** argv, struct cli_flags* out_cli_flags) {
@@ -488,8 +515,18 @@ int parse_cli_flags(int argc, char** argv, struct cli_flags* out_cli_flags) {
     const char* verb_find_memrange_arg = "--mem-range-file";
     const char* common_output_path = "--out";
     const char* common_access_reserved_flag = "--access-reserved";
+    const char* verb_find_seed_arg = "--seed";
+    const char* verb_find_threads_arg = "--threads";
+    const char* verb_find_single_pass_flag = "--single-pass";
+    const char* verb_find_max_mask_weight_arg = "--max-mask-weight";
+    const char* verb_find_linear_flag = "--linear";
+    const char* verb_find_resume_flag = "--resume";
+    const char* verb_find_restart_flag = "--restart";
+    const char* verb_find_metrics_arg = "--metrics";
     int idx = 0;
     out_cli_flags->output_path = "aliases.csv";
+    out_cli_flags->threads = 1;
+    out_cli_flags->max_mask_weight = MASK_SEARCH_DEFAULT_WEIGHT;
     while( idx < argc ) {
         if( 0 == memcmp(common_access_reserved_flag, argv[idx], strlen(common_access_reserved_flag))) {
             out_cli_flags->access_reserved = true;
@@ -518,10 +555,54 @@ int parse_cli_flags(int argc, char** argv, struct cli_flags* out_cli_flags) {
             }
             out_cli_flags->memrange_path = argv[idx+1];
             idx += 2;
+        } else if(0 == memcmp(verb_find_seed_arg, argv[idx], strlen(verb_find_seed_arg))) {
+            if( (idx+1) >= argc || do_stroul(argv[idx+1], 0, &out_cli_flags->seed) ) {
+                printf("Missing or invalid value for \"%s\"\n", verb_find_seed_arg);
+                return -1;
+            }
+            out_cli_flags->have_seed = true;
+            idx += 2;
+        } else if(0 == memcmp(verb_find_threads_arg, argv[idx], strlen(verb_find_threads_arg))) {
+            uint64_t threads;
+            if( (idx+1) >= argc || do_stroul(argv[idx+1], 0, &threads) || threads < 1 || threads > SWEEP_MAX_THREADS ) {
+                printf("Missing or invalid value for \"%s\", must be between 1 and %d\n", verb_find_threads_arg, SWEEP_MAX_THREADS);
+                return -1;
+            }
+            out_cli_flags->threads = threads;
+            idx += 2;
+        } else if(0 == memcmp(verb_find_single_pass_flag, argv[idx], strlen(verb_find_single_pass_flag))) {
+            out_cli_flags->single_pass = true;
+            idx += 1;
+        } else if(0 == memcmp(verb_find_max_mask_weight_arg, argv[idx], strlen(verb_find_max_mask_weight_arg))) {
+            if( (idx+1) >= argc || do_stroul(argv[idx+1], 0, &out_cli_flags->max_mask_weight) || out_cli_flags->max_mask_weight > 64 ) {
+                printf("Missing or invalid value for \"%s\"\n", verb_find_max_mask_weight_arg);
+                return -1;
+            }
+            idx += 2;
+        } else if(0 == memcmp(verb_find_linear_flag, argv[idx], strlen(verb_find_linear_flag))) {
+            out_cli_flags->linear = true;
+            idx += 1;
+        } else if(0 == memcmp(verb_find_resume_flag, argv[idx], strlen(verb_find_resume_flag))) {
+            out_cli_flags->resume = true;
+            idx += 1;
+        } else if(0 == memcmp(verb_find_restart_flag, argv[idx], strlen(verb_find_restart_flag))) {
+            out_cli_flags->restart = true;
+            idx += 1;
+        } else if(0 == memcmp(verb_find_metrics_arg, argv[idx], strlen(verb_find_metrics_arg))) {
+            if( (idx+1) >= argc ) {
+                printf("Missing value for \"%s\"\n", verb_find_metrics_arg);
+                return -1;
+            }
+            out_cli_flags->metrics_path = argv[idx+1];
+            idx += 2;
         } else {
           idx += 1;  
         }
     }
+    if( out_cli_flags->resume && out_cli_flags->restart ) {
+        printf("\"%s\" and \"%s\" are mutually exclusive\n", verb_find_resume_flag, verb_find_restart_flag);
+        return -1;
+    }
     return 0;
 }
 
@@ -538,7 +619,21 @@ void print_usage(void) {
     printf("\t--out <FILE>: Default=aliases.csv : CSV file where the found aliases are stored\n");
     printf("\t--no-scrambling : Use more efficient alias test that only works if memory scrambling is disabled\n");
     printf("\t--source-pa-file <FILE> : Optional. Only search aliases for these PAs\n");
-    printf("\t--mem-range-file <FILE> : Optional. Only consider these memory ranges when searching aliases.");
+    printf("\t--mem-range-file <FILE> : Optional. Only consider these memory ranges when searching aliases.\n");
+    printf("\t--threads <N> : Default=1 : Number of threads that sweep the memory ranges, at most %d. Threads are pinned to the NUMA node of the memory they search."
+        " Without --no-scrambling, the threads share the message at the source pa\n", SWEEP_MAX_THREADS);
+    printf("\t--max-mask-weight <N> : Default=%d : Before sweeping, probe source_pa ^ mask for all masks that flip up to N address bits, in order of increasing weight. 0 disables this\n",
+        MASK_SEARCH_DEFAULT_WEIGHT);
+    printf("\t--single-pass : Search the aliases of all source pas with a single sweep instead of one sweep per source pa. Single threaded\n");
+    printf("\t--linear : Solve the alias function of each memory range as linear map over GF(2) with a few probes per address bit,"
+        " starting from the found alias. Ranges with piecewise alias functions are split\n");
+    printf("\t--resume : Continue the search recorded in <out>%s, e.g. after a crash. Source pas that have already been"
+        " searched are skipped and interrupted sweeps continue at their last checkpoint. Without --resume or --restart,"
+        " find refuses to start if this journal belongs to the same run\n", FAI_JOURNAL_SUFFIX);
+    printf("\t--restart : Discard the journal in <out>%s and start over\n", FAI_JOURNAL_SUFFIX);
+    printf("\t--metrics <FILE> : Optional. Write the sweep progress, the reserved/map fail rates per memory range and the"
+        " latency histograms of the kernel module calls to FILE, one JSON line per second. Appends with --resume\n");
+    printf("\t--seed <N> : Optional. Seed for the alias test messages, to replay a previous run. The seed of each run is printed\n");
 
 
     
@@ -566,8 +661,11 @@ int parse_and_print_memory_layout(struct mem_layout* out_mem_layout, bool access
 
 
     if(wbinvd_ac()) {
-        printf("wbinvd failed\n");
-        goto error;
+        if( errno != EOPNOTSUPP ) {
+            printf("wbinvd failed\n");
+            goto error;
+        }
+        printf("whole cache flush not supported, falling back to line based flushes\n");
     }
     //size of the regular RAM memory in bytes
     size_t system_ram_bytes = 0;
@@ -648,7 +746,7 @@ int select_candidates_for_mem_range(struct mem_layout mem_layout, struct cli_fla
                 printf("0x%09jx does not belong to any known memory range\n", source_pa[i]);
                 goto error;
             }
-            source_pa_mem_ranges[i] = alias_candidate_ranges[i];
+            source_pa_mem_ranges[i] = alias_candidate_ranges[mr_idx];
             printf("\t0x%09jx\n", source_pa[i]);
         }
     } else {
@@ -836,6 +934,7 @@ static int parse_memranges_from_file(char* path, struct mem_layout* ml) {
     while( 2 == fscanf(in_file, "0x%jx,0x%jx\n", &(mr[idx].start), &(mr[idx].end))){
         char* dummy_name = "Not restored by parser\n";
         memcpy(mr[idx].name, dummy_name, strlen(dummy_name));
+        mr[idx].alias_fn = NULL;
         idx += 1;
     }
     if( ferror(in_file) ) {
@@ -870,6 +969,8 @@ int mode_find(struct cli_flags flags) {
     struct mem_layout mem_layout = {0};
     struct mem_range_pa* source_candidates = NULL;
     size_t source_candidates_len;
+    journal_t* journal = NULL;
+    FILE* metrics = NULL;
     
     //Either parse memranges from user supplied file or parse them from /proc/iomem
     if(flags.memrange_path) {
@@ -889,48 +990,178 @@ int mode_find(struct cli_flags flags) {
         goto error;
     }
 
-    //Search alias for each source_pa
+    //the low weight mask search only flips address bits below the top of the iomem map
+    uint64_t top_pa = 0;
+    for( size_t i = 0; i < mem_layout.mem_ranges_len; i++ ) {
+        if( mem_layout.mem_ranges[i].end > top_pa ) {
+            top_pa = mem_layout.mem_ranges[i].end;
+        }
+    }
+
+    //Record the progress in a journal, to resume after a crash. The journal only belongs to this run if
+    //the alias test and the inputs are the same. The remaining flags only change how the search is done
+    {
+        uint64_t tag = JOURNAL_HASH_INIT;
+        tag = journal_hash(tag, &flags.no_scrambling, sizeof(flags.no_scrambling));
+        tag = journal_hash(tag, &flags.access_reserved, sizeof(flags.access_reserved));
+        for( size_t i = 0; i < source_candidates_len; i++ ) {
+            tag = journal_hash(tag, &source_candidates[i].pa, sizeof(source_candidates[i].pa));
+        }
+        for( size_t i = 0; i < mem_layout.filtered_ranges_len; i++ ) {
+            tag = journal_hash(tag, &mem_layout.filtered_ranges[i].start, sizeof(uint64_t));
+            tag = journal_hash(tag, &mem_layout.filtered_ranges[i].end, sizeof(uint64_t));
+        }
+        char* journal_path = malloc(strlen(flags.output_path) + strlen(FAI_JOURNAL_SUFFIX) + 1);
+        sprintf(journal_path, "%s%s", flags.output_path, FAI_JOURNAL_SUFFIX);
+        enum journal_open_mode journal_mode = JOURNAL_CREATE;
+        if( flags.resume ) {
+            journal_mode = JOURNAL_RESUME;
+        } else if( flags.restart ) {
+            journal_mode = JOURNAL_RESTART;
+        }
+        journal = journal_open(journal_path, tag, source_candidates_len, journal_mode);
+        if( !journal ) {
+            err_log("failed to open journal %s\n", journal_path);
+            free(journal_path);
+            goto error;
+        }
+        if( journal_resumed(journal) ) {
+            printf("Resuming the search recorded in %s\n", journal_path);
+        }
+        free(journal_path);
+    }
+    if( flags.metrics_path ) {
+        metrics = fopen(flags.metrics_path, flags.resume ? "a" : "w");
+        if( !metrics ) {
+            err_log("failed to open metrics file %s : %s\n", flags.metrics_path, strerror(errno));
+            goto error;
+        }
+        ra_metrics_enable(true);
+    }
+
+    //Search alias for each source_pa. Results from the journal are reused
     uint64_t* alias_pa = calloc(source_candidates_len, sizeof(uint64_t));
-    for( size_t i = 0; i < source_candidates_len; i++) {
-        printf("[%ju/%ju[: Searching alias for 0x%jx\n", i, source_candidates_len, source_candidates[i].pa);
-        //First check if any of the already found alias shifts work
-        bool existing_alias_worked = false;
-        for(size_t j = 0; j < i; j++) {
-            //invalid value
-            if( alias_pa[j] == 0) {
+    for( size_t i = 0; i < source_candidates_len; i++ ) {
+        struct journal_entry* je = journal_entry(journal, i);
+        if( je->state == JOURNAL_DONE || je->state == JOURNAL_FAILED ) {
+            alias_pa[i] = je->result;
+            printf("[%ju/%ju[: 0x%jx has already been searched, alias=0x%jx\n", i, source_candidates_len, source_candidates[i].pa, alias_pa[i]);
+        }
+    }
+    if( flags.single_pass ) {
+        //only sweep for the sources whose alias mask does not have a low weight
+        uint64_t* source_pas = malloc(sizeof(uint64_t) * source_candidates_len);
+        size_t* source_idx = malloc(sizeof(size_t) * source_candidates_len);
+        size_t sweep_len = 0;
+        for( size_t i = 0; i < source_candidates_len; i++ ) {
+            uint64_t state = journal_entry(journal, i)->state;
+            if( state == JOURNAL_DONE || state == JOURNAL_FAILED ) {
                 continue;
             }
-
-            uint64_t alias_mask = source_candidates[j].pa ^ alias_pa[j];
-            uint64_t alias_candidate = source_candidates[i].pa ^ alias_mask;
-            struct pamemcpy_cfg cfg = {
-                .access_reserved = flags.access_reserved,
-                .err_on_access_fail = true,                
-                .flush_method = FM_CLFLUSH,
-                .out_stats = {0},
-            };
-            if( check_alias(source_candidates[i].pa, alias_candidate, &cfg, true)) {
+            if( flags.max_mask_weight && !find_alias_low_weight(source_candidates[i].pa, mem_layout.filtered_ranges,
+                mem_layout.filtered_ranges_len, top_pa, flags.max_mask_weight, flags.access_reserved, alias_pa+i) ) {
+                journal_finish(journal, i, alias_pa[i]);
                 continue;
             }
-            existing_alias_worked = true;
-            alias_pa[i] = alias_candidate;
-            break;
+            source_pas[sweep_len] = source_candidates[i].pa;
+            source_idx[sweep_len] = i;
+            sweep_len += 1;
         }
-
-        if( existing_alias_worked ) {
-            printf("Found alias using existing alias mask 0x%09jx\n", source_candidates[i].pa ^ alias_pa[i]);
-            continue;
+        uint64_t* sweep_alias = calloc(source_candidates_len, sizeof(uint64_t));
+        //all swept sources share the resume point, i.e. continue at the one that has made the least progress
+        uint64_t resume_pa = UINT64_MAX;
+        for( size_t i = 0; i < sweep_len; i++ ) {
+            struct journal_entry* je = journal_entry(journal, source_idx[i]);
+            if( je->pos < resume_pa ) {
+                resume_pa = je->pos;
+            }
+            je->key = source_pas[i];
+            je->state = JOURNAL_RUNNING;
         }
+        journal_sync(journal, true);
+        struct single_pass_journal spj = {
+            .journal = journal,
+            .source_idx = source_idx,
+            .sweep_alias = sweep_alias,
+            .len = sweep_len,
+        };
+        if( sweep_len && find_aliases_single_pass(source_pas, sweep_len, mem_layout.filtered_ranges, mem_layout.filtered_ranges_len,
+            flags.access_reserved, flags.no_scrambling, resume_pa, journal_single_pass_progress, &spj, metrics, sweep_alias) ) {
+            err_log("single pass alias search failed\n");
+        } else {
+            for( size_t i = 0; i < sweep_len; i++ ) {
+                alias_pa[source_idx[i]] = sweep_alias[i];
+                journal_finish(journal, source_idx[i], sweep_alias[i]);
+            }
+        }
+        free(sweep_alias);
+        free(source_idx);
+        free(source_pas);
+    } else {
+        for( size_t i = 0; i < source_candidates_len; i++) {
+            struct journal_entry* je = journal_entry(journal, i);
+            if( je->state == JOURNAL_DONE || je->state == JOURNAL_FAILED ) {
+                continue;
+            }
+            if( je->state == JOURNAL_RUNNING ) {
+                printf("[%ju/%ju[: Continuing the search for 0x%jx\n", i, source_candidates_len, source_candidates[i].pa);
+            } else {
+                printf("[%ju/%ju[: Searching alias for 0x%jx\n", i, source_candidates_len, source_candidates[i].pa);
+            }
+            journal_set_current(journal, i);
+            je->key = source_candidates[i].pa;
+            je->state = JOURNAL_RUNNING;
+            journal_sync(journal, true);
+            //First check if any of the already found alias shifts work
+            bool existing_alias_worked = false;
+            for(size_t j = 0; j < i; j++) {
+                //invalid value
+                if( alias_pa[j] == 0) {
+                    continue;
+                }
 
-        //Otherwise sweep memory range
-        if( flags.no_scrambling ) {
-            if(find_alias_no_scrambling(source_candidates[i].pa, alias_pa+i, mem_layout.filtered_ranges, mem_layout.filtered_ranges_len,flags.access_reserved)) {
-                err_log( "find_alias_no_scrambling for 0x%jx failed\n", source_candidates[i].pa);
+                uint64_t alias_mask = source_candidates[j].pa ^ alias_pa[j];
+                uint64_t alias_candidate = source_candidates[i].pa ^ alias_mask;
+                struct pamemcpy_cfg cfg = {
+                    .access_reserved = flags.access_reserved,
+                    .err_on_access_fail = true,                
+                    .flush_method = FM_CLFLUSH,
+                    .out_stats = {0},
+                };
+                if( check_alias(source_candidates[i].pa, alias_candidate, &cfg, true)) {
+                    continue;
+                }
+                existing_alias_worked = true;
+                alias_pa[i] = alias_candidate;
+                break;
             }
-        } else {   
-            if(find_alias_scrambling(source_candidates[i].pa, alias_pa+i, mem_layout.filtered_ranges, mem_layout.filtered_ranges_len,flags.access_reserved)) {
-                err_log( "find_alias_scrambling for 0x%jx failed\n", source_candidates[i].pa);
+
+            if( existing_alias_worked ) {
+                printf("Found alias using existing alias mask 0x%09jx\n", source_candidates[i].pa ^ alias_pa[i]);
+                journal_finish(journal, i, alias_pa[i]);
+                continue;
             }
+
+            //Then try the masks that only flip a few address bits
+            if( flags.max_mask_weight && !find_alias_low_weight(source_candidates[i].pa, mem_layout.filtered_ranges,
+                mem_layout.filtered_ranges_len, top_pa, flags.max_mask_weight, flags.access_reserved, alias_pa+i) ) {
+                journal_finish(journal, i, alias_pa[i]);
+                continue;
+            }
+
+            //Otherwise sweep memory range
+            if( flags.no_scrambling ) {
+                if(find_alias_no_scrambling(source_candidates[i].pa, alias_pa+i, mem_layout.filtered_ranges, mem_layout.filtered_ranges_len,flags.access_reserved, flags.threads,
+                    journal, metrics)) {
+                    err_log( "find_alias_no_scrambling for 0x%jx failed\n", source_candidates[i].pa);
+                }
+            } else {   
+                if(find_alias_scrambling(source_candidates[i].pa, alias_pa+i, mem_layout.filtered_ranges, mem_layout.filtered_ranges_len,flags.access_reserved, flags.threads,
+                    journal, metrics)) {
+                    err_log( "find_alias_scrambling for 0x%jx failed\n", source_candidates[i].pa);
+                }
+            }
+            journal_finish(journal, i, alias_pa[i]);
         }
     }
 
@@ -946,13 +1177,26 @@ int mode_find(struct cli_flags flags) {
         }
     }
 
-    printf("Writing aliases to: %s", flags.output_path);
-    if( store_valid_aliases(flags.output_path,source_candidates, alias_pa, source_candidates_len) ) {
-        printf("Failed to store alias to file\n");
-        goto error;        
+    if( flags.linear ) {
+        printf("Solving alias functions\n");
+        if( store_linear_aliases(flags.output_path, source_candidates, alias_pa, source_candidates_len, mem_layout, top_pa,
+            flags.access_reserved) ) {
+            printf("Failed to store alias functions to file\n");
+            goto error;
+        }
+        printf("Wrote alias functions to: %s\n", flags.output_path);
+    } else {
+        printf("Writing aliases to: %s", flags.output_path);
+        if( store_valid_aliases(flags.output_path,source_candidates, alias_pa, source_candidates_len) ) {
+            printf("Failed to store alias to file\n");
+            goto error;        
+        }
     }
     free(alias_pa);
 
+    //all source pas are done and stored, there is nothing left to resume
+    journal_remove(journal);
+    journal = NULL;
 
     int ret = 0;
     goto cleanup;
@@ -962,6 +1206,8 @@ error:
 cleanup:
     free_mem_layout(mem_layout);
     if(source_candidates) free(source_candidates);
+    journal_close(journal);
+    if(metrics) fclose(metrics);
     close_kmod();
     return ret; 
 }
@@ -972,6 +1218,10 @@ int run(enum main_mode mode, struct cli_flags flags ) {
         printf( "failed to communicate with kernel driver : %s\n", strerror(errno));
         goto error;
     }
+    if( flags.have_seed ) {
+        set_rand_seed(flags.seed);
+    }
+    printf("Random seed: 0x%jx\n", get_rand_seed());
 
     switch (mode) {
         case MODE_REPORT:
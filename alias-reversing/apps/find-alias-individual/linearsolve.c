@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "linearsolve.h"
+#include "masksearch.h"
+#include "readalias.h"
+
+//lowest address bit that is solved for, i.e. we work on cache line granularity
+#define LINEAR_MIN_BIT 6
+//random sources after the single bit flips. Cover address bits that cannot be flipped on their own inside the range
+#define LINEAR_RANDOM_SOURCES 8
+//random addresses to check the alias function against
+#define LINEAR_VERIFY_PROBES 16
+//a function that could only be checked against fewer accessible addresses is rejected
+#define LINEAR_VERIFY_MIN_PROBES 8
+//flipped address bits around the predicted alias before giving up on a source
+#define LINEAR_NEAR_WEIGHT 2
+//maximal number of range splits and minimal size of a split range
+#define LINEAR_MAX_DEPTH 8
+#define LINEAR_MIN_RANGE (2ULL << 20)
+
+//linear system over GF(2) in row echelon form. Row d[p] has its highest set bit at p and M * d[p] = y[p]
+struct gf2_system {
+    uint64_t d[64];
+    uint64_t y[64];
+    uint64_t pivots;
+};
+
+struct solver {
+    readalias_ctx_t* ctx;
+    const mem_range_t* mr;
+    mem_range_t* ranges;
+    size_t ranges_len;
+    uint64_t top_pa;
+    bool access_reserved;
+    unsigned addr_bits;
+    uint64_t probes;
+    struct linear_alias** results;
+    size_t* results_len;
+};
+
+/**
+ * @brief Reduce `d` with the rows of `s`
+ * @param io_y : In/Output param. The y values of the used rows are xored to it
+ * @returns the part of `d` that is not in the span of `s`
+*/
+static uint64_t gf2_reduce(const struct gf2_system* s, uint64_t d, uint64_t* io_y) {
+    for( int p = 63; p >= 0 && d; p-- ) {
+        if( ((d >> p) & 1) && ((s->pivots >> p) & 1) ) {
+            d ^= s->d[p];
+            *io_y ^= s->y[p];
+        }
+    }
+    return d;
+}
+
+/**
+ * @brief Add the equation M * d = y to `s`
+ * @returns false if the equation contradicts `s`
+*/
+static bool gf2_insert(struct gf2_system* s, uint64_t d, uint64_t y) {
+    d = gf2_reduce(s, d, &y);
+    if( d == 0 ) {
+        return y == 0;
+    }
+    int p = 63 - __builtin_clzll(d);
+    s->d[p] = d;
+    s->y[p] = y;
+    s->pivots |= 1ULL << p;
+    return true;
+}
+
+/**
+ * @brief Evaluate M * d. Bits that are not in the span of `s` are mapped to themselves, i.e. they
+ * keep the xor mask behaviour. The reduction is linear, i.e. this is a linear map
+*/
+static uint64_t gf2_apply(const struct gf2_system* s, uint64_t d) {
+    uint64_t y = 0;
+    return gf2_reduce(s, d, &y) ^ y;
+}
+
+static bool in_range(uint64_t start, uint64_t end, uint64_t pa) {
+    return pa >= start && pa < end;
+}
+
+static int rand_pa(uint64_t start, uint64_t end, uint64_t* out_pa) {
+    uint64_t r;
+    if( gen_rand_bytes(&r, sizeof(r)) ) {
+        err_log("failed to generate random address\n");
+        return -1;
+    }
+    uint64_t pa = (start + r % (end - start)) & ~63ULL;
+    *out_pa = pa < start ? pa + 64 : pa;
+    return 0;
+}
+
+static bool in_ranges(const struct solver* sv, uint64_t pa) {
+    for( size_t i = 0; i < sv->ranges_len; i++ ) {
+        if( pa >= sv->ranges[i].start && pa < sv->ranges[i].end ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Probe if `prediction` is the alias of `source_pa`. If not, search around it
+ * @param out_alias : Output param. Filled with the alias on success
+ * @returns 0 if an alias has been found, CHECK_ALIAS_ERR_ACCESS if `source_pa` is not accessible,
+ * CHECK_ALIAS_ERR_NO_ALIAS otherwise
+*/
+static int alias_near(struct solver* sv, uint64_t source_pa, uint64_t prediction, unsigned near_weight, uint64_t* out_alias) {
+    //an access error of the probe could also come from the prediction, i.e. check the source on its own
+    size_t inaccessible;
+    if( ra_get_pfn_state(sv->ctx, source_pa & ~4095ULL, 1, NULL, NULL, NULL, &inaccessible) || inaccessible ) {
+        return CHECK_ALIAS_ERR_ACCESS;
+    }
+    //aliases are inside the memory ranges, never touch anything else, e.g. MMIO
+    int result = CHECK_ALIAS_ERR_NO_ALIAS;
+    if( in_ranges(sv, prediction) ) {
+        sv->probes += 1;
+        if( ra_probe_alias(sv->ctx, source_pa, &prediction, 1, &result) ) {
+            return CHECK_ALIAS_ERR_ACCESS;
+        }
+    }
+    if( result == 0 ) {
+        *out_alias = prediction;
+        return 0;
+    }
+    if( near_weight == 0 || find_alias_near(source_pa, prediction, sv->ranges, sv->ranges_len, sv->top_pa, near_weight,
+        sv->access_reserved, out_alias) ) {
+        return CHECK_ALIAS_ERR_NO_ALIAS;
+    }
+    return 0;
+}
+
+/**
+ * @brief Collect equations for [start, end[ around base_pa
+ * @returns 0 if the equations are consistent
+*/
+static int collect_equations(struct solver* sv, uint64_t start, uint64_t end, uint64_t base_pa, uint64_t base_alias,
+    struct gf2_system* s) {
+    size_t sources = 0;
+    for( unsigned bit = LINEAR_MIN_BIT; bit < sv->addr_bits + LINEAR_RANDOM_SOURCES; bit++ ) {
+        uint64_t source_pa;
+        if( bit < sv->addr_bits ) {
+            source_pa = base_pa ^ (1ULL << bit);
+            //the bit does not vary in the range, or the random sources have to cover it
+            if( !in_range(start, end, source_pa) ) {
+                continue;
+            }
+        } else if( rand_pa(start, end, &source_pa) ) {
+            return -1;
+        }
+        uint64_t d = source_pa ^ base_pa;
+        if( d == 0 ) {
+            continue;
+        }
+        uint64_t alias;
+        int res = alias_near(sv, source_pa, base_alias ^ gf2_apply(s, d), LINEAR_NEAR_WEIGHT, &alias);
+        if( res == CHECK_ALIAS_ERR_ACCESS ) {
+            continue;
+        }
+        if( res ) {
+            printf("\tNo alias for 0x%jx near the prediction 0x%jx\n", source_pa, base_alias ^ gf2_apply(s, d));
+            return -1;
+        }
+        if( !gf2_insert(s, d, alias ^ base_alias) ) {
+            printf("\tAlias 0x%jx of 0x%jx contradicts the previous aliases\n", alias, source_pa);
+            return -1;
+        }
+        sources += 1;
+    }
+    if( sources == 0 ) {
+        printf("\tNo accessible source pa in [0x%jx,0x%jx[\n", start, end);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check the alias function against random addresses of [start, end[
+ * @returns 0 if all accessible addresses matched and at least LINEAR_VERIFY_MIN_PROBES have been checked
+*/
+static int verify(struct solver* sv, uint64_t start, uint64_t end, uint64_t base_pa, uint64_t base_alias,
+    const struct gf2_system* s) {
+    size_t checked = 0;
+    for( size_t attempt = 0; attempt < 4 * LINEAR_VERIFY_PROBES && checked < LINEAR_VERIFY_PROBES; attempt++ ) {
+        uint64_t pa, alias;
+        if( rand_pa(start, end, &pa) ) {
+            return -1;
+        }
+        if( pa == base_pa ) {
+            continue;
+        }
+        int res = alias_near(sv, pa, base_alias ^ gf2_apply(s, pa ^ base_pa), 0, &alias);
+        if( res == CHECK_ALIAS_ERR_ACCESS ) {
+            continue;
+        }
+        if( res ) {
+            printf("\tPrediction 0x%jx for 0x%jx is no alias\n", base_alias ^ gf2_apply(s, pa ^ base_pa), pa);
+            return -1;
+        }
+        checked += 1;
+    }
+    if( checked < LINEAR_VERIFY_MIN_PROBES ) {
+        printf("\tOnly %ju accessible addresses in [0x%jx,0x%jx[ to check the alias function against\n", checked, start, end);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Convert `s` into the alias function of `base_pa`'s range and append it to the results
+ * @returns 0 on success
+*/
+static int store_result(struct solver* sv, uint64_t start, uint64_t end, uint64_t base_pa, uint64_t base_alias,
+    const struct gf2_system* s) {
+    struct linear_alias r = {
+        .mr = *sv->mr,
+        .mask = base_pa ^ base_alias,
+        .fn = {.rows = {0}, .offset = 0},
+        .is_mask = true,
+    };
+    r.mr.start = start;
+    r.mr.end = end;
+    r.mr.alias_fn = NULL;
+    //column i of M is the image of address bit i, transpose them into the rows
+    unsigned non_identity = 0;
+    for( unsigned i = 0; i < 64; i++ ) {
+        uint64_t col = gf2_apply(s, 1ULL << i);
+        if( col != (1ULL << i) ) {
+            r.is_mask = false;
+            non_identity += 1;
+        }
+        for( unsigned j = 0; j < 64; j++ ) {
+            r.fn.rows[j] |= ((col >> j) & 1) << i;
+        }
+    }
+    r.fn.offset = base_alias ^ gf2_apply(s, base_pa);
+
+    if( r.is_mask ) {
+        r.mask = r.fn.offset;
+        printf("[0x%09jx,0x%09jx[ : xor mask 0x%09jx\n", start, end, r.mask);
+    } else {
+        printf("[0x%09jx,0x%09jx[ : linear alias function, %u address bits are not mapped to themselves\n",
+            start, end, non_identity);
+    }
+    struct linear_alias* results = realloc(*sv->results, sizeof(struct linear_alias) * (*sv->results_len + 1));
+    if( !results ) {
+        err_log("failed to alloc linear alias results\n");
+        return -1;
+    }
+    *sv->results = results;
+    (*sv->results)[*sv->results_len] = r;
+    *sv->results_len += 1;
+    return 0;
+}
+
+static int solve_range(struct solver* sv, uint64_t start, uint64_t end, uint64_t base_pa, uint64_t base_alias, unsigned depth) {
+    struct gf2_system s = {.d = {0}, .y = {0}, .pivots = 0};
+    if( !collect_equations(sv, start, end, base_pa, base_alias, &s) && !verify(sv, start, end, base_pa, base_alias, &s) ) {
+        return store_result(sv, start, end, base_pa, base_alias, &s);
+    }
+
+    if( depth >= LINEAR_MAX_DEPTH || (end - start) < 2 * LINEAR_MIN_RANGE ) {
+        printf("[0x%09jx,0x%09jx[ : no linear alias function found. Use --source-pa-file to pass in sources for this range\n", start, end);
+        return -1;
+    }
+    //split at the highest address bit that varies inside the range
+    unsigned h = 63 - __builtin_clzll(start ^ (end - 1));
+    uint64_t mid = (end - 1) & ~((1ULL << h) - 1);
+    printf("[0x%09jx,0x%09jx[ : alias function is not linear, splitting at 0x%jx\n", start, end, mid);
+
+    //the half without base_pa needs its own base. Start with the prediction of the failed fit, then
+    //fall back to a low weight mask search
+    uint64_t other_start = base_pa < mid ? mid : start;
+    uint64_t other_end = base_pa < mid ? end : mid;
+    uint64_t other_pa = ((other_start + 4095) & ~4095ULL) | (base_pa & 4095);
+    uint64_t other_alias = 0;
+    int other_res = -1;
+    if( in_range(other_start, other_end, other_pa) ) {
+        other_res = alias_near(sv, other_pa, base_alias ^ gf2_apply(&s, other_pa ^ base_pa), LINEAR_NEAR_WEIGHT, &other_alias);
+        if( other_res == CHECK_ALIAS_ERR_NO_ALIAS ) {
+            other_res = find_alias_near(other_pa, other_pa, sv->ranges, sv->ranges_len, sv->top_pa, MASK_SEARCH_DEFAULT_WEIGHT,
+                sv->access_reserved, &other_alias);
+        }
+    }
+
+    int ret = 0;
+    if( base_pa < mid ) {
+        ret |= solve_range(sv, start, mid, base_pa, base_alias, depth + 1);
+    } else {
+        ret |= solve_range(sv, mid, end, base_pa, base_alias, depth + 1);
+    }
+    if( other_res ) {
+        printf("[0x%09jx,0x%09jx[ : no alias for base 0x%jx\n", other_start, other_end, other_pa);
+        ret = -1;
+    } else {
+        ret |= solve_range(sv, other_start, other_end, other_pa, other_alias, depth + 1);
+    }
+    return ret;
+}
+
+int solve_linear_alias(uint64_t base_pa, uint64_t base_alias, const mem_range_t* mr, mem_range_t* ranges, size_t ranges_len,
+    uint64_t top_pa, bool access_reserved, struct linear_alias** io_results, size_t* io_results_len) {
+    struct solver sv = {
+        .ctx = ra_open(),
+        .mr = mr,
+        .ranges = ranges,
+        .ranges_len = ranges_len,
+        .top_pa = top_pa,
+        .access_reserved = access_reserved,
+        .addr_bits = top_pa > 1 ? 64 - __builtin_clzll(top_pa - 1) : 0,
+        .probes = 0,
+        .results = io_results,
+        .results_len = io_results_len,
+    };
+    if( !sv.ctx ) {
+        err_log("failed to open context\n");
+        return -1;
+    }
+    struct pamemcpy_cfg cfg = {
+        .out_stats = {0},
+        .access_reserved = access_reserved,
+        .err_on_access_fail = false,
+        .flush_method = FM_CLFLUSH,
+    };
+    ra_set_config(sv.ctx, &cfg);
+
+    printf("Solving alias function of [0x%09jx,0x%09jx[ from 0x%jx -> 0x%jx\n", mr->start, mr->end, base_pa, base_alias);
+    int ret = solve_range(&sv, mr->start, mr->end, base_pa, base_alias, 0);
+    ra_get_config(sv.ctx, &cfg);
+    printf("%ju predicted aliases probed. Reserved Page Errors: %ju, Map Failed Errors: %ju\n", sv.probes,
+        cfg.out_stats.reserved_pages, cfg.out_stats.map_failed);
+    ra_close(sv.ctx);
+    return ret;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "helpers.h"
+#include "proc_iomem_parser.h"
+
+//alias function of a memory range or a part of it, as computed by `solve_linear_alias`
+struct linear_alias {
+    mem_range_t mr;
+    //pa ^ alias for the base pa of the range. Only valid at the base if `is_mask` is false
+    uint64_t mask;
+    //alias function of the range. Only used if `is_mask` is false
+    struct alias_fn fn;
+    //true if the alias function is pa ^ mask for all pa in the range
+    bool is_mask;
+};
+
+/**
+ * @brief Recover the alias function of `mr` as affine map over GF(2), i.e. alias = M * pa ^ offset.
+ * Starting from the known alias of `base_pa`, we probe one source per address bit (base_pa with that bit flipped)
+ * and a few random sources in `mr`. The alias of each source is predicted with the equations collected so far and
+ * only searched around the prediction if that fails. Gaussian elimination over the (source ^ base_pa, alias ^ base_alias)
+ * pairs yields M on the address bits that vary inside `mr` and the offset. Finally, the function is checked against
+ * random addresses of `mr`, of which a minimum number has to be accessible. If the equations are inconsistent or the check fails, the alias function is piecewise:
+ * `mr` is split at its highest varying address bit and both halves are solved separately
+ * @param base_pa : accessible pa in `mr`
+ * @param base_alias : alias of `base_pa`
+ * @param ranges : memory ranges that may contain aliases
+ * @param top_pa : exclusive end of the highest memory range in the iomem map
+ * @param io_results : In/Output param. Callee (re-)allocated array, the results for `mr` are appended
+ * @param io_results_len : In/Output param. Length of `io_results`
+ * @returns 0 if the alias function of the whole range has been found
+*/
+int solve_linear_alias(uint64_t base_pa, uint64_t base_alias, const mem_range_t* mr, mem_range_t* ranges, size_t ranges_len,
+    uint64_t top_pa, bool access_reserved, struct linear_alias** io_results, size_t* io_results_len);
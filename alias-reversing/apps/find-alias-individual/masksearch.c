@@ -0,0 +1,145 @@
+#include <stdio.h>
+
+#include "masksearch.h"
+#include "readalias.h"
+#include "helpers.h"
+
+//candidates per PROBE ioctl
+#define MASK_SEARCH_BATCH 1024
+
+static bool in_ranges(uint64_t pa, const mem_range_t* ranges, size_t ranges_len) {
+    for( size_t i = 0; i < ranges_len; i++ ) {
+        if( pa >= ranges[i].start && pa < ranges[i].end ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Probe the queued candidates
+ * @param out_found : Output param, true if `out_alias` has been filled
+ * @returns 0 on success
+*/
+static int probe_batch(readalias_ctx_t* ctx, uint64_t source_pa, const uint64_t* cand, size_t len, uint64_t* out_alias, bool* out_found) {
+    int results[MASK_SEARCH_BATCH];
+    *out_found = false;
+    if( ra_probe_alias(ctx, source_pa, cand, len, results) ) {
+        err_log("probe_alias for source_pa 0x%jx failed\n", source_pa);
+        return -1;
+    }
+    //candidates are ordered by weight, i.e. the first alias has the lowest weight
+    for( size_t i = 0; i < len; i++ ) {
+        if( results[i] == 0 ) {
+            *out_alias = cand[i];
+            *out_found = true;
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Probe center ^ mask for all masks with `first_weight` to `max_weight` set bits
+ * @param verbose : If true, print progress and the page stats
+*/
+static int search_masks(uint64_t source_pa, uint64_t center, unsigned first_weight, mem_range_t* ranges, size_t ranges_len,
+    uint64_t top_pa, unsigned max_weight, bool access_reserved, bool verbose, uint64_t* out_alias) {
+    //flip the bits [12, addr_bits[
+    unsigned addr_bits = top_pa > 1 ? 64 - __builtin_clzll(top_pa - 1) : 0;
+    if( addr_bits <= 12 ) {
+        return -1;
+    }
+    unsigned n = addr_bits - 12;
+    if( max_weight > n ) {
+        max_weight = n;
+    }
+
+    if( verbose ) {
+        //sum of n choose k, the candidates outside of `ranges` are skipped
+        uint64_t masks = 0;
+        uint64_t binom = 1;
+        for( unsigned k = 1; k <= max_weight; k++ ) {
+            binom = binom * (n - k + 1) / k;
+            if( k >= first_weight ) {
+                masks += binom;
+            }
+        }
+        printf("Probing up to %ju masks with up to %u of %u address bits flipped\n", masks, max_weight, n);
+    }
+
+    readalias_ctx_t* ctx = ra_open();
+    if( !ctx ) {
+        err_log("failed to open context\n");
+        return -1;
+    }
+    struct pamemcpy_cfg cfg = {
+        .out_stats = {0},
+        .access_reserved = access_reserved,
+        .err_on_access_fail = false,
+        .flush_method = FM_CLFLUSH,
+    };
+    ra_set_config(ctx, &cfg);
+
+    uint64_t cand[MASK_SEARCH_BATCH];
+    size_t cand_len = 0;
+    uint64_t probes = 0;
+    bool found = false;
+    int ret = 0;
+    for( unsigned weight = first_weight; weight <= max_weight && !found; weight++ ) {
+        //Gosper's hack: all n bit values with `weight` set bits in increasing order
+        for( uint64_t comb = (1ULL << weight) - 1; comb < (1ULL << n) && !found; ) {
+            uint64_t candidate = center ^ (comb << 12);
+            if( in_ranges(candidate, ranges, ranges_len) ) {
+                cand[cand_len] = candidate;
+                cand_len += 1;
+            }
+            //weight 0 is the center itself
+            if( comb == 0 ) {
+                comb = 1ULL << n;
+            } else {
+                uint64_t lowest = comb & -comb;
+                uint64_t ripple = comb + lowest;
+                comb = ripple | (((ripple ^ comb) >> 2) / lowest);
+            }
+
+            //probe at the end of each weight to stop before trying the next weight
+            bool last_of_weight = comb >= (1ULL << n);
+            if( cand_len == MASK_SEARCH_BATCH || (last_of_weight && cand_len) ) {
+                if( probe_batch(ctx, source_pa, cand, cand_len, out_alias, &found) ) {
+                    ret = -1;
+                    goto cleanup;
+                }
+                probes += cand_len;
+                cand_len = 0;
+            }
+        }
+        if( !found && verbose ) {
+            printf("No alias with up to %u flipped address bits, %ju probes\n", weight, probes);
+        }
+    }
+    if( found && verbose ) {
+        printf("Found alias for 0x%jx at 0x%jx after %ju probes! xor diff = 0x%jx\n",
+            source_pa, *out_alias, probes, source_pa ^ *out_alias);
+    } else if( !found ) {
+        ret = -1;
+    }
+
+cleanup:
+    ra_get_config(ctx, &cfg);
+    if( verbose ) {
+        printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n", cfg.out_stats.reserved_pages, cfg.out_stats.map_failed);
+    }
+    ra_close(ctx);
+    return ret;
+}
+
+int find_alias_low_weight(uint64_t source_pa, mem_range_t* ranges, size_t ranges_len, uint64_t top_pa, unsigned max_weight,
+    bool access_reserved, uint64_t* out_alias) {
+    return search_masks(source_pa, source_pa, 1, ranges, ranges_len, top_pa, max_weight, access_reserved, true, out_alias);
+}
+
+int find_alias_near(uint64_t source_pa, uint64_t center, mem_range_t* ranges, size_t ranges_len, uint64_t top_pa,
+    unsigned max_weight, bool access_reserved, uint64_t* out_alias) {
+    return search_masks(source_pa, center, 0, ranges, ranges_len, top_pa, max_weight, access_reserved, false, out_alias);
+}
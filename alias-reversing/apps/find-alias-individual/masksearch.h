@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "proc_iomem_parser.h"
+
+//default for the maximal number of flipped address bits of `find_alias_low_weight`. The number of masks grows
+//with n^weight for n address bits, e.g. 2951 masks for 26 bits at weight 3 but 83681 at weight 5
+#define MASK_SEARCH_DEFAULT_WEIGHT 3
+
+/**
+ * @brief Search an alias of `source_pa` by probing source_pa ^ mask for all masks with 1 to `max_weight`
+ * set bits, ordered by increasing weight. Only the bits above the page offset and below the top of
+ * the physical address space are flipped, and only candidates inside `ranges` are probed.
+ * Alias masks usually flip a few high address bits, i.e. at the default weight this takes at most a few thousand
+ * probes instead of a sweep over the whole memory. The number of masks is printed before probing
+ * @param top_pa : exclusive end of the highest memory range in the iomem map
+ * @param out_alias : Output param. On success filled with the pa of the alias
+ * @returns 0 if an alias has been found
+*/
+int find_alias_low_weight(uint64_t source_pa, mem_range_t* ranges, size_t ranges_len, uint64_t top_pa, unsigned max_weight,
+    bool access_reserved, uint64_t* out_alias);
+
+/**
+ * @brief Like `find_alias_low_weight` but probes center ^ mask, starting with the center itself, and does not
+ * print anything. Used to confirm a predicted alias and to correct it if a few bits are off
+ * @returns 0 if an alias has been found
+*/
+int find_alias_near(uint64_t source_pa, uint64_t center, mem_range_t* ranges, size_t ranges_len, uint64_t top_pa,
+    unsigned max_weight, bool access_reserved, uint64_t* out_alias);
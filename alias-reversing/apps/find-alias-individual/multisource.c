@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "multisource.h"
+#include "readalias.h"
+#include "helpers.h"
+#include "progress.h"
+
+#define MS_MSG_LEN 64
+//candidates that are read with a single batch, i.e. 4096 pages if all sources share one page offset.
+//Bounds the buffers independent of the number of offsets
+#define MS_CHUNK_CANDS 4096
+
+struct ms_state {
+    readalias_ctx_t* ctx;
+    const uint64_t* sources;
+    size_t sources_len;
+    bool no_scrambling;
+    //MS_MSG_LEN bytes per source
+    uint8_t* m1;
+    uint8_t* m2;
+    uint8_t* mxor;
+    //open addressing hash table from message fingerprint to source idx + 1. 0 marks an empty slot
+    uint64_t* fp_keys;
+    size_t* fp_vals;
+    size_t fp_mask;
+    //distinct page offsets of the sources. Each page is read at each offset
+    uint64_t* offsets;
+    size_t offsets_len;
+    //candidates of the current chunk and their read buffers
+    uint64_t* cand;
+    size_t cand_len;
+    size_t cand_cap;
+    uint8_t* buf1;
+    uint8_t* buf2;
+    pa_batch_t batch;
+    uint64_t* out_alias;
+    size_t unresolved;
+    uint64_t processed_bytes;
+    uint64_t total_bytes;
+    //inaccessible pages, each page is counted once although it is read several times
+    page_stats_t stats;
+    //part of `stats` that has been passed to `progress`
+    page_stats_t reported_stats;
+    //progress line and metrics, NULL if they could not be started
+    progress_t* progress;
+    //pages below this pa are skipped
+    uint64_t resume_pa;
+    void (*on_chunk)(void* chunk_arg, uint64_t done_pa);
+    void* chunk_arg;
+};
+
+static uint64_t fingerprint(const uint8_t* msg) {
+    uint64_t fp;
+    memcpy(&fp, msg, sizeof(fp));
+    return fp;
+}
+
+/**
+ * @brief Insert `fp` for source `idx`
+ * @returns 0 on success, -1 if `fp` is already used by another source
+*/
+static int fp_insert(struct ms_state* s, uint64_t fp, size_t idx) {
+    //the messages are random, so are the low bits of their fingerprints
+    for( size_t slot = fp & s->fp_mask; ; slot = (slot + 1) & s->fp_mask ) {
+        if( s->fp_vals[slot] == 0 ) {
+            s->fp_keys[slot] = fp;
+            s->fp_vals[slot] = idx + 1;
+            return 0;
+        }
+        if( s->fp_keys[slot] == fp ) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief Find the source whose message has the fingerprint `fp`
+ * @returns source idx + 1 or 0 if there is none
+*/
+static size_t fp_lookup(const struct ms_state* s, uint64_t fp) {
+    for( size_t slot = fp & s->fp_mask; s->fp_vals[slot]; slot = (slot + 1) & s->fp_mask ) {
+        if( s->fp_keys[slot] == fp ) {
+            return s->fp_vals[slot];
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Generate the messages of all sources and fill the fingerprint table
+ * @returns 0 on success
+*/
+static int generate_messages(struct ms_state* s) {
+    for( size_t i = 0; i < s->sources_len; i++ ) {
+        uint8_t* m1 = s->m1 + i * MS_MSG_LEN;
+        uint8_t* m2 = s->m2 + i * MS_MSG_LEN;
+        uint8_t* mxor = s->mxor + i * MS_MSG_LEN;
+        //regenerate on the (unlikely) fingerprint collision
+        do {
+            if( ra_rand_bytes(s->ctx, m1, MS_MSG_LEN) || ra_rand_bytes(s->ctx, m2, MS_MSG_LEN) ) {
+                err_log("failed to generate messages\n");
+                return -1;
+            }
+            for( size_t j = 0; j < MS_MSG_LEN; j++ ) {
+                mxor[j] = m1[j] ^ m2[j];
+            }
+        } while( fp_insert(s, fingerprint(s->no_scrambling ? m1 : mxor), i) );
+    }
+    return 0;
+}
+
+/**
+ * @brief Queue a write of `msgs` to each source that has no alias yet
+*/
+static int queue_source_writes(struct ms_state* s, uint8_t* msgs) {
+    for( size_t i = 0; i < s->sources_len; i++ ) {
+        if( s->out_alias[i] ) {
+            continue;
+        }
+        if( batch_add_topa(&s->batch, s->sources[i], msgs + i * MS_MSG_LEN, MS_MSG_LEN, FM_CLFLUSH) ) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Check the status of all operations of the submitted batch
+ * @returns 0 if all source writes succeeded and no operation failed with an error
+*/
+static int check_batch_status(struct ms_state* s) {
+    for( size_t i = 0; i < s->batch.len; i++ ) {
+        struct batch_desc* d = s->batch.descs + i;
+        if( d->op == BOP_TOPA && d->status ) {
+            err_log("failed to write message to source 0x%jx : status %jd\n", d->pa, (intmax_t)d->status);
+            return -1;
+        }
+        if( d->status < 0 ) {
+            err_log("access to 0x%jx failed : status %jd\n", d->pa, (intmax_t)d->status);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Read all candidates of the current chunk and match them against the messages of all sources
+ * @returns 0 on success
+*/
+static int process_chunk(struct ms_state* s) {
+    size_t read1_idx, read2_idx = 0;
+
+    batch_reset(&s->batch);
+    if( !s->no_scrambling && queue_source_writes(s, s->m1) ) {
+        goto alloc_error;
+    }
+    read1_idx = s->batch.len;
+    for( size_t i = 0; i < s->cand_len; i++ ) {
+        if( batch_add_frompa(&s->batch, s->buf1 + i * MS_MSG_LEN, s->cand[i], MS_MSG_LEN, FM_CLFLUSH) ) {
+            goto alloc_error;
+        }
+    }
+    if( !s->no_scrambling ) {
+        if( queue_source_writes(s, s->m2) ) {
+            goto alloc_error;
+        }
+        read2_idx = s->batch.len;
+        for( size_t i = 0; i < s->cand_len; i++ ) {
+            if( batch_add_frompa(&s->batch, s->buf2 + i * MS_MSG_LEN, s->cand[i], MS_MSG_LEN, FM_CLFLUSH) ) {
+                goto alloc_error;
+            }
+        }
+    }
+    //fails if any candidate is inaccessible, `check_batch_status` tells the real errors apart
+    ra_batch_submit(s->ctx, &s->batch);
+    if( check_batch_status(s) ) {
+        return -1;
+    }
+
+    for( size_t i = 0; i < s->cand_len; i++ ) {
+        const uint8_t* buf1 = s->buf1 + i * MS_MSG_LEN;
+        const uint8_t* buf2 = s->buf2 + i * MS_MSG_LEN;
+        int64_t status = s->batch.descs[read1_idx + i].status;
+        bool first_of_page = i == 0 || (s->cand[i] / 4096) != (s->cand[i - 1] / 4096);
+        if( first_of_page && status == RET_RESERVED ) {
+            s->stats.reserved_pages += 1;
+        } else if( first_of_page && status == RET_MAPFAIL ) {
+            s->stats.map_failed += 1;
+        }
+        if( status || (!s->no_scrambling && s->batch.descs[read2_idx + i].status) ) {
+            continue;
+        }
+        uint64_t fp = s->no_scrambling ? fingerprint(buf1) : fingerprint(buf1) ^ fingerprint(buf2);
+        size_t idx = fp_lookup(s, fp);
+        if( idx == 0 ) {
+            continue;
+        }
+        idx -= 1;
+        //an alias has the same page offset as its source
+        uint64_t source_pa = s->sources[idx];
+        if( s->out_alias[idx] || s->cand[i] == source_pa || (s->cand[i] % 4096) != (source_pa % 4096) ) {
+            continue;
+        }
+        bool eq;
+        if( s->no_scrambling ) {
+            memeq_batch(buf1, 0, 1, s->m1 + idx * MS_MSG_LEN, NULL, MS_MSG_LEN, &eq);
+        } else {
+            memeq_xor_batch(buf1, buf2, 0, 1, s->mxor + idx * MS_MSG_LEN, MS_MSG_LEN, &eq);
+        }
+        if( !eq ) {
+            continue;
+        }
+        s->out_alias[idx] = s->cand[i];
+        s->unresolved -= 1;
+        printf("Found alias for 0x%jx at 0x%jx! xor diff = 0x%jx\n", source_pa, s->cand[i], source_pa ^ s->cand[i]);
+    }
+    s->cand_len = 0;
+    return 0;
+
+alloc_error:
+    err_log("failed to queue batch operations\n");
+    return -1;
+}
+
+/**
+ * @brief Account the `bytes` starting at `pa` as searched, together with the page stats since the last call
+*/
+static void add_progress(struct ms_state* s, uint64_t pa, uint64_t bytes) {
+    page_stats_t delta = {
+        .reserved_pages = s->stats.reserved_pages - s->reported_stats.reserved_pages,
+        .map_failed = s->stats.map_failed - s->reported_stats.map_failed,
+    };
+    s->reported_stats = s->stats;
+    s->processed_bytes += bytes;
+    if( s->progress ) {
+        progress_add(s->progress, pa, bytes, delta.reserved_pages, delta.map_failed);
+    }
+    if( s->on_chunk ) {
+        s->on_chunk(s->chunk_arg, pa + bytes);
+    }
+}
+
+/**
+ * @brief Queue the candidates of all pages in `mr` above the resume point and process them in chunks
+ * @returns 0 on success
+*/
+static int sweep_range(struct ms_state* s, const mem_range_t* mr) {
+    uint64_t chunk_bytes = 0;
+    uint64_t chunk_start = (mr->start + 4095) & ~4095ULL;
+    if( chunk_start < s->resume_pa ) {
+        chunk_start = s->resume_pa;
+    }
+    for( uint64_t page = chunk_start; page < mr->end && s->unresolved; page += 4096 ) {
+        for( size_t i = 0; i < s->offsets_len; i++ ) {
+            if( page + s->offsets[i] + MS_MSG_LEN <= mr->end ) {
+                s->cand[s->cand_len] = page + s->offsets[i];
+                s->cand_len += 1;
+            }
+        }
+        chunk_bytes += 4096;
+        if( s->cand_len + s->offsets_len > s->cand_cap ) {
+            if( process_chunk(s) ) {
+                return -1;
+            }
+            add_progress(s, chunk_start, chunk_bytes);
+            chunk_start = page + 4096;
+            chunk_bytes = 0;
+        }
+    }
+    if( s->cand_len && s->unresolved ) {
+        if( process_chunk(s) ) {
+            return -1;
+        }
+        add_progress(s, chunk_start, chunk_bytes);
+    }
+    return 0;
+}
+
+int find_aliases_single_pass(const uint64_t* sources, size_t sources_len, mem_range_t* ranges, size_t ranges_len,
+    bool access_reserved, bool no_scrambling, uint64_t resume_pa, void (*on_chunk)(void* chunk_arg, uint64_t done_pa),
+    void* chunk_arg, FILE* metrics, uint64_t* out_alias) {
+    struct ms_state s = {
+        .ctx = NULL,
+        .sources = sources,
+        .sources_len = sources_len,
+        .no_scrambling = no_scrambling,
+        .out_alias = out_alias,
+        .unresolved = sources_len,
+        .resume_pa = resume_pa & ~4095ULL,
+        .on_chunk = on_chunk,
+        .chunk_arg = chunk_arg,
+    };
+    int ret = 0;
+    uint64_t seed;
+    batch_init(&s.batch);
+
+    memset(out_alias, 0, sizeof(uint64_t) * sources_len);
+    for( size_t i = 0; i < sources_len; i++ ) {
+        if( (sources[i] % 4096) + MS_MSG_LEN > 4096 ) {
+            err_log("message at source 0x%jx would cross a page boundary\n", sources[i]);
+            return -1;
+        }
+    }
+
+    s.ctx = ra_open();
+    if( !s.ctx ) {
+        err_log("failed to open context\n");
+        return -1;
+    }
+    struct pamemcpy_cfg cfg = {
+        .out_stats = {0},
+        .access_reserved = access_reserved,
+        .err_on_access_fail = false,
+        .flush_method = FM_CLFLUSH,
+    };
+    ra_set_config(s.ctx, &cfg);
+    //derive the messages from the global seed, i.e. `--seed` replays them
+    if( gen_rand_bytes(&seed, sizeof(seed)) ) {
+        err_log("failed to generate seed\n");
+        goto error;
+    }
+    ra_seed(s.ctx, seed);
+
+    size_t fp_slots = 16;
+    while( fp_slots < 2 * sources_len ) {
+        fp_slots *= 2;
+    }
+    s.fp_mask = fp_slots - 1;
+    s.fp_keys = calloc(fp_slots, sizeof(uint64_t));
+    s.fp_vals = calloc(fp_slots, sizeof(size_t));
+    s.m1 = malloc(sources_len * MS_MSG_LEN);
+    s.m2 = malloc(sources_len * MS_MSG_LEN);
+    s.mxor = malloc(sources_len * MS_MSG_LEN);
+    s.offsets = malloc(sizeof(uint64_t) * sources_len);
+    if( !s.fp_keys || !s.fp_vals || !s.m1 || !s.m2 || !s.mxor || !s.offsets ) {
+        err_log("failed to alloc message state\n");
+        goto error;
+    }
+    for( size_t i = 0; i < sources_len; i++ ) {
+        bool known = false;
+        for( size_t j = 0; j < s.offsets_len; j++ ) {
+            known |= s.offsets[j] == sources[i] % 4096;
+        }
+        if( !known ) {
+            s.offsets[s.offsets_len] = sources[i] % 4096;
+            s.offsets_len += 1;
+        }
+    }
+    //at least one page per chunk
+    s.cand_cap = s.offsets_len > MS_CHUNK_CANDS ? s.offsets_len : MS_CHUNK_CANDS;
+    s.cand = malloc(sizeof(uint64_t) * s.cand_cap);
+    s.buf1 = malloc(s.cand_cap * MS_MSG_LEN);
+    s.buf2 = malloc(s.cand_cap * MS_MSG_LEN);
+    if( !s.cand || !s.buf1 || !s.buf2 ) {
+        err_log("failed to alloc candidate buffers\n");
+        goto error;
+    }
+    if( generate_messages(&s) ) {
+        goto error;
+    }
+
+    //without scrambling, the markers only need to be written once
+    if( no_scrambling ) {
+        batch_reset(&s.batch);
+        if( queue_source_writes(&s, s.m1) ) {
+            err_log("failed to queue marker writes\n");
+            goto error;
+        }
+        ra_batch_submit(s.ctx, &s.batch);
+        if( check_batch_status(&s) ) {
+            goto error;
+        }
+    }
+
+    for( size_t i = 0; i < ranges_len; i++ ) {
+        if( ranges[i].end > s.resume_pa ) {
+            s.total_bytes += ranges[i].end - (ranges[i].start > s.resume_pa ? ranges[i].start : s.resume_pa);
+        }
+    }
+    if( s.resume_pa ) {
+        printf("Resuming single pass sweep at 0x%jx\n", s.resume_pa);
+    }
+    printf("Sweeping %.2f GiB once for %ju sources, reading %ju line(s) per page\n",
+        (double)s.total_bytes / (1 << 30), sources_len, s.offsets_len);
+    s.progress = progress_start("single pass", s.total_bytes, ranges, ranges_len, metrics, ra_metrics_write_current_json);
+    for( size_t i = 0; i < ranges_len && s.unresolved; i++ ) {
+        if( sweep_range(&s, ranges + i) ) {
+            goto error;
+        }
+    }
+    printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n", s.stats.reserved_pages, s.stats.map_failed);
+    goto cleanup;
+error:
+    ret = -1;
+cleanup:
+    progress_stop(s.progress);
+    batch_free(&s.batch);
+    free(s.fp_keys);
+    free(s.fp_vals);
+    free(s.m1);
+    free(s.m2);
+    free(s.mxor);
+    free(s.offsets);
+    free(s.cand);
+    free(s.buf1);
+    free(s.buf2);
+    ra_close(s.ctx);
+    return ret;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "proc_iomem_parser.h"
+
+/**
+ * @brief Search aliases for all `sources` with a single sweep over `ranges`, instead of one sweep per source.
+ * Each source gets its own random messages. The candidates of a chunk of pages are read with a single
+ * batch and matched against all messages at once, using a hash table of 64 bit message fingerprints.
+ * Without scrambling, the markers are written once and each read is compared with the markers. Otherwise,
+ * each batch writes m1 to all sources, reads the candidates, writes m2 and reads them again. Then
+ * buf1 ^ buf2 is compared with m1 ^ m2 of each source. The sweep stops once all sources have an alias
+ * @param sources : page offset + 64 must not exceed the page
+ * @param no_scrambling : If true, use the single write marker comparison that requires disabled scrambling
+ * @param resume_pa : Resume point of an interrupted sweep, as reported by `on_chunk`. Pages below it are skipped.
+ * 0 sweeps everything
+ * @param on_chunk : Optional. Called with `chunk_arg` after each chunk. `done_pa` is the new resume point and
+ * `out_alias` holds the aliases that have been found so far
+ * @param metrics : Optional JSON lines output for the progress and the lib metrics, see `progress_start`
+ * @param out_alias : Output param with `sources_len` entries. 0 if no alias has been found for the source
+ * @returns 0 if the sweep completed
+*/
+int find_aliases_single_pass(const uint64_t* sources, size_t sources_len, mem_range_t* ranges, size_t ranges_len,
+    bool access_reserved, bool no_scrambling, uint64_t resume_pa, void (*on_chunk)(void* chunk_arg, uint64_t done_pa),
+    void* chunk_arg, FILE* metrics, uint64_t* out_alias);
@@ -0,0 +1,729 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sweep.h"
+#include "helpers.h"
+#include "progress.h"
+
+//bytes per chunk. Chunks do not cross a multiple of this size, i.e. they do not span memory blocks
+//of different NUMA nodes. Also bounds the time until a worker notices that the alias has been found
+#define SWEEP_CHUNK_BYTES (128ULL << 20)
+#define SWEEP_MAX_NODES 64
+//number of matches that we fetch per SCAN/PROBE ioctl
+#define SWEEP_MATCHES_LEN 8
+//SWEEP_PROBE with several workers: length of the message at the source pa and candidates per batch,
+//see probe_chunk_shared
+#define SWEEP_MSG_LEN 64
+#define SWEEP_SLICE_CANDS 1024
+
+struct sweep_chunk {
+    uint64_t start;
+    uint64_t end;
+    //position in the order of the ranges
+    size_t seq;
+};
+
+//chunks whose memory belongs to one NUMA node, in ascending order.
+//Workers take the next chunk by incrementing `next`
+struct sweep_queue {
+    struct sweep_chunk* chunks;
+    size_t len;
+    size_t cap;
+    atomic_size_t next;
+};
+
+struct numa_topology {
+    size_t nodes_len;
+    cpu_set_t cpus[SWEEP_MAX_NODES];
+    //node of each memory block, -1 if unknown. NULL if sysfs does not provide the memory blocks
+    int* block_node;
+    size_t blocks_len;
+    uint64_t block_bytes;
+};
+
+struct sweep_state {
+    const struct sweep_params* params;
+    struct numa_topology topo;
+    struct sweep_queue queues[SWEEP_MAX_NODES];
+    //set once an alias has been found or a worker failed
+    atomic_bool stop;
+    atomic_uint_fast64_t processed_bytes;
+    uint64_t total_bytes;
+    //progress line and metrics, NULL if they could not be started
+    progress_t* progress;
+    //protects `found`, `alias_pa` and the completion tracking
+    pthread_mutex_t result_lock;
+    bool found;
+    uint64_t alias_pa;
+    //all chunks in the order of the ranges, with their completion state. All chunks before `done_prefix` are done
+    struct sweep_chunk* chunks;
+    bool* chunk_done;
+    size_t chunks_len;
+    size_t done_prefix;
+    //SWEEP_PROBE with several workers: the workers share the message at the source pa, see probe_chunk_shared.
+    //Workers hold the read lock while they read candidates, i.e. the message does not change during their reads.
+    //`msg_gen` counts the messages that have been written
+    bool shared_msg;
+    pthread_rwlock_t msg_lock;
+    uint64_t msg_gen;
+    uint8_t msg[SWEEP_MSG_LEN];
+    //bytes of the message, it does not cross the page of the source pa
+    size_t msg_len;
+};
+
+//per worker buffers of probe_chunk_shared
+struct probe_bufs {
+    uint64_t cand[SWEEP_SLICE_CANDS];
+    //read buffers with the first and the second message, `msg_len` bytes per candidate
+    uint8_t buf1[SWEEP_SLICE_CANDS * SWEEP_MSG_LEN];
+    uint8_t buf2[SWEEP_SLICE_CANDS * SWEEP_MSG_LEN];
+    //index of the batch descriptor of the second read of each candidate, SIZE_MAX if it has not been read again
+    size_t read2_desc[SWEEP_SLICE_CANDS];
+    bool eq[SWEEP_SLICE_CANDS];
+    pa_batch_t batch;
+};
+
+struct sweep_worker {
+    struct sweep_state* state;
+    size_t idx;
+    //NUMA node whose cpus the worker runs on and whose chunks it takes first
+    size_t node;
+    pthread_t thread;
+    page_stats_t stats;
+    int ret;
+};
+
+/**
+ * @brief Read the first line of the sysfs file at `path` into `buf`
+ * @returns 0 on success
+*/
+static int read_sysfs_line(const char* path, char* buf, size_t len) {
+    FILE* f = fopen(path, "r");
+    if( !f ) {
+        return -1;
+    }
+    char* res = fgets(buf, len, f);
+    fclose(f);
+    return res ? 0 : -1;
+}
+
+/**
+ * @brief Parse a cpu list like "0-3,8,10-11"
+ * @returns 0 on success
+*/
+static int parse_cpulist(char* list, cpu_set_t* out_cpus) {
+    CPU_ZERO(out_cpus);
+    for( char* tok = strtok(list, ",\n"); tok; tok = strtok(NULL, ",\n") ) {
+        unsigned first, last;
+        int n = sscanf(tok, "%u-%u", &first, &last);
+        if( n < 1 ) {
+            return -1;
+        }
+        if( n == 1 ) {
+            last = first;
+        }
+        for( unsigned cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++ ) {
+            CPU_SET(cpu, out_cpus);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Record that the memory blocks listed in `node_dir` belong to `node`
+ * @returns 0 on success
+*/
+static int read_node_memory_blocks(struct numa_topology* topo, const char* node_dir, size_t node) {
+    DIR* dir = opendir(node_dir);
+    if( !dir ) {
+        return -1;
+    }
+    struct dirent* entry;
+    while( (entry = readdir(dir)) ) {
+        size_t block;
+        char trailing;
+        if( sscanf(entry->d_name, "memory%zu%c", &block, &trailing) != 1 ) {
+            continue;
+        }
+        if( block >= topo->blocks_len ) {
+            size_t new_len = 2 * block + 1;
+            int* tmp = realloc(topo->block_node, sizeof(int) * new_len);
+            if( !tmp ) {
+                closedir(dir);
+                return -1;
+            }
+            for( size_t i = topo->blocks_len; i < new_len; i++ ) {
+                tmp[i] = -1;
+            }
+            topo->block_node = tmp;
+            topo->blocks_len = new_len;
+        }
+        topo->block_node[block] = (int)node;
+    }
+    closedir(dir);
+    return 0;
+}
+
+/**
+ * @brief Read the cpus and memory blocks of each NUMA node from sysfs. Falls back to a single
+ * node with all cpus of the process if sysfs does not provide the topology
+*/
+static void read_numa_topology(struct numa_topology* topo) {
+    char buf[4096];
+    char path[256];
+
+    topo->nodes_len = 1;
+    sched_getaffinity(0, sizeof(cpu_set_t), &topo->cpus[0]);
+    topo->block_node = NULL;
+    topo->blocks_len = 0;
+    if( read_sysfs_line("/sys/devices/system/memory/block_size_bytes", buf, sizeof(buf)) ||
+        !(topo->block_bytes = strtoull(buf, NULL, 16)) ) {
+        return;
+    }
+
+    size_t nodes_len = 0;
+    for( size_t node = 0; node < SWEEP_MAX_NODES; node++ ) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+        if( read_sysfs_line(path, buf, sizeof(buf)) ) {
+            break;
+        }
+        if( parse_cpulist(buf, &topo->cpus[node]) ) {
+            break;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu", node);
+        if( read_node_memory_blocks(topo, path, node) ) {
+            break;
+        }
+        nodes_len += 1;
+    }
+    if( nodes_len == 0 ) {
+        free(topo->block_node);
+        topo->block_node = NULL;
+        topo->blocks_len = 0;
+        sched_getaffinity(0, sizeof(cpu_set_t), &topo->cpus[0]);
+        return;
+    }
+    topo->nodes_len = nodes_len;
+}
+
+static size_t pa_to_node(const struct numa_topology* topo, uint64_t pa) {
+    if( !topo->block_node ) {
+        return 0;
+    }
+    uint64_t block = pa / topo->block_bytes;
+    if( block >= topo->blocks_len || topo->block_node[block] < 0 ) {
+        return 0;
+    }
+    return (size_t)topo->block_node[block];
+}
+
+static int queue_push(struct sweep_queue* q, struct sweep_chunk chunk) {
+    if( q->len == q->cap ) {
+        size_t new_cap = q->cap ? 2 * q->cap : 64;
+        struct sweep_chunk* tmp = realloc(q->chunks, sizeof(struct sweep_chunk) * new_cap);
+        if( !tmp ) {
+            return -1;
+        }
+        q->chunks = tmp;
+        q->cap = new_cap;
+    }
+    q->chunks[q->len] = chunk;
+    q->len += 1;
+    return 0;
+}
+
+/**
+ * @brief Split the candidate ranges into page aligned chunks and queue them on the node of their memory
+ * @returns 0 on success
+*/
+static int build_queues(struct sweep_state* s) {
+    const struct sweep_params* p = s->params;
+    size_t cap = 0;
+    for( size_t i = 0; i < p->ranges_len; i++ ) {
+        uint64_t start = (p->ranges[i].start + 4095) & ~4095ULL;
+        uint64_t end = p->ranges[i].end;
+        while( start < end ) {
+            uint64_t chunk_end = (start / SWEEP_CHUNK_BYTES + 1) * SWEEP_CHUNK_BYTES;
+            if( chunk_end > end ) {
+                chunk_end = end;
+            }
+            if( s->chunks_len == cap ) {
+                cap = cap ? 2 * cap : 64;
+                struct sweep_chunk* tmp = realloc(s->chunks, sizeof(struct sweep_chunk) * cap);
+                if( !tmp ) {
+                    err_log("failed to alloc chunks\n");
+                    return -1;
+                }
+                s->chunks = tmp;
+            }
+            s->chunks[s->chunks_len] = (struct sweep_chunk){.start = start, .end = chunk_end, .seq = s->chunks_len};
+            s->chunks_len += 1;
+            start = chunk_end;
+        }
+    }
+    s->chunk_done = calloc(s->chunks_len ? s->chunks_len : 1, sizeof(bool));
+    if( !s->chunk_done ) {
+        err_log("failed to alloc chunk states\n");
+        return -1;
+    }
+
+    //skip the chunks up to the resume point
+    if( p->resume_pa ) {
+        for( size_t i = 0; i < s->chunks_len && !s->done_prefix; i++ ) {
+            if( s->chunks[i].end == p->resume_pa ) {
+                s->done_prefix = i + 1;
+            }
+        }
+        if( s->done_prefix ) {
+            printf("Resuming sweep at 0x%jx\n", p->resume_pa);
+        } else {
+            printf("Resume point 0x%jx is not a chunk boundary of the ranges, sweeping everything\n", p->resume_pa);
+        }
+    }
+    for( size_t i = s->done_prefix; i < s->chunks_len; i++ ) {
+        if( queue_push(s->queues + pa_to_node(&s->topo, s->chunks[i].start), s->chunks[i]) ) {
+            err_log("failed to alloc chunk queue\n");
+            return -1;
+        }
+        s->total_bytes += s->chunks[i].end - s->chunks[i].start;
+    }
+    return 0;
+}
+
+/**
+ * @brief Mark `chunk` as searched and report the new resume point, if any
+*/
+static void chunk_finished(struct sweep_state* s, struct sweep_chunk chunk) {
+    pthread_mutex_lock(&s->result_lock);
+    s->chunk_done[chunk.seq] = true;
+    size_t before = s->done_prefix;
+    while( s->done_prefix < s->chunks_len && s->chunk_done[s->done_prefix] ) {
+        s->done_prefix += 1;
+    }
+    if( s->done_prefix != before && s->params->on_progress ) {
+        s->params->on_progress(s->params->progress_arg, s->chunks[s->done_prefix - 1].end);
+    }
+    pthread_mutex_unlock(&s->result_lock);
+}
+
+/**
+ * @brief Take the next chunk from the queue of `node` or, if that is empty, steal one from the other nodes
+ * @returns false if all queues are empty
+*/
+static bool next_chunk(struct sweep_state* s, size_t node, struct sweep_chunk* out_chunk) {
+    for( size_t i = 0; i < s->topo.nodes_len; i++ ) {
+        struct sweep_queue* q = s->queues + (node + i) % s->topo.nodes_len;
+        if( atomic_load_explicit(&q->next, memory_order_relaxed) >= q->len ) {
+            continue;
+        }
+        size_t idx = atomic_fetch_add(&q->next, 1);
+        if( idx < q->len ) {
+            *out_chunk = q->chunks[idx];
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Write a new random message to the source pa, unless another worker already replaced message `gen`
+ * @returns 0 on success
+*/
+static int replace_message(struct sweep_state* s, readalias_ctx_t* ctx, pa_batch_t* batch, uint64_t gen) {
+    int ret = 0;
+    pthread_rwlock_wrlock(&s->msg_lock);
+    if( s->msg_gen == gen ) {
+        batch_reset(batch);
+        if( ra_rand_bytes(ctx, s->msg, s->msg_len) ||
+            batch_add_topa(batch, s->params->source_pa, s->msg, s->msg_len, FM_CLFLUSH) ) {
+            err_log("failed to queue message for source_pa 0x%jx\n", s->params->source_pa);
+            ret = -1;
+        } else if( ra_batch_submit(ctx, batch) || batch->descs[0].status ) {
+            err_log("failed to write message to source_pa 0x%jx\n", s->params->source_pa);
+            ret = -1;
+        }
+        s->msg_gen += 1;
+    }
+    pthread_rwlock_unlock(&s->msg_lock);
+    return ret;
+}
+
+/**
+ * @brief Read the queued batch with the read lock held, i.e. while the source pa holds one message
+ * @param out_msg : Output param, the message of the source pa during the reads
+ * @returns generation of the message
+*/
+static uint64_t read_with_message(struct sweep_state* s, readalias_ctx_t* ctx, pa_batch_t* batch, uint8_t* out_msg) {
+    pthread_rwlock_rdlock(&s->msg_lock);
+    uint64_t gen = s->msg_gen;
+    memcpy(out_msg, s->msg, s->msg_len);
+    //fails if any candidate is inaccessible, the callers check the status of each read
+    ra_batch_submit(ctx, batch);
+    pthread_rwlock_unlock(&s->msg_lock);
+    return gen;
+}
+
+/**
+ * @brief Xor differential test of the `n` candidates in `b->cand`, with the message that the source pa holds
+ * during the first read and a new one for the second read
+ * @returns 0 on success
+*/
+static int probe_slice(struct sweep_state* s, readalias_ctx_t* ctx, struct probe_bufs* b, size_t n,
+    uint64_t* out_match, bool* out_found) {
+    const size_t len = s->msg_len;
+    uint8_t m1[SWEEP_MSG_LEN], mxor[SWEEP_MSG_LEN];
+
+    batch_reset(&b->batch);
+    for( size_t i = 0; i < n; i++ ) {
+        if( batch_add_frompa(&b->batch, b->buf1 + i * len, b->cand[i], len, FM_CLFLUSH) ) {
+            goto alloc_error;
+        }
+    }
+    uint64_t gen = read_with_message(s, ctx, &b->batch, m1);
+
+    //only candidates that could be read are read again, i.e. inaccessible pages are counted once
+    size_t read1_status[SWEEP_SLICE_CANDS];
+    for( size_t i = 0; i < n; i++ ) {
+        if( b->batch.descs[i].status < 0 ) {
+            err_log("access to 0x%jx failed : status %jd\n", b->cand[i], (intmax_t)b->batch.descs[i].status);
+            return -1;
+        }
+        read1_status[i] = b->batch.descs[i].status;
+    }
+    if( replace_message(s, ctx, &b->batch, gen) ) {
+        return -1;
+    }
+    batch_reset(&b->batch);
+    for( size_t i = 0; i < n; i++ ) {
+        b->read2_desc[i] = SIZE_MAX;
+        if( read1_status[i] ) {
+            continue;
+        }
+        b->read2_desc[i] = b->batch.len;
+        if( batch_add_frompa(&b->batch, b->buf2 + i * len, b->cand[i], len, FM_CLFLUSH) ) {
+            goto alloc_error;
+        }
+    }
+    read_with_message(s, ctx, &b->batch, mxor);
+    for( size_t i = 0; i < len; i++ ) {
+        mxor[i] ^= m1[i];
+    }
+
+    memeq_xor_batch(b->buf1, b->buf2, len, n, mxor, len, b->eq);
+    for( size_t i = 0; i < n; i++ ) {
+        if( b->read2_desc[i] == SIZE_MAX ) {
+            continue;
+        }
+        int64_t status = b->batch.descs[b->read2_desc[i]].status;
+        if( status < 0 ) {
+            err_log("access to 0x%jx failed : status %jd\n", b->cand[i], (intmax_t)status);
+            return -1;
+        }
+        if( status || !b->eq[i] ) {
+            continue;
+        }
+        *out_match = b->cand[i];
+        *out_found = true;
+        return 0;
+    }
+    return 0;
+
+alloc_error:
+    err_log("failed to queue batch operations\n");
+    return -1;
+}
+
+/**
+ * @brief Search an alias for the source pa in `chunk` with the message shared by all workers. Concurrent
+ * PROBE ioctls for the same source pa would overwrite each others messages. Instead, the workers read
+ * their candidates in slices while the source pa holds one message, replace the message and read them again.
+ * Only the source pa itself is written
+ * @param out_found : Output param, true if `out_match` has been filled
+ * @returns 0 on success
+*/
+static int probe_chunk_shared(struct sweep_state* s, readalias_ctx_t* ctx, struct probe_bufs* b, struct sweep_chunk chunk,
+    uint64_t* out_match, bool* out_found) {
+    const uint64_t source_pa = s->params->source_pa;
+    size_t n = 0;
+
+    *out_found = false;
+    for( uint64_t pa = chunk.start + (source_pa % 4096); pa + s->msg_len <= chunk.end; pa += 4096 ) {
+        if( pa != source_pa ) {
+            b->cand[n] = pa;
+            n += 1;
+        }
+        if( n == SWEEP_SLICE_CANDS ) {
+            if( probe_slice(s, ctx, b, n, out_match, out_found) ) {
+                return -1;
+            }
+            n = 0;
+            if( *out_found || atomic_load(&s->stop) ) {
+                return 0;
+            }
+        }
+    }
+    if( n ) {
+        return probe_slice(s, ctx, b, n, out_match, out_found);
+    }
+    return 0;
+}
+
+/**
+ * @brief Search an alias for `source_pa` in `chunk`. Candidates have the same page offset as `source_pa`
+ * @param out_found : Output param, true if `out_match` has been filled
+ * @returns 0 on success
+*/
+static int sweep_chunk(readalias_ctx_t* ctx, const struct sweep_params* p, uint64_t source_pa, struct sweep_chunk chunk,
+    uint64_t* out_match, bool* out_found) {
+    uint64_t matches[SWEEP_MATCHES_LEN];
+    size_t match_count;
+    uint64_t next_pa = chunk.start + (source_pa % 4096);
+
+    *out_found = false;
+    while( next_pa < chunk.end ) {
+        if( p->mode == SWEEP_SCAN ) {
+            uint64_t start = next_pa;
+            if( ra_scan_pa_range(ctx, start, chunk.end, 4096, p->marker, NULL, p->marker_len,
+                matches, SWEEP_MATCHES_LEN, &match_count, &next_pa) ) {
+                err_log("scan_pa_range for [0x%jx,0x%jx[ failed\n", start, chunk.end);
+                return -1;
+            }
+        } else {
+            size_t count = (chunk.end - next_pa + 4095) / 4096;
+            size_t next;
+            if( ra_probe_alias_range(ctx, source_pa, next_pa, 4096, count,
+                matches, SWEEP_MATCHES_LEN, &match_count, &next) ) {
+                err_log("probe_alias_range for source_pa 0x%jx failed\n", source_pa);
+                return -1;
+            }
+            next_pa += next * 4096;
+        }
+        for( size_t i = 0; i < match_count; i++ ) {
+            if( matches[i] == source_pa ) {
+                continue;
+            }
+            *out_match = matches[i];
+            *out_found = true;
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Account `chunk` as searched. `stats_before` are the statistics of `ctx` before the chunk, they are
+ * updated to the current ones
+*/
+static void add_progress(struct sweep_state* s, readalias_ctx_t* ctx, struct sweep_chunk chunk, page_stats_t* stats_before) {
+    struct pamemcpy_cfg cfg;
+    ra_get_config(ctx, &cfg);
+    page_stats_t delta = {
+        .reserved_pages = cfg.out_stats.reserved_pages - stats_before->reserved_pages,
+        .map_failed = cfg.out_stats.map_failed - stats_before->map_failed,
+    };
+    *stats_before = cfg.out_stats;
+    atomic_fetch_add(&s->processed_bytes, chunk.end - chunk.start);
+    if( s->progress ) {
+        progress_add(s->progress, chunk.start, chunk.end - chunk.start, delta.reserved_pages, delta.map_failed);
+    }
+}
+
+static void* sweep_worker_main(void* arg) {
+    struct sweep_worker* w = arg;
+    struct sweep_state* s = w->state;
+    const struct sweep_params* p = s->params;
+
+    //pinning only matters if there are several nodes
+    if( s->topo.nodes_len > 1 &&
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &s->topo.cpus[w->node]) ) {
+        printf("Failed to pin worker %zu to node %zu\n", w->idx, w->node);
+    }
+
+    readalias_ctx_t* ctx = ra_open();
+    if( !ctx ) {
+        err_log("worker %zu : failed to open context\n", w->idx);
+        w->ret = -1;
+        atomic_store(&s->stop, true);
+        return NULL;
+    }
+    ra_seed(ctx, p->seed + w->idx);
+    struct pamemcpy_cfg cfg = {
+        .out_stats = {0},
+        .access_reserved = p->access_reserved,
+        .err_on_access_fail = false,
+        .flush_method = FM_CLFLUSH,
+    };
+    ra_set_config(ctx, &cfg);
+
+    struct probe_bufs* bufs = NULL;
+    if( s->shared_msg ) {
+        bufs = malloc(sizeof(*bufs));
+        if( !bufs ) {
+            err_log("worker %zu : failed to alloc probe buffers\n", w->idx);
+            w->ret = -1;
+            atomic_store(&s->stop, true);
+            ra_close(ctx);
+            return NULL;
+        }
+        batch_init(&bufs->batch);
+        //the content of the source pa before the first message is unknown, the first worker writes one
+        if( replace_message(s, ctx, &bufs->batch, 0) ) {
+            w->ret = -1;
+            atomic_store(&s->stop, true);
+        }
+    }
+
+    page_stats_t stats_before = {0};
+    struct sweep_chunk chunk;
+    while( !atomic_load(&s->stop) && next_chunk(s, w->node, &chunk) ) {
+        uint64_t match;
+        bool found;
+        int err = bufs ? probe_chunk_shared(s, ctx, bufs, chunk, &match, &found) :
+            sweep_chunk(ctx, p, p->source_pa, chunk, &match, &found);
+        if( err ) {
+            w->ret = -1;
+            atomic_store(&s->stop, true);
+            break;
+        }
+        add_progress(s, ctx, chunk, &stats_before);
+        chunk_finished(s, chunk);
+        if( found ) {
+            pthread_mutex_lock(&s->result_lock);
+            if( !s->found ) {
+                s->found = true;
+                s->alias_pa = match;
+            }
+            pthread_mutex_unlock(&s->result_lock);
+            atomic_store(&s->stop, true);
+        }
+    }
+
+    if( bufs ) {
+        batch_free(&bufs->batch);
+        free(bufs);
+    }
+    ra_get_config(ctx, &cfg);
+    w->stats = cfg.out_stats;
+    ra_close(ctx);
+    return NULL;
+}
+
+int sweep_find_alias(const struct sweep_params* params, struct sweep_result* out_result) {
+    struct sweep_state* s = NULL;
+    struct sweep_worker* workers = NULL;
+    size_t started = 0;
+    int ret = 0;
+
+    if( params->threads < 1 || params->threads > SWEEP_MAX_THREADS ) {
+        err_log("thread count must be between 1 and %d\n", SWEEP_MAX_THREADS);
+        return -1;
+    }
+    s = calloc(1, sizeof(*s));
+    if( !s ) {
+        err_log("failed to alloc sweep state\n");
+        return -1;
+    }
+    s->params = params;
+    atomic_init(&s->stop, false);
+    atomic_init(&s->processed_bytes, 0);
+    for( size_t i = 0; i < SWEEP_MAX_NODES; i++ ) {
+        atomic_init(&s->queues[i].next, 0);
+    }
+    pthread_mutex_init(&s->result_lock, NULL);
+    //writers must not starve while the other workers keep reading
+    pthread_rwlockattr_t msg_lock_attr;
+    pthread_rwlockattr_init(&msg_lock_attr);
+    pthread_rwlockattr_setkind_np(&msg_lock_attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&s->msg_lock, &msg_lock_attr);
+    pthread_rwlockattr_destroy(&msg_lock_attr);
+    s->shared_msg = params->mode == SWEEP_PROBE && params->threads > 1;
+    s->msg_len = 4096 - params->source_pa % 4096;
+    if( s->msg_len > SWEEP_MSG_LEN ) {
+        s->msg_len = SWEEP_MSG_LEN;
+    }
+    read_numa_topology(&s->topo);
+    if( build_queues(s) ) {
+        goto error;
+    }
+
+    //workers are distributed round robin over the nodes that have cpus
+    size_t cpu_nodes[SWEEP_MAX_NODES];
+    size_t cpu_nodes_len = 0;
+    for( size_t i = 0; i < s->topo.nodes_len; i++ ) {
+        if( CPU_COUNT(&s->topo.cpus[i]) > 0 ) {
+            cpu_nodes[cpu_nodes_len] = i;
+            cpu_nodes_len += 1;
+        }
+    }
+    if( cpu_nodes_len == 0 ) {
+        cpu_nodes[0] = 0;
+        cpu_nodes_len = 1;
+    }
+    printf("Sweeping %.2f GiB with %zu threads on %zu NUMA nodes\n",
+        (double)s->total_bytes / (1 << 30), params->threads, s->topo.nodes_len);
+
+    char label[64];
+    snprintf(label, sizeof(label), "sweep 0x%jx", params->source_pa);
+    s->progress = progress_start(label, s->total_bytes, params->ranges, params->ranges_len, params->metrics,
+        ra_metrics_write_current_json);
+
+    workers = calloc(params->threads, sizeof(struct sweep_worker));
+    if( !workers ) {
+        err_log("failed to alloc workers\n");
+        goto error;
+    }
+    for( ; started < params->threads; started++ ) {
+        struct sweep_worker* w = workers + started;
+        w->state = s;
+        w->idx = started;
+        w->node = cpu_nodes[started % cpu_nodes_len];
+        if( pthread_create(&w->thread, NULL, sweep_worker_main, w) ) {
+            err_log("failed to create worker %zu\n", started);
+            atomic_store(&s->stop, true);
+            ret = -1;
+            break;
+        }
+    }
+
+    page_stats_t stats = {0};
+    for( size_t i = 0; i < started; i++ ) {
+        pthread_join(workers[i].thread, NULL);
+        stats.reserved_pages += workers[i].stats.reserved_pages;
+        stats.map_failed += workers[i].stats.map_failed;
+        if( workers[i].ret ) {
+            ret = -1;
+        }
+    }
+    progress_stop(s->progress);
+    s->progress = NULL;
+    //a failing worker does not invalidate an alias found by another one
+    if( s->found ) {
+        ret = 0;
+    }
+    out_result->found = s->found;
+    out_result->alias_pa = s->alias_pa;
+    out_result->stats = stats;
+    out_result->processed_bytes = atomic_load(&s->processed_bytes);
+    goto cleanup;
+error:
+    ret = -1;
+cleanup:
+    progress_stop(s->progress);
+    for( size_t i = 0; i < SWEEP_MAX_NODES; i++ ) {
+        free(s->queues[i].chunks);
+    }
+    free(s->topo.block_node);
+    free(s->chunks);
+    free(s->chunk_done);
+    pthread_mutex_destroy(&s->result_lock);
+    pthread_rwlock_destroy(&s->msg_lock);
+    free(workers);
+    free(s);
+    return ret;
+}
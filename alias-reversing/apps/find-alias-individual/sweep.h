@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "readalias.h"
+#include "proc_iomem_parser.h"
+
+//upper bound for the number of sweep workers
+#define SWEEP_MAX_THREADS 64
+
+enum sweep_mode {
+    //search for a marker that has been written to the source pa. Requires disabled scrambling
+    SWEEP_SCAN,
+    //xor differential test of each candidate, works with scrambling
+    SWEEP_PROBE,
+};
+
+struct sweep_params {
+    enum sweep_mode mode;
+    //search alias for this physical address
+    uint64_t source_pa;
+    //SWEEP_SCAN only: marker value that has already been written to `source_pa`
+    const uint8_t* marker;
+    size_t marker_len;
+    //candidate memory ranges
+    mem_range_t* ranges;
+    size_t ranges_len;
+    //If true, try to access pages marked as reserved. Might lead to crashes
+    bool access_reserved;
+    //number of worker threads, between 1 and SWEEP_MAX_THREADS
+    size_t threads;
+    //worker i seeds its random generator with `seed + i`
+    uint64_t seed;
+    //Optional. Resume point of an interrupted sweep, as reported by `on_progress`. 0 sweeps everything
+    uint64_t resume_pa;
+    //Optional. Called with `progress_arg` whenever the chunks that have been searched without gaps, in the order
+    //of `ranges`, grow. `done_pa` is the end of the last of these chunks. Calls are serialized
+    void (*on_progress)(void* progress_arg, uint64_t done_pa);
+    void* progress_arg;
+    //Optional. JSON lines output for the progress and the lib metrics, see `progress_start`
+    FILE* metrics;
+};
+
+struct sweep_result {
+    //true if an alias has been found
+    bool found;
+    uint64_t alias_pa;
+    //reserved/map fail statistics, summed over all workers
+    page_stats_t stats;
+    //number of bytes that have been searched
+    uint64_t processed_bytes;
+};
+
+/**
+ * @brief Search an alias for `params->source_pa` in `params->ranges` with `params->threads` workers.
+ * The ranges are split into chunks that are queued on the NUMA node of their memory. Each worker is
+ * pinned to the cpus of one node and takes chunks from the queue of its node first, before stealing
+ * from the other queues. All workers stop as soon as one of them found an alias
+ * @param out_result : Output param, only valid on success
+ * @returns 0 if the sweep completed or found an alias
+*/
+int sweep_find_alias(const struct sweep_params* params, struct sweep_result* out_result);
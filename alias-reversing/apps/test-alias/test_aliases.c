@@ -4,12 +4,17 @@
 */
 
 #include<stdbool.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
 
 #include "mem_range_repo.h"
 #include "proc_iomem_parser.h"
 #include "helpers.h"
 #include "readalias.h"
 #include "readalias_ioctls.h"
+#include "journal.h"
+#include "progress.h"
 #include <argp.h>
 
 //cli arguments
@@ -17,11 +22,46 @@ struct arguments {
 	bool verbose;
 	bool acess_reserved;
 	char* alias_file_path;
+	//if true, seed the generator for the alias test messages with `seed`
+	bool have_seed;
+	uint64_t seed;
+	//if true, continue the test recorded in the journal next to `alias_file_path`
+	bool resume;
+	//if true, discard the journal next to `alias_file_path`
+	bool restart;
+	//optional. Write the progress and the lib metrics to this file, as JSON lines
+	char* metrics_path;
+	//if true, check random pages of each memory range until the disfunct fraction is known to be below/above
+	//`max_fraction` with `confidence`, instead of checking all pages
+	bool sample;
+	double confidence;
+	double max_fraction;
+	//stop sampling a memory range after this many random pages, even if there is no decision
+	uint64_t max_samples;
 };
 
+//the journal is stored next to the alias file, with this suffix
+#define TEST_JOURNAL_SUFFIX ".test-journal"
+//journal counters of a memory range
+#define JOURNAL_DISFUNCT 0
+#define JOURNAL_ACCESS_ERRORS 1
+
+//number of pages that are checked with a single syscall
+#define TEST_BATCH_LEN 256
+
+//`--sample` checks all pages this close to the ends of a memory range or to an iomem boundary inside it
+#define SAMPLE_EDGE_PAGES 256
+//`--sample` splits a memory range into this many equally sized strata and draws one page from each per round,
+//until all pages of a stratum have been drawn. Must divide TEST_BATCH_LEN, so that the bounds are only computed after
+//complete rounds
+#define SAMPLE_STRATA 64
+
 typedef struct {
+	//disfunct addresses found by this run, i.e. without those before the resume point
 	uint64_t* disfunct_pa;
 	size_t disfunct_pa_len;
+	//totals over all runs
+	size_t disfunct_total;
 	size_t access_errors;
 	size_t total_pages;
 } mr_stats_t;
@@ -32,19 +72,34 @@ void free_mr_stats_t(mr_stats_t s) {
 	}
 }
 
+/**
+ * @brief Aliased address of `pa`. Uses the linear alias function of `mr` if it has one, otherwise the xor mask `alias`
+*/
+static uint64_t alias_of(mem_range_t mr, uint64_t alias, uint64_t pa) {
+	if( mr.alias_fn ) {
+		return alias_fn_eval(mr.alias_fn, pa);
+	}
+	return pa ^ alias;
+}
+
 /**
  * @brief Checks if `alias` is valid for each page aligned addr in `mr`. Disfunct addresses are
  * returned to the caller
  * @brief mr : memory range to check
- * @brief alias : value to xor to an address in `mr` to obtained the coresponding aliased address
+ * @brief alias : value to xor to an address in `mr` to obtained the coresponding aliased address. Ignored if `mr`
+ * has a linear alias function
  * @brief out_stats : Outputparam with detailed information about test. Free with `free_mr_stats_t`
+ * @brief journal : The test starts at the resume point of the current journal entry. Progress and counters
+ * are recorded after each batch
+ * @brief progress : Receives the checked pages and access errors of each batch
  * @return 0 on success. The existence of disfunct addresses is not considered an error
 */
-int test_mem_range(mem_range_t mr, uint64_t alias, mr_stats_t* out_stats, struct arguments args) {
+int test_mem_range(mem_range_t mr, uint64_t alias, mr_stats_t* out_stats, struct arguments args, journal_t* journal, progress_t* progress) {
+	struct journal_entry* je = journal_entry(journal, journal_current(journal));
 	out_stats->disfunct_pa = NULL;
 	uint64_t aligned_start = mr.start;
 	if( aligned_start & 0xfff ) {
-		aligned_start = (aligned_start + 4096) & 0xfff;
+		aligned_start = (aligned_start + 4096) & ~0xfffULL;
 	}
 	if( aligned_start >= mr.end ) {
 		err_log("Weird small memory range: MemRange{.start = 0x%09jx .end=0x%09jx} and aligned_start=0x%09jx\n",
@@ -55,7 +110,12 @@ int test_mem_range(mem_range_t mr, uint64_t alias, mr_stats_t* out_stats, struct
 	//sweep over pages, storing pages where alias did not work
 	size_t pages_in_mr = (mr.end - aligned_start) /  4096;
 	size_t df_next = 0;
-	size_t access_errors = 0;
+	//continue after the pages that have been checked before
+	size_t first_page = 0;
+	if( je->pos > aligned_start ) {
+		first_page = (je->pos - aligned_start) / 4096;
+		printf("Resuming at 0x%09jx\n", je->pos);
+	}
 	struct pamemcpy_cfg cfg = {
 		.access_reserved = args.acess_reserved,
 		.err_on_access_fail = false,
@@ -63,26 +123,543 @@ int test_mem_range(mem_range_t mr, uint64_t alias, mr_stats_t* out_stats, struct
 		.out_stats = {0},
 	};
 	uint64_t* df = malloc(sizeof(uint64_t) * pages_in_mr);
-	for(uint64_t pa = aligned_start; pa < mr.end; pa += 4096 ) {
-		uint64_t alias_pa = pa ^ alias;
-		//printf("pa 0x%09jx alias_candidate 0x%09jx\n", pa, alias_pa);
-		int ret = check_alias(pa, alias_pa, &cfg, false ); 
-		if( ret == CHECK_ALIAS_ERR_NO_ALIAS ) {
-			df[df_next] = pa;
-			df_next += 1;
-		} else if( ret == CHECK_ALIAS_ERR_ACCESS ) {
-			access_errors += 1;
-		}
-	}
-	df = realloc(df, df_next);
+	//skip pages that we cannot access up front instead of failing on them in the batches
+	uint64_t* inaccessible = malloc(sizeof(uint64_t) * PFN_BITMAP_WORDS(pages_in_mr));
+	uint64_t* reserved = malloc(sizeof(uint64_t) * PFN_BITMAP_WORDS(pages_in_mr));
+	if( !df || !inaccessible || !reserved ) {
+		err_log("failed to alloc buffers for %zu pages\n", pages_in_mr);
+		free(df);
+		free(inaccessible);
+		free(reserved);
+		return -1;
+	}
+	if( get_pfn_state(aligned_start, pages_in_mr, args.acess_reserved, NULL, reserved, inaccessible, NULL) ) {
+		err_log("failed to get page state for mem range starting at 0x%09jx\n", aligned_start);
+		free(df);
+		free(inaccessible);
+		free(reserved);
+		return -1;
+	}
+	//check TEST_BATCH_LEN pages per syscall
+	uint64_t batch_pa[TEST_BATCH_LEN], batch_alias_pa[TEST_BATCH_LEN];
+	int batch_results[TEST_BATCH_LEN];
+	for(size_t page = first_page; page < pages_in_mr; ) {
+		size_t batch_len = 0;
+		size_t batch_first_page = page;
+		//skipped pages count as access errors of this batch, i.e. they are recorded together with the batch
+		size_t batch_access_errors = 0;
+		size_t batch_disfunct = 0;
+		page_stats_t stats_before = cfg.out_stats;
+		page_stats_t skipped = {0};
+		for(; (batch_len < TEST_BATCH_LEN) && (page < pages_in_mr); page++ ) {
+			if( pfn_bitmap_test(inaccessible, page) ) {
+				batch_access_errors += 1;
+				if( pfn_bitmap_test(reserved, page) ) {
+					skipped.reserved_pages += 1;
+				} else {
+					skipped.map_failed += 1;
+				}
+				continue;
+			}
+			batch_pa[batch_len] = aligned_start + page * 4096;
+			batch_alias_pa[batch_len] = alias_of(mr, alias, batch_pa[batch_len]);
+			batch_len++;
+		}
+		if( batch_len != 0 && check_alias_batch(batch_pa, batch_alias_pa, batch_len, &cfg, batch_results) ) {
+			err_log("check_alias_batch failed for pages starting at 0x%09jx\n", batch_pa[0]);
+			free(df);
+			free(inaccessible);
+			free(reserved);
+			return -1;
+		}
+		for(size_t i = 0; i < batch_len; i++ ) {
+			if( batch_results[i] == CHECK_ALIAS_ERR_NO_ALIAS ) {
+				df[df_next] = batch_pa[i];
+				df_next += 1;
+				batch_disfunct += 1;
+			} else if( batch_results[i] == CHECK_ALIAS_ERR_ACCESS ) {
+				batch_access_errors += 1;
+			}
+		}
+		je->counters[JOURNAL_DISFUNCT] += batch_disfunct;
+		je->counters[JOURNAL_ACCESS_ERRORS] += batch_access_errors;
+		je->pos = aligned_start + page * 4096;
+		journal_sync(journal, false);
+		if( progress ) {
+			progress_add(progress, aligned_start + batch_first_page * 4096, (page - batch_first_page) * 4096,
+				skipped.reserved_pages + cfg.out_stats.reserved_pages - stats_before.reserved_pages,
+				skipped.map_failed + cfg.out_stats.map_failed - stats_before.map_failed);
+		}
+	}
+	free(inaccessible);
+	free(reserved);
+	df = realloc(df, sizeof(uint64_t) * df_next);
 	out_stats->disfunct_pa = df;
 	out_stats->disfunct_pa_len = df_next;
-	out_stats->access_errors = access_errors;
+	out_stats->disfunct_total = je->counters[JOURNAL_DISFUNCT];
+	out_stats->access_errors = je->counters[JOURNAL_ACCESS_ERRORS];
 	out_stats->total_pages = pages_in_mr;
 
 	return 0;
 }
 
+typedef struct {
+	//pages close to the range ends and iomem boundaries, all of them are checked
+	size_t edge_pages;
+	size_t edge_disfunct;
+	//random pages from the strata that could be accessed, drawn without replacement from the pages that are no edge pages
+	size_t samples;
+	size_t sample_disfunct;
+	//pages of both kinds that could not be accessed
+	size_t access_errors;
+	//all pages of the range have been checked as edge pages, i.e. there are no random samples
+	bool exhaustive;
+	//bounds on the disfunct fraction of the range at the last look of `sample_mem_range`: the exact fraction of the
+	//edge pages combined with the Clopper-Pearson bounds of the random pages. Exact if `exhaustive`
+	double lower;
+	double upper;
+	uint64_t* disfunct_pa;
+	size_t disfunct_pa_len;
+	size_t disfunct_pa_cap;
+} sample_stats_t;
+
+void free_sample_stats_t(sample_stats_t s) {
+	if( s.disfunct_pa != NULL ) {
+		free(s.disfunct_pa);
+	}
+}
+
+/**
+ * @brief Probability of at most `k` hits in `n` draws with hit probability `p`
+*/
+static double binom_cdf(size_t k, size_t n, double p) {
+	if( k >= n || p <= 0 ) {
+		return 1;
+	}
+	if( p >= 1 ) {
+		return 0;
+	}
+	double sum = 0;
+	for(size_t i = 0; i <= k; i++ ) {
+		double log_term = lgamma(n + 1.0) - lgamma(i + 1.0) - lgamma(n - i + 1.0) + i * log(p) + (n - i) * log1p(-p);
+		sum += exp(log_term);
+	}
+	return sum < 1 ? sum : 1;
+}
+
+/**
+ * @brief Find p in [lo,hi] with binom_cdf(k, n, p) == target. The cdf decreases in p
+*/
+static double binom_cdf_solve(size_t k, size_t n, double target, double lo, double hi) {
+	for(int i = 0; i < 64; i++ ) {
+		double mid = (lo + hi) / 2;
+		if( binom_cdf(k, n, mid) > target ) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+	return hi;
+}
+
+/**
+ * @brief One sided Clopper-Pearson bounds for the hit probability after `k` hits in `n` draws. The true
+ * probability is below `upper`, respectively above `lower`, with probability `confidence` each
+*/
+static void clopper_pearson(size_t k, size_t n, double confidence, double* lower, double* upper) {
+	double alpha = 1 - confidence;
+	if( n == 0 ) {
+		*lower = 0;
+		*upper = 1;
+		return;
+	}
+	double p_hat = (double)k / n;
+	*upper = k >= n ? 1 : binom_cdf_solve(k, n, alpha, p_hat, 1);
+	//P(X >= k) = alpha <=> P(X <= k-1) = 1 - alpha
+	*lower = k == 0 ? 0 : binom_cdf_solve(k - 1, n, 1 - alpha, 0, p_hat);
+}
+
+/**
+ * @brief Check the pages `pages` of `mr`, TEST_BATCH_LEN per syscall. Disfunct addresses are appended to `s`
+ * @param out_checked : Outputparam, number of pages without access error
+ * @param out_disfunct : Outputparam, number of disfunct pages
+ * @return 0 on success
+*/
+static int check_pages(mem_range_t mr, uint64_t alias, uint64_t aligned_start, const uint64_t* pages, size_t len,
+	struct pamemcpy_cfg* cfg, sample_stats_t* s, size_t* out_checked, size_t* out_disfunct) {
+	uint64_t batch_pa[TEST_BATCH_LEN], batch_alias_pa[TEST_BATCH_LEN];
+	int batch_results[TEST_BATCH_LEN];
+	*out_checked = 0;
+	*out_disfunct = 0;
+	for(size_t off = 0; off < len; off += TEST_BATCH_LEN ) {
+		size_t batch_len = len - off < TEST_BATCH_LEN ? len - off : TEST_BATCH_LEN;
+		for(size_t i = 0; i < batch_len; i++ ) {
+			batch_pa[i] = aligned_start + pages[off + i] * 4096;
+			batch_alias_pa[i] = alias_of(mr, alias, batch_pa[i]);
+		}
+		if( check_alias_batch(batch_pa, batch_alias_pa, batch_len, cfg, batch_results) ) {
+			err_log("check_alias_batch failed for pages starting at 0x%09jx\n", batch_pa[0]);
+			return -1;
+		}
+		for(size_t i = 0; i < batch_len; i++ ) {
+			if( batch_results[i] == CHECK_ALIAS_ERR_ACCESS ) {
+				s->access_errors += 1;
+				continue;
+			}
+			*out_checked += 1;
+			if( batch_results[i] != CHECK_ALIAS_ERR_NO_ALIAS ) {
+				continue;
+			}
+			*out_disfunct += 1;
+			if( s->disfunct_pa_len == s->disfunct_pa_cap ) {
+				size_t cap = s->disfunct_pa_cap ? 2 * s->disfunct_pa_cap : 64;
+				uint64_t* tmp = realloc(s->disfunct_pa, sizeof(uint64_t) * cap);
+				if( !tmp ) {
+					err_log("failed to alloc disfunct addrs\n");
+					return -1;
+				}
+				s->disfunct_pa = tmp;
+				s->disfunct_pa_cap = cap;
+			}
+			s->disfunct_pa[s->disfunct_pa_len] = batch_pa[i];
+			s->disfunct_pa_len += 1;
+		}
+	}
+	return 0;
+}
+
+struct page_interval {
+	uint64_t start;
+	uint64_t end;
+};
+
+static int cmp_page_interval(const void* a, const void* b) {
+	const struct page_interval* x = a;
+	const struct page_interval* y = b;
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+/**
+ * @brief true if `page` is inside one of the sorted, non overlapping `edges`
+*/
+static bool in_edges(const struct page_interval* edges, size_t edges_len, uint64_t page) {
+	size_t lo = 0, hi = edges_len;
+	while( lo < hi ) {
+		size_t mid = (lo + hi) / 2;
+		if( page < edges[mid].start ) {
+			hi = mid;
+		} else if( page >= edges[mid].end ) {
+			lo = mid + 1;
+		} else {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief Number of pages of [lo,hi[ inside the `edges`
+*/
+static uint64_t edge_overlap(const struct page_interval* edges, size_t edges_len, uint64_t lo, uint64_t hi) {
+	uint64_t overlap = 0;
+	for(size_t i = 0; i < edges_len; i++ ) {
+		uint64_t start = edges[i].start > lo ? edges[i].start : lo;
+		uint64_t end = edges[i].end < hi ? edges[i].end : hi;
+		if( start < end ) {
+			overlap += end - start;
+		}
+	}
+	return overlap;
+}
+
+//open addressing hash set of the drawn pages, to sample without replacement
+struct page_set {
+	//page + 1, 0 marks an empty slot
+	uint64_t* slots;
+	size_t mask;
+};
+
+/**
+ * @brief Insert `page` into `set`, which must not be full
+ * @returns false if `page` is already in `set`
+*/
+static bool page_set_insert(struct page_set* set, uint64_t page) {
+	for(size_t slot = ((page * 0x9e3779b97f4a7c15ULL) >> 32) & set->mask; ; slot = (slot + 1) & set->mask ) {
+		if( set->slots[slot] == 0 ) {
+			set->slots[slot] = page + 1;
+			return true;
+		}
+		if( set->slots[slot] == page + 1 ) {
+			return false;
+		}
+	}
+}
+
+/**
+ * @brief Estimates the fraction of pages in `mr` for which `alias` does not work, from stratified random samples.
+ * All pages within SAMPLE_EDGE_PAGES of the range ends and of the boundaries in `iomem` are checked first, since
+ * a wrong alias function tends to break at the transition to another memory device.
+ * Afterwards, each round draws one random page from each of SAMPLE_STRATA equally sized strata, without replacement
+ * and without the edge pages, until the upper confidence bound drops below `args.max_fraction`, the lower bound
+ * exceeds it, all pages have been drawn or `args.max_samples` is reached. The bounds combine the exact fraction of
+ * the edge pages with the bounds for the remaining pages, weighted by their number of pages, i.e. a disfunct edge
+ * page counts like any other disfunct page. `args.max_samples` is rounded up to a multiple of TEST_BATCH_LEN.
+ * If the range is not much larger than the number of samples needed, all pages are checked instead and the exact
+ * fraction is compared with `args.max_fraction`.
+ * Stopping at the first of many bound checks would inflate the error probability, so the bounds are only checked
+ * at the looks n0, 2*n0, 4*n0, ... and at `args.max_samples`, where n0 is the smallest sample size that can
+ * validate the range. Look i is tested with an error probability of alpha/2^(i+1), alpha = 1 - `args.confidence`.
+ * By the union bound, a validated or failed verdict is wrong with a probability of at most alpha
+ * @param iomem : memory layout, to place the edge pages on boundaries inside `mr`. May be NULL
+ * @param out_stats : Outputparam. Free with `free_sample_stats_t`
+ * @return 0 on success. The existence of disfunct addresses is not considered an error
+*/
+int sample_mem_range(mem_range_t mr, uint64_t alias, const mem_range_t* iomem, size_t iomem_len, sample_stats_t* out_stats, struct arguments args) {
+	memset(out_stats, 0, sizeof(*out_stats));
+	out_stats->upper = 1;
+	uint64_t aligned_start = mr.start;
+	if( aligned_start & 0xfff ) {
+		aligned_start = (aligned_start + 4096) & ~0xfffULL;
+	}
+	if( aligned_start >= mr.end ) {
+		err_log("Weird small memory range: MemRange{.start = 0x%09jx .end=0x%09jx} and aligned_start=0x%09jx\n",
+			mr.start, mr.end, aligned_start);
+		return -1;
+	}
+	uint64_t pages_in_mr = (mr.end - aligned_start) / 4096;
+	struct pamemcpy_cfg cfg = {
+		.access_reserved = args.acess_reserved,
+		.err_on_access_fail = false,
+		.flush_method = FM_CLFLUSH,
+		.out_stats = {0},
+	};
+	uint64_t* pages = NULL;
+	struct page_interval* edges = NULL;
+	size_t edges_len = 0;
+	struct page_set drawn = {0};
+
+	//first look: number of samples that validate the range at the error probability of the first look if none
+	//of them is disfunct, in complete batches. E.g. 5376 for 99% confidence and 0.1% max fraction. There is no
+	//point in sampling a range that is not much larger than that
+	double alpha = 1 - args.confidence;
+	uint64_t first_look = (uint64_t)ceil(log(alpha / 2) / log1p(-args.max_fraction));
+	first_look = (first_look + TEST_BATCH_LEN - 1) / TEST_BATCH_LEN * TEST_BATCH_LEN;
+	if( pages_in_mr <= 4 * first_look || pages_in_mr <= 4 * SAMPLE_EDGE_PAGES ) {
+		edges = malloc(sizeof(*edges));
+		if( !edges ) {
+			err_log("failed to alloc edge intervals\n");
+			goto error;
+		}
+		edges[0] = (struct page_interval){.start = 0, .end = pages_in_mr};
+		edges_len = 1;
+		out_stats->exhaustive = true;
+	} else {
+		//window at each end of the range and on both sides of each iomem boundary inside it. The iomem end is inclusive
+		edges = malloc(sizeof(*edges) * (2 + 2 * iomem_len));
+		if( !edges ) {
+			err_log("failed to alloc edge intervals\n");
+			goto error;
+		}
+		edges[edges_len++] = (struct page_interval){.start = 0, .end = SAMPLE_EDGE_PAGES};
+		edges[edges_len++] = (struct page_interval){.start = pages_in_mr - SAMPLE_EDGE_PAGES, .end = pages_in_mr};
+		for(size_t i = 0; i < iomem_len; i++ ) {
+			uint64_t boundaries[2] = {iomem[i].start, iomem[i].end + 1};
+			for(size_t j = 0; j < 2; j++ ) {
+				if( boundaries[j] <= aligned_start || boundaries[j] >= mr.end ) {
+					continue;
+				}
+				uint64_t page = (boundaries[j] - aligned_start) / 4096;
+				edges[edges_len++] = (struct page_interval){
+					.start = page > SAMPLE_EDGE_PAGES ? page - SAMPLE_EDGE_PAGES : 0,
+					.end = page + SAMPLE_EDGE_PAGES < pages_in_mr ? page + SAMPLE_EDGE_PAGES : pages_in_mr,
+				};
+			}
+		}
+		//merge overlapping windows, so that no page is checked twice
+		qsort(edges, edges_len, sizeof(*edges), cmp_page_interval);
+		size_t merged = 0;
+		for(size_t i = 1; i < edges_len; i++ ) {
+			if( edges[i].start <= edges[merged].end ) {
+				if( edges[i].end > edges[merged].end ) {
+					edges[merged].end = edges[i].end;
+				}
+			} else {
+				edges[++merged] = edges[i];
+			}
+		}
+		edges_len = merged + 1;
+	}
+
+	//check the edge pages
+	pages = malloc(sizeof(uint64_t) * TEST_BATCH_LEN);
+	if( !pages ) {
+		err_log("failed to alloc page buffer\n");
+		goto error;
+	}
+	for(size_t i = 0; i < edges_len; i++ ) {
+		for(uint64_t page = edges[i].start; page < edges[i].end; ) {
+			size_t len = 0;
+			for(; len < TEST_BATCH_LEN && page < edges[i].end; page++ ) {
+				pages[len++] = page;
+			}
+			size_t checked, disfunct;
+			if( check_pages(mr, alias, aligned_start, pages, len, &cfg, out_stats, &checked, &disfunct) ) {
+				goto error;
+			}
+			out_stats->edge_pages += checked;
+			out_stats->edge_disfunct += disfunct;
+		}
+	}
+	if( out_stats->exhaustive ) {
+		//the exact fraction
+		out_stats->lower = out_stats->edge_pages ? (double)out_stats->edge_disfunct / out_stats->edge_pages : 0;
+		out_stats->upper = out_stats->edge_pages ? out_stats->lower : 1;
+		free(edges);
+		free(pages);
+		return 0;
+	}
+
+	//the edge pages are known exactly, only the other pages of each stratum are drawn
+	uint64_t stratum_pages[SAMPLE_STRATA];
+	uint64_t stratum_drawn[SAMPLE_STRATA] = {0};
+	uint64_t random_pages = 0;
+	for(size_t i = 0; i < SAMPLE_STRATA; i++ ) {
+		uint64_t lo = i * pages_in_mr / SAMPLE_STRATA;
+		uint64_t hi = (i + 1) * pages_in_mr / SAMPLE_STRATA;
+		stratum_pages[i] = hi - lo - edge_overlap(edges, edges_len, lo, hi);
+		random_pages += stratum_pages[i];
+	}
+	double edge_fraction = out_stats->edge_pages ? (double)out_stats->edge_disfunct / out_stats->edge_pages : 0;
+	uint64_t max_draws = args.max_samples < random_pages ? args.max_samples : random_pages;
+	size_t set_slots = 16;
+	while( set_slots < 2 * (max_draws + TEST_BATCH_LEN) ) {
+		set_slots *= 2;
+	}
+	drawn.slots = calloc(set_slots, sizeof(uint64_t));
+	drawn.mask = set_slots - 1;
+	if( !drawn.slots ) {
+		err_log("failed to alloc drawn pages\n");
+		goto error;
+	}
+
+	//stratified sampling over the whole range. The draws are from the seeded generator of the lib, i.e. `--seed`
+	//replays the same pages
+	uint64_t rand_buf[TEST_BATCH_LEN];
+	size_t rand_next = TEST_BATCH_LEN;
+	uint64_t next_look = first_look;
+	double look_alpha = alpha / 2;
+	for(uint64_t draws = 0; draws < max_draws; ) {
+		size_t len = 0;
+		for(size_t i = 0; i < TEST_BATCH_LEN; i++ ) {
+			uint64_t stratum = i % SAMPLE_STRATA;
+			if( stratum_drawn[stratum] == stratum_pages[stratum] ) {
+				continue;
+			}
+			uint64_t lo = stratum * pages_in_mr / SAMPLE_STRATA;
+			uint64_t hi = (stratum + 1) * pages_in_mr / SAMPLE_STRATA;
+			uint64_t page;
+			do {
+				if( rand_next == TEST_BATCH_LEN ) {
+					if( gen_rand_bytes(rand_buf, sizeof(rand_buf)) ) {
+						err_log("gen_rand_bytes failed\n");
+						goto error;
+					}
+					rand_next = 0;
+				}
+				page = lo + rand_buf[rand_next++] % (hi - lo);
+			} while( in_edges(edges, edges_len, page) || !page_set_insert(&drawn, page) );
+			stratum_drawn[stratum] += 1;
+			pages[len++] = page;
+		}
+		draws += len;
+		size_t checked, disfunct;
+		if( check_pages(mr, alias, aligned_start, pages, len, &cfg, out_stats, &checked, &disfunct) ) {
+			goto error;
+		}
+		out_stats->samples += checked;
+		out_stats->sample_disfunct += disfunct;
+		if( draws < next_look && draws < max_draws ) {
+			continue;
+		}
+		double lower, upper;
+		clopper_pearson(out_stats->sample_disfunct, out_stats->samples, 1 - look_alpha, &lower, &upper);
+		if( draws == random_pages && out_stats->samples ) {
+			//all pages have been checked, i.e. the fraction is exact
+			lower = upper = (double)out_stats->sample_disfunct / out_stats->samples;
+		}
+		uint64_t edge_pages = pages_in_mr - random_pages;
+		out_stats->lower = (edge_pages * edge_fraction + random_pages * lower) / pages_in_mr;
+		out_stats->upper = (edge_pages * edge_fraction + random_pages * upper) / pages_in_mr;
+		if( out_stats->upper <= args.max_fraction || out_stats->lower > args.max_fraction ) {
+			break;
+		}
+		next_look *= 2;
+		look_alpha /= 2;
+	}
+	free(drawn.slots);
+	free(edges);
+	free(pages);
+	return 0;
+
+error:
+	free(drawn.slots);
+	free(edges);
+	free(pages);
+	free_sample_stats_t(*out_stats);
+	out_stats->disfunct_pa = NULL;
+	return -1;
+}
+
+
+/**
+ * @brief Run `sample_mem_range` for `mr`, record the counters in `je` and print the result
+ * @return 0 on success
+*/
+static int report_sample_mem_range(mem_range_t mr, uint64_t alias, const mem_range_t* iomem, size_t iomem_len,
+	struct arguments args, struct journal_entry* je) {
+	sample_stats_t stats;
+	if( sample_mem_range(mr, alias, iomem, iomem_len, &stats, args) ) {
+		err_log("sample_mem_range failed\n");
+		return -1;
+	}
+	je->counters[JOURNAL_DISFUNCT] = stats.edge_disfunct + stats.sample_disfunct;
+	je->counters[JOURNAL_ACCESS_ERRORS] = stats.access_errors;
+	je->result = stats.edge_pages + stats.samples + stats.access_errors;
+	je->state = JOURNAL_DONE;
+
+	if( stats.exhaustive ) {
+		printf("Small range, checked all %ju pages: %ju disfunct, access errors for %ju\n", stats.edge_pages + stats.access_errors,
+			stats.edge_disfunct, stats.access_errors);
+	} else {
+		printf("Checked %ju edge pages and %ju random pages: %ju and %ju disfunct, access errors for %ju\n",
+			stats.edge_pages, stats.samples, stats.edge_disfunct, stats.sample_disfunct, stats.access_errors);
+	}
+	const char* verdict;
+	if( stats.upper <= args.max_fraction ) {
+		verdict = "validated";
+	} else if( stats.lower > args.max_fraction ) {
+		verdict = "NOT validated";
+	} else {
+		verdict = "undecided after --max-samples, rerun with more samples or without --sample";
+	}
+	if( stats.exhaustive ) {
+		printf("MemRange{.start=0x%09jx .end=0x%09jx} alias 0x%09jx disfunct fraction %0.4f%%: %s\n", mr.start, mr.end,
+			alias, stats.upper * 100, verdict);
+	} else {
+		printf("MemRange{.start=0x%09jx .end=0x%09jx} alias 0x%09jx disfunct fraction in [%0.4f%%,%0.4f%%] with at least %0.2f%% confidence"
+			" each: %s\n", mr.start, mr.end, alias, stats.lower * 100, stats.upper * 100, args.confidence * 100, verdict);
+	}
+	size_t print_limit = stats.disfunct_pa_len;
+	if( !args.verbose && print_limit > 10) {
+		printf("Limiting output to 10, start with verbose flag to get all %ju addrs\n", stats.disfunct_pa_len);
+		print_limit = 10;
+	}
+	for(size_t j = 0; j < print_limit; j++ ) {
+		printf("\t0x%09jx\n", stats.disfunct_pa[j]);
+	}
+	free_sample_stats_t(stats);
+	return 0;
+}
 
 /**
  * @brief main function
@@ -93,6 +670,11 @@ int run(struct arguments args) {
 	//parse alias definitions
 	mem_range_t* mr = NULL;
 	uint64_t* aliases = NULL;
+	journal_t* journal = NULL;
+	FILE* metrics = NULL;
+	progress_t* progress = NULL;
+	mem_range_t* iomem = NULL;
+	size_t iomem_len = 0;
 	size_t len;
 	if( parse_csv(args.alias_file_path, &mr , &aliases , &len ) ) {
 		err_log("Failed to parse aliases from %s\n", args.alias_file_path);
@@ -104,22 +686,111 @@ int run(struct arguments args) {
 		printf("Failed to open kernel module driver. Did you load it?\n");
 		goto error;
 	}
+	if( args.have_seed ) {
+		set_rand_seed(args.seed);
+	}
+	printf("Random seed: 0x%jx\n", get_rand_seed());
+	//the boundaries of the memory devices only add edge pages, i.e. sampling still works without them
+	if( args.sample && parse_mem_layout(&iomem, &iomem_len) ) {
+		printf("Failed to parse /proc/iomem, only the ends of the memory ranges get extra samples\n");
+		iomem = NULL;
+		iomem_len = 0;
+	}
+
+	//record the progress in a journal, to resume after a crash. The journal only belongs to this run
+	//if the memory ranges and aliases are the same
+	{
+		uint64_t tag = journal_hash(JOURNAL_HASH_INIT, &args.acess_reserved, sizeof(args.acess_reserved));
+		tag = journal_hash(tag, &args.sample, sizeof(args.sample));
+		if( args.sample ) {
+			tag = journal_hash(tag, &args.confidence, sizeof(args.confidence));
+			tag = journal_hash(tag, &args.max_fraction, sizeof(args.max_fraction));
+			tag = journal_hash(tag, &args.max_samples, sizeof(args.max_samples));
+		}
+		for(size_t i = 0; i < len; i++ ) {
+			tag = journal_hash(tag, &mr[i].start, sizeof(mr[i].start));
+			tag = journal_hash(tag, &mr[i].end, sizeof(mr[i].end));
+			tag = journal_hash(tag, aliases + i, sizeof(aliases[i]));
+		}
+		char* journal_path = malloc(strlen(args.alias_file_path) + strlen(TEST_JOURNAL_SUFFIX) + 1);
+		sprintf(journal_path, "%s%s", args.alias_file_path, TEST_JOURNAL_SUFFIX);
+		enum journal_open_mode journal_mode = JOURNAL_CREATE;
+		if( args.resume ) {
+			journal_mode = JOURNAL_RESUME;
+		} else if( args.restart ) {
+			journal_mode = JOURNAL_RESTART;
+		}
+		journal = journal_open(journal_path, tag, len, journal_mode);
+		if( !journal ) {
+			err_log("Failed to open journal %s\n", journal_path);
+			free(journal_path);
+			goto error;
+		}
+		if( journal_resumed(journal) ) {
+			printf("Resuming the test recorded in %s\n", journal_path);
+		}
+		free(journal_path);
+	}
+
+	//the progress covers the pages that are left to test. Sampling only touches a few pages per range and
+	//does not report progress
+	if( args.metrics_path ) {
+		metrics = fopen(args.metrics_path, args.resume ? "a" : "w");
+		if( !metrics ) {
+			err_log("Failed to open metrics file %s : %s\n", args.metrics_path, strerror(errno));
+			goto error;
+		}
+		ra_metrics_enable(true);
+	}
+	if( !args.sample ) {
+		uint64_t total_bytes = 0;
+		for(size_t i = 0; i < len; i++ ) {
+			struct journal_entry* je = journal_entry(journal, i);
+			uint64_t start = je->pos > mr[i].start ? je->pos : mr[i].start;
+			if( je->state != JOURNAL_DONE && start < mr[i].end ) {
+				total_bytes += mr[i].end - start;
+			}
+		}
+		progress = progress_start("test-alias", total_bytes, mr, len, metrics, ra_metrics_write_current_json);
+	}
 
 	//call `test_mem_range` for each mem range and print results
 	for(size_t i = 0; i < len; i++ ) {
 		mr_stats_t stats;
+		struct journal_entry* je = journal_entry(journal, i);
+		if( je->state == JOURNAL_DONE ) {
+			printf("[%ju,%ju[ : MemRange{.start=0x%09jx .end=0x%09jx} has already been tested. Alias did not work for %ju addrs,"
+				" access errors for %ju out of %ju addrs\n", i, len, mr[i].start, mr[i].end, je->counters[JOURNAL_DISFUNCT],
+				je->counters[JOURNAL_ACCESS_ERRORS], je->result);
+			continue;
+		}
+		journal_set_current(journal, i);
+		je->key = mr[i].start;
+		je->state = JOURNAL_RUNNING;
+		journal_sync(journal, true);
 
 		double mr_size_gib = (double)(mr[i].end - mr[i].start)/(1<<30);
 		printf("[%ju,%ju[ : Checking MemRange{.start=0x%09jx .end=0x%09jx} %0.4f GiB, alias_mask=0x%09jx\n",
 			i, len, mr[i].start, mr[i].end, mr_size_gib, aliases[i]);
 
-		if( test_mem_range(mr[i], aliases[i], &stats, args)) {
+		if( args.sample ) {
+			if( report_sample_mem_range(mr[i], aliases[i], iomem, iomem_len, args, je) ) {
+				goto error;
+			}
+			journal_sync(journal, true);
+			continue;
+		}
+
+		if( test_mem_range(mr[i], aliases[i], &stats, args, journal, progress)) {
 			err_log("test_mem_range failed\n");
 			goto error;
 		}
+		je->result = stats.total_pages;
+		je->state = JOURNAL_DONE;
+		journal_sync(journal, true);
 		double access_err_percentage = stats.access_errors / (double)stats.total_pages * 100;
-		if( stats.disfunct_pa_len != 0 ) {
-			double disfunct_percentage = stats.disfunct_pa_len / (double)stats.total_pages * 100;
+		if( stats.disfunct_total != 0 ) {
+			double disfunct_percentage = stats.disfunct_total / (double)stats.total_pages * 100;
 			printf("MemRange{.start=0x%09jx .end=0x%09jx} alias 0x%09jx did not work for %0.2f%% of addrs. Access errors for %0.2f%% of addrs\n",
 				mr[i].start, mr[i].end, aliases[i], disfunct_percentage, access_err_percentage);
 			size_t print_limit = stats.disfunct_pa_len;
@@ -127,6 +798,9 @@ int run(struct arguments args) {
 				printf("Limiting output to 10, start with verbose flag to get all %ju addrs\n", stats.disfunct_pa_len);
 				print_limit = 10;
 			}
+			if( stats.disfunct_total != stats.disfunct_pa_len ) {
+				printf("%ju addrs have been found before the resume and are not listed\n", stats.disfunct_total - stats.disfunct_pa_len);
+			}
 			for(size_t j = 0; j < print_limit; j++ ) {
 				printf("\t0x%09jx\n", stats.disfunct_pa[j]);
 			}
@@ -135,29 +809,48 @@ int run(struct arguments args) {
 		}
 		free_mr_stats_t(stats);
 	}
+	//all memory ranges are done, there is nothing left to resume
+	journal_remove(journal);
+	journal = NULL;
 
 	int r = 0;
 	goto cleanup;
 error:
 		r = - 1;
 cleanup:
+	progress_stop(progress);
+	if( metrics ) {
+		fclose(metrics);
+	}
 	if( mr ) {
 		free(mr);
 	}
 	if( aliases ) {
 		free(aliases);
 	}
+	if( iomem ) {
+		free(iomem);
+	}
+	journal_close(journal);
 	return r;
 }
 
 const char* argp_program_version = "test_aliases";
 const char* argp_program_bug_address = "l.wilke@uni-luebeck.de";
 static char doc[] = "Tool to test if the specified alias functions work for addresses in the memory range";
-static char args_doc[] = "--aliases [--verbose] [--access-reserved]";
+static char args_doc[] = "--aliases [--verbose] [--access-reserved] [--seed] [--resume | --restart] [--metrics] [--sample [--confidence] [--max-fraction] [--max-samples]]";
 static struct argp_option options[] = {
 	{"verbose", 1, 0, 0, "Verbose output", 0},
 	{"access-reserved", 2, 0, 0, "Allow accessing reserved memory ranges. Might lead to crashes\n", 0},
-	{"aliases", 3, 0, 0, "CSV file (same syntax as fai tool output) that specifies the memory ranges and alias functions\n", 0},
+	{"aliases", 3, "FILE", 0, "CSV file (same syntax as fai tool output) that specifies the memory ranges and alias functions\n", 0},
+	{"seed", 4, "N", 0, "Seed for the alias test messages, to replay a previous run. The seed of each run is printed", 0},
+	{"resume", 5, 0, 0, "Continue the test recorded in <aliases>" TEST_JOURNAL_SUFFIX ", e.g. after a crash. Tested memory ranges are skipped", 0},
+	{"metrics", 6, "FILE", 0, "Write the progress, the reserved/map fail rates per memory range and the latency histograms of the kernel module calls to FILE, one JSON line per second. Appends with --resume", 0},
+	{"sample", 7, 0, 0, "Instead of checking all pages, check the pages at the ends of each memory range and at the /proc/iomem boundaries inside it, plus stratified random pages until the fraction of disfunct pages is known to be below or above --max-fraction", 0},
+	{"confidence", 8, "P", 0, "Confidence of the bounds for --sample, default 0.99", 0},
+	{"max-fraction", 9, "P", 0, "Largest acceptable fraction of disfunct pages for --sample, default 0.001", 0},
+	{"max-samples", 10, "N", 0, "Give up on a memory range after N random pages for --sample, default 1000000", 0},
+	{"restart", 11, 0, 0, "Discard the test recorded in <aliases>" TEST_JOURNAL_SUFFIX " and start over. Without --resume or --restart, the test refuses to start if this journal belongs to the same run", 0},
 	{0},
 };
 
@@ -174,12 +867,60 @@ static error_t parse_opt(int key, char* arg, struct argp_state* state) {
 		case 3:
 			args->alias_file_path = arg;
 			break;
+		case 4:
+			if( do_stroul(arg, 0, &args->seed) ) {
+				argp_usage(state);
+			}
+			args->have_seed = true;
+			break;
+		case 5:
+			args->resume = true;
+			break;
+		case 6:
+			args->metrics_path = arg;
+			break;
+		case 7:
+			args->sample = true;
+			break;
+		case 8:
+		case 9: {
+			char* end;
+			double v = strtod(arg, &end);
+			if( *arg == 0 || *end != 0 || !(v > 0 && v < 1) ) {
+				printf("%s must be in ]0,1[\n", key == 8 ? "--confidence" : "--max-fraction");
+				argp_usage(state);
+			}
+			if( key == 8 ) {
+				args->confidence = v;
+			} else {
+				args->max_fraction = v;
+			}
+			break;
+		}
+		case 10:
+			if( do_stroul(arg, 0, &args->max_samples) || args->max_samples == 0 ) {
+				argp_usage(state);
+			}
+			break;
+		case 11:
+			args->restart = true;
+			break;
 		case ARGP_KEY_END:
 			if( args->alias_file_path == NULL ) {
 				printf("Missing alias file path option\n");
 				argp_usage(state);
 				return ARGP_ERR_UNKNOWN;
 			}
+			if( args->sample && args->metrics_path ) {
+				printf("--metrics only reports the progress of a full test, it cannot be combined with --sample\n");
+				argp_usage(state);
+				return ARGP_ERR_UNKNOWN;
+			}
+			if( args->resume && args->restart ) {
+				printf("--resume and --restart are mutually exclusive\n");
+				argp_usage(state);
+				return ARGP_ERR_UNKNOWN;
+			}
 			break;
 		default:
 			return ARGP_ERR_UNKNOWN;
@@ -202,6 +943,15 @@ int main(int argc, char** argv) {
 		.acess_reserved = false,
 		.alias_file_path = NULL,
 		.verbose = false,
+		.have_seed = false,
+		.seed = 0,
+		.resume = false,
+		.restart = false,
+		.metrics_path = NULL,
+		.sample = false,
+		.confidence = 0.99,
+		.max_fraction = 0.001,
+		.max_samples = 1000000,
 	};
 	if(argp_parse(&argp, argc, argv, 0, 0, &args)) {
 		printf("Failed to parse arguments\n");
@@ -0,0 +1,111 @@
+#pragma once
+
+/**
+ * Physical memory backends of libkmodreadalias. The public API in readalias.c
+ * forwards the basic operations to the selected backend. The kernel module
+ * backend additionally implements batches, scans, probes and page state
+ * queries inside the kernel. For the other backends, readalias.c emulates
+ * these on top of the basic operations.
+ *
+ * The backend is selected with `select_backend` or, if that was not called,
+ * with the READALIAS_BACKEND environment variable when a context is opened.
+ * Each context (see `ra_open`) holds its own backend resources in `fd`
+*/
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "include/readalias.h"
+
+#define err_log(fmt, ...) fprintf(stderr, "%s:%d : " fmt, __FILE__, __LINE__, ##__VA_ARGS__);
+
+//number of xoshiro256** generators per context that are advanced in lock-step. The
+//structure of arrays layout lets the compiler vectorize the update
+#define RNG_LANES 8
+//bytes produced by one step of all lanes
+#define RNG_BLOCK_LEN (RNG_LANES * sizeof(uint64_t))
+
+//seeded random generator for the alias test messages
+struct ra_rng {
+  //xoshiro256** state word i of each lane
+  uint64_t s[4][RNG_LANES];
+  uint64_t seed;
+  bool seeded;
+  //output of the last step, bytes before `block_pos` have been consumed
+  uint64_t block[RNG_LANES];
+  size_t block_pos;
+};
+
+struct readalias_ctx {
+  const struct pa_backend* backend;
+  //file descriptor of the backend, -1 while the context is closed
+  int fd;
+  //session config of `fd`. For the kernel module, this mirrors the kernel state such that we only
+  //issue SET_CONFIG if the config changes. Threads using the same config
+  //share the read lock, changing the config requires the write lock
+  struct session_config session;
+  pthread_rwlock_t session_lock;
+  //config and statistics of the ra_* functions
+  struct pamemcpy_cfg cfg;
+  //true for the context of the functions without ra_ prefix, which is shared by all threads
+  bool shared;
+  //random generator for the alias test messages. `rng_lock` is only used for the shared context
+  struct ra_rng rng;
+  pthread_mutex_t rng_lock;
+};
+
+struct pa_backend {
+  const char* name;
+  //Acquire the resources of the backend for `ctx` and set `ctx->fd`. Calling this again while
+  //`ctx` is open is a no-op
+  int (*open)(readalias_ctx_t* ctx);
+  void (*close)(readalias_ctx_t* ctx);
+  //Copy `count` bytes between `buf` and physical memory. Same semantics as memcpy_topa_ext/memcpy_frompa_ext
+  int (*memcpy_range)(readalias_ctx_t* ctx, bool to_pa, void* buf, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg);
+  //Same semantics as flush_ext. `cfg->flush_method` is never FM_NONE
+  int (*flush)(readalias_ctx_t* ctx, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg);
+  //Same semantics as wbinvd_ac
+  int (*wbinvd)(readalias_ctx_t* ctx);
+  //State of the page `pfn`. Returns 0 if the page is accessible, RET_RESERVED or RET_MAPFAIL otherwise
+  int (*page_state)(readalias_ctx_t* ctx, uint64_t pfn, bool access_reserved, bool* out_invalid, bool* out_reserved);
+};
+
+//physical memory via mmap of /dev/mem
+extern const struct pa_backend devmem_backend;
+//simulated DRAM, see backend_sim.c
+extern const struct pa_backend sim_backend;
+
+/**
+ * @brief Access a part of a single page. `buf` is NULL for flushes
+ * @returns 0 on success, RET_RESERVED or RET_MAPFAIL if the page is not accessible
+ * and -1 on other errors
+*/
+typedef int (*page_access_fn)(readalias_ctx_t* ctx, bool to_pa, uint8_t* buf, uint64_t pa, size_t len, const struct pamemcpy_cfg* cfg);
+
+/**
+ * @brief Split [pa, pa+count[ at page boundaries and call `fn` for each part. Applies
+ * `cfg->err_on_access_fail` and counts inaccessible pages in `cfg->out_stats`, like the
+ * range ioctls of the kernel module
+ * @param buf : buffer for the whole range or NULL for flushes
+ * @returns 0 on success
+*/
+int ra_walk_pages(readalias_ctx_t* ctx, page_access_fn fn, bool to_pa, uint8_t* buf, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg);
+
+/**
+ * @brief Start time of an operation for `metrics_record`. 0 if the metrics are disabled
+*/
+uint64_t metrics_start(void);
+
+/**
+ * @brief Record an operation that started at `start_ns`. No-op if `start_ns` is 0
+ * @param items : amount of work, see enum ra_metric_op
+*/
+void metrics_record(enum ra_metric_op op, uint64_t start_ns, uint64_t items, bool failed);
+
+/**
+ * @brief Count `n` syscalls of a backend. No-op if the metrics are disabled
+*/
+void metrics_count_syscalls(uint64_t n);
@@ -0,0 +1,131 @@
+/**
+ * Backend that accesses physical memory by mapping /dev/mem. Reading RAM requires a
+ * kernel without CONFIG_STRICT_DEVMEM or booting with iomem=relaxed. Every access maps
+ * the affected pages temporarily. Each context opens /dev/mem on its own, with O_SYNC,
+ * which requests uncached mappings, thus `cache_mode` and `access_mode` are ignored.
+ * Reserved pages cannot be told apart from other pages, they are either mappable or
+ * count as map failures.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+#define CACHE_LINE_SIZE 64
+
+static int devmem_open(readalias_ctx_t* ctx) {
+  if( ctx->fd == -1 ) {
+    ctx->fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if( ctx->fd < 0 ) {
+      err_log("failed to open /dev/mem : %s\n", strerror(errno));
+    }
+  }
+  return ctx->fd < 0 ? -1 : 0;
+}
+
+static void devmem_close(readalias_ctx_t* ctx) {
+  if( ctx->fd != -1 ) {
+    close(ctx->fd);
+    ctx->fd = -1;
+  }
+}
+
+/**
+ * @brief Write back and invalidate the cache lines of [va, va+len[
+*/
+static void flush_lines(uint8_t* va, size_t len) {
+#if defined(__x86_64__) || defined(__i386__)
+  uintptr_t end = (uintptr_t)va + len;
+  for(uintptr_t line = (uintptr_t)va & ~((uintptr_t)CACHE_LINE_SIZE - 1); line < end; line += CACHE_LINE_SIZE) {
+    __builtin_ia32_clflush((void*)line);
+  }
+  __builtin_ia32_mfence();
+#else
+  //there is no unprivileged flush instruction, rely on the uncached O_SYNC mapping
+  (void)va;
+  (void)len;
+#endif
+}
+
+static int devmem_page_access(readalias_ctx_t* ctx, bool to_pa, uint8_t* buf, uint64_t pa, size_t len, const struct pamemcpy_cfg* cfg) {
+  uint64_t page = pa & ~((uint64_t)PAGE_SIZE - 1);
+  uint8_t* mapping = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->fd, page);
+  //mmap and munmap
+  metrics_count_syscalls(mapping == MAP_FAILED ? 1 : 2);
+  if( mapping == MAP_FAILED ) {
+    return RET_MAPFAIL;
+  }
+  uint8_t* va = mapping + (pa - page);
+  bool flush = cfg->flush_method != FM_NONE;
+
+  if( !buf ) {
+    flush_lines(va, len);
+  } else if( to_pa ) {
+    memcpy(va, buf, len);
+    if( flush ) {
+      flush_lines(va, len);
+    }
+  } else {
+    if( flush ) {
+      flush_lines(va, len);
+    }
+    memcpy(buf, va, len);
+  }
+  munmap(mapping, PAGE_SIZE);
+  return 0;
+}
+
+static int devmem_memcpy_range(readalias_ctx_t* ctx, bool to_pa, void* buf, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  if( ctx->fd < 0 ) {
+    err_log("/dev/mem not opened\n");
+    return -1;
+  }
+  return ra_walk_pages(ctx, devmem_page_access, to_pa, buf, pa, count, cfg);
+}
+
+static int devmem_flush(readalias_ctx_t* ctx, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  if( ctx->fd < 0 ) {
+    err_log("/dev/mem not opened\n");
+    return -1;
+  }
+  //all flush methods are implemented with line flushes
+  return ra_walk_pages(ctx, devmem_page_access, false, NULL, pa, count, cfg);
+}
+
+static int devmem_wbinvd(readalias_ctx_t* ctx) {
+  (void)ctx;
+  err_log("wbinvd requires the kernel module backend\n");
+  errno = EOPNOTSUPP;
+  return -1;
+}
+
+static int devmem_page_state(readalias_ctx_t* ctx, uint64_t pfn, bool access_reserved, bool* out_invalid, bool* out_reserved) {
+  (void)access_reserved;
+  if( ctx->fd < 0 ) {
+    err_log("/dev/mem not opened\n");
+    return -1;
+  }
+  *out_invalid = false;
+  *out_reserved = false;
+  void* mapping = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, ctx->fd, pfn << PAGE_SHIFT);
+  metrics_count_syscalls(mapping == MAP_FAILED ? 1 : 2);
+  if( mapping == MAP_FAILED ) {
+    return RET_MAPFAIL;
+  }
+  munmap(mapping, PAGE_SIZE);
+  return 0;
+}
+
+const struct pa_backend devmem_backend = {
+  .name = "devmem",
+  .open = devmem_open,
+  .close = devmem_close,
+  .memcpy_range = devmem_memcpy_range,
+  .flush = devmem_flush,
+  .wbinvd = devmem_wbinvd,
+  .page_state = devmem_page_state,
+};
@@ -0,0 +1,348 @@
+/**
+ * Backend that simulates DRAM with a sparse file, to test the alias tools without
+ * the kernel module or SEV hardware. The simulated physical address space consists of
+ * - DRAM: [0, size[, backed by the file
+ * - alias ranges: [start, end[ is redirected to DRAM at pa ^ mask
+ * - reserved ranges: RET_RESERVED unless reserved pages may be accessed
+ * - holes: RET_MAPFAIL, e.g. to model MMIO ranges
+ * Addresses outside of DRAM that are not redirected are invalid. With scrambling,
+ * each byte is stored xor'ed with a keystream that depends on the physical address
+ * used for the access, like a memory controller that scrambles with the pa. Reads
+ * through an alias thus differ from the data written, but the XOR-differential alias
+ * test still works. There is no cache, flushes only check the accessibility.
+ * All contexts share the simulated DRAM, it is released when the last context is closed.
+ *
+ * The layout is read from the file in the READALIAS_SIM_CONFIG environment variable,
+ * one directive per line, numbers in C notation:
+ *   size <bytes>
+ *   file <path>                  (default: anonymous temporary file)
+ *   alias <start> <end> <mask>
+ *   reserved <start> <end>
+ *   hole <start> <end>
+ *   scramble <seed>
+ * Lines starting with '#' are ignored. All addresses and masks must be page aligned.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "backend.h"
+
+//maximal number of ranges per directive type
+#define SIM_MAX_RANGES 64
+//DRAM size if no config is given
+#define SIM_DEFAULT_SIZE (256ULL << 20)
+
+struct sim_range {
+  uint64_t start;
+  uint64_t end;
+  uint64_t mask;
+};
+
+struct sim_ranges {
+  struct sim_range r[SIM_MAX_RANGES];
+  size_t len;
+};
+
+static struct {
+  //number of open contexts, protected by `sim_lock`
+  size_t users;
+  int fd;
+  uint8_t* dram;
+  uint64_t size;
+  struct sim_ranges aliases;
+  struct sim_ranges reserved;
+  struct sim_ranges holes;
+  bool scramble;
+  uint64_t seed;
+} sim = {.fd = -1};
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct sim_range* find_range(const struct sim_ranges* ranges, uint64_t pa) {
+  for(size_t i = 0; i < ranges->len; i++) {
+    if( pa >= ranges->r[i].start && pa < ranges->r[i].end ) {
+      return ranges->r + i;
+    }
+  }
+  return NULL;
+}
+
+static int add_range(struct sim_ranges* ranges, const char* directive, uint64_t start, uint64_t end, uint64_t mask) {
+  if( ranges->len == SIM_MAX_RANGES ) {
+    err_log("more than %d %s directives\n", SIM_MAX_RANGES, directive);
+    return -1;
+  }
+  if( start >= end || (start | end | mask) % PAGE_SIZE ) {
+    err_log("invalid %s range [0x%jx,0x%jx[ : must be non empty and page aligned\n", directive, start, end);
+    return -1;
+  }
+  ranges->r[ranges->len] = (struct sim_range){.start = start, .end = end, .mask = mask};
+  ranges->len += 1;
+  return 0;
+}
+
+/**
+ * @brief Parse the config file at `path` into `sim`
+ * @param out_file : Output param, receives the value of the file directive.
+ * Must hold PATH_MAX bytes
+ * @returns 0 on success
+*/
+static int parse_config(const char* path, char* out_file) {
+  FILE* f = fopen(path, "r");
+  if( !f ) {
+    err_log("failed to open sim config %s : %s\n", path, strerror(errno));
+    return -1;
+  }
+  int ret = 0;
+  char line[PATH_MAX + 64];
+  size_t lineno = 0;
+  while( fgets(line, sizeof(line), f) ) {
+    lineno += 1;
+    char* key = strtok(line, " \t\n");
+    if( !key || key[0] == '#' ) {
+      continue;
+    }
+    if( !strcmp(key, "file") ) {
+      char* file = strtok(NULL, " \t\n");
+      if( !file || strlen(file) >= PATH_MAX ) {
+        goto invalid;
+      }
+      strcpy(out_file, file);
+      continue;
+    }
+
+    uint64_t v[3];
+    size_t n = 0;
+    char* tok;
+    while( (tok = strtok(NULL, " \t\n")) ) {
+      char* end;
+      if( n == 3 ) {
+        goto invalid;
+      }
+      errno = 0;
+      v[n] = strtoull(tok, &end, 0);
+      if( errno || *end ) {
+        goto invalid;
+      }
+      n += 1;
+    }
+
+    if( !strcmp(key, "size") && n == 1 && v[0] && v[0] % PAGE_SIZE == 0 ) {
+      sim.size = v[0];
+    } else if( !strcmp(key, "alias") && n == 3 ) {
+      ret = add_range(&sim.aliases, key, v[0], v[1], v[2]);
+    } else if( !strcmp(key, "reserved") && n == 2 ) {
+      ret = add_range(&sim.reserved, key, v[0], v[1], 0);
+    } else if( !strcmp(key, "hole") && n == 2 ) {
+      ret = add_range(&sim.holes, key, v[0], v[1], 0);
+    } else if( !strcmp(key, "scramble") && n == 1 ) {
+      sim.scramble = true;
+      sim.seed = v[0];
+    } else {
+      goto invalid;
+    }
+    if( ret ) {
+      err_log("%s:%zu : invalid range\n", path, lineno);
+      goto cleanup;
+    }
+  }
+  goto cleanup;
+
+invalid:
+  err_log("%s:%zu : invalid directive\n", path, lineno);
+  ret = -1;
+cleanup:
+  fclose(f);
+  return ret;
+}
+
+/**
+ * @brief Parse the config and map the simulated DRAM. Caller must hold `sim_lock`
+ * @returns 0 on success
+*/
+static int sim_setup(void) {
+  char file[PATH_MAX] = {0};
+  const char* config = getenv("READALIAS_SIM_CONFIG");
+  sim.size = SIM_DEFAULT_SIZE;
+  sim.aliases.len = 0;
+  sim.reserved.len = 0;
+  sim.holes.len = 0;
+  sim.scramble = false;
+  if( config && parse_config(config, file) ) {
+    return -1;
+  }
+
+  if( file[0] ) {
+    sim.fd = open(file, O_RDWR | O_CREAT, 0600);
+  } else {
+    char tmp[] = "/tmp/readalias_simXXXXXX";
+    sim.fd = mkstemp(tmp);
+    if( sim.fd >= 0 ) {
+      unlink(tmp);
+    }
+  }
+  if( sim.fd < 0 ) {
+    err_log("failed to open sim backing file : %s\n", strerror(errno));
+    return -1;
+  }
+  //only pages that are written consume disk space
+  if( ftruncate(sim.fd, sim.size) ) {
+    err_log("failed to resize sim backing file to 0x%jx bytes : %s\n", sim.size, strerror(errno));
+    goto error;
+  }
+  sim.dram = mmap(NULL, sim.size, PROT_READ | PROT_WRITE, MAP_SHARED, sim.fd, 0);
+  if( sim.dram == MAP_FAILED ) {
+    err_log("failed to map sim backing file : %s\n", strerror(errno));
+    sim.dram = NULL;
+    goto error;
+  }
+  return 0;
+
+error:
+  close(sim.fd);
+  sim.fd = -1;
+  return -1;
+}
+
+static int sim_open(readalias_ctx_t* ctx) {
+  if( ctx->fd != -1 ) {
+    return 0;
+  }
+  int ret = 0;
+  pthread_mutex_lock(&sim_lock);
+  if( sim.users == 0 ) {
+    ret = sim_setup();
+  }
+  if( !ret ) {
+    sim.users += 1;
+    ctx->fd = sim.fd;
+  }
+  pthread_mutex_unlock(&sim_lock);
+  return ret;
+}
+
+static void sim_close(readalias_ctx_t* ctx) {
+  if( ctx->fd == -1 ) {
+    return;
+  }
+  ctx->fd = -1;
+  pthread_mutex_lock(&sim_lock);
+  sim.users -= 1;
+  if( sim.users == 0 ) {
+    munmap(sim.dram, sim.size);
+    close(sim.fd);
+    sim.dram = NULL;
+    sim.fd = -1;
+  }
+  pthread_mutex_unlock(&sim_lock);
+}
+
+/**
+ * @brief Resolve the page of `pa`
+ * @param out_dram : Output param, DRAM offset that `pa` refers to. Only valid if the page is accessible
+ * @returns 0 if the page is accessible, RET_RESERVED or RET_MAPFAIL otherwise
+*/
+static int sim_resolve(uint64_t pa, bool access_reserved, bool* out_invalid, bool* out_reserved, uint64_t* out_dram) {
+  const struct sim_range* alias = find_range(&sim.aliases, pa);
+  uint64_t dram = alias ? pa ^ alias->mask : pa;
+
+  *out_invalid = dram >= sim.size;
+  *out_reserved = find_range(&sim.reserved, pa) != NULL;
+  *out_dram = dram;
+  if( *out_invalid || find_range(&sim.holes, pa) ) {
+    return RET_MAPFAIL;
+  }
+  if( *out_reserved && !access_reserved ) {
+    return RET_RESERVED;
+  }
+  return 0;
+}
+
+static uint64_t splitmix64(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+/**
+ * @brief Xor [buf, buf+len[, which is accessed at `pa`, with the scrambling keystream
+*/
+static void scramble(uint8_t* buf, uint64_t pa, size_t len) {
+  uint64_t ks = 0;
+  for(size_t i = 0; i < len; i++) {
+    uint64_t byte_pa = pa + i;
+    if( i == 0 || byte_pa % sizeof(ks) == 0 ) {
+      ks = splitmix64(sim.seed ^ (byte_pa & ~(uint64_t)(sizeof(ks) - 1)));
+    }
+    buf[i] ^= (uint8_t)(ks >> (8 * (byte_pa % sizeof(ks))));
+  }
+}
+
+static int sim_page_access(readalias_ctx_t* ctx, bool to_pa, uint8_t* buf, uint64_t pa, size_t len, const struct pamemcpy_cfg* cfg) {
+  (void)ctx;
+  bool invalid, reserved;
+  uint64_t dram;
+  int status = sim_resolve(pa, cfg->access_reserved, &invalid, &reserved, &dram);
+  if( status || !buf ) {
+    return status;
+  }
+
+  if( to_pa ) {
+    memcpy(sim.dram + dram, buf, len);
+    if( sim.scramble ) {
+      scramble(sim.dram + dram, pa, len);
+    }
+  } else {
+    memcpy(buf, sim.dram + dram, len);
+    if( sim.scramble ) {
+      scramble(buf, pa, len);
+    }
+  }
+  return 0;
+}
+
+static int sim_memcpy_range(readalias_ctx_t* ctx, bool to_pa, void* buf, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  if( ctx->fd < 0 ) {
+    err_log("sim backend not opened\n");
+    return -1;
+  }
+  return ra_walk_pages(ctx, sim_page_access, to_pa, buf, pa, count, cfg);
+}
+
+static int sim_flush(readalias_ctx_t* ctx, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  if( ctx->fd < 0 ) {
+    err_log("sim backend not opened\n");
+    return -1;
+  }
+  return ra_walk_pages(ctx, sim_page_access, false, NULL, pa, count, cfg);
+}
+
+static int sim_wbinvd(readalias_ctx_t* ctx) {
+  (void)ctx;
+  return 0;
+}
+
+static int sim_page_state(readalias_ctx_t* ctx, uint64_t pfn, bool access_reserved, bool* out_invalid, bool* out_reserved) {
+  uint64_t dram;
+  if( ctx->fd < 0 ) {
+    err_log("sim backend not opened\n");
+    return -1;
+  }
+  return sim_resolve(pfn << PAGE_SHIFT, access_reserved, out_invalid, out_reserved, &dram);
+}
+
+const struct pa_backend sim_backend = {
+  .name = "sim",
+  .open = sim_open,
+  .close = sim_close,
+  .memcpy_range = sim_memcpy_range,
+  .flush = sim_flush,
+  .wbinvd = sim_wbinvd,
+  .page_state = sim_page_state,
+};
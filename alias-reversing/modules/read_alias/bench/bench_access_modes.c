@@ -0,0 +1,194 @@
+/**
+ * Benchmark for the access modes of the readalias kernel module.
+ * Runs the check_alias protocol (write m1 to the source, read the candidate,
+ * write m2, read the candidate) with flush-then-copy (FM_CLFLUSH) and with the
+ * cache bypassing modes that do not require flushing: uncached and
+ * write-combining mappings as well as non-temporal accesses.
+ * For each mode, the time per check and the fraction of checks that detected
+ * the alias is reported. If the candidate is an alias of the source, every mode
+ * that reliably accesses DRAM should report an alias rate of 1.
+ * The benchmark overwrites the first 64 bytes of the source pa.
+*/
+
+#include <argp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "helpers.h"
+#include "readalias.h"
+#include "readalias_ioctls.h"
+
+#define MSG_LEN 64
+
+//cli arguments
+struct arguments {
+	uint64_t source_pa;
+	uint64_t candidate_pa;
+	uint64_t iterations;
+	bool access_reserved;
+};
+
+typedef struct {
+	const char* name;
+	enum flush_method flush_method;
+	enum cache_mode cache_mode;
+	enum access_mode access_mode;
+} access_mode_t;
+
+static const access_mode_t modes[] = {
+	{"clflush", FM_CLFLUSH, CM_DEFAULT, AM_DEFAULT},
+	{"uncached", FM_NONE, CM_UC, AM_DEFAULT},
+	{"write-combining", FM_NONE, CM_WC, AM_DEFAULT},
+	{"nontemporal", FM_NONE, CM_DEFAULT, AM_NONTEMPORAL},
+};
+
+static double now_sec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Run `args->iterations` alias checks with `mode`
+ * @param out_ns_per_check : Output param, average duration of one check
+ * @param out_alias_rate : Output param, fraction of checks that detected the alias
+ * @returns 0 on success
+*/
+static int bench_mode(struct arguments* args, const access_mode_t* mode, double* out_ns_per_check, double* out_alias_rate) {
+	struct pamemcpy_cfg cfg = {
+		.access_reserved = args->access_reserved,
+		.err_on_access_fail = true,
+		.flush_method = mode->flush_method,
+		.cache_mode = mode->cache_mode,
+		.access_mode = mode->access_mode,
+		.out_stats = {0},
+	};
+	uint8_t m1[MSG_LEN], m2[MSG_LEN], buf1[MSG_LEN], buf2[MSG_LEN];
+	uint64_t aliases = 0;
+
+	if( get_rand_bytes(m1, MSG_LEN) || get_rand_bytes(m2, MSG_LEN) ) {
+		err_log("failed to get random bytes\n");
+		return -1;
+	}
+	double t_start = now_sec();
+	for(uint64_t i = 0; i < args->iterations; i++) {
+		if( memcpy_topa_ext(args->source_pa, m1, MSG_LEN, &cfg) ||
+			memcpy_frompa_ext(buf1, args->candidate_pa, MSG_LEN, &cfg) ||
+			memcpy_topa_ext(args->source_pa, m2, MSG_LEN, &cfg) ||
+			memcpy_frompa_ext(buf2, args->candidate_pa, MSG_LEN, &cfg) ) {
+			err_log("access failed in iteration %ju\n", i);
+			return -1;
+		}
+		bool is_alias = true;
+		for(size_t j = 0; j < MSG_LEN; j++) {
+			if( (buf1[j] ^ buf2[j]) != (m1[j] ^ m2[j]) ) {
+				is_alias = false;
+				break;
+			}
+		}
+		aliases += is_alias;
+	}
+	double elapsed = now_sec() - t_start;
+
+	*out_ns_per_check = elapsed * 1e9 / (double)args->iterations;
+	*out_alias_rate = (double)aliases / (double)args->iterations;
+	return 0;
+}
+
+static int run(struct arguments args) {
+	int ret = 0;
+	if( open_kmod() ) {
+		err_log("failed to open kernel module\n");
+		return -1;
+	}
+
+	printf("mode,iterations,ns_per_check,checks_per_sec,alias_rate\n");
+	for(size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+		double ns_per_check, alias_rate;
+		if( bench_mode(&args, &modes[i], &ns_per_check, &alias_rate) ) {
+			err_log("benchmark for mode %s failed\n", modes[i].name);
+			ret = -1;
+			continue;
+		}
+		printf("%s,%ju,%.1f,%.0f,%.3f\n", modes[i].name, args.iterations, ns_per_check,
+			1e9 / ns_per_check, alias_rate);
+	}
+
+	close_kmod();
+	return ret;
+}
+
+const char* argp_program_version = "bench_access_modes";
+const char* argp_program_bug_address = "l.wilke@uni-luebeck.de";
+static char doc[] = "Compares flush-then-copy with uncached, write-combining and non-temporal accesses "
+	"for the check_alias protocol. Overwrites 64 bytes at the source pa";
+static char args_doc[] = "--source --candidate [--iterations] [--access-reserved]";
+static struct argp_option options[] = {
+	{"source", 1, "PA", 0, "Physical address that is written (64 byte aligned)", 0},
+	{"candidate", 2, "PA", 0, "Physical address that is read, i.e. the alias candidate (64 byte aligned)", 0},
+	{"iterations", 3, "N", 0, "Number of alias checks per mode. Default 10000", 0},
+	{"access-reserved", 4, 0, 0, "Allow accessing reserved memory ranges. Might lead to crashes\n", 0},
+	{0},
+};
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state) {
+	struct arguments* args = state->input;
+	switch(key) {
+		case 1:
+			if( do_stroul(arg, 0, &args->source_pa) ) {
+				argp_usage(state);
+			}
+			break;
+		case 2:
+			if( do_stroul(arg, 0, &args->candidate_pa) ) {
+				argp_usage(state);
+			}
+			break;
+		case 3:
+			if( do_stroul(arg, 0, &args->iterations) || args->iterations == 0 ) {
+				argp_usage(state);
+			}
+			break;
+		case 4:
+			args->access_reserved = true;
+			break;
+		case ARGP_KEY_END:
+			if( !args->source_pa || !args->candidate_pa || (args->source_pa % MSG_LEN) || (args->candidate_pa % MSG_LEN) ) {
+				printf("Missing or unaligned source/candidate pa\n");
+				argp_usage(state);
+				return ARGP_ERR_UNKNOWN;
+			}
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = {
+	options,
+	parse_opt,
+	args_doc,
+	doc,
+	0,
+	0,
+	0,
+};
+
+int main(int argc, char** argv) {
+	struct arguments args = {
+		.source_pa = 0,
+		.candidate_pa = 0,
+		.iterations = 10000,
+		.access_reserved = false,
+	};
+	if(argp_parse(&argp, argc, argv, 0, 0, &args)) {
+		printf("Failed to parse arguments\n");
+		return -1;
+	}
+	return run(args);
+}
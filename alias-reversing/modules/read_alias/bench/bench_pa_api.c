@@ -0,0 +1,397 @@
+/**
+ * Microbenchmark for the physical memory access API of libkmodreadalias.
+ * Sweeps memcpy_frompa, memcpy_topa, flush and check_alias over transfer sizes, offsets into the page,
+ * flush methods, cache modes (i.e. the mapping type of the kernel module), access_reserved and sequential
+ * vs random physical addresses inside the test region. For each configuration, the throughput, the
+ * p50/p99 latency of a single call and the syscalls per byte are printed as CSV.
+ * Works with all backends, e.g. run it with READALIAS_BACKEND=sim to compare changes of the lib without
+ * the kernel module. topa and check_alias overwrite the test region, use --read-only for memory in use
+*/
+
+#include <argp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "helpers.h"
+#include "readalias.h"
+#include "readalias_ioctls.h"
+
+#define MAX_OFFSETS 16
+//message length of the check_alias protocol
+#define CHECK_ALIAS_LEN 64
+
+enum bench_op {
+	OP_FROMPA,
+	OP_TOPA,
+	OP_FLUSH,
+	OP_CHECK_ALIAS,
+	OP_COUNT,
+};
+
+static const char* const op_names[OP_COUNT] = {"frompa", "topa", "flush", "check_alias"};
+
+//cli arguments
+struct arguments {
+	uint64_t pa;
+	uint64_t len;
+	uint64_t min_size;
+	uint64_t max_size;
+	uint64_t offsets[MAX_OFFSETS];
+	size_t offsets_len;
+	uint64_t min_time_ms;
+	uint64_t max_iterations;
+	bool access_reserved;
+	bool read_only;
+	const char* backend;
+};
+
+//flush method and cache mode of one configuration
+typedef struct {
+	const char* flush_name;
+	enum flush_method flush_method;
+	const char* cache_name;
+	enum cache_mode cache_mode;
+} access_t;
+
+//the cache modes bypass the cache, i.e. they are only combined with FM_NONE
+static const access_t accesses[] = {
+	{"none", FM_NONE, "default", CM_DEFAULT},
+	{"clflush", FM_CLFLUSH, "default", CM_DEFAULT},
+	{"wbinvd", FM_WBINVD, "default", CM_DEFAULT},
+	{"auto", FM_AUTO, "default", CM_DEFAULT},
+	{"none", FM_NONE, "wb", CM_WB},
+	{"none", FM_NONE, "uc", CM_UC},
+	{"none", FM_NONE, "wc", CM_WC},
+};
+
+typedef struct {
+	uint64_t iterations;
+	uint64_t errors;
+	uint64_t bytes;
+	double elapsed_ns;
+	uint64_t p50_ns;
+	uint64_t p99_ns;
+	uint64_t syscalls;
+} result_t;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t xorshift64(uint64_t* state) {
+	uint64_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+	return x;
+}
+
+static int cmp_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Run `op` with the config of `ctx` until `args->min_time_ms` passed or `args->max_iterations` calls
+ * have been made. Iteration i accesses the i-th page of the region (sequential) or a random page, plus `offset`
+ * @param lat : buffer for `args->max_iterations` latencies
+ * @returns 0 on success. Failing calls are counted in `out->errors`
+*/
+static int bench_config(readalias_ctx_t* ctx, const struct arguments* args, enum bench_op op, uint64_t size, uint64_t offset,
+	bool random, uint8_t* buf, uint64_t* lat, result_t* out) {
+	//pages at which an access of `size` bytes at `offset` starts, without leaving the region
+	uint64_t stride = (offset + size + 4095) & ~4095ULL;
+	uint64_t slots = (args->len - stride) / 4096 + 1;
+	uint64_t rng = 0x9e3779b97f4a7c15ULL ^ size ^ (offset << 32);
+	struct ra_metrics* before = malloc(sizeof(*before));
+	struct ra_metrics* after = malloc(sizeof(*after));
+	if( !before || !after ) {
+		err_log("failed to alloc metrics\n");
+		free(before);
+		free(after);
+		return -1;
+	}
+
+	memset(out, 0, sizeof(*out));
+	ra_metrics_snapshot(before);
+	uint64_t deadline = now_ns() + args->min_time_ms * 1000000ULL;
+	uint64_t pos = 0;
+	for(uint64_t i = 0; i < args->max_iterations && (i < 3 || now_ns() < deadline); i++) {
+		uint64_t page;
+		if( random ) {
+			page = xorshift64(&rng) % slots;
+		} else {
+			page = pos;
+			pos = (pos + stride / 4096) % slots;
+		}
+		uint64_t pa = args->pa + page * 4096 + offset;
+		int ret = 0;
+		uint64_t t = now_ns();
+		switch(op) {
+			case OP_FROMPA:
+				ret = ra_memcpy_frompa(ctx, buf, pa, size);
+				break;
+			case OP_TOPA:
+				ret = ra_memcpy_topa(ctx, pa, buf, size);
+				break;
+			case OP_FLUSH:
+				ret = ra_flush(ctx, pa, size);
+				break;
+			case OP_CHECK_ALIAS: {
+				//the candidate is the page half a region away, i.e. usually no alias
+				uint64_t candidate = args->pa + ((page + slots / 2) % slots) * 4096 + offset;
+				ret = ra_check_alias(ctx, pa, candidate, false);
+				ret = ret == CHECK_ALIAS_ERR_NO_ALIAS ? 0 : ret;
+				break;
+			}
+			default:
+				break;
+		}
+		lat[i] = now_ns() - t;
+		out->elapsed_ns += lat[i];
+		out->iterations += 1;
+		out->errors += ret != 0;
+		//check_alias writes and reads two messages
+		out->bytes += op == OP_CHECK_ALIAS ? 4 * CHECK_ALIAS_LEN : size;
+	}
+	ra_metrics_snapshot(after);
+	out->syscalls = after->syscalls - before->syscalls;
+	free(before);
+	free(after);
+
+	qsort(lat, out->iterations, sizeof(uint64_t), cmp_u64);
+	out->p50_ns = lat[(out->iterations - 1) / 2];
+	out->p99_ns = lat[(out->iterations - 1) * 99 / 100];
+	return 0;
+}
+
+static int run(struct arguments args) {
+	int ret = 0;
+	if( args.backend && select_backend(args.backend) ) {
+		err_log("unknown backend %s\n", args.backend);
+		return -1;
+	}
+	const char* backend_name = args.backend ? args.backend : getenv("READALIAS_BACKEND");
+	if( !backend_name ) {
+		backend_name = "kmod";
+	}
+	readalias_ctx_t* ctx = ra_open();
+	if( !ctx ) {
+		err_log("failed to open backend %s\n", backend_name);
+		return -1;
+	}
+	ra_metrics_enable(true);
+
+	uint8_t* buf = aligned_alloc(4096, args.max_size + 4096);
+	uint64_t* lat = malloc(sizeof(uint64_t) * args.max_iterations);
+	if( !buf || !lat ) {
+		err_log("failed to alloc buffers\n");
+		ret = -1;
+		goto cleanup;
+	}
+	memset(buf, 0xa5, args.max_size + 4096);
+
+	//read the region once, such that the first configuration does not pay for faulting in the pages,
+	//e.g. of the sparse file of the sim backend
+	for(uint64_t off = 0; off < args.len; off += args.max_size) {
+		uint64_t chunk = args.len - off < args.max_size ? args.len - off : args.max_size;
+		if( ra_memcpy_frompa(ctx, buf, args.pa + off, chunk) ) {
+			err_log("warm up read at 0x%jx failed\n", args.pa + off);
+		}
+	}
+
+	printf("backend,op,size,offset,flush,cache_mode,access_reserved,pattern,iterations,errors,mib_per_s,calls_per_s,"
+		"p50_ns,p99_ns,syscalls_per_byte\n");
+	for(int reserved = 0; reserved <= (int)args.access_reserved; reserved++) {
+		for(size_t op = 0; op < OP_COUNT; op++) {
+			if( args.read_only && (op == OP_TOPA || op == OP_CHECK_ALIAS) ) {
+				continue;
+			}
+			for(size_t a = 0; a < sizeof(accesses) / sizeof(accesses[0]); a++) {
+				const access_t* acc = accesses + a;
+				//flushes and the alias test do not take a cache mode
+				if( (op == OP_FLUSH || op == OP_CHECK_ALIAS) && acc->cache_mode != CM_DEFAULT ) {
+					continue;
+				}
+				//flushing without a flush method is a no-op
+				if( op == OP_FLUSH && acc->flush_method == FM_NONE ) {
+					continue;
+				}
+				struct pamemcpy_cfg cfg = {
+					.out_stats = {0},
+					.access_reserved = reserved,
+					.err_on_access_fail = false,
+					.flush_method = acc->flush_method,
+					.cache_mode = acc->cache_mode,
+					.access_mode = AM_DEFAULT,
+				};
+				ra_set_config(ctx, &cfg);
+				for(uint64_t size = args.min_size; size <= args.max_size; size *= 4) {
+					for(size_t o = 0; o < args.offsets_len; o++) {
+						uint64_t offset = args.offsets[o];
+						//the alias test uses a fixed message that must not cross a page
+						uint64_t access_size = op == OP_CHECK_ALIAS ? CHECK_ALIAS_LEN : size;
+						if( (op == OP_CHECK_ALIAS && (offset + CHECK_ALIAS_LEN > 4096 || size != args.min_size)) ||
+							offset + access_size + 4096 > args.len ) {
+							continue;
+						}
+						for(int random = 0; random <= 1; random++) {
+							result_t r;
+							if( bench_config(ctx, &args, op, access_size, offset, random, buf, lat, &r) ) {
+								ret = -1;
+								goto cleanup;
+							}
+							printf("%s,%s,%ju,%ju,%s,%s,%d,%s,%ju,%ju,%.2f,%.0f,%ju,%ju,%.6f\n", backend_name, op_names[op],
+								access_size, offset, acc->flush_name, acc->cache_name, reserved, random ? "random" : "sequential",
+								r.iterations, r.errors, (double)r.bytes / (1 << 20) / (r.elapsed_ns / 1e9),
+								r.iterations / (r.elapsed_ns / 1e9), r.p50_ns, r.p99_ns, (double)r.syscalls / r.bytes);
+							fflush(stdout);
+						}
+					}
+				}
+			}
+		}
+	}
+
+cleanup:
+	free(buf);
+	free(lat);
+	ra_close(ctx);
+	return ret;
+}
+
+/**
+ * @brief Parse a comma separated list of page offsets
+ * @returns 0 on success
+*/
+static int parse_offsets(char* arg, struct arguments* args) {
+	args->offsets_len = 0;
+	for(char* tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+		if( args->offsets_len == MAX_OFFSETS || do_stroul(tok, 0, &args->offsets[args->offsets_len]) ||
+			args->offsets[args->offsets_len] >= 4096 ) {
+			return -1;
+		}
+		args->offsets_len += 1;
+	}
+	return args->offsets_len ? 0 : -1;
+}
+
+const char* argp_program_version = "bench_pa_api";
+const char* argp_program_bug_address = "l.wilke@uni-luebeck.de";
+static char doc[] = "Measures throughput, latency and syscalls per byte of memcpy_frompa, memcpy_topa, flush_ext and "
+	"check_alias for different sizes, offsets, flush methods, cache modes and access patterns. Prints CSV. "
+	"Overwrites the test region unless --read-only is given";
+static char args_doc[] = "--pa [--len] [--min-size] [--max-size] [--offsets] [--min-time] [--max-iterations] "
+	"[--access-reserved] [--read-only] [--backend]";
+static struct argp_option options[] = {
+	{"pa", 1, "PA", 0, "Start of the test region (page aligned)", 0},
+	{"len", 2, "N", 0, "Length of the test region. Default 128 MiB. Must exceed the max size by a page", 0},
+	{"min-size", 3, "N", 0, "Smallest transfer size, multiplied by 4 up to the max size. Default 64", 0},
+	{"max-size", 4, "N", 0, "Largest transfer size. Default 64 MiB", 0},
+	{"offsets", 5, "LIST", 0, "Comma separated offsets into the first page of each access. Default 0,8,4064", 0},
+	{"min-time", 6, "MS", 0, "Minimal run time per configuration. Default 100", 0},
+	{"max-iterations", 7, "N", 0, "Maximal number of calls per configuration. Default 10000", 0},
+	{"access-reserved", 8, 0, 0, "Also run all configurations with access_reserved. Might lead to crashes", 0},
+	{"read-only", 9, 0, 0, "Skip memcpy_topa and check_alias, which overwrite the test region", 0},
+	{"backend", 10, "NAME", 0, "kmod, devmem or sim. Default: READALIAS_BACKEND or kmod", 0},
+	{0},
+};
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state) {
+	struct arguments* args = state->input;
+	switch(key) {
+		case 1:
+			if( do_stroul(arg, 0, &args->pa) ) {
+				argp_usage(state);
+			}
+			break;
+		case 2:
+			if( do_stroul(arg, 0, &args->len) ) {
+				argp_usage(state);
+			}
+			break;
+		case 3:
+			if( do_stroul(arg, 0, &args->min_size) || args->min_size == 0 ) {
+				argp_usage(state);
+			}
+			break;
+		case 4:
+			if( do_stroul(arg, 0, &args->max_size) || args->max_size == 0 ) {
+				argp_usage(state);
+			}
+			break;
+		case 5:
+			if( parse_offsets(arg, args) ) {
+				printf("Invalid offsets, expected at most %d comma separated values below 4096\n", MAX_OFFSETS);
+				argp_usage(state);
+			}
+			break;
+		case 6:
+			if( do_stroul(arg, 0, &args->min_time_ms) ) {
+				argp_usage(state);
+			}
+			break;
+		case 7:
+			if( do_stroul(arg, 0, &args->max_iterations) || args->max_iterations == 0 ) {
+				argp_usage(state);
+			}
+			break;
+		case 8:
+			args->access_reserved = true;
+			break;
+		case 9:
+			args->read_only = true;
+			break;
+		case 10:
+			args->backend = arg;
+			break;
+		case ARGP_KEY_END:
+			if( !args->pa || (args->pa % 4096) || args->min_size > args->max_size || args->len < args->max_size + 4096 ) {
+				printf("Missing or unaligned pa, or the region is too small for the max size\n");
+				argp_usage(state);
+				return ARGP_ERR_UNKNOWN;
+			}
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = {
+	options,
+	parse_opt,
+	args_doc,
+	doc,
+	0,
+	0,
+	0,
+};
+
+int main(int argc, char** argv) {
+	struct arguments args = {
+		.pa = 0,
+		.len = 128ULL << 20,
+		.min_size = 64,
+		.max_size = 64ULL << 20,
+		.offsets = {0, 8, 4064},
+		.offsets_len = 3,
+		.min_time_ms = 100,
+		.max_iterations = 10000,
+		.access_reserved = false,
+		.read_only = false,
+		.backend = NULL,
+	};
+	if(argp_parse(&argp, argc, argv, 0, 0, &args)) {
+		printf("Failed to parse arguments\n");
+		return -1;
+	}
+	return run(args);
+}
@@ -0,0 +1,292 @@
+/**
+ * Multi-threaded stress benchmark for the readalias kernel module.
+ * Spawns N worker threads that concurrently read from a physical memory range
+ * via the module and reports the achieved throughput for each thread count.
+ * With a reentrant module, the throughput should scale (almost) linearly with
+ * the number of threads, as long as there are enough cores.
+ * The benchmark only reads physical memory, i.e. it does not modify system state.
+*/
+
+#include <argp.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "helpers.h"
+#include "readalias.h"
+#include "readalias_ioctls.h"
+
+//cli arguments
+struct arguments {
+	uint64_t start_pa;
+	uint64_t end_pa;
+	size_t chunk_size;
+	uint64_t max_threads;
+	double duration_sec;
+	bool access_reserved;
+	enum flush_method flush_method;
+};
+
+typedef struct {
+	struct arguments* args;
+	//first pa of the slice of this worker
+	uint64_t slice_start;
+	//first pa after the slice of this worker
+	uint64_t slice_end;
+	//set by the main thread to stop all workers
+	atomic_bool* stop;
+	//output params
+	uint64_t ops;
+	uint64_t bytes;
+	size_t access_errors;
+	int err;
+} worker_t;
+
+static double now_sec(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void* worker_main(void* arg) {
+	worker_t* w = arg;
+	struct pamemcpy_cfg cfg = {
+		.access_reserved = w->args->access_reserved,
+		.err_on_access_fail = false,
+		.flush_method = w->args->flush_method,
+		.out_stats = {0},
+	};
+	uint8_t* buf = malloc(w->args->chunk_size);
+	if( buf == NULL ) {
+		err_log("failed to alloc buffer\n");
+		w->err = -1;
+		return NULL;
+	}
+
+	uint64_t pa = w->slice_start;
+	while( !atomic_load_explicit(w->stop, memory_order_relaxed) ) {
+		size_t count = w->args->chunk_size;
+		if( pa + count > w->slice_end ) {
+			count = w->slice_end - pa;
+		}
+		if( memcpy_frompa_ext(buf, pa, count, &cfg) ) {
+			err_log("memcpy_frompa_ext failed for pa 0x%jx\n", pa);
+			w->err = -1;
+			break;
+		}
+		w->ops += 1;
+		w->bytes += count;
+		pa += count;
+		if( pa >= w->slice_end ) {
+			pa = w->slice_start;
+		}
+	}
+	w->access_errors = cfg.out_stats.map_failed + cfg.out_stats.reserved_pages;
+	free(buf);
+	return NULL;
+}
+
+/**
+ * @brief Run the benchmark with `threads` workers for the configured duration.
+ * Each worker reads its own slice of the pa range.
+ * @param out_ops_per_sec : Output param, number of read operations per second over all workers
+ * @param out_mib_per_sec : Output param, read throughput over all workers
+ * @returns 0 on success
+*/
+static int run_with_threads(struct arguments* args, uint64_t threads, double* out_ops_per_sec, double* out_mib_per_sec) {
+	int ret = 0;
+	atomic_bool stop = false;
+	worker_t* workers = calloc(threads, sizeof(worker_t));
+	pthread_t* tids = calloc(threads, sizeof(pthread_t));
+	uint64_t started = 0;
+	if( workers == NULL || tids == NULL ) {
+		err_log("failed to alloc worker state\n");
+		ret = -1;
+		goto cleanup;
+	}
+
+	//split range into page aligned slices
+	uint64_t slice_len = ((args->end_pa - args->start_pa) / threads) & ~((uint64_t)PAGE_SIZE - 1);
+	if( slice_len < args->chunk_size ) {
+		err_log("pa range too small for %ju threads with chunk size %zu\n", threads, args->chunk_size);
+		ret = -1;
+		goto cleanup;
+	}
+	for(uint64_t i = 0; i < threads; i++) {
+		workers[i].args = args;
+		workers[i].slice_start = args->start_pa + i * slice_len;
+		workers[i].slice_end = workers[i].slice_start + slice_len;
+		workers[i].stop = &stop;
+	}
+
+	double t_start = now_sec();
+	for(; started < threads; started++) {
+		if( pthread_create(&tids[started], NULL, worker_main, &workers[started]) ) {
+			err_log("pthread_create failed\n");
+			atomic_store(&stop, true);
+			ret = -1;
+			break;
+		}
+	}
+	struct timespec ts = {
+		.tv_sec = (time_t)args->duration_sec,
+		.tv_nsec = (long)((args->duration_sec - (double)(time_t)args->duration_sec) * 1e9),
+	};
+	if( ret == 0 ) {
+		nanosleep(&ts, NULL);
+	}
+	atomic_store(&stop, true);
+
+	uint64_t total_ops = 0, total_bytes = 0;
+	size_t access_errors = 0;
+	for(uint64_t i = 0; i < started; i++) {
+		pthread_join(tids[i], NULL);
+		total_ops += workers[i].ops;
+		total_bytes += workers[i].bytes;
+		access_errors += workers[i].access_errors;
+		if( workers[i].err ) {
+			ret = -1;
+		}
+	}
+	double elapsed = now_sec() - t_start;
+	if( access_errors ) {
+		printf("Warning: %zu pages were not accessible\n", access_errors);
+	}
+	*out_ops_per_sec = (double)total_ops / elapsed;
+	*out_mib_per_sec = ((double)total_bytes / (1024.0 * 1024.0)) / elapsed;
+
+cleanup:
+	free(workers);
+	free(tids);
+	return ret;
+}
+
+static int run(struct arguments args) {
+	int ret = 0;
+	if( open_kmod() ) {
+		err_log("failed to open kernel module\n");
+		return -1;
+	}
+
+	printf("threads,ops_per_sec,mib_per_sec,speedup,efficiency\n");
+	double base_ops = 0;
+	for(uint64_t threads = 1; ; ) {
+		double ops, mib;
+		if( run_with_threads(&args, threads, &ops, &mib) ) {
+			err_log("benchmark with %ju threads failed\n", threads);
+			ret = -1;
+			break;
+		}
+		if( threads == 1 ) {
+			base_ops = ops;
+		}
+		double speedup = base_ops > 0 ? ops / base_ops : 0;
+		printf("%ju,%.0f,%.2f,%.2f,%.2f\n", threads, ops, mib, speedup, speedup / (double)threads);
+		if( threads == args.max_threads ) {
+			break;
+		}
+		//always include max_threads, even if it is no power of two
+		threads = threads * 2 > args.max_threads ? args.max_threads : threads * 2;
+	}
+
+	close_kmod();
+	return ret;
+}
+
+const char* argp_program_version = "stress_readalias";
+const char* argp_program_bug_address = "l.wilke@uni-luebeck.de";
+static char doc[] = "Multi-threaded stress benchmark for the readalias kernel module. "
+	"Reads the pa range with 1,2,4,...,threads workers and reports the throughput scaling";
+static char args_doc[] = "--start --end [--threads] [--chunk-size] [--duration] [--flush] [--access-reserved]";
+static struct argp_option options[] = {
+	{"start", 1, "PA", 0, "First physical address of the range (page aligned)", 0},
+	{"end", 2, "PA", 0, "First physical address after the range", 0},
+	{"threads", 3, "N", 0, "Maximal number of worker threads. Default 1", 0},
+	{"chunk-size", 4, "BYTES", 0, "Bytes read per ioctl. Default 4096", 0},
+	{"duration", 5, "SEC", 0, "Duration of each measurement in seconds. Default 2", 0},
+	{"flush", 6, 0, 0, "Flush each chunk before reading it", 0},
+	{"access-reserved", 7, 0, 0, "Allow accessing reserved memory ranges. Might lead to crashes\n", 0},
+	{0},
+};
+
+static error_t parse_opt(int key, char* arg, struct argp_state* state) {
+	struct arguments* args = state->input;
+	uint64_t v;
+	switch(key) {
+		case 1:
+			if( do_stroul(arg, 0, &args->start_pa) ) {
+				argp_usage(state);
+			}
+			break;
+		case 2:
+			if( do_stroul(arg, 0, &args->end_pa) ) {
+				argp_usage(state);
+			}
+			break;
+		case 3:
+			if( do_stroul(arg, 0, &args->max_threads) || args->max_threads == 0 ) {
+				argp_usage(state);
+			}
+			break;
+		case 4:
+			if( do_stroul(arg, 0, &v) || v == 0 ) {
+				argp_usage(state);
+			}
+			args->chunk_size = v;
+			break;
+		case 5:
+			args->duration_sec = strtod(arg, NULL);
+			if( args->duration_sec <= 0 ) {
+				argp_usage(state);
+			}
+			break;
+		case 6:
+			args->flush_method = FM_CLFLUSH;
+			break;
+		case 7:
+			args->access_reserved = true;
+			break;
+		case ARGP_KEY_END:
+			if( args->end_pa <= args->start_pa || (args->start_pa & (PAGE_SIZE - 1)) ) {
+				printf("Missing or invalid pa range\n");
+				argp_usage(state);
+				return ARGP_ERR_UNKNOWN;
+			}
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp argp = {
+	options,
+	parse_opt,
+	args_doc,
+	doc,
+	0,
+	0,
+	0,
+};
+
+int main(int argc, char** argv) {
+	struct arguments args = {
+		.start_pa = 0,
+		.end_pa = 0,
+		.chunk_size = PAGE_SIZE,
+		.max_threads = 1,
+		.duration_sec = 2,
+		.access_reserved = false,
+		.flush_method = FM_NONE,
+	};
+	if(argp_parse(&argp, argc, argv, 0, 0, &args)) {
+		printf("Failed to parse arguments\n");
+		return -1;
+	}
+	return run(args);
+}
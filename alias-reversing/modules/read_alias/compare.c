@@ -0,0 +1,339 @@
+/**
+ * Compare kernels for alias test buffers. A buffer matches if ((a ^ b ^ ref) & mask) is zero,
+ * which covers the marker comparison of the scan (b = NULL) as well as the xor differential
+ * test of the probes (a = buf1, b = buf2, ref = m1 ^ m2). The implementation is selected on
+ * first use, depending on the cpu features. The READALIAS_COMPARE environment variable
+ * selects a specific implementation, e.g. to compare them.
+ * The x86 kernels use target attributes. The RISC-V kernels are in their own translation units that
+ * are built with the vector extension, see compare.h, while the rest of the lib stays rv64gc.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(READALIAS_HAVE_RVV) || defined(READALIAS_HAVE_XTHEADVECTOR)
+#include <stdio.h>
+#include <sys/auxv.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if __has_include(<asm/hwprobe.h>)
+#include <asm/hwprobe.h>
+#endif
+#if __has_include(<asm/vendor/thead.h>)
+#include <asm/vendor/thead.h>
+#endif
+#endif
+
+#include "backend.h"
+#include "compare.h"
+
+static bool cmp_one_portable(const struct cmp_batch* c, const uint8_t* a, const uint8_t* b) {
+  uint64_t acc = 0;
+  size_t i = 0;
+  for(; i + sizeof(uint64_t) <= c->len; i += sizeof(uint64_t)) {
+    uint64_t x, y = 0, r, m = ~0ULL;
+    memcpy(&x, a + i, sizeof(x));
+    if( b ) {
+      memcpy(&y, b + i, sizeof(y));
+    }
+    memcpy(&r, c->ref + i, sizeof(r));
+    if( c->mask ) {
+      memcpy(&m, c->mask + i, sizeof(m));
+    }
+    acc |= (x ^ y ^ r) & m;
+  }
+  for(; i < c->len; i++) {
+    acc |= (a[i] ^ (b ? b[i] : 0) ^ c->ref[i]) & (c->mask ? c->mask[i] : 0xff);
+  }
+  return acc == 0;
+}
+
+static size_t cmp_batch_portable(const struct cmp_batch* c, bool* out_eq) {
+  size_t matches = 0;
+  for(size_t i = 0; i < c->n; i++) {
+    out_eq[i] = cmp_one_portable(c, c->a + i * c->stride, c->b ? c->b + i * c->stride : NULL);
+    matches += out_eq[i];
+  }
+  return matches;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * @brief Compare the bytes that are left after the vector loop
+*/
+static bool cmp_tail(const struct cmp_batch* c, const uint8_t* a, const uint8_t* b, size_t i) {
+  uint8_t acc = 0;
+  for(; i < c->len; i++) {
+    acc |= (a[i] ^ (b ? b[i] : 0) ^ c->ref[i]) & (c->mask ? c->mask[i] : 0xff);
+  }
+  return acc == 0;
+}
+
+__attribute__((target("sse2"))) static size_t cmp_batch_sse2(const struct cmp_batch* c, bool* out_eq) {
+  size_t matches = 0;
+  for(size_t n = 0; n < c->n; n++) {
+    const uint8_t* a = c->a + n * c->stride;
+    const uint8_t* b = c->b ? c->b + n * c->stride : NULL;
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+    for(; i + 16 <= c->len; i += 16) {
+      __m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(c->ref + i)));
+      if( b ) {
+        x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i*)(b + i)));
+      }
+      if( c->mask ) {
+        x = _mm_and_si128(x, _mm_loadu_si128((const __m128i*)(c->mask + i)));
+      }
+      acc = _mm_or_si128(acc, x);
+    }
+    out_eq[n] = _mm_movemask_epi8(_mm_cmpeq_epi8(acc, _mm_setzero_si128())) == 0xffff && cmp_tail(c, a, b, i);
+    matches += out_eq[n];
+  }
+  return matches;
+}
+
+__attribute__((target("avx2"))) static size_t cmp_batch_avx2(const struct cmp_batch* c, bool* out_eq) {
+  size_t matches = 0;
+  for(size_t n = 0; n < c->n; n++) {
+    const uint8_t* a = c->a + n * c->stride;
+    const uint8_t* b = c->b ? c->b + n * c->stride : NULL;
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 32 <= c->len; i += 32) {
+      __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(c->ref + i)));
+      if( b ) {
+        x = _mm256_xor_si256(x, _mm256_loadu_si256((const __m256i*)(b + i)));
+      }
+      if( c->mask ) {
+        x = _mm256_and_si256(x, _mm256_loadu_si256((const __m256i*)(c->mask + i)));
+      }
+      acc = _mm256_or_si256(acc, x);
+    }
+    out_eq[n] = _mm256_testz_si256(acc, acc) && cmp_tail(c, a, b, i);
+    matches += out_eq[n];
+  }
+  return matches;
+}
+
+__attribute__((target("avx512f,avx512bw"))) static size_t cmp_batch_avx512(const struct cmp_batch* c, bool* out_eq) {
+  size_t matches = 0;
+  for(size_t n = 0; n < c->n; n++) {
+    const uint8_t* a = c->a + n * c->stride;
+    const uint8_t* b = c->b ? c->b + n * c->stride : NULL;
+    __mmask64 diff = 0;
+    //masked loads handle the tail, i.e. a 64 byte message is a single iteration
+    for(size_t i = 0; i < c->len; i += 64) {
+      size_t left = c->len - i;
+      __mmask64 k = left >= 64 ? ~(__mmask64)0 : ((__mmask64)1 << left) - 1;
+      __m512i x = _mm512_xor_si512(_mm512_maskz_loadu_epi8(k, a + i), _mm512_maskz_loadu_epi8(k, c->ref + i));
+      if( b ) {
+        x = _mm512_xor_si512(x, _mm512_maskz_loadu_epi8(k, b + i));
+      }
+      if( c->mask ) {
+        x = _mm512_and_si512(x, _mm512_maskz_loadu_epi8(k, c->mask + i));
+      }
+      diff |= _mm512_test_epi8_mask(x, x);
+    }
+    out_eq[n] = diff == 0;
+    matches += out_eq[n];
+  }
+  return matches;
+}
+
+#endif
+
+#if defined(READALIAS_HAVE_RVV) || defined(READALIAS_HAVE_XTHEADVECTOR)
+
+//mvendorid of T-Head. Their vendor kernels report the RVV 0.7.1 unit of the C9xx cores as V in AT_HWCAP
+#define THEAD_MVENDORID 0x5b7
+
+struct riscv_cpu_info {
+  uint64_t mvendorid;
+  bool isa_xtheadvector;
+};
+
+/**
+ * @brief Vendor and ISA string of the first hart from /proc/cpuinfo. Fields that are missing stay zero
+*/
+__attribute__((unused)) static struct riscv_cpu_info riscv_cpu_info(void) {
+  struct riscv_cpu_info info = {0};
+  FILE* f = fopen("/proc/cpuinfo", "r");
+  if( !f ) {
+    return info;
+  }
+  char line[1024];
+  bool have_vendor = false, have_isa = false;
+  while( (!have_vendor || !have_isa) && fgets(line, sizeof(line), f) ) {
+    unsigned long long v;
+    if( !have_vendor && sscanf(line, "mvendorid : %llx", &v) == 1 ) {
+      info.mvendorid = v;
+      have_vendor = true;
+    } else if( !have_isa && !strncmp(line, "isa", 3) ) {
+      info.isa_xtheadvector = strstr(line, "xtheadvector") != NULL;
+      have_isa = true;
+    }
+  }
+  fclose(f);
+  return info;
+}
+
+/**
+ * @brief Query a single hwprobe key
+ * @returns 0 on success, -1 if the kernel or the headers do not know hwprobe or the key
+*/
+__attribute__((unused)) static int riscv_hwprobe_key(int64_t key, uint64_t* out_value) {
+#if defined(__NR_riscv_hwprobe) && __has_include(<asm/hwprobe.h>)
+  struct riscv_hwprobe pair = {.key = key, .value = 0};
+  if( syscall(__NR_riscv_hwprobe, &pair, 1, 0, NULL, 0) || pair.key < 0 ) {
+    return -1;
+  }
+  *out_value = pair.value;
+  return 0;
+#else
+  (void)key;
+  (void)out_value;
+  return -1;
+#endif
+}
+
+#if defined(READALIAS_HAVE_RVV)
+static bool cpu_has_rvv(void) {
+#if defined(RISCV_HWPROBE_KEY_IMA_EXT_0) && defined(RISCV_HWPROBE_IMA_V)
+  uint64_t ext;
+  if( !riscv_hwprobe_key(RISCV_HWPROBE_KEY_IMA_EXT_0, &ext) ) {
+    return ext & RISCV_HWPROBE_IMA_V;
+  }
+#endif
+  //without hwprobe, only trust the V bit of AT_HWCAP on cores that do not implement RVV 0.7.1 instead
+  return (getauxval(AT_HWCAP) & (1UL << ('V' - 'A'))) && riscv_cpu_info().mvendorid != THEAD_MVENDORID;
+}
+#endif
+
+#if defined(READALIAS_HAVE_XTHEADVECTOR)
+static bool cpu_has_xtheadvector(void) {
+#if defined(RISCV_HWPROBE_KEY_VENDOR_EXT_THEAD_0) && defined(RISCV_HWPROBE_VENDOR_EXT_XTHEADVECTOR)
+  uint64_t ext;
+  if( !riscv_hwprobe_key(RISCV_HWPROBE_KEY_VENDOR_EXT_THEAD_0, &ext) && (ext & RISCV_HWPROBE_VENDOR_EXT_XTHEADVECTOR) ) {
+    return true;
+  }
+#endif
+  //mainline kernels list the extension in the ISA string, vendor kernels report it as V
+  struct riscv_cpu_info info = riscv_cpu_info();
+  return info.isa_xtheadvector ||
+    (info.mvendorid == THEAD_MVENDORID && (getauxval(AT_HWCAP) & (1UL << ('V' - 'A'))));
+}
+#endif
+
+#endif
+
+struct cmp_impl {
+  const char* name;
+  cmp_batch_fn fn;
+};
+
+//ordered from most to least preferred
+static const struct cmp_impl cmp_impls[] = {
+#if defined(__x86_64__) || defined(__i386__)
+  {"avx512", cmp_batch_avx512},
+  {"avx2", cmp_batch_avx2},
+  {"sse2", cmp_batch_sse2},
+#endif
+#if defined(READALIAS_HAVE_RVV)
+  {"rvv", cmp_batch_rvv},
+#endif
+#if defined(READALIAS_HAVE_XTHEADVECTOR)
+  {"xtheadvector", cmp_batch_xtheadvector},
+#endif
+  {"portable", cmp_batch_portable},
+};
+
+static const struct cmp_impl* selected_cmp = NULL;
+static pthread_once_t cmp_once = PTHREAD_ONCE_INIT;
+
+static bool cmp_impl_supported(const struct cmp_impl* impl) {
+#if defined(__x86_64__) || defined(__i386__)
+  if( impl->fn == cmp_batch_avx512 ) {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+  }
+  if( impl->fn == cmp_batch_avx2 ) {
+    return __builtin_cpu_supports("avx2");
+  }
+  if( impl->fn == cmp_batch_sse2 ) {
+    return __builtin_cpu_supports("sse2");
+  }
+#endif
+#if defined(READALIAS_HAVE_RVV)
+  if( impl->fn == cmp_batch_rvv ) {
+    return cpu_has_rvv();
+  }
+#endif
+#if defined(READALIAS_HAVE_XTHEADVECTOR)
+  if( impl->fn == cmp_batch_xtheadvector ) {
+    return cpu_has_xtheadvector();
+  }
+#endif
+  (void)impl;
+  return true;
+}
+
+static void select_cmp_impl(void) {
+  const char* name = getenv("READALIAS_COMPARE");
+  if( name && !name[0] ) {
+    name = NULL;
+  }
+  for(size_t i = 0; i < sizeof(cmp_impls) / sizeof(cmp_impls[0]); i++) {
+    if( (name && strcmp(name, cmp_impls[i].name)) || !cmp_impl_supported(cmp_impls + i) ) {
+      continue;
+    }
+    selected_cmp = cmp_impls + i;
+    return;
+  }
+  if( name ) {
+    err_log("compare implementation \"%s\" is unknown or not supported, using the default\n", name);
+  }
+  for(size_t i = 0; !selected_cmp; i++) {
+    if( cmp_impl_supported(cmp_impls + i) ) {
+      selected_cmp = cmp_impls + i;
+    }
+  }
+}
+
+static const struct cmp_impl* __cmp_impl(void) {
+  pthread_once(&cmp_once, select_cmp_impl);
+  return selected_cmp;
+}
+
+const char* compare_impl_name(void) {
+  return __cmp_impl()->name;
+}
+
+size_t memeq_batch(const void* bufs, size_t stride, size_t n, const void* ref, const void* mask, size_t len, bool* out_eq) {
+  struct cmp_batch c = {
+    .a = bufs,
+    .b = NULL,
+    .stride = stride,
+    .n = n,
+    .ref = ref,
+    .mask = mask,
+    .len = len,
+  };
+  return __cmp_impl()->fn(&c, out_eq);
+}
+
+size_t memeq_xor_batch(const void* a, const void* b, size_t stride, size_t n, const void* ref, size_t len, bool* out_eq) {
+  struct cmp_batch c = {
+    .a = a,
+    .b = b,
+    .stride = stride,
+    .n = n,
+    .ref = ref,
+    .mask = NULL,
+    .len = len,
+  };
+  return __cmp_impl()->fn(&c, out_eq);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+/**
+ * Compare kernels of compare.c that need a different -march than the rest of the lib. Each one lives
+ * in its own translation unit, which the Makefile builds with the required extension and announces
+ * to compare.c with a READALIAS_HAVE_* define. compare.c only selects them if the cpu supports them
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct cmp_batch {
+  //buffer i starts at a + i * stride and b + i * stride
+  const uint8_t* a;
+  //NULL for a plain comparison
+  const uint8_t* b;
+  size_t stride;
+  size_t n;
+  const uint8_t* ref;
+  //NULL to compare all bits
+  const uint8_t* mask;
+  size_t len;
+};
+
+typedef size_t (*cmp_batch_fn)(const struct cmp_batch* c, bool* out_eq);
+
+#if defined(READALIAS_HAVE_RVV)
+//RVV 1.0, compare_rvv.c
+size_t cmp_batch_rvv(const struct cmp_batch* c, bool* out_eq);
+#endif
+
+#if defined(READALIAS_HAVE_XTHEADVECTOR)
+//RVV 0.7.1 as implemented by the T-Head C906/C910/C920 cores, compare_xtheadvector.c
+size_t cmp_batch_xtheadvector(const struct cmp_batch* c, bool* out_eq);
+#endif
@@ -0,0 +1,31 @@
+/**
+ * RVV 1.0 compare kernel, see compare.c. Built with -march=rv64gcv, i.e. only call it after checking
+ * that the cpu implements V
+*/
+
+#include <riscv_vector.h>
+
+#include "compare.h"
+
+size_t cmp_batch_rvv(const struct cmp_batch* c, bool* out_eq) {
+  size_t matches = 0;
+  for(size_t n = 0; n < c->n; n++) {
+    const uint8_t* a = c->a + n * c->stride;
+    const uint8_t* b = c->b ? c->b + n * c->stride : NULL;
+    bool eq = true;
+    for(size_t i = 0, vl; eq && i < c->len; i += vl) {
+      vl = __riscv_vsetvl_e8m8(c->len - i);
+      vuint8m8_t x = __riscv_vxor_vv_u8m8(__riscv_vle8_v_u8m8(a + i, vl), __riscv_vle8_v_u8m8(c->ref + i, vl), vl);
+      if( b ) {
+        x = __riscv_vxor_vv_u8m8(x, __riscv_vle8_v_u8m8(b + i, vl), vl);
+      }
+      if( c->mask ) {
+        x = __riscv_vand_vv_u8m8(x, __riscv_vle8_v_u8m8(c->mask + i, vl), vl);
+      }
+      eq = __riscv_vfirst_m_b1(__riscv_vmsne_vx_u8m8_b1(x, 0, vl), vl) < 0;
+    }
+    out_eq[n] = eq;
+    matches += eq;
+  }
+  return matches;
+}
@@ -0,0 +1,58 @@
+/**
+ * RVV 0.7.1 compare kernel for the vector unit of the T-Head C920 cores of the SG2042, see compare.c.
+ * The encoding differs from RVV 1.0, so the kernel is written with the th.* mnemonics of the
+ * XTheadVector extension. Requires a toolchain that knows XTheadVector (GCC >= 14 with binutils >= 2.42,
+ * or the T-Head toolchain): the Makefile only builds this file if the compiler accepts
+ * -march=$(THEAD_MARCH)
+*/
+
+#include "compare.h"
+
+/**
+ * @brief Compare up to one vector register group (8 registers, LMUL=8) of the buffers starting at byte `i`
+ * @param out_vl : Output param, number of bytes that have been compared
+ * @returns true if the compared bytes match
+*/
+static bool cmp_chunk(const struct cmp_batch* c, const uint8_t* a, const uint8_t* b, size_t i, size_t* out_vl) {
+  const uint8_t* bi = b ? b + i : NULL;
+  const uint8_t* mi = c->mask ? c->mask + i : NULL;
+  size_t vl;
+  long first;
+  //a single asm statement, so that the compiler cannot use the vector registers in between
+  __asm__ volatile(
+    "th.vsetvli %[vl], %[left], e8, m8\n\t"
+    "th.vle.v v8, (%[a])\n\t"
+    "th.vle.v v16, (%[ref])\n\t"
+    "th.vxor.vv v8, v8, v16\n\t"
+    "beqz %[b], 1f\n\t"
+    "th.vle.v v16, (%[b])\n\t"
+    "th.vxor.vv v8, v8, v16\n"
+    "1:\n\t"
+    "beqz %[mask], 2f\n\t"
+    "th.vle.v v16, (%[mask])\n\t"
+    "th.vand.vv v8, v8, v16\n"
+    "2:\n\t"
+    "th.vmsne.vi v0, v8, 0\n\t"
+    "th.vmfirst.m %[first], v0"
+    : [vl] "=&r"(vl), [first] "=&r"(first)
+    : [left] "r"(c->len - i), [a] "r"(a + i), [ref] "r"(c->ref + i), [b] "r"(bi), [mask] "r"(mi)
+    : "v0", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15", "v16", "v17", "v18", "v19", "v20", "v21",
+      "v22", "v23", "vl", "vtype", "memory");
+  *out_vl = vl;
+  return first < 0;
+}
+
+size_t cmp_batch_xtheadvector(const struct cmp_batch* c, bool* out_eq) {
+  size_t matches = 0;
+  for(size_t n = 0; n < c->n; n++) {
+    const uint8_t* a = c->a + n * c->stride;
+    const uint8_t* b = c->b ? c->b + n * c->stride : NULL;
+    bool eq = true;
+    for(size_t i = 0, vl; eq && i < c->len; i += vl) {
+      eq = cmp_chunk(c, a, b, i, &vl);
+    }
+    out_eq[n] = eq;
+    matches += eq;
+  }
+  return matches;
+}
@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 
 #include "readalias_ioctls.h"
@@ -15,9 +16,24 @@ typedef struct  {
   size_t map_failed;
 } page_stats_t;
 
+//Handle for the context based ra_* API, see `ra_open`
+typedef struct readalias_ctx readalias_ctx_t;
+
+
+/**
+ * Select the physical memory backend used by all functions of this lib.
+ * "kmod" (default) uses the readalias kernel module, "devmem" mmaps /dev/mem and
+ * "sim" simulates DRAM with configurable aliases (see readme).
+ * Must be called before `open_kmod`. If not called, `open_kmod` uses the
+ * READALIAS_BACKEND environment variable
+ *
+ * @returns 0 on success, -1 for unknown backends
+ */
+int select_backend(const char* name);
 
 /**
- * Open the kernel module
+ * Open the kernel module, or the backend chosen with `select_backend`, for the functions
+ * without ra_ prefix. These share a single context between all threads
  * 
  * @returns Whether the kernel module was opened successfully.
  */
@@ -40,6 +56,14 @@ struct pamemcpy_cfg {
  bool access_reserved;
  //Control flushing method or disable flushing
  enum flush_method flush_method;
+ //Cache attributes of the kernel mapping used by memcpy_topa_ext/memcpy_frompa_ext.
+ //CM_UC/CM_WC are only supported outside of RAM, the accesses fail for RAM
+ enum cache_mode cache_mode;
+ //Regular or non-temporal accesses. Use AM_NONTEMPORAL with FM_NONE for DRAM-coherent
+ //accesses without flushing. This is the only way to bypass the cache for RAM.
+ //With cache_mode/access_mode other than the defaults and err_on_access_fail false, `out_stats`
+ //only records whether an access failed, not how many pages failed
+ enum access_mode access_mode;
 };
 
 /**
@@ -57,7 +81,9 @@ struct pamemcpy_cfg {
 int memcpy_topa(uint64_t dst, void* src, size_t count, page_stats_t* out_stats, bool err_on_access_fail);
 
 /**
- *@brief Like memcpy_topa but with more options
+ *@brief Like memcpy_topa but with more options. `cfg` is stored as session config of the
+ *kernel module, such that subsequent calls with the same config only pass (pa, len, buf)
+ *to the kernel
  *@parameter cfg : control behaviour. Also contains some output paramters
  *@returns 0 on success
 */
@@ -79,15 +105,15 @@ int memcpy_topa_ext(uint64_t dst, void* src, size_t count, struct pamemcpy_cfg*
 int memcpy_frompa(void* dst, uint64_t src, size_t count, page_stats_t* out_stats, bool err_on_access_fail);
 
 /**
- *@brief Like memcpy_frompa but with more options
+ *@brief Like memcpy_frompa but with more options. See `memcpy_topa_ext` for the session config
  *@parameter cfg : control behaviour. Also contains some output paramters
  *@returns 0 on success
 */
 int memcpy_frompa_ext(void* dst, uint64_t src, size_t count, struct pamemcpy_cfg* cfg);
 
 /**
- * Flush a given memory range from the cache. This function will flush at the
- * granularity of a page.
+ * Flush a given memory range from the cache using clflush, with a single
+ * FLUSH_RANGE ioctl.
  * 
  * @param pa: The starting physical address to flush.
  * @param count: The number of bytes to flush.
@@ -100,16 +126,124 @@ int memcpy_frompa_ext(void* dst, uint64_t src, size_t count, struct pamemcpy_cfg
 int clflush_range(uint64_t pa, size_t count, page_stats_t* out_stats, bool err_on_access_fail);
 
 /**
- @brief Issue `wbinvd` instruction on all cpu cores
+ @brief Issue `wbinvd` instruction on all cpu cores. On RISC-V, this flushes the whole
+ data cache if the cpu supports this (T-Head). Fails if the cpu only supports line based flushes (Zicbom)
 */
 int wbinvd_ac(void);
 
 
 /**
- * @brief Flush the given memory range using the selected method
+ * @brief Seed the generator for the alias test messages (`check_alias`, `probe_alias`, ...) and
+ * `gen_rand_bytes`. With the same seed, a single threaded run uses the same messages, i.e.
+ * failed probes can be replayed. Without a seed, the generator is seeded from getrandom on first use
+*/
+void set_rand_seed(uint64_t seed);
+
+/**
+ * @brief Get the seed of the generator, e.g. to print it for a later replay. Seeds the
+ * generator from getrandom if required
+ * @returns the seed or 0 if seeding failed
+*/
+uint64_t get_rand_seed(void);
+
+/**
+ * @brief Fill `p` with `len` random bytes from the seeded generator. The generator is a
+ * xoshiro256** with several lanes that produces 64 byte blocks, i.e. no syscalls are required
+ * @returns 0 on success
+*/
+int gen_rand_bytes(void* p, size_t len);
+
+/**
+ * @brief Flush the given memory range using the selected method. FM_WBINVD falls back to
+ * flushing the range if the whole cache cannot be flushed. FM_AUTO lets the kernel module choose
 */
 int flush_ext(uint64_t pa, size_t count, struct pamemcpy_cfg* cfg);
 
+/**
+ * @brief Set the flush method, access_reserved, err_on_access_fail, cache and access mode of `cfg` as
+ * defaults for read/write/pread/pwrite/splice on the device file. These treat the file offset as
+ * physical address. `memcpy_topa_ext`/`memcpy_frompa_ext` also update the session config
+ * @returns 0 on success
+*/
+int set_session_config(const struct pamemcpy_cfg* cfg);
+
+/**
+ * @brief Copy the physical memory range [pa, pa+count[ to `out_fd` with sendfile, i.e. without
+ * copying the data through a user space buffer. Uses the settings of `set_session_config`.
+ * Backends other than the kernel module copy through a bounce buffer
+ * @returns 0 on success
+*/
+int sendfile_pa(int out_fd, uint64_t pa, size_t count);
+
+/**
+ * @brief Map the physical memory range [pa, pa+count[ into our address space.
+ * Accesses through the mapping do not require any syscalls. Use `flush_ext`
+ * to flush cacheable mappings or request an uncached mapping.
+ * Only supported by the kernel module backend
+ * @param pa : start of the range. Does not need to be page aligned
+ * @param count : length of the range in bytes
+ * @param cache_mode : cache attributes for the mapping
+ * @param access_reserved : If true, allow mapping pages that are marked as reserved
+ * @returns pointer to the byte at `pa` or NULL on error
+*/
+void* map_pa(uint64_t pa, size_t count, enum cache_mode cache_mode, bool access_reserved);
+
+/**
+ * @brief Unmap a mapping created with `map_pa`
+ * @param mapping : pointer returned by `map_pa`
+ * @param count : `count` value passed to `map_pa`
+ * @returns 0 on success
+*/
+int unmap_pa(void* mapping, size_t count);
+
+/**
+ * @brief Queue of physical memory operations that are executed in order
+ * with a single BATCH_SUBMIT ioctl. Initialize with `batch_init` and
+ * free with `batch_free`. The buffers passed to the `batch_add_*` functions
+ * must stay valid until `batch_submit` returns
+*/
+typedef struct {
+  struct batch_desc* descs;
+  size_t len;
+  size_t cap;
+} pa_batch_t;
+
+void batch_init(pa_batch_t* batch);
+
+void batch_free(pa_batch_t* batch);
+
+/**
+ * @brief Remove all queued operations but keep the allocated memory
+*/
+void batch_reset(pa_batch_t* batch);
+
+/**
+ * @brief Queue a copy of `count` bytes from `src` to the physical address `dst`
+ * @returns 0 on success
+*/
+int batch_add_topa(pa_batch_t* batch, uint64_t dst, void* src, size_t count, enum flush_method fm);
+
+/**
+ * @brief Queue a copy of `count` bytes from the physical address `src` to `dst`
+ * @returns 0 on success
+*/
+int batch_add_frompa(pa_batch_t* batch, void* dst, uint64_t src, size_t count, enum flush_method fm);
+
+/**
+ * @brief Queue a flush of the physical memory range [pa, pa+count[ using `fm`
+ * @returns 0 on success
+*/
+int batch_add_flush(pa_batch_t* batch, uint64_t pa, size_t count, enum flush_method fm);
+
+/**
+ * @brief Execute all queued operations with a single ioctl. Afterwards, the
+ * `status` field of each entry in `batch->descs` is 0, RET_RESERVED, RET_MAPFAIL or
+ * a negative error code. Operations with RET_RESERVED/RET_MAPFAIL status are counted in `cfg->out_stats`.
+ * If `cfg->err_on_access_fail` is set, the kernel stops at the first failed operation
+ * @returns 0 if all operations succeeded
+*/
+int batch_submit(pa_batch_t* batch, struct pamemcpy_cfg* cfg);
+
 //check alias failed to perform a memory access
 //this might happend if the page is reserved
 #define CHECK_ALIAS_ERR_ACCESS -1
@@ -122,7 +256,340 @@ int flush_ext(uint64_t pa, size_t count, struct pamemcpy_cfg* cfg);
  * @param source_pa
  * @param alias_candidate
  * @param memcpy_cfg : config options for pa memcpy functions
- * @param verbose : if true, log more error information 
+ * @param verbose : if true, log more error information and hexdump the messages and read buffers of a found alias. Runs
+ * the protocol as batch instead of a single PROBE ioctl
  * @return 0 on success, CHECK_ALIAS_ERR_ACCESS on access error, CHECK_ALIAS_ERR_NO_ALIAS if access succeeded but the candidate is no alias
 */
 int check_alias(uint64_t source_pa, uint64_t alias_candidate, struct pamemcpy_cfg* memcpy_cfg,bool verbose);
+
+/**
+ * @brief Like `check_alias` but performs `len` checks with a single
+ * BATCH_SUBMIT ioctl. Access errors only affect the result of the corresponding check
+ * @param source_pas : source pa for each check
+ * @param alias_candidates : alias candidate for each check
+ * @param len : length of `source_pas`, `alias_candidates` and `out_results`
+ * @param memcpy_cfg : config options for pa memcpy functions
+ * @param out_results : Output param. Filled with the `check_alias` return value for each check
+ * @return 0 if the batch could be executed, i.e. `out_results` is valid
+*/
+int check_alias_batch(const uint64_t* source_pas, const uint64_t* alias_candidates, size_t len, struct pamemcpy_cfg* memcpy_cfg, int* out_results);
+
+/**
+ * @brief Like `check_alias` for many candidates of the same source. The kernel writes the first
+ * message to `source_pa`, reads a chunk of candidates, writes the second message and reads them again,
+ * i.e. the whole test runs in a single PROBE ioctl without copying data to userspace.
+ * `cfg->err_on_access_fail` is ignored
+ * @param out_results : Output param with `len` entries. 0 if the candidate is an alias,
+ * CHECK_ALIAS_ERR_ACCESS or CHECK_ALIAS_ERR_NO_ALIAS otherwise
+ * @returns 0 on success. Fails if `source_pa` cannot be accessed, which is left to the caller to log
+*/
+int probe_alias(uint64_t source_pa, const uint64_t* candidates, size_t len, struct pamemcpy_cfg* cfg, int* out_results);
+
+/**
+ * @brief Like `probe_alias` for the candidates start, start+stride, ..., start+(count-1)*stride.
+ * Only the aliases are reported back
+ * @param out_matches : Output param. Filled with up to `max_matches` aliases
+ * @param out_match_count : Output param. Number of entries in `out_matches`
+ * @param out_next : Output param, may be NULL. Index of the first candidate that has not been
+ * processed because `out_matches` is full. Equal to `count` if all candidates have been processed
+ * @returns 0 on success. Fails if `source_pa` cannot be accessed
+*/
+int probe_alias_range(uint64_t source_pa, uint64_t start, uint64_t stride, size_t count, struct pamemcpy_cfg* cfg,
+  uint64_t* out_matches, size_t max_matches, size_t* out_match_count, size_t* out_next);
+
+/**
+ * @brief Scan the candidates start, start+stride, ... < end for `marker` inside the kernel module.
+ * Only the matching addresses are copied to userspace. Reserved pages and pages
+ * that cannot be mapped are skipped and counted in `cfg->out_stats`. `cfg->err_on_access_fail` is ignored
+ * @param marker : up to SCAN_MAX_MARKER_LEN bytes that we search for
+ * @param mask : if not NULL, only bits set in `mask` are compared. Same length as `marker`
+ * @param out_matches : Output param. Filled with up to `max_matches` matching addresses
+ * @param out_match_count : Output param. Number of entries in `out_matches`
+ * @param out_next_pa : Output param, may be NULL. If `out_matches` is full before the whole range
+ * has been scanned, this is the first address that has not been scanned. Otherwise it is >= `end`
+ * @returns 0 on success
+*/
+int scan_pa_range(uint64_t start, uint64_t end, uint64_t stride, const void* marker, const void* mask, size_t marker_len,
+  struct pamemcpy_cfg* cfg, uint64_t* out_matches, size_t max_matches, size_t* out_match_count, uint64_t* out_next_pa);
+
+//number of uint64_t words of a page state bitmap for `pages` pages
+#define PFN_BITMAP_WORDS(pages) (((pages) + 63) / 64)
+
+/**
+ * @brief Test bit `idx` of a page state bitmap returned by `get_pfn_state`
+*/
+static inline bool pfn_bitmap_test(const uint64_t* bitmap, size_t idx) {
+  return (bitmap[idx / 64] >> (idx % 64)) & 1;
+}
+
+/**
+ * @brief Query the state of the pages [start_pa, start_pa + pages * PAGE_SIZE[ with a single
+ * PFN_STATE ioctl. Bit i of each bitmap refers to the page start_pa + i * PAGE_SIZE
+ * @param start_pa : page aligned start of the range
+ * @param access_reserved : If true, reserved pages are considered accessible
+ * @param out_invalid : Optional output param with PFN_BITMAP_WORDS(pages) words. Pages not backed by a struct page
+ * @param out_reserved : Optional output param with PFN_BITMAP_WORDS(pages) words. Pages marked as reserved
+ * @param out_inaccessible : Optional output param with PFN_BITMAP_WORDS(pages) words. Pages for which the
+ * memcpy/flush functions would report a reserved page or mapping error
+ * @param out_inaccessible_count : Optional output param. Number of bits set in `out_inaccessible`
+ * @returns 0 on success
+*/
+int get_pfn_state(uint64_t start_pa, size_t pages, bool access_reserved, uint64_t* out_invalid, uint64_t* out_reserved,
+  uint64_t* out_inaccessible, size_t* out_inaccessible_count);
+
+/**
+ * @brief Remove all addresses whose page is not accessible from `pas`. The order of the remaining
+ * addresses is preserved. The page state is queried for aligned windows of pages, i.e. sorted or
+ * clustered address lists only require a few ioctls
+ * @param pas : addresses to filter in place
+ * @param len : length of `pas`
+ * @param access_reserved : If true, reserved pages are considered accessible
+ * @param out_len : Output param. Number of remaining addresses
+ * @returns 0 on success
+*/
+int prune_inaccessible_pa(uint64_t* pas, size_t len, bool access_reserved, size_t* out_len);
+
+/**
+ * @brief Compare `n` buffers `bufs + i * stride` with `ref`. Buffer i is equal if all bits selected by `mask`
+ * match. Uses SSE2/AVX2/AVX-512 or RVV if the cpu supports it, see `compare_impl_name`
+ * @param mask : if not NULL, only bits set in `mask` are compared. Same length as `ref`
+ * @param out_eq : Output param with `n` entries
+ * @returns number of equal buffers
+*/
+size_t memeq_batch(const void* bufs, size_t stride, size_t n, const void* ref, const void* mask, size_t len, bool* out_eq);
+
+/**
+ * @brief Xor differential comparison of the alias test: buffer i is equal if
+ * (a + i * stride) ^ (b + i * stride) equals `ref`, i.e. m1 ^ m2. Otherwise like `memeq_batch`
+ * @returns number of equal buffers
+*/
+size_t memeq_xor_batch(const void* a, const void* b, size_t stride, size_t n, const void* ref, size_t len, bool* out_eq);
+
+/**
+ * @brief Name of the compare implementation used by `memeq_batch`/`memeq_xor_batch`, selected on
+ * first use. Can be overwritten with the READALIAS_COMPARE environment variable
+ * (avx512, avx2, sse2, rvv or portable)
+*/
+const char* compare_impl_name(void);
+
+/*
+ * Context based API. A context owns its connection to the backend (e.g. a file descriptor of the
+ * kernel module with its own session config), the random generator for the alias test messages,
+ * the config and the access statistics. The functions take the config from the context and add
+ * the reserved/map fail counts to its statistics. Threads that use their own context do not share
+ * any state, i.e. sweeps can run one context per worker without locking and closing a context does
+ * not affect the other ones. A context must not be used by multiple threads at once.
+ * The functions without ra_ prefix are wrappers that use a shared default context.
+*/
+
+/**
+ * @brief Open a new context with the backend chosen with `select_backend`. The config defaults
+ * to `err_on_access_fail` without flushing, see `ra_set_config`
+ * @returns NULL on error
+*/
+readalias_ctx_t* ra_open(void);
+
+/**
+ * @brief Close `ctx` and free all its resources
+*/
+void ra_close(readalias_ctx_t* ctx);
+
+/**
+ * @brief Set the config of `ctx`. `cfg->out_stats` is ignored, the statistics of `ctx` are kept
+*/
+void ra_set_config(readalias_ctx_t* ctx, const struct pamemcpy_cfg* cfg);
+
+/**
+ * @brief Get the config of `ctx`. `out_cfg->out_stats` receives the accumulated statistics
+*/
+void ra_get_config(readalias_ctx_t* ctx, struct pamemcpy_cfg* out_cfg);
+
+/**
+ * @brief Reset the reserved/map fail statistics of `ctx` to zero
+*/
+void ra_reset_stats(readalias_ctx_t* ctx);
+
+/**
+ * @brief Fill `p` with `len` random bytes from the generator of `ctx`. See `gen_rand_bytes`
+ * @returns 0 on success
+*/
+int ra_rand_bytes(readalias_ctx_t* ctx, void* p, size_t len);
+
+/**
+ * @brief Seed the generator of `ctx`, see `set_rand_seed`
+*/
+void ra_seed(readalias_ctx_t* ctx, uint64_t seed);
+
+/**
+ * @brief Get the seed of the generator of `ctx`, see `get_rand_seed`
+*/
+uint64_t ra_get_seed(readalias_ctx_t* ctx);
+
+/**
+ * @brief `memcpy_topa_ext` with the config of `ctx`
+*/
+int ra_memcpy_topa(readalias_ctx_t* ctx, uint64_t dst, void* src, size_t count);
+
+/**
+ * @brief `memcpy_frompa_ext` with the config of `ctx`
+*/
+int ra_memcpy_frompa(readalias_ctx_t* ctx, void* dst, uint64_t src, size_t count);
+
+/**
+ * @brief `flush_ext` with the config of `ctx`
+*/
+int ra_flush(readalias_ctx_t* ctx, uint64_t pa, size_t count);
+
+/**
+ * @brief `wbinvd_ac` with the backend of `ctx`
+*/
+int ra_wbinvd(readalias_ctx_t* ctx);
+
+/**
+ * @brief `check_alias` with the config of `ctx`
+*/
+int ra_check_alias(readalias_ctx_t* ctx, uint64_t source_pa, uint64_t alias_candidate, bool verbose);
+
+/**
+ * @brief `check_alias_batch` with the config of `ctx`
+*/
+int ra_check_alias_batch(readalias_ctx_t* ctx, const uint64_t* source_pas, const uint64_t* alias_candidates, size_t len,
+  int* out_results);
+
+/**
+ * @brief `probe_alias` with the config of `ctx`
+*/
+int ra_probe_alias(readalias_ctx_t* ctx, uint64_t source_pa, const uint64_t* candidates, size_t len, int* out_results);
+
+/**
+ * @brief `probe_alias_range` with the config of `ctx`
+*/
+int ra_probe_alias_range(readalias_ctx_t* ctx, uint64_t source_pa, uint64_t start, uint64_t stride, size_t count,
+  uint64_t* out_matches, size_t max_matches, size_t* out_match_count, size_t* out_next);
+
+/**
+ * @brief `scan_pa_range` with the config of `ctx`
+*/
+int ra_scan_pa_range(readalias_ctx_t* ctx, uint64_t start, uint64_t end, uint64_t stride, const void* marker, const void* mask,
+  size_t marker_len, uint64_t* out_matches, size_t max_matches, size_t* out_match_count, uint64_t* out_next_pa);
+
+/**
+ * @brief `batch_submit` with the config of `ctx`
+*/
+int ra_batch_submit(readalias_ctx_t* ctx, pa_batch_t* batch);
+
+/**
+ * @brief `get_pfn_state` with `access_reserved` from the config of `ctx`
+*/
+int ra_get_pfn_state(readalias_ctx_t* ctx, uint64_t start_pa, size_t pages, uint64_t* out_invalid, uint64_t* out_reserved,
+  uint64_t* out_inaccessible, size_t* out_inaccessible_count);
+
+/**
+ * @brief `prune_inaccessible_pa` with `access_reserved` from the config of `ctx`
+*/
+int ra_prune_inaccessible_pa(readalias_ctx_t* ctx, uint64_t* pas, size_t len, size_t* out_len);
+
+/**
+ * @brief `sendfile_pa` with the config of `ctx` as session config
+*/
+int ra_sendfile_pa(readalias_ctx_t* ctx, int out_fd, uint64_t pa, size_t count);
+
+/**
+ * @brief `map_pa` with `access_reserved` from the config of `ctx`. The mapping stays valid after
+ * `ra_close`, unmap it with `unmap_pa`
+*/
+void* ra_map_pa(readalias_ctx_t* ctx, uint64_t pa, size_t count, enum cache_mode cache_mode);
+
+/*
+ * Metrics. While enabled, the lib records the latency of each operation in a histogram, together with
+ * the number of calls, failed calls and the amount of work. Operations of all contexts and threads are
+ * summed up. The latency of batches, scans and probes includes the flushes that they issue, the flush
+ * operation only covers explicit flushes. Disabled by default, the overhead is a single branch
+*/
+
+enum ra_metric_op {
+  //`items` is the number of copied bytes
+  RA_OP_MEMCPY,
+  //`items` is the number of flushed bytes
+  RA_OP_FLUSH,
+  RA_OP_WBINVD,
+  //`items` is the number of executed descriptors
+  RA_OP_BATCH,
+  //`items` is the number of scanned pages
+  RA_OP_SCAN,
+  //`items` is the number of probed candidates
+  RA_OP_PROBE,
+  //`items` is the number of queried pages
+  RA_OP_PFN_STATE,
+  RA_OP_COUNT,
+};
+
+//HDR style latency histogram: values below 2^RA_HIST_SUB_BITS ns have their own bucket. Above, each power
+//of two is split into 2^RA_HIST_SUB_BITS linear buckets, i.e. the relative error is below 2^-RA_HIST_SUB_BITS
+#define RA_HIST_SUB_BITS 3
+#define RA_HIST_BUCKETS ((64 - RA_HIST_SUB_BITS + 1) << RA_HIST_SUB_BITS)
+
+struct ra_op_metrics {
+  uint64_t count;
+  uint64_t errors;
+  //amount of work, see enum ra_metric_op
+  uint64_t items;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t hist[RA_HIST_BUCKETS];
+};
+
+struct ra_metrics {
+  struct ra_op_metrics ops[RA_OP_COUNT];
+  //ioctls of the kernel module backend and mmap/munmap calls of the devmem backend
+  uint64_t syscalls;
+};
+
+/**
+ * @brief Enable or disable recording. The recorded values are kept, see `ra_metrics_reset`
+*/
+void ra_metrics_enable(bool enable);
+
+bool ra_metrics_enabled(void);
+
+/**
+ * @brief Copy the values recorded so far to `out`. Thread safe, concurrent operations are either
+ * fully or partially included
+*/
+void ra_metrics_snapshot(struct ra_metrics* out);
+
+/**
+ * @brief Set all recorded values to zero
+*/
+void ra_metrics_reset(void);
+
+/**
+ * @brief Short lower case name of `op`, e.g. "memcpy"
+*/
+const char* ra_metric_op_name(enum ra_metric_op op);
+
+/**
+ * @brief Lower bound of histogram bucket `idx` in ns
+*/
+uint64_t ra_hist_bucket_ns(size_t idx);
+
+/**
+ * @brief Latency below which `q` (0 to 1) of the operations completed, rounded up to the bucket bound.
+ * 0 if nothing has been recorded
+*/
+uint64_t ra_metrics_quantile_ns(const struct ra_op_metrics* m, double q);
+
+/**
+ * @brief Write `m` as JSON object with one member per operation and the syscall count to `f`, without newline.
+ * Each operation holds the counters, mean, p50/p90/p99/p999 and max latency and the non empty histogram
+ * buckets as [lower bound in ns, count] pairs
+ * @returns 0 on success
+*/
+int ra_metrics_write_json(FILE* f, const struct ra_metrics* m);
+
+/**
+ * @brief Snapshot the current metrics and write them with `ra_metrics_write_json`, e.g. as "ops" of the
+ * progress lines of the tools
+ * @returns 0 on success. -1 without writing anything if the snapshot cannot be allocated
+*/
+int ra_metrics_write_current_json(FILE* f);
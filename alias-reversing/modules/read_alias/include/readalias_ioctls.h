@@ -14,6 +14,59 @@ enum flush_method {
   FM_CLFLUSH,
   //Flush using wbinvd on all cores
   FM_WBINVD,
+  //Flush the range or the whole cache, depending on what is faster for the
+  //size of the range. The module measures the crossover at load time
+  FM_AUTO,
+  //Flush using clflushopt with a single fence per range. Falls back to
+  //clflush if the cpu does not support it. Same as FM_CLFLUSH on RISC-V
+  FM_CLFLUSHOPT,
+  //Write back using clwb with a single fence per range. The lines may stay
+  //in the cache, so use this to get writes to DRAM, not to read from DRAM.
+  //Falls back to clflushopt/clflush. Uses clean instead of flush on RISC-V
+  FM_CLWB,
+};
+
+//Cache attributes for mappings of physical memory
+enum cache_mode {
+  //Use the default attributes of the kernel for the target memory
+  CM_DEFAULT,
+  //Cacheable, write-back
+  CM_WB,
+  //Uncached
+  CM_UC,
+  //Write-combining
+  CM_WC,
+};
+
+/*
+ * The mmap offset for /dev/readalias_dev selects the physical address of the
+ * mapping. The cache mode and the access reserved flag are encoded in the upper
+ * bits of the page offset. Use MMAP_OFFSET to build the offset
+ */
+#define MMAP_PAGE_SHIFT 12
+//bits [0,MMAP_CACHE_MODE_SHIFT[ of the page offset hold the pfn
+#define MMAP_PFN_MASK ((1ULL << 40) - 1)
+#define MMAP_CACHE_MODE_SHIFT 40
+#define MMAP_CACHE_MODE_MASK 0x3ULL
+//if set, we allow mapping pages even if they are marked as reserved
+#define MMAP_ACCESS_RESERVED_BIT (1ULL << 42)
+//`pa` must be page aligned
+#define MMAP_OFFSET(pa, cache_mode, access_reserved)                                  \
+  (((((uint64_t)(pa)) >> MMAP_PAGE_SHIFT) |                                           \
+    ((((uint64_t)(cache_mode)) & MMAP_CACHE_MODE_MASK) << MMAP_CACHE_MODE_SHIFT) |   \
+    ((access_reserved) ? MMAP_ACCESS_RESERVED_BIT : 0))                               \
+   << MMAP_PAGE_SHIFT)
+
+//How the module copies data from/to physical memory
+enum access_mode {
+  //Regular loads/stores through the mapping selected by the cache mode
+  AM_DEFAULT,
+  //Non-temporal stores that bypass the cache (movnti on x86). Falls back to
+  //regular stores followed by a write back of the lines (cbo.clean on RISC-V).
+  //Non-temporal loads from write-back memory may still hit the cache, thus
+  //reads use an uncached mapping unless another cache mode is selected.
+  //DRAM-coherent accesses in this mode do not require flushing
+  AM_NONTEMPORAL,
 };
 
 struct args {
@@ -30,9 +83,208 @@ struct args {
 #define FLUSH_PAGE     _IOW('f', 0x22, struct args*)
 #define WBINVD_AC      _IOW('f', 0x23, struct args*)
 
+//Arguments for the multi page memcpy ioctls. In contrast to `struct args`,
+//`count` may span an arbitrary number of pages. The kernel walks the pages
+//and copies directly from/to `buffer`
+struct range_args {
+  void* buffer;
+  uint64_t   count;
+  uint64_t   pa;
+  enum flush_method   flush;
+  //if 1, we access pages even if they are marked as reserved
+  int access_reserved;
+  //if 1, stop at the first page that is reserved or that we fail to map
+  int err_on_access_fail;
+  //Output param: number of pages skipped because they are reserved
+  uint64_t out_reserved_pages;
+  //Output param: number of pages skipped because we failed to map them
+  uint64_t out_map_failed;
+  //Output param: number of bytes processed. Smaller than `count` if we aborted early
+  uint64_t out_processed;
+};
+
+#define MEMCPY_TOPA_RANGE    _IOWR('f', 0x24, struct range_args*)
+#define MEMCPY_FROMPA_RANGE  _IOWR('f', 0x25, struct range_args*)
+
+enum batch_op {
+  //copy `len` bytes from `user_buf` to `pa`
+  BOP_TOPA,
+  //copy `len` bytes from `pa` to `user_buf`
+  BOP_FROMPA,
+  //flush [pa, pa+len[ with `flush`. For FM_WBINVD, `pa` and `len` are ignored
+  BOP_FLUSH,
+};
+
+//One operation of a BATCH_SUBMIT ioctl
+struct batch_desc {
+  enum batch_op op;
+  enum flush_method flush;
+  uint64_t pa;
+  uint64_t len;
+  void* user_buf;
+  //Output param: 0 on success, RET_RESERVED, RET_MAPFAIL or a negative error code
+  int64_t status;
+};
+
+//Arguments for the BATCH_SUBMIT ioctl. The kernel executes
+//the descriptors in order in a single kernel entry
+struct batch_args {
+  struct batch_desc* descs;
+  uint64_t count;
+  //if 1, we access pages even if they are marked as reserved
+  int access_reserved;
+  //if 1, stop at the first descriptor with a non zero status
+  int stop_on_error;
+  //Output param: number of descriptors that have been executed
+  uint64_t out_completed;
+};
+
+#define BATCH_SUBMIT         _IOWR('f', 0x26, struct batch_args*)
+
+//maximal length of the marker for the SCAN ioctl
+#define SCAN_MAX_MARKER_LEN 64
+
+//Arguments for the SCAN ioctl. The kernel compares the `marker_len` bytes at
+//start_pa, start_pa + stride, ... (< end_pa) with `marker` and reports the
+//matching addresses. Pages that are reserved or that we fail to map are skipped
+struct scan_args {
+  uint64_t start_pa;
+  uint64_t end_pa;
+  uint64_t stride;
+  uint8_t marker[SCAN_MAX_MARKER_LEN];
+  //only bits set in `mask` are compared. Ignored if `use_mask` is 0
+  uint8_t mask[SCAN_MAX_MARKER_LEN];
+  uint64_t marker_len;
+  int use_mask;
+  //flush the candidate before comparing. FM_WBINVD flushes once per ioctl
+  enum flush_method flush;
+  //if 1, we access pages even if they are marked as reserved
+  int access_reserved;
+  //user buffer for up to `max_matches` matching addresses
+  uint64_t* out_matches;
+  uint64_t max_matches;
+  //Output param: number of entries written to `out_matches`
+  uint64_t out_match_count;
+  //Output param: number of pages skipped because they are reserved
+  uint64_t out_reserved_pages;
+  //Output param: number of pages skipped because we failed to map them
+  uint64_t out_map_failed;
+  //Output param: first candidate that has not been scanned. Equal to or larger than
+  //`end_pa` if the whole range was scanned. Smaller if `out_matches` is full
+  uint64_t out_next_pa;
+};
+
+#define SCAN                 _IOWR('f', 0x27, struct scan_args*)
+
+//maximal message length for the PROBE ioctl
+#define PROBE_MAX_MSG_LEN 64
+
+//Arguments for the PROBE ioctl. Runs the XOR-differential alias test for
+//many candidates: write m1 to source_pa, read all candidates, write m2 to
+//source_pa, read all candidates again. A candidate is an alias if the xor of
+//both reads equals m1^m2. This works even if memory scrambling is active.
+//The candidates are processed in chunks, i.e. the source is written twice per chunk
+struct probe_args {
+  uint64_t source_pa;
+  //If not NULL, candidate i is `candidates[i]`. Otherwise, candidate i is
+  //`start_pa + i * stride`
+  uint64_t* candidates;
+  uint64_t start_pa;
+  uint64_t stride;
+  //number of candidates
+  uint64_t count;
+  uint8_t m1[PROBE_MAX_MSG_LEN];
+  uint8_t m2[PROBE_MAX_MSG_LEN];
+  //source_pa and all candidates must not cross a page boundary
+  uint64_t msg_len;
+  enum flush_method flush;
+  //if 1, we access pages even if they are marked as reserved
+  int access_reserved;
+  //Optional: if not NULL, filled with the status for each of the `count` candidates:
+  //0 if the candidate is an alias, RET_NO_ALIAS, RET_RESERVED or RET_MAPFAIL.
+  int8_t* out_status;
+  //Optional: user buffer for up to `max_matches` aliases
+  uint64_t* out_matches;
+  uint64_t max_matches;
+  //Output param: number of entries written to `out_matches`
+  uint64_t out_match_count;
+  //Output param: number of candidates skipped because their page is reserved
+  uint64_t out_reserved_pages;
+  //Output param: number of candidates skipped because we failed to map them
+  uint64_t out_map_failed;
+  //Output param: index of the first candidate that has not been processed.
+  //Smaller than `count` if `out_matches` is full
+  uint64_t out_next;
+};
+
+#define PROBE                _IOWR('f', 0x28, struct probe_args*)
+
+//Flush [pa, pa+count[ with `flush`. Uses `struct range_args`, `buffer` is ignored.
+//Line based methods issue a single fence for the whole range
+#define FLUSH_RANGE          _IOWR('f', 0x29, struct range_args*)
+
+//Arguments for the PFN_STATE ioctl. Computes the state of each page in
+//[start_pa, start_pa + pages * PAGE_SIZE[ in a single pass. Bit i of each
+//bitmap refers to page i of the range and is stored in bit i%64 of word i/64.
+//The bitmaps must hold at least DIV_ROUND_UP(pages, 64) words
+struct pfn_state_args {
+  //page aligned start of the range
+  uint64_t start_pa;
+  uint64_t pages;
+  //if 1, reserved pages are considered accessible
+  int access_reserved;
+  //Optional: bit is set if the pfn is not backed by a struct page (!pfn_valid)
+  uint64_t* out_invalid;
+  //Optional: bit is set if the page is marked as reserved
+  uint64_t* out_reserved;
+  //Optional: bit is set if accessing the page via the other ioctls fails
+  //with RET_RESERVED or RET_MAPFAIL
+  uint64_t* out_inaccessible;
+  //Output param: number of set bits in `out_inaccessible`
+  uint64_t out_inaccessible_count;
+};
+
+#define PFN_STATE            _IOWR('f', 0x2A, struct pfn_state_args*)
+
+//Per file descriptor defaults. Used by the TOPA_FAST/FROMPA_FAST ioctls and
+//by read/write/pread/pwrite/splice on the device, which treat the file
+//offset as physical address
+struct session_config {
+  enum flush_method flush;
+  //if 1, we access pages even if they are marked as reserved
+  int access_reserved;
+  //if 1, abort at the first inaccessible page. Otherwise, inaccessible pages
+  //are skipped: reads return zeros and writes are dropped
+  int err_on_access_fail;
+  //Cache attributes of the kernel mapping used for the accesses.
+  //CM_DEFAULT uses the (cached) mappings of the mapping cache. With CM_UC,
+  //accesses go to DRAM without flushing. CM_WC writes are fenced at the end.
+  //CM_UC/CM_WC fail with -EINVAL for RAM, which the direct map keeps write-back
+  enum cache_mode cache_mode;
+  enum access_mode access_mode;
+};
+
+#define SET_CONFIG           _IOW('f', 0x2B, struct session_config*)
+#define GET_CONFIG           _IOR('f', 0x2C, struct session_config*)
+
+//Arguments for the TOPA_FAST and FROMPA_FAST ioctls. Everything else is taken
+//from the session config. Return 0 on success and RET_RESERVED/RET_MAPFAIL
+//for the first inaccessible page. Only as large as required, to keep the
+//per call overhead low
+struct fast_args {
+  uint64_t pa;
+  uint64_t len;
+  void* buf;
+};
+
+#define TOPA_FAST            _IOW('f', 0x2D, struct fast_args*)
+#define FROMPA_FAST          _IOW('f', 0x2E, struct fast_args*)
+
 //ioctl return code to indicate that page is reserved
 #define RET_RESERVED 1
 //ioctl return code to indicate that we failed to map the page
 #define RET_MAPFAIL 2
+//PROBE status to indicate that the candidate is no alias
+#define RET_NO_ALIAS 3
 
 #endif
@@ -2,11 +2,38 @@
 #include <asm/pgtable.h>
 #include <asm/uaccess.h>
 #include <linux/cdev.h>    // device_create, ...
+#include <linux/debugfs.h>
 #include <linux/highmem.h> // kmap, kunmap
 #include <linux/io.h>
+#include <linux/mm.h> // remap_pfn_range
 #include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/refcount.h>
+#include <linux/sched/signal.h> // fatal_signal_pending
+#include <linux/seq_file.h>
+#include <linux/slab.h> // kmalloc, kfree
+#include <linux/smp.h>  // on_each_cpu
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/uio.h> // iov_iter
 #include <linux/version.h>
 #include <linux/vmalloc.h>
+#include <linux/xarray.h>
+#ifdef CONFIG_RISCV
+#include <asm/cacheflush.h> // riscv_cbom_block_size
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+#include <asm/cpufeature.h> // riscv_isa_extension_available
+#else
+#include <asm/hwcap.h>
+#endif
+#include <asm/sbi.h> // sbi_get_mvendorid
+#include <asm/vendorid_list.h>
+#endif
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>    // boot_cpu_has
+#include <asm/special_insns.h> // clflush, clflushopt, clwb
+#endif
 
 #include "include/readalias_ioctls.h"
 
@@ -18,6 +45,10 @@ enum mapping_type {
   MT_MEMREMAP,
 };
 
+// memremap flags used by custom_map for MT_MEMREMAP
+#define CUSTOM_MEMREMAP_FLAGS                                                  \
+  (MEMREMAP_WB | MEMREMAP_WT | MEMREMAP_WC | MEMREMAP_ENC | MEMREMAP_DEC)
+
 /**
  * @brief Try to map pfn using various strategies
  * @paramter pfn : page we want to map
@@ -39,9 +70,7 @@ void *custom_map(uint64_t pfn, enum mapping_type *out_mt,
     return mapping;
   }
   *out_mt = MT_MEMREMAP;
-  return memremap(pfn << PAGE_SHIFT, PAGE_SIZE,
-                  MEMREMAP_WB | MEMREMAP_WT | MEMREMAP_WC | MEMREMAP_ENC |
-                      MEMREMAP_DEC);
+  return memremap(pfn << PAGE_SHIFT, PAGE_SIZE, CUSTOM_MEMREMAP_FLAGS);
 }
 
 /**
@@ -52,7 +81,7 @@ void *custom_map(uint64_t pfn, enum mapping_type *out_mt,
 void custom_unmap(void *mapping, enum mapping_type mt) {
   switch (mt) {
   case MT_VMAP:
-    vfree(mapping);
+    vunmap(mapping);
     break;
   case MT_IOREMAP:
     iounmap((void __iomem *)mapping);
@@ -69,285 +98,2094 @@ void custom_unmap(void *mapping, enum mapping_type mt) {
 #define NAME "readalias"
 #define CACHELINE_SIZE 64
 
-static int major = -1;
-static struct cdev mycdev;
-static struct class *myclass = NULL;
+/*
+ * Mapping cache
+ *
+ * Creating and tearing down a mapping for every access is expensive (vmap or
+ * ioremap plus a TLB shootdown on unmap). Instead, we keep recently used
+ * windows of MAP_CACHE_WINDOW_PAGES pages mapped in a small LRU cache. Windows
+ * that cannot be mapped as a whole, e.g. because they contain both valid and
+ * invalid pfns, are cached page by page. The mapping type that worked is
+ * remembered, so that remapping an evicted window does not have to probe the
+ * different strategies again. For windows that are cached page by page, the
+ * types of the individual pages are only kept while one of the pages is cached.
+ *
+ * The cache is split into shards with separate locks. Windows are assigned to
+ * shards by their index, such that threads sweeping different ranges rarely
+ * contend for the same lock. Only misses take the lock. Hits pin the entry with
+ * refcount_inc_not_zero and check its window again, as it might have been
+ * refilled in between. The entries are allocated on load and only freed on
+ * unload, so the lockless lookup does not need RCU. Statistics are kept per
+ * cpu.
+ */
 
-unsigned char buffer[PAGE_SIZE];
+// Pages per cached window, i.e. 2 MiB for 4 KiB pages
+#define MAP_CACHE_WINDOW_PAGES 512UL
+// window_hints value for windows that must be mapped page by page
+#define MT_HINT_PER_PAGE 0xff
+// Number of independently locked shards
+#define MAP_CACHE_SHARDS 16
 
-void clflush_range(void *p, size_t size) {
-  size_t i;
-  for (i = 0; i < size; i += CACHELINE_SIZE) {
-    //  asm volatile("clflush 0(%0)\n" : : "c"(p+i) : "rax");
-    //  flushes on cache line
+static unsigned int map_cache_entries = 64;
+module_param(map_cache_entries, uint, 0444);
+MODULE_PARM_DESC(map_cache_entries,
+                 "Number of mappings kept by the mapping cache (0 disables it). "
+                 "Rounded up to a multiple of the number of shards");
+
+struct map_cache_entry {
+  // first pfn covered by the mapping
+  ull base_pfn;
+  // number of pages covered by the mapping. 0 marks an unused entry
+  unsigned long nr_pages;
+  enum mapping_type mt;
+  void *mapping;
+  // value of the shard's tick at the last lookup, used for LRU eviction. 0
+  // for unused entries
+  u64 last_use;
+  // 0 while the entry is unused or being refilled. Otherwise 1 for the cache
+  // plus 1 per user currently accessing the mapping. Only entries without
+  // users are evicted
+  refcount_t ref;
+};
+
+struct map_cache_shard {
+  // serializes misses, i.e. eviction and refill of the entries
+  struct mutex lock;
+  struct map_cache_entry *entries;
+  unsigned int nr_entries;
+  // incremented on every miss
+  u64 tick;
+} ____cacheline_aligned_in_smp;
+
+static struct {
+  struct map_cache_shard shards[MAP_CACHE_SHARDS];
+  // backing memory for the entries of all shards
+  struct map_cache_entry *entries;
+  // mapping type that worked for a window. Indexed by pfn / window pages
+  struct xarray window_hints;
+  // mapping type that worked for pages of windows with MT_HINT_PER_PAGE
+  struct xarray page_hints;
+} map_cache;
+
+// statistics, exported via debugfs
+struct map_cache_stats {
+  u64 hits;
+  u64 misses;
+  u64 evictions;
+  // accesses that used a temporary mapping because all entries were in use
+  u64 uncached;
+};
+static DEFINE_PER_CPU(struct map_cache_stats, map_cache_pcpu_stats);
+
+static struct dentry *debugfs_dir;
+
+// Handle for a mapped page. Obtain with map_pfn, release with unmap_pfn
+struct pfn_mapping {
+  // kernel virtual address of the page
+  unsigned char *va;
+  // cache entry holding the mapping or NULL for a temporary mapping
+  struct map_cache_entry *entry;
+  // mapping type of a temporary mapping
+  enum mapping_type mt;
+};
+
+/**
+ * @brief Map `nr_pages` pages starting at `pfn` with the given mapping type
+ * @returns valid mapping or NULL on error
+ */
+static void *map_pages_with_type(ull pfn, unsigned long nr_pages,
+                                 enum mapping_type mt) {
+  switch (mt) {
+  case MT_VMAP: {
+    struct page *single_page, **pages = &single_page;
+    void *mapping;
+    unsigned long i;
+
+    if (nr_pages > 1) {
+      pages = kmalloc_array(nr_pages, sizeof(*pages), GFP_KERNEL);
+      if (!pages)
+        return NULL;
+    }
+    for (i = 0; i < nr_pages; i++)
+      pages[i] = pfn_to_page(pfn + i);
+    mapping = vmap(pages, nr_pages, 0, PAGE_KERNEL_IO);
+    if (nr_pages > 1)
+      kfree(pages);
+    return mapping;
+  }
+  case MT_IOREMAP:
+    return (void __force *)ioremap(pfn << PAGE_SHIFT, nr_pages << PAGE_SHIFT);
+  case MT_MEMREMAP:
+    return memremap(pfn << PAGE_SHIFT, nr_pages << PAGE_SHIFT,
+                    CUSTOM_MEMREMAP_FLAGS);
+  default:
+    return NULL;
   }
-  // asm volatile("mfence\n");
-  // serialize memory accesses
 }
 
-void wbinvd_ac(void) {
-  // asm volatile("th.dcache.call");
-  //  write back invalidate command
-  //  wbinvd_on_all_cpus();
-}
+/**
+ * @brief Try to map the whole window starting at `base_pfn`, using the same
+ * strategies as custom_map
+ * @returns valid mapping or NULL if the window cannot be mapped as a whole
+ */
+static void *map_window(ull base_pfn, enum mapping_type *out_mt) {
+  unsigned long i, nr_valid = 0;
+  void *mapping;
 
-void custom_flush(void *mem, size_t bytes, enum flush_method fm) {
-  switch (fm) {
-  case FM_NONE: // No action required
-    break;
-  case FM_CLFLUSH:
-    return clflush_range(mem, bytes);
-    break;
-  case FM_WBINVD:
-    return wbinvd_ac();
-    break;
-  default:
-    printk("%s:%d invalid flush method %d\n", __FILE__, __LINE__, (int)fm);
-    break;
+  for (i = 0; i < MAP_CACHE_WINDOW_PAGES; i++) {
+    if (pfn_valid(base_pfn + i))
+      nr_valid++;
   }
+  if (nr_valid == MAP_CACHE_WINDOW_PAGES) {
+    *out_mt = MT_VMAP;
+    return map_pages_with_type(base_pfn, MAP_CACHE_WINDOW_PAGES, MT_VMAP);
+  }
+  // mixed windows are mapped page by page
+  if (nr_valid)
+    return NULL;
+
+  *out_mt = MT_IOREMAP;
+  mapping = map_pages_with_type(base_pfn, MAP_CACHE_WINDOW_PAGES, MT_IOREMAP);
+  if (mapping)
+    return mapping;
+  *out_mt = MT_MEMREMAP;
+  return map_pages_with_type(base_pfn, MAP_CACHE_WINDOW_PAGES, MT_MEMREMAP);
 }
 
 /**
- * Copy memory to destination.
- *
- * @param pa: The physical address to the page to flush. Any physical address
- *            within the target page works.
- * @param access_reserved : if true, try to access pa even if it is marked as
- * reserved
- *
- * @returns Whether the flushing was successful.
+ * @brief Create a mapping for `pfn` and store it in `e`. Must be called with
+ * the lock of the shard holding `e`
+ * @returns 0 on success
  */
-int flush_page(ull pa, int access_reserved) {
-  ull pfn;
-  struct page *page;
-  enum mapping_type mapping_type;
-  unsigned char *current_page;
+static int map_cache_fill(ull pfn, struct map_cache_entry *e) {
+  ull window_idx = pfn / MAP_CACHE_WINDOW_PAGES;
+  void *hint = xa_load(&map_cache.window_hints, window_idx);
+  struct page *page = pfn_valid(pfn) ? pfn_to_page(pfn) : NULL;
+  enum mapping_type mt;
+  void *mapping = NULL;
 
-  // printk("trying to flush 0x%llx\n", pa);
-  //  Temporarily disable SMAP, which prevents the kernel from reading/writing
-  //  user-space memory
-  // __uaccess_begin_nospec();
-  __enable_user_access();
+  if (!hint || xa_to_value(hint) != MT_HINT_PER_PAGE) {
+    ull base_pfn = window_idx * MAP_CACHE_WINDOW_PAGES;
 
-  pfn = pa >> PAGE_SHIFT;
-  page = pfn_to_page(pfn);
+    if (hint) {
+      mt = xa_to_value(hint);
+      mapping = map_pages_with_type(base_pfn, MAP_CACHE_WINDOW_PAGES, mt);
+    } else {
+      mapping = map_window(base_pfn, &mt);
+    }
+    xa_store(&map_cache.window_hints, window_idx,
+             xa_mk_value(mapping ? mt : MT_HINT_PER_PAGE), GFP_KERNEL);
+    if (mapping) {
+      WRITE_ONCE(e->base_pfn, base_pfn);
+      WRITE_ONCE(e->nr_pages, MAP_CACHE_WINDOW_PAGES);
+      e->mt = mt;
+      e->mapping = mapping;
+      return 0;
+    }
+  }
 
-  if (pfn_valid(pfn) && PageReserved(page) && !access_reserved) {
-    // printk("pfn valid but reserved page\n");
-    return RET_RESERVED;
+  hint = xa_load(&map_cache.page_hints, pfn);
+  if (hint) {
+    mt = xa_to_value(hint);
+    mapping = map_pages_with_type(pfn, 1, mt);
   }
+  if (!mapping) {
+    mapping = custom_map(pfn, &mt, &page);
+    if (!mapping)
+      return -ENOMEM;
+    xa_store(&map_cache.page_hints, pfn, xa_mk_value(mt), GFP_KERNEL);
+  }
+  WRITE_ONCE(e->base_pfn, pfn);
+  WRITE_ONCE(e->nr_pages, 1);
+  e->mt = mt;
+  e->mapping = mapping;
+  return 0;
+}
 
-  current_page = custom_map(pfn, &mapping_type, &page);
-  if (!current_page) {
-    printk("flush_page: failed to map 0x%llx\n", pa);
-    return RET_MAPFAIL;
+static struct map_cache_shard *pfn_to_shard(ull pfn) {
+  return &map_cache.shards[(pfn / MAP_CACHE_WINDOW_PAGES) % MAP_CACHE_SHARDS];
+}
+
+/**
+ * @brief Look up and pin the entry of `shard` that maps `pfn`. Does not take
+ * the shard lock
+ * @returns true if `out_m` has been filled
+ */
+static bool map_cache_lookup(struct map_cache_shard *shard, ull pfn,
+                             struct pfn_mapping *out_m) {
+  unsigned int i;
+
+  for (i = 0; i < shard->nr_entries; i++) {
+    struct map_cache_entry *e = shard->entries + i;
+    ull base_pfn = READ_ONCE(e->base_pfn);
+
+    if (pfn < base_pfn || pfn >= base_pfn + READ_ONCE(e->nr_pages))
+      continue;
+    if (!refcount_inc_not_zero(&e->ref))
+      continue;
+    // pairs with the smp_wmb in map_pfn. The entry might have been refilled
+    // with another window before we pinned it
+    smp_rmb();
+    if (pfn < e->base_pfn || pfn >= e->base_pfn + e->nr_pages) {
+      refcount_dec(&e->ref);
+      continue;
+    }
+    WRITE_ONCE(e->last_use, READ_ONCE(shard->tick));
+    this_cpu_inc(map_cache_pcpu_stats.hits);
+    out_m->entry = e;
+    out_m->va =
+        (unsigned char *)e->mapping + ((pfn - e->base_pfn) << PAGE_SHIFT);
+    return true;
   }
+  return false;
+}
 
-  clflush_range(current_page, PAGE_SIZE);
+/**
+ * @brief Unmap the mapping of `e`. Drops the page hints of its window if no
+ * other page of the window is cached anymore. Must be called with the lock of
+ * `shard` and without references to `e`
+ */
+static void map_cache_evict(struct map_cache_shard *shard,
+                            struct map_cache_entry *e) {
+  ull window_idx = e->base_pfn / MAP_CACHE_WINDOW_PAGES;
+  bool per_page = e->nr_pages != MAP_CACHE_WINDOW_PAGES;
+  unsigned long first = window_idx * MAP_CACHE_WINDOW_PAGES, idx;
+  unsigned int i;
+  void *hint;
 
-  custom_unmap(current_page, mapping_type);
+  custom_unmap(e->mapping, e->mt);
+  WRITE_ONCE(e->nr_pages, 0);
+  this_cpu_inc(map_cache_pcpu_stats.evictions);
+  if (!per_page)
+    return;
+  // all pages of a window are cached in the same shard
+  for (i = 0; i < shard->nr_entries; i++) {
+    struct map_cache_entry *other = shard->entries + i;
 
-  // Re-enable SMAP
-  //__uaccess_end();
-  __disable_user_access();
-  // printk("flushh successfull\n");
-  return 0;
+    if (other->nr_pages &&
+        other->base_pfn / MAP_CACHE_WINDOW_PAGES == window_idx)
+      return;
+  }
+  xa_for_each_range(&map_cache.page_hints, idx, hint, first,
+                    first + MAP_CACHE_WINDOW_PAGES - 1)
+    xa_erase(&map_cache.page_hints, idx);
 }
 
 /**
- * Copy memory to destination.
- *
- * @param dst: The physical address of the destination. All destination bytes
- *             must lay within the same page.
- * @param src: The buffer to copy from.
- * @param count: The number of bytes to copy.
- * @param flush: Whether to flush the page after writing to it and type of
- * flush. This ensures the data is written to DRAM.
- *
- * @returns Whether the copy was successful.
+ * @brief Get a kernel mapping for `pfn`. Serves the mapping from the mapping
+ * cache if possible. Release the mapping with `unmap_pfn`
+ * @param out_m : Output parameter, filled with the mapping
+ * @returns 0 on success
  */
-int memcpy_topage(ull dst, const void *src, size_t count,
-                  enum flush_method flush_method, int access_reserved) {
-  ull pfn, offset;
+static int map_pfn(ull pfn, struct pfn_mapping *out_m) {
+  struct map_cache_shard *shard = pfn_to_shard(pfn);
+  struct map_cache_entry *victim = NULL;
   struct page *page;
-  enum mapping_type mapping_type;
-  unsigned char *current_page;
+  unsigned int i;
 
-  // Temporarily disable SMAP, which prevents the kernel from reading/writing
-  // user-space memory
-  //
-  __enable_user_access();
-  // __uaccess_begin_nospec();
+  if (shard->nr_entries) {
+    if (map_cache_lookup(shard, pfn, out_m))
+      return 0;
 
-  pfn = dst >> PAGE_SHIFT;
-  page = pfn_to_page(pfn);
+    mutex_lock(&shard->lock);
+    // another thread might have mapped the window while we waited
+    if (map_cache_lookup(shard, pfn, out_m)) {
+      mutex_unlock(&shard->lock);
+      return 0;
+    }
+    this_cpu_inc(map_cache_pcpu_stats.misses);
+    WRITE_ONCE(shard->tick, shard->tick + 1);
+    for (i = 0; i < shard->nr_entries; i++) {
+      struct map_cache_entry *e = shard->entries + i;
 
-  // Writing to reserved pages can cause the system to crash
-  if (pfn_valid(pfn) && PageReserved(page) && !access_reserved) {
-    return RET_RESERVED;
+      // unused entries have last_use 0 and are preferred
+      if (refcount_read(&e->ref) <= 1 &&
+          (!victim || READ_ONCE(e->last_use) < READ_ONCE(victim->last_use)))
+        victim = e;
+    }
+
+    // unused entries can only be claimed with the lock, used ones might have
+    // been pinned since we looked at them
+    if (victim && (!refcount_read(&victim->ref) ||
+                   refcount_dec_if_one(&victim->ref))) {
+      int ret;
+
+      if (victim->nr_pages)
+        map_cache_evict(shard, victim);
+      ret = map_cache_fill(pfn, victim);
+      if (ret) {
+        WRITE_ONCE(victim->last_use, 0);
+        mutex_unlock(&shard->lock);
+        return ret;
+      }
+      WRITE_ONCE(victim->last_use, shard->tick);
+      out_m->entry = victim;
+      out_m->va = (unsigned char *)victim->mapping +
+                  ((pfn - victim->base_pfn) << PAGE_SHIFT);
+      // publish the new window before lookups can pin the entry. One
+      // reference for the cache and one for us
+      smp_wmb();
+      refcount_set(&victim->ref, 2);
+      mutex_unlock(&shard->lock);
+      return 0;
+    }
+    this_cpu_inc(map_cache_pcpu_stats.uncached);
+    mutex_unlock(&shard->lock);
   }
 
-  current_page = custom_map(pfn, &mapping_type, &page);
-  if (!current_page) {
-    printk("memcpy_topage: failed to map 0x%llx\n", dst);
-    return RET_MAPFAIL;
+  // cache disabled or all entries in use: temporary mapping
+  page = pfn_valid(pfn) ? pfn_to_page(pfn) : NULL;
+  out_m->entry = NULL;
+  out_m->va = custom_map(pfn, &out_m->mt, &page);
+  return out_m->va ? 0 : -ENOMEM;
+}
+
+/**
+ * @brief Release a mapping obtained with `map_pfn`
+ */
+static void unmap_pfn(struct pfn_mapping *m) {
+  if (!m->entry) {
+    custom_unmap(m->va, m->mt);
+    return;
+  }
+  // the reference of the cache keeps the entry mapped
+  refcount_dec(&m->entry->ref);
+}
+
+/**
+ * @brief Create a temporary mapping of `pfn` with the cache attributes `cm`,
+ * bypassing the mapping cache. Release the mapping with `unmap_pfn`.
+ * The direct map keeps RAM (pfns with a struct page) write-back. An uncached
+ * or write-combining alias of it is a memory type conflict with undefined
+ * results, e.g. on x86 with PAT. Thus, like memremap, CM_UC/CM_WC are refused
+ * for RAM. Non-temporal accesses are the only way to bypass the cache for RAM
+ * @returns 0 on success, -EINVAL for CM_UC/CM_WC on RAM
+ */
+static int map_pfn_cm(ull pfn, enum cache_mode cm, struct pfn_mapping *out_m) {
+  phys_addr_t pa = (phys_addr_t)pfn << PAGE_SHIFT;
+
+  out_m->entry = NULL;
+  if (pfn_valid(pfn)) {
+    struct page *page = pfn_to_page(pfn);
+
+    if (cm != CM_WB)
+      return -EINVAL;
+    out_m->mt = MT_VMAP;
+    out_m->va = vmap(&page, 1, 0, PAGE_KERNEL);
+  } else if (cm == CM_WB) {
+    out_m->mt = MT_MEMREMAP;
+    out_m->va = memremap(pa, PAGE_SIZE, MEMREMAP_WB);
+  } else {
+    out_m->mt = MT_IOREMAP;
+    out_m->va = (void __force *)(cm == CM_WC ? ioremap_wc(pa, PAGE_SIZE)
+                                             : ioremap(pa, PAGE_SIZE));
   }
+  return out_m->va ? 0 : -ENOMEM;
+}
+
+/**
+ * @brief Sum up the per cpu statistics of the mapping cache
+ */
+static struct map_cache_stats map_cache_sum_stats(void) {
+  struct map_cache_stats sum = {0};
+  int cpu;
+
+  for_each_possible_cpu(cpu) {
+    struct map_cache_stats *s = per_cpu_ptr(&map_cache_pcpu_stats, cpu);
 
-  offset = dst % PAGE_SIZE;
-  if (offset + count > PAGE_SIZE)
-    return -1;
-  memcpy(current_page + offset, src, count);
+    sum.hits += s->hits;
+    sum.misses += s->misses;
+    sum.evictions += s->evictions;
+    sum.uncached += s->uncached;
+  }
+  return sum;
+}
 
-  // Flushing ensures the data is written to DRAM
-  custom_flush(current_page, PAGE_SIZE, flush_method);
+static int map_cache_stats_show(struct seq_file *sf, void *unused) {
+  struct map_cache_stats stats = map_cache_sum_stats();
+  u64 lookups = stats.hits + stats.misses, used = 0, total = 0;
+  unsigned int i, j;
+  (void)unused;
 
-  custom_unmap(current_page, mapping_type);
-  // Re-enable SMAP
-  __disable_user_access();
-  //  __uaccess_end();
+  for (i = 0; i < MAP_CACHE_SHARDS; i++) {
+    struct map_cache_shard *shard = &map_cache.shards[i];
 
+    mutex_lock(&shard->lock);
+    for (j = 0; j < shard->nr_entries; j++) {
+      if (shard->entries[j].nr_pages)
+        used++;
+    }
+    total += shard->nr_entries;
+    mutex_unlock(&shard->lock);
+  }
+  seq_printf(sf, "entries: %llu/%llu\n", used, total);
+  seq_printf(sf, "hits: %llu\nmisses: %llu\nevictions: %llu\nuncached: %llu\n",
+             stats.hits, stats.misses, stats.evictions, stats.uncached);
+  // hit rate in hundredths of a percent
+  seq_printf(sf, "hit_rate: %llu.%02llu%%\n",
+             lookups ? stats.hits * 100 / lookups : 0,
+             lookups ? (stats.hits * 10000 / lookups) % 100 : 0);
   return 0;
 }
+DEFINE_SHOW_ATTRIBUTE(map_cache_stats);
 
-/**
- * Copy memory to buffer.
+// debugfs files for the individual counters
+#define MAP_CACHE_COUNTER_ATTR(name)                                           \
+  static int map_cache_##name##_get(void *data, u64 *val) {                   \
+    (void)data;                                                                \
+    *val = map_cache_sum_stats().name;                                         \
+    return 0;                                                                  \
+  }                                                                            \
+  DEFINE_DEBUGFS_ATTRIBUTE(map_cache_##name##_fops, map_cache_##name##_get,    \
+                           NULL, "%llu\n")
+
+MAP_CACHE_COUNTER_ATTR(hits);
+MAP_CACHE_COUNTER_ATTR(misses);
+MAP_CACHE_COUNTER_ATTR(evictions);
+MAP_CACHE_COUNTER_ATTR(uncached);
+
+static int map_cache_init(void) {
+  unsigned int i, per_shard = DIV_ROUND_UP(map_cache_entries, MAP_CACHE_SHARDS);
+
+  xa_init(&map_cache.window_hints);
+  xa_init(&map_cache.page_hints);
+  if (per_shard) {
+    map_cache.entries = kcalloc(per_shard * MAP_CACHE_SHARDS,
+                                sizeof(*map_cache.entries), GFP_KERNEL);
+    if (!map_cache.entries)
+      return -ENOMEM;
+  }
+  for (i = 0; i < MAP_CACHE_SHARDS; i++) {
+    struct map_cache_shard *shard = &map_cache.shards[i];
+
+    mutex_init(&shard->lock);
+    shard->tick = 0;
+    shard->nr_entries = map_cache.entries ? per_shard : 0;
+    shard->entries = map_cache.entries ? map_cache.entries + i * per_shard : NULL;
+  }
+
+  debugfs_dir = debugfs_create_dir(NAME, NULL);
+  debugfs_create_file_unsafe("map_cache_hits", 0444, debugfs_dir, NULL,
+                             &map_cache_hits_fops);
+  debugfs_create_file_unsafe("map_cache_misses", 0444, debugfs_dir, NULL,
+                             &map_cache_misses_fops);
+  debugfs_create_file_unsafe("map_cache_evictions", 0444, debugfs_dir, NULL,
+                             &map_cache_evictions_fops);
+  debugfs_create_file_unsafe("map_cache_uncached", 0444, debugfs_dir, NULL,
+                             &map_cache_uncached_fops);
+  debugfs_create_file("map_cache_stats", 0444, debugfs_dir, NULL,
+                      &map_cache_stats_fops);
+  return 0;
+}
+
+static void map_cache_destroy(void) {
+  unsigned int i, j;
+
+  debugfs_remove_recursive(debugfs_dir);
+  debugfs_dir = NULL;
+  for (i = 0; i < MAP_CACHE_SHARDS; i++) {
+    struct map_cache_shard *shard = &map_cache.shards[i];
+
+    for (j = 0; j < shard->nr_entries; j++) {
+      struct map_cache_entry *e = shard->entries + j;
+
+      if (e->nr_pages)
+        custom_unmap(e->mapping, e->mt);
+    }
+    shard->nr_entries = 0;
+    shard->entries = NULL;
+  }
+  kfree(map_cache.entries);
+  map_cache.entries = NULL;
+  xa_destroy(&map_cache.window_hints);
+  xa_destroy(&map_cache.page_hints);
+}
+
+static int major = -1;
+static struct cdev mycdev;
+static struct class *myclass = NULL;
+
+/*
+ * Cache maintenance. The implementation is selected at module load, see the
+ * `flush_impl` module parameter.
  *
- * @param dst: The buffer to copy to.
- * @param src: The physical address to copy from. All source bytes must lay
- *             within the same page.
- * @param count: The number of bytes to copy.
- * @param flush: Whether to flush the page before reading from it. This ensures
- *               the data is read from DRAM.
+ * T-Head C9xx cores (e.g. SG2042 on the Milk-V Pioneer) implement the vendor
+ * specific th.dcache.* / th.l2cache.* instructions. Standard RISC-V cores
+ * implement Zicbom (cbo.flush). Zicbom has no whole-cache operation, thus
+ * FM_WBINVD falls back to flushing the requested range.
+ * We emit the RISC-V instructions as raw words with the address in a0, so that
+ * the module builds with toolchains that do not know the extensions.
  *
- * @returns Whether the copy was successful.
+ * On x86, we use clflush/clflushopt/clwb if CPUID reports them. Line flushes
+ * are not ordered with later loads, so each range ends with a single fence.
  */
-int memcpy_frompage(void *dst, ull src, size_t count,
-                    enum flush_method flush_method, int access_reserved) {
-  ull pfn, offset;
-  struct page *page;
-  enum mapping_type mapping_type;
-  unsigned char *current_page;
+enum flush_impl {
+  FI_NONE,
+  FI_THEAD,
+  FI_ZICBOM,
+  FI_X86,
+};
 
-  // Temporarily disable SMAP, which prevents the kernel from reading/writing
-  // user-space memory
-  __enable_user_access();
-  //__uaccess_begin_nospec();
+static const char *const flush_impl_names[] = {"none", "thead", "zicbom",
+                                               "x86"};
 
-  pfn = src >> PAGE_SHIFT;
-  page = pfn_to_page(pfn);
+static char *flush_impl_param = "auto";
+module_param_named(flush_impl, flush_impl_param, charp, 0444);
+MODULE_PARM_DESC(flush_impl, "Cache maintenance instructions: auto (default), "
+                             "thead, zicbom, x86 or none");
 
-  if (pfn_valid(pfn) && PageReserved(page) && !access_reserved) {
-    //   printk("memcpy_frompage: src=0x%llx : reserved page (pfn_valid=%d)\n",
-    //   src, pfn_valid(pfn));
-    return RET_RESERVED;
-  }
+static unsigned long flush_crossover = 0;
+module_param(flush_crossover, ulong, 0644);
+MODULE_PARM_DESC(flush_crossover,
+                 "Range size in bytes above which FM_AUTO flushes the whole "
+                 "cache instead of the range. Measured at load time if 0");
 
-  current_page = custom_map(pfn, &mapping_type, &page);
-  if (!current_page) {
-    printk("memcpy_frompage: src=0x%llx : failed to map\n", src);
-    return RET_MAPFAIL;
+static enum flush_impl flush_impl = FI_NONE;
+// Granularity of the line based flush instructions
+static unsigned int flush_line_size = CACHELINE_SIZE;
+
+#ifdef CONFIG_RISCV
+// th.dcache.civa a0: clean and invalidate the L1 line of the virtual address
+#define THEAD_DCACHE_CIVA_A0 ".long 0x0275000b"
+// th.dcache.cva a0: clean the L1 line of the virtual address
+#define THEAD_DCACHE_CVA_A0 ".long 0x0255000b"
+// th.dcache.ciall: clean and invalidate the whole L1 dcache
+#define THEAD_DCACHE_CIALL ".long 0x0030000b"
+// th.l2cache.ciall: clean and invalidate the whole L2 cache
+#define THEAD_L2CACHE_CIALL ".long 0x0170000b"
+// th.sync.s: wait until all cache operations have completed on all harts
+#define THEAD_SYNC_S ".long 0x0190000b"
+// cbo.flush 0(a0)
+#define CBO_FLUSH_A0 ".long 0x0025200f"
+// cbo.clean 0(a0)
+#define CBO_CLEAN_A0 ".long 0x0015200f"
+
+static void flush_lines_thead(unsigned long addr, unsigned long end,
+                              bool clean_only) {
+  for (; addr < end; addr += flush_line_size) {
+    register unsigned long a0 asm("a0") = addr;
+    if (clean_only)
+      asm volatile(THEAD_DCACHE_CVA_A0 : : "r"(a0) : "memory");
+    else
+      asm volatile(THEAD_DCACHE_CIVA_A0 : : "r"(a0) : "memory");
   }
+}
 
-  offset = src % PAGE_SIZE;
-  if (offset + count > PAGE_SIZE) {
-    printk(
-        "memcpy_frompage: src=0x%llx : offset + count larger than page size\n",
-        src);
-    return -1;
+static void flush_lines_zicbom(unsigned long addr, unsigned long end,
+                               bool clean_only) {
+  for (; addr < end; addr += flush_line_size) {
+    register unsigned long a0 asm("a0") = addr;
+    if (clean_only)
+      asm volatile(CBO_CLEAN_A0 : : "r"(a0) : "memory");
+    else
+      asm volatile(CBO_FLUSH_A0 : : "r"(a0) : "memory");
   }
+}
+
+static void flush_all_thead_local(void *unused) {
+  (void)unused;
+  asm volatile(THEAD_DCACHE_CIALL : : : "memory");
+  // The L2 is shared per cluster. Flushing it from every hart is redundant
+  // but reaches all clusters without knowing the topology
+  asm volatile(THEAD_L2CACHE_CIALL : : : "memory");
+  asm volatile(THEAD_SYNC_S : : : "memory");
+}
+
+static bool thead_available(void) {
+#ifdef CONFIG_RISCV_SBI
+  return sbi_get_mvendorid() == THEAD_VENDOR_ID;
+#else
+  return false;
+#endif
+}
 
-  custom_flush(current_page, PAGE_SIZE, flush_method);
+static bool zicbom_available(void) {
+#ifdef CONFIG_RISCV_ISA_ZICBOM
+  return riscv_isa_extension_available(NULL, ZICBOM);
+#else
+  return false;
+#endif
+}
 
-  memcpy(dst, current_page + offset, count);
+static unsigned int zicbom_block_size(void) {
+#ifdef CONFIG_RISCV_ISA_ZICBOM
+  if (riscv_cbom_block_size)
+    return riscv_cbom_block_size;
+#endif
+  return CACHELINE_SIZE;
+}
+#endif
 
-  custom_unmap(current_page, mapping_type);
+#ifdef CONFIG_X86
+// Set at load time from CPUID
+static bool x86_has_clflushopt;
+static bool x86_has_clwb;
 
-  // Re-enable SMAP
-  __disable_user_access();
-  //__uaccess_end();
+static void flush_lines_x86(unsigned long addr, unsigned long end,
+                            enum flush_method fm) {
+  // Fall back to the next stronger instruction if the cpu lacks one
+  if (fm == FM_CLWB && !x86_has_clwb)
+    fm = FM_CLFLUSHOPT;
+  if (fm == FM_CLFLUSHOPT && !x86_has_clflushopt)
+    fm = FM_CLFLUSH;
 
-  return 0;
+  for (; addr < end; addr += flush_line_size) {
+    switch (fm) {
+    case FM_CLWB:
+      clwb((void *)addr);
+      break;
+    case FM_CLFLUSHOPT:
+      clflushopt((void *)addr);
+      break;
+    default:
+      clflush((void *)addr);
+      break;
+    }
+  }
 }
+#endif
 
-static int open(struct inode *inode, struct file *file) {
-  (void)inode;
-  (void)file;
-  printk("Opened module.\n");
-  return 0;
+/**
+ * @brief Issue the line flush instructions for all cache lines overlapping
+ * [p, p+size[ without waiting for their completion. Use `flush_fence`
+ * afterwards
+ * @param fm : FM_CLFLUSH, FM_CLFLUSHOPT or FM_CLWB. FM_CLWB only writes back
+ * the lines, the others also invalidate them
+ */
+static void flush_lines(void *p, size_t size, enum flush_method fm) {
+  unsigned long addr = (unsigned long)p & ~(unsigned long)(flush_line_size - 1);
+  unsigned long end = (unsigned long)p + size;
+
+  switch (flush_impl) {
+#ifdef CONFIG_RISCV
+  case FI_THEAD:
+    flush_lines_thead(addr, end, fm == FM_CLWB);
+    break;
+  case FI_ZICBOM:
+    flush_lines_zicbom(addr, end, fm == FM_CLWB);
+    break;
+#endif
+#ifdef CONFIG_X86
+  case FI_X86:
+    flush_lines_x86(addr, end, fm);
+    break;
+#endif
+  default:
+    break;
+  }
 }
 
-static int close(struct inode *inode, struct file *file) {
-  (void)inode;
-  (void)file;
-  printk("Closed module.\n");
-  return 0;
+/**
+ * @brief Wait until all previously issued line flushes have completed
+ */
+static void flush_fence(void) {
+  switch (flush_impl) {
+#ifdef CONFIG_RISCV
+  case FI_THEAD:
+    asm volatile(THEAD_SYNC_S : : : "memory");
+    break;
+  case FI_ZICBOM:
+    asm volatile("fence rw, rw" : : : "memory");
+    break;
+#endif
+  case FI_X86:
+    // mfence, also orders the flushes with later loads
+    mb();
+    break;
+  default:
+    break;
+  }
 }
 
-static long ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
-  struct args args;
-  (void)file;
+/**
+ * @brief Clean and invalidate all cache lines overlapping [p, p+size[
+ */
+void clflush_range(void *p, size_t size) {
+  flush_lines(p, size, FM_CLFLUSH);
+  flush_fence();
+}
 
-  switch (cmd) {
-  case MEMCPY_TOPA:
-    if (copy_from_user(&args, (const void *)arg, sizeof(args)))
-      return -1;
-    if (copy_from_user(buffer, args.buffer, args.count))
-      return -1;
-    return memcpy_topage(args.pa, buffer, args.count, args.flush,
-                         args.access_reserved);
-  case MEMCPY_FROMPA: {
-    int cpy_ret;
-    if (copy_from_user(&args, (const void *)arg, sizeof(args)))
-      return -1;
-    // we use the retval to communicate reserved page and mapping errs
-    // separately
-    //  only < 0 is a hard error. store retval to return it after copy to user
-    cpy_ret = memcpy_frompage(buffer, args.pa, args.count, args.flush,
-                              args.access_reserved);
-    if (cpy_ret < 0) {
-      return cpy_ret;
-    }
-    if (copy_to_user(args.buffer, buffer, args.count)) {
-      return -1;
-    }
-    return cpy_ret;
+/**
+ * @brief Clean and invalidate the whole data cache on all cores
+ * @returns 0 on success, -EOPNOTSUPP if the implementation cannot flush the
+ * whole cache
+ */
+int wbinvd_ac(void) {
+  switch (flush_impl) {
+#ifdef CONFIG_RISCV
+  case FI_THEAD:
+    on_each_cpu(flush_all_thead_local, NULL, 1);
+    return 0;
+#endif
+#ifdef CONFIG_X86
+  case FI_X86:
+    wbinvd_on_all_cpus();
+    return 0;
+#endif
+  default:
+    return -EOPNOTSUPP;
   }
+}
 
-  case FLUSH_PAGE:
-    if (copy_from_user(&args, (const void *)arg, sizeof(args)))
-      return -1;
-    return flush_page(args.pa, args.access_reserved);
-  case WBINVD_AC:
-    wbinvd_ac();
-    return 0;
+static bool is_line_flush(enum flush_method fm) {
+  return fm == FM_CLFLUSH || fm == FM_CLFLUSHOPT || fm == FM_CLWB;
+}
+
+static bool flush_all_supported(void) {
+  return flush_impl == FI_THEAD || flush_impl == FI_X86;
+}
+
+/**
+ * @brief Resolve the flush method for a flush of `bytes` bytes. FM_AUTO
+ * becomes FM_WBINVD above the crossover and the fastest line flush
+ * otherwise. FM_WBINVD becomes a line flush if we cannot flush the whole cache
+ */
+static enum flush_method resolve_flush(enum flush_method fm, u64 bytes) {
+  switch (fm) {
+  case FM_AUTO:
+    if (flush_all_supported() && flush_crossover && bytes >= flush_crossover)
+      return FM_WBINVD;
+    return FM_CLFLUSHOPT;
+  case FM_WBINVD:
+    return flush_all_supported() ? FM_WBINVD : FM_CLFLUSHOPT;
   default:
-    printk("Unknown cmd=%ud\n", cmd);
-    break;
+    return fm;
   }
-  return 0;
 }
 
-static const struct file_operations fops = {
-    .open = open,
-    .owner = THIS_MODULE,
-    .release = close,
-    .unlocked_ioctl = ioctl,
-};
+void custom_flush(void *mem, size_t bytes, enum flush_method fm) {
+  enum flush_method resolved = resolve_flush(fm, bytes);
 
-static void cleanup(int device_created) {
-  if (device_created) {
-    device_destroy(myclass, major);
-    cdev_del(&mycdev);
+  switch (resolved) {
+  case FM_NONE: // No action required
+    break;
+  case FM_CLFLUSH:
+  case FM_CLFLUSHOPT:
+  case FM_CLWB:
+    flush_lines(mem, bytes, resolved);
+    flush_fence();
+    break;
+  case FM_WBINVD:
+    wbinvd_ac();
+    break;
+  default:
+    printk("%s:%d invalid flush method %d\n", __FILE__, __LINE__, (int)fm);
+    break;
   }
-  if (myclass)
-    class_destroy(myclass);
-  if (major != -1)
-    unregister_chrdev_region(major, 1);
 }
 
-static int __init findpattern_init(void) {
-  int device_created = 0;
+// Size of the buffer used to measure the line flush throughput
+#define FLUSH_CALIBRATION_BYTES (1UL << 20)
+
+/**
+ * @brief Measure after how many bytes flushing the range takes longer than
+ * flushing the whole cache
+ * @returns the crossover in bytes or 0 if FM_AUTO should always flush ranges
+ */
+static unsigned long flush_calibrate(void) {
+  u8 *buf;
+  u64 t_start, t_range, t_all;
+  unsigned long crossover;
+
+  if (wbinvd_ac())
+    return 0;
+  buf = vmalloc(FLUSH_CALIBRATION_BYTES);
+  if (!buf)
+    return 0;
 
+  // Dirty the buffer such that the flushes have to write back data
+  memset(buf, 0xa5, FLUSH_CALIBRATION_BYTES);
+  t_start = ktime_get_ns();
+  // FM_AUTO uses FM_CLFLUSHOPT below the crossover
+  flush_lines(buf, FLUSH_CALIBRATION_BYTES, FM_CLFLUSHOPT);
+  flush_fence();
+  t_range = ktime_get_ns() - t_start;
+
+  memset(buf, 0x5a, FLUSH_CALIBRATION_BYTES);
+  t_start = ktime_get_ns();
+  wbinvd_ac();
+  t_all = ktime_get_ns() - t_start;
+  vfree(buf);
+
+  crossover = div64_u64((u64)FLUSH_CALIBRATION_BYTES * t_all,
+                        max_t(u64, t_range, 1));
+  printk("flush calibration: %lu bytes by line: %llu ns, whole cache: %llu "
+         "ns\n",
+         FLUSH_CALIBRATION_BYTES, t_range, t_all);
+  return max_t(unsigned long, crossover, PAGE_SIZE);
+}
+
+/**
+ * @brief Select the cache maintenance implementation and measure the FM_AUTO
+ * crossover
+ * @returns 0 on success
+ */
+static int flush_init(void) {
+  if (sysfs_streq(flush_impl_param, "none")) {
+    flush_impl = FI_NONE;
+#ifdef CONFIG_RISCV
+  } else if (sysfs_streq(flush_impl_param, "thead")) {
+    flush_impl = FI_THEAD;
+  } else if (sysfs_streq(flush_impl_param, "zicbom")) {
+    flush_impl = FI_ZICBOM;
+  } else if (sysfs_streq(flush_impl_param, "auto")) {
+    if (thead_available())
+      flush_impl = FI_THEAD;
+    else if (zicbom_available())
+      flush_impl = FI_ZICBOM;
+#elif defined(CONFIG_X86)
+  } else if (sysfs_streq(flush_impl_param, "x86") ||
+             sysfs_streq(flush_impl_param, "auto")) {
+    flush_impl = FI_X86;
+#else
+  } else if (sysfs_streq(flush_impl_param, "auto")) {
+    flush_impl = FI_NONE;
+#endif
+  } else {
+    printk("unsupported flush_impl \"%s\"\n", flush_impl_param);
+    return -EINVAL;
+  }
+#ifdef CONFIG_RISCV
+  if (flush_impl == FI_ZICBOM)
+    flush_line_size = zicbom_block_size();
+#endif
+#ifdef CONFIG_X86
+  x86_has_clflushopt = boot_cpu_has(X86_FEATURE_CLFLUSHOPT);
+  x86_has_clwb = boot_cpu_has(X86_FEATURE_CLWB);
+  if (boot_cpu_data.x86_clflush_size)
+    flush_line_size = boot_cpu_data.x86_clflush_size;
+  printk("x86 flush instructions: clflush%s%s\n",
+         x86_has_clflushopt ? ", clflushopt" : "",
+         x86_has_clwb ? ", clwb" : "");
+#endif
+
+  if (flush_impl == FI_NONE)
+    printk("WARNING: no cache maintenance implementation, flushes are no-ops\n");
+  if (!flush_crossover)
+    flush_crossover = flush_calibrate();
+  printk("flush_impl=%s, line size %u, FM_AUTO crossover %lu bytes\n",
+         flush_impl_names[flush_impl], flush_line_size, flush_crossover);
+  return 0;
+}
+
+/**
+ * @brief Check access permissions for pfn and map it with the cache
+ * attributes `cm`. CM_DEFAULT uses the mapping cache
+ * @returns 0 on success, RET_RESERVED or RET_MAPFAIL. -EINVAL if `cm` is not
+ * supported for `pfn`, see map_pfn_cm
+ */
+static int access_pfn_cm(ull pfn, int access_reserved, enum cache_mode cm,
+                         struct pfn_mapping *out_m) {
+  struct page *page = pfn_valid(pfn) ? pfn_to_page(pfn) : NULL;
+  int ret;
+
+  if (page && PageReserved(page) && !access_reserved)
+    return RET_RESERVED;
+  ret = cm == CM_DEFAULT ? map_pfn(pfn, out_m) : map_pfn_cm(pfn, cm, out_m);
+  if (ret == -EINVAL)
+    return ret;
+  return ret ? RET_MAPFAIL : 0;
+}
+
+static int access_pfn(ull pfn, int access_reserved, struct pfn_mapping *out_m) {
+  return access_pfn_cm(pfn, access_reserved, CM_DEFAULT, out_m);
+}
+
+/**
+ * @brief Cache mode of the mapping of `pfn` for an access with `cm` and `am`.
+ * Non-temporal loads are not guaranteed to bypass the cache for write-back
+ * memory, thus non-temporal reads use an uncached mapping outside of RAM. RAM
+ * must stay write-back (see map_pfn_cm), there the lines are evicted before
+ * the read instead, see read_needs_flush
+ */
+static enum cache_mode access_cm(ull pfn, enum cache_mode cm,
+                                 enum access_mode am, bool to_pa) {
+  if (am == AM_NONTEMPORAL && !to_pa && cm == CM_DEFAULT && !pfn_valid(pfn))
+    return CM_UC;
+  return cm;
+}
+
+/**
+ * @brief Whether a read of `pfn` with `cm` and `am` has to evict the lines
+ * first, i.e. a non-temporal read through a write-back mapping
+ */
+static bool read_needs_flush(ull pfn, enum cache_mode cm, enum access_mode am) {
+  enum cache_mode mapped = access_cm(pfn, cm, am, false);
+
+  return am == AM_NONTEMPORAL && (mapped == CM_DEFAULT || mapped == CM_WB);
+}
+
+/**
+ * @brief Whether writes with `cm` and `am` need a trailing fence to reach
+ * DRAM, i.e. non-temporal stores and write-combining buffers
+ */
+static bool write_needs_fence(enum cache_mode cm, enum access_mode am) {
+  return am == AM_NONTEMPORAL || cm == CM_WC;
+}
+
+/**
+ * @brief Copy from user space with non-temporal stores if the architecture
+ * supports this. Otherwise copy and write back the lines. Requires a fence
+ * afterwards
+ * @returns number of bytes that could not be copied
+ */
+static unsigned long copy_from_user_nt(void *dst, const void __user *src,
+                                       size_t len) {
+#ifdef CONFIG_ARCH_HAS_UACCESS_FLUSHCACHE
+  if (!access_ok(src, len))
+    return len;
+  return __copy_from_user_flushcache(dst, src, len);
+#else
+  unsigned long not_copied = copy_from_user(dst, src, len);
+
+  flush_lines(dst, len - not_copied, FM_CLWB);
+  return not_copied;
+#endif
+}
+
+/**
+ * @brief Like copy_from_user_nt for an iov_iter
+ * @returns number of copied bytes
+ */
+static size_t copy_from_iter_nt(void *dst, size_t len, struct iov_iter *iter) {
+#ifdef CONFIG_ARCH_HAS_UACCESS_FLUSHCACHE
+  return copy_from_iter_flushcache(dst, len, iter);
+#else
+  size_t copied = copy_from_iter(dst, len, iter);
+
+  flush_lines(dst, copied, FM_CLWB);
+  return copied;
+#endif
+}
+
+/**
+ * @brief Flush the physical memory range [pa, pa+count[ of `ra`. Line flushes
+ * are issued for the whole range, followed by a single fence.
+ *
+ * @param ra: Arguments as passed by userspace. `buffer` is ignored. The `out_`
+ * fields are updated with the per page reserved/map fail counts and the
+ * processed bytes.
+ *
+ * @returns 0 on success, RET_RESERVED/RET_MAPFAIL if we aborted due to
+ * `err_on_access_fail` and a negative error code on hard errors.
+ */
+static long flush_range(struct range_args *ra) {
+  ull pa = ra->pa;
+  u64 remaining = ra->count;
+  enum flush_method fm = resolve_flush(ra->flush, ra->count);
+  long ret = 0;
+
+  ra->out_reserved_pages = 0;
+  ra->out_map_failed = 0;
+  ra->out_processed = 0;
+  if (fm == FM_WBINVD)
+    wbinvd_ac();
+  if (!is_line_flush(fm)) {
+    ra->out_processed = ra->count;
+    return 0;
+  }
+
+  while (remaining) {
+    ull pfn = pa >> PAGE_SHIFT;
+    ull offset = pa % PAGE_SIZE;
+    size_t chunk = min_t(u64, remaining, PAGE_SIZE - offset);
+    struct pfn_mapping mapping;
+    int status = access_pfn(pfn, ra->access_reserved, &mapping);
+
+    if (!status) {
+      flush_lines(mapping.va + offset, chunk, fm);
+      unmap_pfn(&mapping);
+    } else if (status == RET_RESERVED) {
+      ra->out_reserved_pages += 1;
+    } else {
+      ra->out_map_failed += 1;
+    }
+    if (status && ra->err_on_access_fail) {
+      ret = status;
+      break;
+    }
+
+    pa += chunk;
+    remaining -= chunk;
+    ra->out_processed += chunk;
+
+    if (fatal_signal_pending(current)) {
+      ret = -EINTR;
+      break;
+    }
+    cond_resched();
+  }
+
+  flush_fence();
+  return ret;
+}
+
+/**
+ * @brief Copy between a user buffer and an arbitrary large physical memory
+ * range. Walks the range page by page inside the kernel and copies directly
+ * from/to the user buffer, i.e. without a kernel bounce buffer. This keeps the
+ * function reentrant. Flushing needs a single fence for the whole range: reads
+ * flush the whole range before copying, writes flush each page after copying
+ * and fence at the end.
+ *
+ * @param ra: Arguments as passed by userspace. The `out_` fields are updated
+ * with the per page reserved/map fail counts and the processed bytes.
+ * @param to_pa: If true, copy from the user buffer to physical memory.
+ * Otherwise copy from physical memory to the user buffer.
+ * @param cm: Cache attributes of the mapping used for the copy
+ * @param am: Regular or non-temporal accesses
+ *
+ * @returns 0 on success, RET_RESERVED/RET_MAPFAIL if we aborted due to
+ * `err_on_access_fail` and a negative error code on hard errors.
+ */
+static long memcpy_range(struct range_args *ra, bool to_pa, enum cache_mode cm,
+                         enum access_mode am) {
+  ull pa = ra->pa;
+  unsigned char __user *ubuf = (unsigned char __user *)ra->buffer;
+  u64 remaining = ra->count;
+  enum flush_method fm = resolve_flush(ra->flush, ra->count);
+  long ret = 0;
+
+  if (!to_pa && fm != FM_NONE) {
+    // Access errors are counted by the copy loop below
+    struct range_args fr = *ra;
+
+    fr.flush = fm;
+    fr.err_on_access_fail = 0;
+    ret = flush_range(&fr);
+    if (ret < 0)
+      return ret;
+    fm = FM_NONE;
+  }
+
+  ra->out_reserved_pages = 0;
+  ra->out_map_failed = 0;
+  ra->out_processed = 0;
+  while (remaining) {
+    ull pfn = pa >> PAGE_SHIFT;
+    ull offset = pa % PAGE_SIZE;
+    size_t chunk = min_t(u64, remaining, PAGE_SIZE - offset);
+    struct pfn_mapping mapping;
+    int status;
+    unsigned long not_copied = 0;
+
+    status = access_pfn_cm(pfn, ra->access_reserved,
+                           access_cm(pfn, cm, am, to_pa), &mapping);
+    if (status < 0) {
+      ret = status;
+      break;
+    }
+    if (!status) {
+      if (to_pa && am == AM_NONTEMPORAL) {
+        not_copied = copy_from_user_nt(mapping.va + offset, ubuf, chunk);
+      } else if (to_pa) {
+        not_copied = copy_from_user(mapping.va + offset, ubuf, chunk);
+        // Flushing ensures the data is written to DRAM
+        if (is_line_flush(fm))
+          flush_lines(mapping.va + offset, chunk, fm);
+      } else {
+        if (read_needs_flush(pfn, cm, am)) {
+          flush_lines(mapping.va + offset, chunk, FM_CLFLUSH);
+          flush_fence();
+        }
+        not_copied = copy_to_user(ubuf, mapping.va + offset, chunk);
+      }
+      unmap_pfn(&mapping);
+    }
+
+    if (not_copied) {
+      ret = -EFAULT;
+      break;
+    }
+    if (status == RET_RESERVED)
+      ra->out_reserved_pages += 1;
+    else if (status == RET_MAPFAIL)
+      ra->out_map_failed += 1;
+    if (status && ra->err_on_access_fail) {
+      ret = status;
+      break;
+    }
+
+    pa += chunk;
+    ubuf += chunk;
+    remaining -= chunk;
+    ra->out_processed += chunk;
+
+    // Large ranges may take a while, don't hog the cpu and allow to abort
+    if (fatal_signal_pending(current)) {
+      ret = -EINTR;
+      break;
+    }
+    cond_resched();
+  }
+
+  // Also write back partial writes if we aborted early
+  if (to_pa && (is_line_flush(fm) || write_needs_fence(cm, am)))
+    flush_fence();
+  if (to_pa && fm == FM_WBINVD)
+    wbinvd_ac();
+  return ret;
+}
+
+/**
+ * @brief Ioctl handler for MEMCPY_TOPA_RANGE and MEMCPY_FROMPA_RANGE
+ */
+static long ioctl_memcpy_range(unsigned long arg, bool to_pa) {
+  struct range_args ra;
+  long ret;
+
+  if (copy_from_user(&ra, (const void __user *)arg, sizeof(ra)))
+    return -EFAULT;
+  ret = memcpy_range(&ra, to_pa, CM_DEFAULT, AM_DEFAULT);
+  // Always report progress, even if we aborted early
+  if (copy_to_user((void __user *)arg, &ra, sizeof(ra)))
+    return -EFAULT;
+  return ret;
+}
+
+/**
+ * @brief Ioctl handler for FLUSH_RANGE
+ */
+static long ioctl_flush_range(unsigned long arg) {
+  struct range_args ra;
+  long ret;
+
+  if (copy_from_user(&ra, (const void __user *)arg, sizeof(ra)))
+    return -EFAULT;
+  ret = flush_range(&ra);
+  if (copy_to_user((void __user *)arg, &ra, sizeof(ra)))
+    return -EFAULT;
+  return ret;
+}
+
+/**
+ * @brief Ioctl handler for the single page MEMCPY_TOPA and MEMCPY_FROMPA
+ * ioctls. All bytes must lay within the same page
+ * @returns 0 on success, RET_RESERVED/RET_MAPFAIL if the page is not
+ * accessible and a negative error code on hard errors
+ */
+static long ioctl_memcpy_page(unsigned long arg, bool to_pa) {
+  struct args args;
+  struct range_args ra;
+
+  if (copy_from_user(&args, (const void __user *)arg, sizeof(args)))
+    return -EFAULT;
+  if ((args.pa % PAGE_SIZE) + args.count > PAGE_SIZE) {
+    printk("memcpy_page: pa=0x%llx : offset + count larger than page size\n",
+           (ull)args.pa);
+    return -EINVAL;
+  }
+  ra = (struct range_args){
+      .buffer = args.buffer,
+      .count = args.count,
+      .pa = args.pa,
+      .flush = args.flush,
+      .access_reserved = args.access_reserved,
+      .err_on_access_fail = 1,
+  };
+  return memcpy_range(&ra, to_pa, CM_DEFAULT, AM_DEFAULT);
+}
+
+/**
+ * @brief Flush all pages of the physical memory range [pa, pa+count[
+ * @param flush_method: FM_WBINVD flushes the whole cache once, all other
+ * methods are applied to each page of the range. FM_AUTO picks based on the
+ * range size
+ * @returns 0 on success, RET_RESERVED or RET_MAPFAIL for the first page
+ * that could not be flushed
+ */
+static long flush_range_pa(ull pa, u64 count, enum flush_method flush_method,
+                           int access_reserved) {
+  ull start = pa & PAGE_MASK;
+  struct range_args ra = {
+      .pa = start,
+      .count = PAGE_ALIGN(pa + max_t(u64, count, 1)) - start,
+      .flush = flush_method,
+      .access_reserved = access_reserved,
+      .err_on_access_fail = 1,
+  };
+
+  return flush_range(&ra);
+}
+
+// Number of descriptors that we copy from userspace at once
+#define BATCH_CHUNK 64
+
+// Per open file state
+struct ra_fd {
+  // Scratch buffer for BATCH_CHUNK batch descriptors. Threads sharing the
+  // file descriptor fall back to a temporary allocation if it is in use
+  struct mutex scratch_lock;
+  struct batch_desc *scratch;
+  // Defaults for read/write/splice, set with SET_CONFIG
+  spinlock_t cfg_lock;
+  struct session_config cfg;
+};
+
+/**
+ * @brief Execute a single batch descriptor
+ * @returns the status code for the descriptor
+ */
+static long exec_batch_desc(const struct batch_desc *desc,
+                            int access_reserved) {
+  struct range_args ra = {
+      .buffer = desc->user_buf,
+      .count = desc->len,
+      .pa = desc->pa,
+      .flush = desc->flush,
+      .access_reserved = access_reserved,
+      .err_on_access_fail = 1,
+  };
+
+  switch (desc->op) {
+  case BOP_TOPA:
+    return memcpy_range(&ra, true, CM_DEFAULT, AM_DEFAULT);
+  case BOP_FROMPA:
+    return memcpy_range(&ra, false, CM_DEFAULT, AM_DEFAULT);
+  case BOP_FLUSH:
+    return flush_range_pa(desc->pa, desc->len, desc->flush, access_reserved);
+  default:
+    return -EINVAL;
+  }
+}
+
+/**
+ * @brief Ioctl handler for BATCH_SUBMIT. Executes all descriptors in order
+ * and stores the status of each descriptor in its `status` field
+ */
+static long ioctl_batch_submit(struct ra_fd *fd, unsigned long arg) {
+  struct batch_args ba;
+  struct batch_desc *descs;
+  struct batch_desc __user *udescs;
+  bool own_scratch;
+  long ret = 0;
+  u64 done = 0;
+
+  if (copy_from_user(&ba, (const void __user *)arg, sizeof(ba)))
+    return -EFAULT;
+  udescs = (struct batch_desc __user *)ba.descs;
+
+  own_scratch = mutex_trylock(&fd->scratch_lock);
+  if (own_scratch) {
+    descs = fd->scratch;
+  } else {
+    descs = kmalloc_array(BATCH_CHUNK, sizeof(*descs), GFP_KERNEL);
+    if (!descs)
+      return -ENOMEM;
+  }
+
+  while (done < ba.count) {
+    u64 i, n = min_t(u64, ba.count - done, BATCH_CHUNK);
+    bool stop = false;
+
+    if (copy_from_user(descs, udescs + done, n * sizeof(*descs))) {
+      ret = -EFAULT;
+      break;
+    }
+    for (i = 0; i < n; i++) {
+      descs[i].status = exec_batch_desc(descs + i, ba.access_reserved);
+      if (descs[i].status == -EINTR || descs[i].status == -EFAULT ||
+          (descs[i].status && ba.stop_on_error)) {
+        stop = true;
+        i++;
+        break;
+      }
+    }
+    // Only the status fields are output params
+    for (u64 j = 0; j < i; j++) {
+      if (put_user(descs[j].status, &udescs[done + j].status)) {
+        ret = -EFAULT;
+        stop = true;
+        break;
+      }
+    }
+    done += i;
+    if (stop)
+      break;
+  }
+
+  if (own_scratch)
+    mutex_unlock(&fd->scratch_lock);
+  else
+    kfree(descs);
+  ba.out_completed = done;
+  if (copy_to_user((void __user *)arg, &ba, sizeof(ba)))
+    return -EFAULT;
+  return ret;
+}
+
+/**
+ * @brief Compare `len` bytes at `va` with `marker`, only considering the bits
+ * set in `mask`
+ */
+static bool scan_cmp(const u8 *va, const u8 *marker, const u8 *mask, u64 len) {
+  u64 i;
+
+  for (i = 0; i < len; i++) {
+    if ((va[i] ^ marker[i]) & mask[i])
+      return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Compare the marker with the candidate at `pa`, flushing it first.
+ * `cur` must be the mapping of the page containing `pa`. If the candidate
+ * crosses a page boundary, the next page is mapped temporarily
+ */
+static bool scan_candidate(const struct scan_args *sa, const u8 *mask, ull pa,
+                           struct pfn_mapping *cur, enum flush_method fm) {
+  ull offset = pa % PAGE_SIZE;
+  u64 first = min_t(u64, sa->marker_len, PAGE_SIZE - offset);
+  struct pfn_mapping next;
+  bool match;
+
+  custom_flush(cur->va + offset, first, fm);
+  if (!scan_cmp(cur->va + offset, sa->marker, mask, first))
+    return false;
+  if (first == sa->marker_len)
+    return true;
+
+  // Access errors for the next page are counted once we reach it
+  if (access_pfn((pa >> PAGE_SHIFT) + 1, sa->access_reserved, &next))
+    return false;
+  custom_flush(next.va, sa->marker_len - first, fm);
+  match = scan_cmp(next.va, sa->marker + first, mask + first,
+                   sa->marker_len - first);
+  unmap_pfn(&next);
+  return match;
+}
+
+/**
+ * @brief Scan the candidates start_pa, start_pa + stride, ... < end_pa for the
+ * marker and store the matching addresses in `sa->out_matches`. Stops early if
+ * `out_matches` is full. The `out_` fields of `sa` are updated accordingly
+ * @returns 0 on success and a negative error code on hard errors
+ */
+static long scan_range(struct scan_args *sa) {
+  u64 __user *umatches = (u64 __user *)sa->out_matches;
+  enum flush_method fm = sa->flush;
+  u8 mask[SCAN_MAX_MARKER_LEN];
+  struct pfn_mapping cur;
+  ull cur_pfn = 0;
+  bool have_cur = false;
+  int cur_status = 0;
+  long ret = 0;
+  ull pa;
+
+  sa->out_match_count = 0;
+  sa->out_reserved_pages = 0;
+  sa->out_map_failed = 0;
+  sa->out_next_pa = sa->start_pa;
+  if (!sa->marker_len || sa->marker_len > SCAN_MAX_MARKER_LEN || !sa->stride)
+    return -EINVAL;
+
+  if (sa->use_mask)
+    memcpy(mask, sa->mask, sizeof(mask));
+  else
+    memset(mask, 0xff, sizeof(mask));
+  if (sa->end_pa > sa->start_pa)
+    fm = resolve_flush(fm, div64_u64(sa->end_pa - sa->start_pa, sa->stride) *
+                               sa->marker_len);
+  // Flushing the whole cache once is sufficient
+  if (fm == FM_WBINVD) {
+    wbinvd_ac();
+    fm = FM_NONE;
+  }
+
+  for (pa = sa->start_pa; pa < sa->end_pa; pa += sa->stride) {
+    ull pfn = pa >> PAGE_SHIFT;
+
+    if (!have_cur || pfn != cur_pfn) {
+      if (have_cur && !cur_status)
+        unmap_pfn(&cur);
+      // Large ranges may take a while, don't hog the cpu and allow to abort
+      if (fatal_signal_pending(current)) {
+        have_cur = false;
+        ret = -EINTR;
+        break;
+      }
+      cond_resched();
+
+      cur_status = access_pfn(pfn, sa->access_reserved, &cur);
+      cur_pfn = pfn;
+      have_cur = true;
+      if (cur_status == RET_RESERVED)
+        sa->out_reserved_pages += 1;
+      else if (cur_status == RET_MAPFAIL)
+        sa->out_map_failed += 1;
+    }
+    if (cur_status || !scan_candidate(sa, mask, pa, &cur, fm))
+      goto next;
+
+    if (sa->out_match_count == sa->max_matches)
+      break;
+    if (put_user(pa, umatches + sa->out_match_count)) {
+      ret = -EFAULT;
+      break;
+    }
+    sa->out_match_count += 1;
+  next:
+    // Avoid an endless loop if end_pa is close to the end of the address space
+    if (pa + sa->stride < pa) {
+      pa = sa->end_pa;
+      break;
+    }
+  }
+
+  if (have_cur && !cur_status)
+    unmap_pfn(&cur);
+  sa->out_next_pa = pa;
+  return ret;
+}
+
+/**
+ * @brief Ioctl handler for SCAN
+ */
+static long ioctl_scan(unsigned long arg) {
+  struct scan_args sa;
+  long ret;
+
+  if (copy_from_user(&sa, (const void __user *)arg, sizeof(sa)))
+    return -EFAULT;
+  ret = scan_range(&sa);
+  if (copy_to_user((void __user *)arg, &sa, sizeof(sa)))
+    return -EFAULT;
+  return ret;
+}
+
+// Number of candidates that are processed per phase of the PROBE protocol
+#define PROBE_CHUNK 64
+
+// Scratch state for one PROBE ioctl
+struct probe_state {
+  u64 cand[PROBE_CHUNK];
+  s8 status[PROBE_CHUNK];
+  u8 buf1[PROBE_CHUNK][PROBE_MAX_MSG_LEN];
+};
+
+/**
+ * @brief Write `len` bytes to pa and flush them to memory. The write must not
+ * cross a page boundary
+ * @returns 0 on success, RET_RESERVED or RET_MAPFAIL
+ */
+static int probe_write(ull pa, const u8 *msg, u64 len, enum flush_method fm,
+                       int access_reserved) {
+  struct pfn_mapping m;
+  int status = access_pfn(pa >> PAGE_SHIFT, access_reserved, &m);
+
+  if (status)
+    return status;
+  memcpy(m.va + (pa % PAGE_SIZE), msg, len);
+  custom_flush(m.va + (pa % PAGE_SIZE), len, fm);
+  unmap_pfn(&m);
+  return 0;
+}
+
+/**
+ * @brief Flush and read `len` bytes from pa. The read must not cross a page
+ * boundary
+ * @returns 0 on success, RET_RESERVED or RET_MAPFAIL
+ */
+static int probe_read(ull pa, u8 *buf, u64 len, enum flush_method fm,
+                      int access_reserved) {
+  struct pfn_mapping m;
+  int status = access_pfn(pa >> PAGE_SHIFT, access_reserved, &m);
+
+  if (status)
+    return status;
+  custom_flush(m.va + (pa % PAGE_SIZE), len, fm);
+  memcpy(buf, m.va + (pa % PAGE_SIZE), len);
+  unmap_pfn(&m);
+  return 0;
+}
+
+/**
+ * @brief Run one phase of the probe protocol for the `n` candidates in `ps`:
+ * write `msg` to the source and read all candidates that are still pending
+ * @param second : If false, store the reads in `ps->buf1`. Otherwise, compare
+ * buf1 ^ read with m1 ^ m2 and update the status
+ * @returns 0 on success, RET_RESERVED or RET_MAPFAIL if the source is not
+ * accessible
+ */
+static int probe_phase(const struct probe_args *pa, struct probe_state *ps,
+                       u64 n, bool second) {
+  enum flush_method fm = resolve_flush(pa->flush, n * pa->msg_len);
+  u8 buf2[PROBE_MAX_MSG_LEN];
+  int status;
+  u64 i, j;
+
+  // For FM_WBINVD, the whole-cache flush below also writes back the source
+  status = probe_write(pa->source_pa, second ? pa->m2 : pa->m1, pa->msg_len,
+                       fm == FM_WBINVD ? FM_NONE : fm, pa->access_reserved);
+  if (status)
+    return status;
+  // Flushing the whole cache once per phase is sufficient
+  if (fm == FM_WBINVD) {
+    wbinvd_ac();
+    fm = FM_NONE;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (ps->status[i])
+      continue;
+    if (!second) {
+      ps->status[i] = probe_read(ps->cand[i], ps->buf1[i], pa->msg_len, fm,
+                                 pa->access_reserved);
+      continue;
+    }
+    ps->status[i] =
+        probe_read(ps->cand[i], buf2, pa->msg_len, fm, pa->access_reserved);
+    if (ps->status[i])
+      continue;
+    for (j = 0; j < pa->msg_len; j++) {
+      if ((ps->buf1[i][j] ^ buf2[j]) != (pa->m1[j] ^ pa->m2[j])) {
+        ps->status[i] = RET_NO_ALIAS;
+        break;
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Load the next `n` candidates starting at index `next`
+ * @returns 0 on success and a negative error code on hard errors
+ */
+static long probe_load_candidates(const struct probe_args *pa,
+                                  struct probe_state *ps, u64 next, u64 n) {
+  u64 i;
+
+  if (pa->candidates) {
+    if (copy_from_user(ps->cand, (const u64 __user *)pa->candidates + next,
+                       n * sizeof(u64)))
+      return -EFAULT;
+  } else {
+    for (i = 0; i < n; i++)
+      ps->cand[i] = pa->start_pa + (next + i) * pa->stride;
+  }
+  for (i = 0; i < n; i++) {
+    if ((ps->cand[i] % PAGE_SIZE) + pa->msg_len > PAGE_SIZE)
+      return -EINVAL;
+    // Without this, the source would trivially be its own alias
+    ps->status[i] = ps->cand[i] == pa->source_pa ? RET_NO_ALIAS : 0;
+  }
+  return 0;
+}
+
+/**
+ * @brief Execute the XOR-differential alias test for all candidates of `pa`.
+ * The `out_` fields of `pa` are updated accordingly
+ * @returns 0 on success, RET_RESERVED/RET_MAPFAIL if the source is not
+ * accessible and a negative error code on hard errors
+ */
+static long probe_candidates(struct probe_args *pa) {
+  s8 __user *ustatus = (s8 __user *)pa->out_status;
+  u64 __user *umatches = (u64 __user *)pa->out_matches;
+  struct probe_state *ps;
+  long ret = 0;
+  u64 next, i;
+
+  pa->out_match_count = 0;
+  pa->out_reserved_pages = 0;
+  pa->out_map_failed = 0;
+  pa->out_next = 0;
+  if (!pa->msg_len || pa->msg_len > PROBE_MAX_MSG_LEN ||
+      (pa->source_pa % PAGE_SIZE) + pa->msg_len > PAGE_SIZE)
+    return -EINVAL;
+
+  ps = kmalloc(sizeof(*ps), GFP_KERNEL);
+  if (!ps)
+    return -ENOMEM;
+
+  for (next = 0; next < pa->count; next += PROBE_CHUNK) {
+    u64 n = min_t(u64, PROBE_CHUNK, pa->count - next);
+
+    ret = probe_load_candidates(pa, ps, next, n);
+    if (ret)
+      break;
+    ret = probe_phase(pa, ps, n, false);
+    if (!ret)
+      ret = probe_phase(pa, ps, n, true);
+    if (ret)
+      break;
+
+    for (i = 0; i < n; i++) {
+      if (ps->status[i] == RET_RESERVED)
+        pa->out_reserved_pages += 1;
+      else if (ps->status[i] == RET_MAPFAIL)
+        pa->out_map_failed += 1;
+    }
+    if (ustatus && copy_to_user(ustatus + next, ps->status, n)) {
+      ret = -EFAULT;
+      break;
+    }
+    for (i = 0; i < n; i++) {
+      if (ps->status[i] || !umatches)
+        continue;
+      // Resume at the first match that did not fit
+      if (pa->out_match_count == pa->max_matches)
+        break;
+      if (put_user(ps->cand[i], umatches + pa->out_match_count)) {
+        ret = -EFAULT;
+        break;
+      }
+      pa->out_match_count += 1;
+    }
+    pa->out_next = next + i;
+    if (ret || i < n)
+      break;
+
+    // Large ranges may take a while, don't hog the cpu and allow to abort
+    if (fatal_signal_pending(current)) {
+      ret = -EINTR;
+      break;
+    }
+    cond_resched();
+  }
+
+  kfree(ps);
+  return ret;
+}
+
+/**
+ * @brief Ioctl handler for PROBE
+ */
+static long ioctl_probe(unsigned long arg) {
+  struct probe_args pa;
+  long ret;
+
+  if (copy_from_user(&pa, (const void __user *)arg, sizeof(pa)))
+    return -EFAULT;
+  ret = probe_candidates(&pa);
+  if (copy_to_user((void __user *)arg, &pa, sizeof(pa)))
+    return -EFAULT;
+  return ret;
+}
+
+/**
+ * @brief Write the bitmap word `w` to `ubitmap[idx]` if `ubitmap` is not NULL
+ * @returns 0 on success
+ */
+static int put_bitmap_word(u64 __user *ubitmap, u64 idx, u64 w) {
+  if (!ubitmap)
+    return 0;
+  return put_user(w, ubitmap + idx) ? -EFAULT : 0;
+}
+
+/**
+ * @brief Compute the pfn state bitmaps of `sa` in a single pass over the
+ * range. Accessibility is determined exactly like for the other ioctls, i.e.
+ * with `access_pfn`. Thanks to the mapping cache, this maps each window of the
+ * range only once.
+ * @returns 0 on success and a negative error code on hard errors
+ */
+static long pfn_state(struct pfn_state_args *sa) {
+  u64 __user *uinvalid = (u64 __user *)sa->out_invalid;
+  u64 __user *ureserved = (u64 __user *)sa->out_reserved;
+  u64 __user *uinaccessible = (u64 __user *)sa->out_inaccessible;
+  ull base_pfn = sa->start_pa >> PAGE_SHIFT;
+  u64 word_idx;
+
+  sa->out_inaccessible_count = 0;
+  if (sa->start_pa % PAGE_SIZE)
+    return -EINVAL;
+
+  // one bitmap word per iteration, i.e. 64 pages
+  for (word_idx = 0; word_idx * 64 < sa->pages; word_idx++) {
+    u64 invalid = 0, reserved = 0, inaccessible = 0;
+    u64 bit;
+
+    for (bit = 0; bit < 64 && word_idx * 64 + bit < sa->pages; bit++) {
+      ull pfn = base_pfn + word_idx * 64 + bit;
+      struct page *page = pfn_valid(pfn) ? pfn_to_page(pfn) : NULL;
+      struct pfn_mapping mapping;
+
+      if (!page)
+        invalid |= 1ULL << bit;
+      else if (PageReserved(page))
+        reserved |= 1ULL << bit;
+
+      if (access_pfn(pfn, sa->access_reserved, &mapping)) {
+        inaccessible |= 1ULL << bit;
+        sa->out_inaccessible_count += 1;
+      } else {
+        unmap_pfn(&mapping);
+      }
+    }
+
+    if (put_bitmap_word(uinvalid, word_idx, invalid) ||
+        put_bitmap_word(ureserved, word_idx, reserved) ||
+        put_bitmap_word(uinaccessible, word_idx, inaccessible))
+      return -EFAULT;
+
+    if (fatal_signal_pending(current))
+      return -EINTR;
+    cond_resched();
+  }
+  return 0;
+}
+
+/**
+ * @brief Ioctl handler for PFN_STATE
+ */
+static long ioctl_pfn_state(unsigned long arg) {
+  struct pfn_state_args sa;
+  long ret;
+
+  if (copy_from_user(&sa, (const void __user *)arg, sizeof(sa)))
+    return -EFAULT;
+  ret = pfn_state(&sa);
+  if (copy_to_user((void __user *)arg, &sa, sizeof(sa)))
+    return -EFAULT;
+  return ret;
+}
+
+/**
+ * @brief Ioctl handler for SET_CONFIG
+ */
+static long ioctl_set_config(struct ra_fd *fd, unsigned long arg) {
+  struct session_config cfg;
+
+  if (copy_from_user(&cfg, (const void __user *)arg, sizeof(cfg)))
+    return -EFAULT;
+  if (cfg.flush > FM_CLWB || cfg.cache_mode > CM_WC ||
+      cfg.access_mode > AM_NONTEMPORAL)
+    return -EINVAL;
+  spin_lock(&fd->cfg_lock);
+  fd->cfg = cfg;
+  spin_unlock(&fd->cfg_lock);
+  return 0;
+}
+
+static struct session_config get_config(struct ra_fd *fd) {
+  struct session_config cfg;
+
+  spin_lock(&fd->cfg_lock);
+  cfg = fd->cfg;
+  spin_unlock(&fd->cfg_lock);
+  return cfg;
+}
+
+/**
+ * @brief Ioctl handler for GET_CONFIG
+ */
+static long ioctl_get_config(struct ra_fd *fd, unsigned long arg) {
+  struct session_config cfg = get_config(fd);
+
+  if (copy_to_user((void __user *)arg, &cfg, sizeof(cfg)))
+    return -EFAULT;
+  return 0;
+}
+
+/**
+ * @brief Ioctl handler for TOPA_FAST and FROMPA_FAST. Like the range ioctls
+ * but with the flush method, access policy and cache mode of the session
+ * @returns 0 on success, RET_RESERVED/RET_MAPFAIL for the first page that
+ * could not be accessed and a negative error code on hard errors
+ */
+static long ioctl_memcpy_fast(struct ra_fd *fd, unsigned long arg,
+                              bool to_pa) {
+  struct session_config cfg = get_config(fd);
+  struct fast_args fa;
+  struct range_args ra;
+  long ret;
+
+  if (copy_from_user(&fa, (const void __user *)arg, sizeof(fa)))
+    return -EFAULT;
+  ra = (struct range_args){
+      .buffer = fa.buf,
+      .count = fa.len,
+      .pa = fa.pa,
+      .flush = cfg.flush,
+      .access_reserved = cfg.access_reserved,
+      .err_on_access_fail = cfg.err_on_access_fail,
+  };
+  ret = memcpy_range(&ra, to_pa, cfg.cache_mode, cfg.access_mode);
+  if (ret)
+    return ret;
+  if (ra.out_reserved_pages)
+    return RET_RESERVED;
+  if (ra.out_map_failed)
+    return RET_MAPFAIL;
+  return 0;
+}
+
+/**
+ * @brief Common implementation of read_iter and write_iter. The file offset
+ * is the physical address. Works like `memcpy_range` but copies from/to an
+ * iov_iter, which also allows splicing physical memory without a user space
+ * buffer. Flushing, the access policy and the cache mode follow the session
+ * config.
+ *
+ * @returns the number of copied bytes or a negative error code if nothing
+ * was copied
+ */
+static ssize_t rw_iter(struct kiocb *iocb, struct iov_iter *iter, bool to_pa) {
+  struct session_config cfg = get_config(iocb->ki_filp->private_data);
+  ull pa = iocb->ki_pos;
+  enum flush_method fm = resolve_flush(cfg.flush, iov_iter_count(iter));
+  ssize_t done = 0;
+  long ret = 0;
+
+  if (!to_pa && fm != FM_NONE) {
+    // Access errors are handled by the copy loop below
+    struct range_args fr = {
+        .pa = pa,
+        .count = iov_iter_count(iter),
+        .flush = fm,
+        .access_reserved = cfg.access_reserved,
+        .err_on_access_fail = 0,
+    };
+
+    ret = flush_range(&fr);
+    if (ret < 0)
+      return ret;
+    fm = FM_NONE;
+  }
+
+  while (iov_iter_count(iter)) {
+    ull offset = pa % PAGE_SIZE;
+    size_t chunk = min_t(size_t, iov_iter_count(iter), PAGE_SIZE - offset);
+    ull pfn = pa >> PAGE_SHIFT;
+    struct pfn_mapping mapping;
+    size_t copied;
+    int status;
+
+    status = access_pfn_cm(
+        pfn, cfg.access_reserved,
+        access_cm(pfn, cfg.cache_mode, cfg.access_mode, to_pa), &mapping);
+    if (status < 0) {
+      ret = status;
+      break;
+    }
+    if (status) {
+      if (cfg.err_on_access_fail) {
+        ret = -EIO;
+        break;
+      }
+      // inaccessible pages read as zeros, writes to them are dropped
+      if (to_pa) {
+        iov_iter_advance(iter, chunk);
+        copied = chunk;
+      } else {
+        copied = iov_iter_zero(chunk, iter);
+      }
+    } else if (to_pa && cfg.access_mode == AM_NONTEMPORAL) {
+      copied = copy_from_iter_nt(mapping.va + offset, chunk, iter);
+      unmap_pfn(&mapping);
+    } else if (to_pa) {
+      copied = copy_from_iter(mapping.va + offset, chunk, iter);
+      if (is_line_flush(fm))
+        flush_lines(mapping.va + offset, copied, fm);
+      unmap_pfn(&mapping);
+    } else {
+      if (read_needs_flush(pfn, cfg.cache_mode, cfg.access_mode)) {
+        flush_lines(mapping.va + offset, chunk, FM_CLFLUSH);
+        flush_fence();
+      }
+      copied = copy_to_iter(mapping.va + offset, chunk, iter);
+      unmap_pfn(&mapping);
+    }
+
+    pa += copied;
+    done += copied;
+    if (copied != chunk) {
+      ret = -EFAULT;
+      break;
+    }
+
+    if (fatal_signal_pending(current)) {
+      ret = -EINTR;
+      break;
+    }
+    cond_resched();
+  }
+
+  if (to_pa &&
+      (is_line_flush(fm) || write_needs_fence(cfg.cache_mode, cfg.access_mode)))
+    flush_fence();
+  if (to_pa && fm == FM_WBINVD)
+    wbinvd_ac();
+  iocb->ki_pos = pa;
+  return done ? done : ret;
+}
+
+static ssize_t read_iter(struct kiocb *iocb, struct iov_iter *iter) {
+  return rw_iter(iocb, iter, false);
+}
+
+static ssize_t write_iter(struct kiocb *iocb, struct iov_iter *iter) {
+  return rw_iter(iocb, iter, true);
+}
+
+static int open(struct inode *inode, struct file *file) {
+  struct ra_fd *fd;
+  (void)inode;
+
+  fd = kzalloc(sizeof(*fd), GFP_KERNEL);
+  if (!fd)
+    return -ENOMEM;
+  fd->scratch = kmalloc_array(BATCH_CHUNK, sizeof(*fd->scratch), GFP_KERNEL);
+  if (!fd->scratch) {
+    kfree(fd);
+    return -ENOMEM;
+  }
+  mutex_init(&fd->scratch_lock);
+  spin_lock_init(&fd->cfg_lock);
+  fd->cfg.flush = FM_NONE;
+  fd->cfg.access_reserved = 0;
+  fd->cfg.err_on_access_fail = 1;
+  fd->cfg.cache_mode = CM_DEFAULT;
+  fd->cfg.access_mode = AM_DEFAULT;
+  file->private_data = fd;
+  printk("Opened module.\n");
+  return 0;
+}
+
+static int close(struct inode *inode, struct file *file) {
+  struct ra_fd *fd = file->private_data;
+  (void)inode;
+
+  kfree(fd->scratch);
+  kfree(fd);
+  printk("Closed module.\n");
+  return 0;
+}
+
+/**
+ * @brief Map physical memory into userspace. The page offset selects the pfn,
+ * the cache mode and whether reserved pages may be mapped. See MMAP_OFFSET in
+ * readalias_ioctls.h
+ */
+static int mmap(struct file *file, struct vm_area_struct *vma) {
+  unsigned long pfn = vma->vm_pgoff & MMAP_PFN_MASK;
+  enum cache_mode cache_mode =
+      (vma->vm_pgoff >> MMAP_CACHE_MODE_SHIFT) & MMAP_CACHE_MODE_MASK;
+  int access_reserved = (vma->vm_pgoff & MMAP_ACCESS_RESERVED_BIT) != 0;
+  unsigned long size = vma->vm_end - vma->vm_start;
+  unsigned long i;
+  (void)file;
+
+  if (pfn + (size >> PAGE_SHIFT) > MMAP_PFN_MASK + 1)
+    return -EINVAL;
+
+  // Same policy as for the memcpy ioctls: writing to reserved pages can cause
+  // the system to crash
+  if (!access_reserved) {
+    for (i = 0; i < (size >> PAGE_SHIFT); i++) {
+      if (pfn_valid(pfn + i) && PageReserved(pfn_to_page(pfn + i)))
+        return -EPERM;
+    }
+  }
+
+  switch (cache_mode) {
+  case CM_DEFAULT: // fallthrough
+  case CM_WB:
+    break;
+  case CM_UC:
+    vma->vm_page_prot = pgprot_noncached(vma->vm_page_prot);
+    break;
+  case CM_WC:
+    vma->vm_page_prot = pgprot_writecombine(vma->vm_page_prot);
+    break;
+  default:
+    return -EINVAL;
+  }
+
+  // Strip our flag bits, such that vm_pgoff is the pfn of the mapping
+  vma->vm_pgoff = pfn;
+  return remap_pfn_range(vma, vma->vm_start, pfn, size, vma->vm_page_prot);
+}
+
+/*
+ * All ioctls are reentrant: they only use stack/per call state, per file
+ * state and the internally locked mapping cache. Thus, many threads may use
+ * the module in parallel, either via separate or shared file descriptors
+ */
+static long ioctl(struct file *file, unsigned int cmd, unsigned long arg) {
+  struct ra_fd *fd = file->private_data;
+  struct args args;
+
+  switch (cmd) {
+  // we use the retval to communicate reserved page and mapping errs
+  // separately. Only < 0 is a hard error
+  case MEMCPY_TOPA:
+    return ioctl_memcpy_page(arg, true);
+  case MEMCPY_FROMPA:
+    return ioctl_memcpy_page(arg, false);
+  case FLUSH_PAGE:
+    if (copy_from_user(&args, (const void __user *)arg, sizeof(args)))
+      return -EFAULT;
+    return flush_range_pa(args.pa, 1, FM_CLFLUSH, args.access_reserved);
+  case WBINVD_AC:
+    return wbinvd_ac();
+  case MEMCPY_TOPA_RANGE:
+    return ioctl_memcpy_range(arg, true);
+  case MEMCPY_FROMPA_RANGE:
+    return ioctl_memcpy_range(arg, false);
+  case BATCH_SUBMIT:
+    return ioctl_batch_submit(fd, arg);
+  case SCAN:
+    return ioctl_scan(arg);
+  case PROBE:
+    return ioctl_probe(arg);
+  case FLUSH_RANGE:
+    return ioctl_flush_range(arg);
+  case PFN_STATE:
+    return ioctl_pfn_state(arg);
+  case SET_CONFIG:
+    return ioctl_set_config(fd, arg);
+  case GET_CONFIG:
+    return ioctl_get_config(fd, arg);
+  case TOPA_FAST:
+    return ioctl_memcpy_fast(fd, arg, true);
+  case FROMPA_FAST:
+    return ioctl_memcpy_fast(fd, arg, false);
+  default:
+    printk("Unknown cmd=%ud\n", cmd);
+    break;
+  }
+  return 0;
+}
+
+static const struct file_operations fops = {
+    .open = open,
+    .owner = THIS_MODULE,
+    .release = close,
+    .unlocked_ioctl = ioctl,
+    .mmap = mmap,
+    // The file offset is the physical address. There is no end
+    .llseek = no_seek_end_llseek,
+    .read_iter = read_iter,
+    .write_iter = write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read = copy_splice_read,
+#else
+    .splice_read = generic_file_splice_read,
+#endif
+    .splice_write = iter_file_splice_write,
+};
+
+static void cleanup(int device_created) {
+  if (device_created) {
+    device_destroy(myclass, major);
+    cdev_del(&mycdev);
+  }
+  if (myclass)
+    class_destroy(myclass);
+  if (major != -1)
+    unregister_chrdev_region(major, 1);
+  map_cache_destroy();
+}
+
+static int __init findpattern_init(void) {
+  int device_created = 0;
+
+  if (flush_init())
+    goto error;
+  if (map_cache_init())
+    goto error;
   /* /proc/devices */
   if (alloc_chrdev_region(&major, 0, 1, NAME "_proc") < 0)
     goto error;
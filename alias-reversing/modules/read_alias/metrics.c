@@ -0,0 +1,202 @@
+/**
+ * Latency histograms and counters of the lib operations, see the metrics section of readalias.h.
+ * All threads update the same counters with relaxed atomics. Compared to the ioctls, which take
+ * at least a few microseconds, the contention on these cache lines is negligible
+*/
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "backend.h"
+
+struct op_counters {
+  _Atomic uint64_t count;
+  _Atomic uint64_t errors;
+  _Atomic uint64_t items;
+  _Atomic uint64_t total_ns;
+  _Atomic uint64_t max_ns;
+  _Atomic uint64_t hist[RA_HIST_BUCKETS];
+};
+
+static atomic_bool metrics_enabled = false;
+static struct op_counters counters[RA_OP_COUNT];
+static _Atomic uint64_t syscalls;
+
+static const char* const op_names[RA_OP_COUNT] = {
+  [RA_OP_MEMCPY] = "memcpy",
+  [RA_OP_FLUSH] = "flush",
+  [RA_OP_WBINVD] = "wbinvd",
+  [RA_OP_BATCH] = "batch",
+  [RA_OP_SCAN] = "scan",
+  [RA_OP_PROBE] = "probe",
+  [RA_OP_PFN_STATE] = "pfn_state",
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t bucket_idx(uint64_t ns) {
+  const uint64_t sub = 1ULL << RA_HIST_SUB_BITS;
+  if( ns < sub ) {
+    return ns;
+  }
+  unsigned exp = 63 - __builtin_clzll(ns);
+  uint64_t frac = (ns >> (exp - RA_HIST_SUB_BITS)) & (sub - 1);
+  return ((exp - RA_HIST_SUB_BITS + 1) << RA_HIST_SUB_BITS) + frac;
+}
+
+uint64_t ra_hist_bucket_ns(size_t idx) {
+  const uint64_t sub = 1ULL << RA_HIST_SUB_BITS;
+  if( idx < sub ) {
+    return idx;
+  }
+  unsigned exp = (idx >> RA_HIST_SUB_BITS) - 1 + RA_HIST_SUB_BITS;
+  return (sub + (idx & (sub - 1))) << (exp - RA_HIST_SUB_BITS);
+}
+
+uint64_t metrics_start(void) {
+  if( !atomic_load_explicit(&metrics_enabled, memory_order_relaxed) ) {
+    return 0;
+  }
+  return now_ns();
+}
+
+void metrics_record(enum ra_metric_op op, uint64_t start_ns, uint64_t items, bool failed) {
+  if( start_ns == 0 ) {
+    return;
+  }
+  uint64_t ns = now_ns() - start_ns;
+  struct op_counters* c = counters + op;
+  atomic_fetch_add_explicit(&c->count, 1, memory_order_relaxed);
+  if( failed ) {
+    atomic_fetch_add_explicit(&c->errors, 1, memory_order_relaxed);
+  }
+  atomic_fetch_add_explicit(&c->items, items, memory_order_relaxed);
+  atomic_fetch_add_explicit(&c->total_ns, ns, memory_order_relaxed);
+  atomic_fetch_add_explicit(&c->hist[bucket_idx(ns)], 1, memory_order_relaxed);
+  uint64_t max = atomic_load_explicit(&c->max_ns, memory_order_relaxed);
+  while( ns > max && !atomic_compare_exchange_weak_explicit(&c->max_ns, &max, ns, memory_order_relaxed, memory_order_relaxed) ) {
+  }
+}
+
+void metrics_count_syscalls(uint64_t n) {
+  if( atomic_load_explicit(&metrics_enabled, memory_order_relaxed) ) {
+    atomic_fetch_add_explicit(&syscalls, n, memory_order_relaxed);
+  }
+}
+
+void ra_metrics_enable(bool enable) {
+  atomic_store(&metrics_enabled, enable);
+}
+
+bool ra_metrics_enabled(void) {
+  return atomic_load(&metrics_enabled);
+}
+
+void ra_metrics_snapshot(struct ra_metrics* out) {
+  for(size_t op = 0; op < RA_OP_COUNT; op++) {
+    struct op_counters* c = counters + op;
+    struct ra_op_metrics* m = out->ops + op;
+    m->count = atomic_load_explicit(&c->count, memory_order_relaxed);
+    m->errors = atomic_load_explicit(&c->errors, memory_order_relaxed);
+    m->items = atomic_load_explicit(&c->items, memory_order_relaxed);
+    m->total_ns = atomic_load_explicit(&c->total_ns, memory_order_relaxed);
+    m->max_ns = atomic_load_explicit(&c->max_ns, memory_order_relaxed);
+    for(size_t i = 0; i < RA_HIST_BUCKETS; i++) {
+      m->hist[i] = atomic_load_explicit(&c->hist[i], memory_order_relaxed);
+    }
+  }
+  out->syscalls = atomic_load_explicit(&syscalls, memory_order_relaxed);
+}
+
+void ra_metrics_reset(void) {
+  for(size_t op = 0; op < RA_OP_COUNT; op++) {
+    struct op_counters* c = counters + op;
+    atomic_store_explicit(&c->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->errors, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->items, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->total_ns, 0, memory_order_relaxed);
+    atomic_store_explicit(&c->max_ns, 0, memory_order_relaxed);
+    for(size_t i = 0; i < RA_HIST_BUCKETS; i++) {
+      atomic_store_explicit(&c->hist[i], 0, memory_order_relaxed);
+    }
+  }
+  atomic_store_explicit(&syscalls, 0, memory_order_relaxed);
+}
+
+const char* ra_metric_op_name(enum ra_metric_op op) {
+  return op < RA_OP_COUNT ? op_names[op] : "unknown";
+}
+
+uint64_t ra_metrics_quantile_ns(const struct ra_op_metrics* m, double q) {
+  uint64_t total = 0;
+  for(size_t i = 0; i < RA_HIST_BUCKETS; i++) {
+    total += m->hist[i];
+  }
+  if( total == 0 ) {
+    return 0;
+  }
+  //rank of the requested value, starting at 1
+  uint64_t rank = (uint64_t)(q * total);
+  if( (double)rank < q * total ) {
+    rank += 1;
+  }
+  if( rank < 1 ) {
+    rank = 1;
+  } else if( rank > total ) {
+    rank = total;
+  }
+  uint64_t seen = 0;
+  for(size_t i = 0; i < RA_HIST_BUCKETS; i++) {
+    seen += m->hist[i];
+    if( seen >= rank ) {
+      //upper bound of the bucket, but never above the largest recorded value
+      uint64_t upper = i + 1 < RA_HIST_BUCKETS ? ra_hist_bucket_ns(i + 1) - 1 : UINT64_MAX;
+      return upper < m->max_ns ? upper : m->max_ns;
+    }
+  }
+  return m->max_ns;
+}
+
+int ra_metrics_write_json(FILE* f, const struct ra_metrics* m) {
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  static const char* const quantile_names[] = {"p50_ns", "p90_ns", "p99_ns", "p999_ns"};
+
+  fputc('{', f);
+  for(size_t op = 0; op < RA_OP_COUNT; op++) {
+    const struct ra_op_metrics* o = m->ops + op;
+    fprintf(f, "%s\"%s\":{\"count\":%ju,\"errors\":%ju,\"items\":%ju,\"total_ns\":%ju,\"mean_ns\":%ju",
+      op ? "," : "", op_names[op], o->count, o->errors, o->items, o->total_ns, o->count ? o->total_ns / o->count : 0);
+    for(size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+      fprintf(f, ",\"%s\":%ju", quantile_names[i], ra_metrics_quantile_ns(o, quantiles[i]));
+    }
+    fprintf(f, ",\"max_ns\":%ju,\"hist\":[", o->max_ns);
+    bool first = true;
+    for(size_t i = 0; i < RA_HIST_BUCKETS; i++) {
+      if( o->hist[i] ) {
+        fprintf(f, "%s[%ju,%ju]", first ? "" : ",", ra_hist_bucket_ns(i), o->hist[i]);
+        first = false;
+      }
+    }
+    fputs("]}", f);
+  }
+  fprintf(f, ",\"syscalls\":%ju}", m->syscalls);
+  return ferror(f) ? -1 : 0;
+}
+
+int ra_metrics_write_current_json(FILE* f) {
+  struct ra_metrics* m = malloc(sizeof(*m));
+  if( !m ) {
+    err_log("failed to alloc metrics snapshot\n");
+    return -1;
+  }
+  ra_metrics_snapshot(m);
+  int ret = ra_metrics_write_json(f, m);
+  free(m);
+  return ret;
+}
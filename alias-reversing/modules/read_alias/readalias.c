@@ -1,32 +1,51 @@
+#include <pthread.h>
 #include <stdbool.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/param.h>
+#include <sys/random.h>
+#include <sys/sendfile.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
 
 
 #include "include/readalias_ioctls.h"
 #include "include/readalias.h"
+#include "backend.h"
 
-static int kmod_fd = -1;
-static int random_fd = -1;
+//context of the functions without ra_ prefix, opened by `open_kmod`
+static readalias_ctx_t default_ctx = {
+  .backend = NULL,
+  .fd = -1,
+  .session_lock = PTHREAD_RWLOCK_INITIALIZER,
+  .shared = true,
+  .rng_lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
+//backend for new contexts. Chosen by `select_backend` or the READALIAS_BACKEND environment variable
+static const struct pa_backend kmod_backend;
+static const struct pa_backend* selected_backend = NULL;
+static pthread_mutex_t backend_lock = PTHREAD_MUTEX_INITIALIZER;
 
-//err_log, _get_rand_bytes and _hexdump are copy paste from common-code but this allows
-//use to include this lib here. Since we also want to compile a lib from this code this would be confusing
 
-#define err_log(fmt, ...) fprintf(stderr, "%s:%d : " fmt, __FILE__, __LINE__, ##__VA_ARGS__);
+//ioctl on the backend fd of `ctx`, counted in the syscalls of the metrics
+static int __ioctl(readalias_ctx_t* ctx, unsigned long cmd, const void* arg) {
+  metrics_count_syscalls(1);
+  return ioctl(ctx->fd, cmd, arg);
+}
 
-static int _get_rand_bytes(void *p, size_t len) {
-  if (random_fd == -1) {
-    random_fd = open("/dev/urandom", O_RDWR);
-    if (random_fd < 0) return random_fd;
-  }
+//err_log (see backend.h), _get_rand_bytes and _hexdump are copy paste from common-code but this allows
+//use to include this lib here. Since we also want to compile a lib from this code this would be confusing
 
-  size_t nb_read = read(random_fd, p, len);
+//uses getrandom instead of a lazily opened /dev/urandom fd to be thread safe. Only used
+//for seeding, the alias test messages come from the seeded generator of the context
+static int _get_rand_bytes(void *p, size_t len) {
+  ssize_t nb_read = getrandom(p, len, 0);
 
-  return nb_read != len;
+  return nb_read < 0 || (size_t)nb_read != len;
 }
 
 static void _hexdump(uint8_t* a, const size_t n)
@@ -39,297 +58,1622 @@ static void _hexdump(uint8_t* a, const size_t n)
 	printf("\n");
 }
 
-uint64_t __next_page(uint64_t pa) {
-  return ((pa >> PAGE_SHIFT) + 1) << PAGE_SHIFT;
+static inline uint64_t rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
 }
 
-int wbinvd_ac(void) {
-  if( kmod_fd < 0) {
+static uint64_t splitmix64(uint64_t* x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/**
+ * @brief Derive the state of all lanes from `seed`
+*/
+static void __rng_seed(struct ra_rng* rng, uint64_t seed) {
+  uint64_t sm = seed;
+  for(size_t i = 0; i < 4; i++) {
+    for(size_t lane = 0; lane < RNG_LANES; lane++) {
+      rng->s[i][lane] = splitmix64(&sm);
+    }
+  }
+  rng->seed = seed;
+  rng->seeded = true;
+  rng->block_pos = RNG_BLOCK_LEN;
+}
+
+/**
+ * @brief Advance all lanes by one xoshiro256** step, producing one 64 byte block
+*/
+static void __rng_step(struct ra_rng* rng, uint64_t out[RNG_LANES]) {
+  uint64_t* s0 = rng->s[0];
+  uint64_t* s1 = rng->s[1];
+  uint64_t* s2 = rng->s[2];
+  uint64_t* s3 = rng->s[3];
+  for(size_t lane = 0; lane < RNG_LANES; lane++) {
+    out[lane] = rotl(s1[lane] * 5, 7) * 9;
+    uint64_t t = s1[lane] << 17;
+    s2[lane] ^= s0[lane];
+    s3[lane] ^= s1[lane];
+    s1[lane] ^= s2[lane];
+    s0[lane] ^= s3[lane];
+    s2[lane] ^= t;
+    s3[lane] = rotl(s3[lane], 45);
+  }
+}
+
+/**
+ * @brief Seed `rng` from getrandom if it has not been seeded yet
+ * @returns 0 on success
+*/
+static int __rng_ensure_seeded(struct ra_rng* rng) {
+  uint64_t seed;
+  if( rng->seeded ) {
+    return 0;
+  }
+  if( _get_rand_bytes(&seed, sizeof(seed)) ) {
+    err_log("failed to get random seed\n");
+    return -1;
+  }
+  __rng_seed(rng, seed);
+  return 0;
+}
+
+/**
+ * @brief Fill `p` with `len` bytes of the output stream of `rng`. The stream only depends on
+ * the seed, not on how it is split into calls
+*/
+static void __rng_bytes(struct ra_rng* rng, void* p, size_t len) {
+  uint8_t* dst = p;
+  //bytes left from the previous block
+  size_t n = MIN(len, RNG_BLOCK_LEN - rng->block_pos);
+  memcpy(dst, (uint8_t*)rng->block + rng->block_pos, n);
+  rng->block_pos += n;
+  dst += n;
+  len -= n;
+
+  for(; len >= RNG_BLOCK_LEN; len -= RNG_BLOCK_LEN, dst += RNG_BLOCK_LEN) {
+    uint64_t block[RNG_LANES];
+    __rng_step(rng, block);
+    memcpy(dst, block, RNG_BLOCK_LEN);
+  }
+  if( len ) {
+    __rng_step(rng, rng->block);
+    memcpy(dst, rng->block, len);
+    rng->block_pos = len;
+  }
+}
+
+/**
+ * @brief Get `len` random bytes for the alias test messages of `ctx` from its seeded generator.
+ * The generator is seeded from getrandom on first use, unless a seed was set
+ * @returns 0 on success
+*/
+static int __rand_bytes(readalias_ctx_t* ctx, void* p, size_t len) {
+  int ret;
+  if( ctx->shared ) {
+    pthread_mutex_lock(&ctx->rng_lock);
+  }
+  ret = __rng_ensure_seeded(&ctx->rng);
+  if( !ret ) {
+    __rng_bytes(&ctx->rng, p, len);
+  }
+  if( ctx->shared ) {
+    pthread_mutex_unlock(&ctx->rng_lock);
+  }
+  return ret;
+}
+
+static void __set_seed(readalias_ctx_t* ctx, uint64_t seed) {
+  if( ctx->shared ) {
+    pthread_mutex_lock(&ctx->rng_lock);
+  }
+  __rng_seed(&ctx->rng, seed);
+  if( ctx->shared ) {
+    pthread_mutex_unlock(&ctx->rng_lock);
+  }
+}
+
+/**
+ * @brief Get the seed of `ctx`, seeding it from getrandom if required
+ * @returns the seed or 0 if seeding failed
+*/
+static uint64_t __get_seed(readalias_ctx_t* ctx) {
+  uint64_t seed = 0;
+  if( ctx->shared ) {
+    pthread_mutex_lock(&ctx->rng_lock);
+  }
+  if( !__rng_ensure_seeded(&ctx->rng) ) {
+    seed = ctx->rng.seed;
+  }
+  if( ctx->shared ) {
+    pthread_mutex_unlock(&ctx->rng_lock);
+  }
+  return seed;
+}
+
+static int __kmod_wbinvd(readalias_ctx_t* ctx) {
+  if( ctx->fd < 0) {
     err_log("%s:%d: driver not openened\n", __FILE__, __LINE__);
     return -1;
   }
   struct args args = {0};
-  return ioctl(kmod_fd, WBINVD_AC, &args);
+  return __ioctl(ctx, WBINVD_AC, &args);
 }
 
-int __memcpy_topa(uint64_t dst, void* src, size_t count, enum flush_method fm, page_stats_t* out_stats, bool err_on_access_fail, bool access_reserved) {
-  if (kmod_fd < 0) {
+/**
+ * @brief Issue one of the multi page memcpy ioctls and update `out_stats`
+ * @parameter cmd : MEMCPY_TOPA_RANGE or MEMCPY_FROMPA_RANGE
+ * @returns 0 on success
+*/
+static int __memcpy_range(readalias_ctx_t* ctx, unsigned long cmd, void* buf, uint64_t pa, size_t count, enum flush_method fm, page_stats_t* out_stats, bool err_on_access_fail, bool access_reserved) {
+  if (ctx->fd < 0) {
     printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
     return -1;
   }
 
-  // The kernel module requires that only one page can be copied to at a time.
-  uint64_t offset = dst % PAGE_SIZE;
-
-  struct args args = {
-    .buffer = src,
-    .count = offset ? MIN(PAGE_SIZE - offset, count) : MIN(PAGE_SIZE, count),
-    .pa = dst,
+  // The kernel module walks all pages of the range, so a single ioctl is sufficient
+  struct range_args args = {
+    .buffer = buf,
+    .count = count,
+    .pa = pa,
     .flush = fm,
     .access_reserved = access_reserved,
+    .err_on_access_fail = err_on_access_fail,
   };
 
-  size_t remaining = count;
+  int ret = __ioctl(ctx, cmd, &args);
+  out_stats->reserved_pages += args.out_reserved_pages;
+  out_stats->map_failed += args.out_map_failed;
 
-  while  (remaining != 0) {
-    switch (ioctl(kmod_fd, MEMCPY_TOPA, &args)) {
-      case 0:
-        break;
-      case 1:
-        out_stats->reserved_pages += 1;
-        if( err_on_access_fail ) {
-          return -1;
-        }
-        break;
-      case 2:
-        out_stats->map_failed += 1;
-        if( err_on_access_fail ) {
-          return -1;
-        }
-        break;
-      default:
-        return -1;
+  switch (ret) {
+    case 0:
+      return 0;
+    case RET_RESERVED:
+    case RET_MAPFAIL:
+      //kernel only aborts early if err_on_access_fail is set
+      return -1;
+    default:
+      err_log("memcpy range ioctl for pa 0x%jx failed after 0x%jx of 0x%jx bytes\n",
+        pa, args.out_processed, count);
+      return -1;
+  }
+}
+
+static int __kmod_open(readalias_ctx_t* ctx) {
+  if( ctx->fd == - 1) {
+    ctx->fd = open("/dev/readalias_dev", O_RDWR);
+    if( ctx->fd >= 0 && __ioctl(ctx, GET_CONFIG, &ctx->session) ) {
+      err_log("get config ioctl failed : %s\n", strerror(errno));
+      close(ctx->fd);
+      ctx->fd = -1;
     }
+  }
+  return ctx->fd < 0 ? ctx->fd : 0;
+}
 
-    remaining -= args.count;
-    args.pa = __next_page(args.pa);
-    args.buffer = (unsigned char*)args.buffer + args.count;
-    args.count = MIN(remaining, PAGE_SIZE);
+static void __kmod_close(readalias_ctx_t* ctx) {
+  if( ctx->fd != - 1 ) {
+    close(ctx->fd);
+    ctx->fd = - 1;
   }
+}
+
+static bool __session_matches(readalias_ctx_t* ctx, const struct session_config* sc) {
+  return ctx->session.flush == sc->flush && ctx->session.access_reserved == sc->access_reserved &&
+    ctx->session.err_on_access_fail == sc->err_on_access_fail && ctx->session.cache_mode == sc->cache_mode &&
+    ctx->session.access_mode == sc->access_mode;
+}
 
+/**
+ * @brief Issue SET_CONFIG. Caller must hold the write lock of `ctx->session_lock`
+ * @returns 0 on success
+*/
+static int __set_session(readalias_ctx_t* ctx, const struct session_config* sc) {
+  if( __ioctl(ctx, SET_CONFIG, sc) ) {
+    err_log("set config ioctl failed : %s\n", strerror(errno));
+    return -1;
+  }
+  ctx->session = *sc;
   return 0;
 }
 
-int __memcpy_frompa(void* dst, uint64_t src, size_t count, enum flush_method fm, page_stats_t* out_stats, bool err_on_access_fail, bool access_reserved) {
-  if (kmod_fd < 0) {
+/**
+ * @brief Make `sc` the session config and acquire the read lock of `ctx->session_lock`.
+ * Release with pthread_rwlock_unlock
+ * @returns 0 on success
+*/
+static int __acquire_session(readalias_ctx_t* ctx, const struct session_config* sc) {
+  for(;;) {
+    pthread_rwlock_rdlock(&ctx->session_lock);
+    if( __session_matches(ctx, sc) ) {
+      return 0;
+    }
+    pthread_rwlock_unlock(&ctx->session_lock);
+
+    pthread_rwlock_wrlock(&ctx->session_lock);
+    int ret = __session_matches(ctx, sc) ? 0 : __set_session(ctx, sc);
+    pthread_rwlock_unlock(&ctx->session_lock);
+    if( ret ) {
+      return -1;
+    }
+  }
+}
+
+/**
+ * @brief Copy with TOPA_FAST/FROMPA_FAST using `cfg` as session config and update `cfg->out_stats`
+ * @returns 0 on success
+*/
+static int __memcpy_fast(readalias_ctx_t* ctx, unsigned long cmd, void* buf, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  //exact per page access statistics require the range ioctls
+  if( !cfg->err_on_access_fail && cfg->cache_mode == CM_DEFAULT && cfg->access_mode == AM_DEFAULT ) {
+    return __memcpy_range(ctx, cmd == TOPA_FAST ? MEMCPY_TOPA_RANGE : MEMCPY_FROMPA_RANGE, buf, pa, count,
+      cfg->flush_method, &cfg->out_stats, false, cfg->access_reserved);
+  }
+  if (ctx->fd < 0) {
     printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
     return -1;
   }
 
-  // The kernel module requires that only one page can be copied from at a time.
-  uint64_t offset = src % PAGE_SIZE;
+  struct session_config sc = {
+    .flush = cfg->flush_method,
+    .access_reserved = cfg->access_reserved,
+    .err_on_access_fail = cfg->err_on_access_fail,
+    .cache_mode = cfg->cache_mode,
+    .access_mode = cfg->access_mode,
+  };
+  if( __acquire_session(ctx, &sc) ) {
+    return -1;
+  }
+  struct fast_args args = {
+    .pa = pa,
+    .len = count,
+    .buf = buf,
+  };
+  int ret = __ioctl(ctx, cmd, &args);
+  pthread_rwlock_unlock(&ctx->session_lock);
+
+  switch (ret) {
+    case 0:
+      return 0;
+    case RET_RESERVED:
+      cfg->out_stats.reserved_pages += 1;
+      return cfg->err_on_access_fail ? -1 : 0;
+    case RET_MAPFAIL:
+      cfg->out_stats.map_failed += 1;
+      return cfg->err_on_access_fail ? -1 : 0;
+    default:
+      err_log("fast memcpy ioctl for pa 0x%jx with 0x%zx bytes failed : %s\n", pa, count, strerror(errno));
+      return -1;
+  }
+}
+
+static int __kmod_memcpy(readalias_ctx_t* ctx, bool to_pa, void* buf, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  return __memcpy_fast(ctx, to_pa ? TOPA_FAST : FROMPA_FAST, buf, pa, count, cfg);
+}
+
+/**
+ * @brief Flush [pa, pa+count[ with a single FLUSH_RANGE ioctl and update `out_stats`
+ * @returns 0 on success
+*/
+static int __flush_range(readalias_ctx_t* ctx, uint64_t pa, size_t count, enum flush_method fm, page_stats_t* out_stats, bool err_on_access_fail, bool access_reserved) {
+  if (ctx->fd < 0) {
+    printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
+    return -1;
+  }
 
-  struct args args = {
-    .buffer = dst,
-    .count = offset ? MIN(PAGE_SIZE - offset, count) : MIN(PAGE_SIZE, count),
-    .pa = src,
+  struct range_args args = {
+    .buffer = NULL,
+    .count = count,
+    .pa = pa,
     .flush = fm,
     .access_reserved = access_reserved,
+    .err_on_access_fail = err_on_access_fail,
+  };
+  int ret = __ioctl(ctx, FLUSH_RANGE, &args);
+  out_stats->reserved_pages += args.out_reserved_pages;
+  out_stats->map_failed += args.out_map_failed;
+
+  switch (ret) {
+    case 0:
+      return 0;
+    case RET_RESERVED:
+    case RET_MAPFAIL:
+      //kernel only aborts early if err_on_access_fail is set
+      return -1;
+    default:
+      err_log("flush range ioctl for pa 0x%jx failed after 0x%jx of 0x%jx bytes\n",
+        pa, args.out_processed, count);
+      return -1;
+  }
+}
+
+static int __kmod_flush(readalias_ctx_t* ctx, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  //the kernel resolves FM_AUTO and falls back to line flushes if FM_WBINVD is not supported
+  return __flush_range(ctx, pa, count, cfg->flush_method, &(cfg->out_stats), cfg->err_on_access_fail, cfg->access_reserved);
+}
+
+/**
+ * @brief Issue the PFN_STATE ioctl. See `get_pfn_state`
+ * @returns 0 on success
+*/
+static int __kmod_pfn_state(readalias_ctx_t* ctx, uint64_t start_pa, size_t pages, bool access_reserved, uint64_t* out_invalid, uint64_t* out_reserved,
+  uint64_t* out_inaccessible, size_t* out_inaccessible_count) {
+  if (ctx->fd < 0) {
+    printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
+    return -1;
+  }
+  struct pfn_state_args args = {
+    .start_pa = start_pa,
+    .pages = pages,
+    .access_reserved = access_reserved,
+    .out_invalid = out_invalid,
+    .out_reserved = out_reserved,
+    .out_inaccessible = out_inaccessible,
   };
+  if( __ioctl(ctx, PFN_STATE, &args) ) {
+    err_log("pfn state ioctl for 0x%jx with %zu pages failed : %s\n", start_pa, pages, strerror(errno));
+    return -1;
+  }
+  if( out_inaccessible_count ) {
+    *out_inaccessible_count = args.out_inaccessible_count;
+  }
+  return 0;
+}
 
-  size_t remaining = count;
+static int __kmod_page_state(readalias_ctx_t* ctx, uint64_t pfn, bool access_reserved, bool* out_invalid, bool* out_reserved) {
+  uint64_t invalid, reserved, inaccessible;
+  if( __kmod_pfn_state(ctx, pfn << PAGE_SHIFT, 1, access_reserved, &invalid, &reserved, &inaccessible, NULL) ) {
+    return -1;
+  }
+  *out_invalid = invalid & 1;
+  *out_reserved = reserved & 1;
+  if( !(inaccessible & 1) ) {
+    return 0;
+  }
+  return (*out_reserved && !access_reserved) ? RET_RESERVED : RET_MAPFAIL;
+}
 
-  while  (remaining != 0) {
-    switch (ioctl(kmod_fd, MEMCPY_FROMPA, &args)) {
-      case 0:
-        break;
-      case 1:
-        out_stats->reserved_pages += 1;
-        if( err_on_access_fail ) {
-          return -1;
-        }
-        break;
-      case 2:
-        out_stats->map_failed += 1;
-        if(err_on_access_fail) {
-          return -1;
-        }
-        break;
-      default:
-        return -1;
+static const struct pa_backend kmod_backend = {
+  .name = "kmod",
+  .open = __kmod_open,
+  .close = __kmod_close,
+  .memcpy_range = __kmod_memcpy,
+  .flush = __kmod_flush,
+  .wbinvd = __kmod_wbinvd,
+  .page_state = __kmod_page_state,
+};
+
+static const struct pa_backend* const backends[] = {
+  &kmod_backend,
+  &devmem_backend,
+  &sim_backend,
+};
+
+int select_backend(const char* name) {
+  for(size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+    if( strcmp(name, backends[i]->name) ) {
+      continue;
     }
+    pthread_mutex_lock(&backend_lock);
+    selected_backend = backends[i];
+    pthread_mutex_unlock(&backend_lock);
+    return 0;
+  }
+  err_log("unknown backend \"%s\"\n", name);
+  return -1;
+}
 
-    remaining -= args.count;
-    args.pa = __next_page(args.pa);
-    args.buffer = (unsigned char*)args.buffer + args.count;
-    args.count = MIN(remaining, PAGE_SIZE);
+/**
+ * @brief Get the backend for new contexts. Falls back to READALIAS_BACKEND or the
+ * kernel module if `select_backend` has not been called
+ * @returns NULL for unknown backends
+*/
+static const struct pa_backend* __selected_backend(void) {
+  pthread_mutex_lock(&backend_lock);
+  const struct pa_backend* b = selected_backend;
+  pthread_mutex_unlock(&backend_lock);
+  if( b ) {
+    return b;
   }
+  const char* name = getenv("READALIAS_BACKEND");
+  if( select_backend(name ? name : kmod_backend.name) ) {
+    return NULL;
+  }
+  return __selected_backend();
+}
 
-  return 0;
+/**
+ * @brief Get the backend of `ctx`
+ * @returns NULL if `ctx` has not been opened
+*/
+static const struct pa_backend* __ctx_backend(readalias_ctx_t* ctx) {
+  if( !ctx->backend ) {
+    err_log("no backend opened\n");
+  }
+  return ctx->backend;
 }
 
-int open_kmod() {
-  if( kmod_fd == - 1) {
-    kmod_fd = open("/dev/readalias_dev", O_RDWR);
+/**
+ * @brief Open `ctx` with the selected backend. Reopens `ctx` if it uses a different backend
+ * @returns 0 on success
+*/
+static int __ctx_open(readalias_ctx_t* ctx) {
+  const struct pa_backend* b = __selected_backend();
+  if( !b ) {
+    return -1;
   }
-  return kmod_fd < 0 ? kmod_fd : 0;
+  if( ctx->backend && ctx->backend != b ) {
+    ctx->backend->close(ctx);
+  }
+  ctx->backend = b;
+  return b->open(ctx);
 }
 
-void close_kmod() {
-  if( kmod_fd != - 1 ) {
-    close(kmod_fd);
-    kmod_fd = - 1;
+int ra_walk_pages(readalias_ctx_t* ctx, page_access_fn fn, bool to_pa, uint8_t* buf, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  while( count ) {
+    size_t chunk = MIN(count, PAGE_SIZE - (pa % PAGE_SIZE));
+    int ret = fn(ctx, to_pa, buf, pa, chunk, cfg);
+    if( ret == RET_RESERVED ) {
+      cfg->out_stats.reserved_pages += 1;
+    } else if( ret == RET_MAPFAIL ) {
+      cfg->out_stats.map_failed += 1;
+    } else if( ret ) {
+      return -1;
+    }
+    if( ret && cfg->err_on_access_fail ) {
+      return -1;
+    }
+    if( ret && buf && !to_pa ) {
+      //like a failed read of the kernel module, inaccessible pages read as zero
+      memset(buf, 0, chunk);
+    }
+    pa += chunk;
+    count -= chunk;
+    if( buf ) {
+      buf += chunk;
+    }
   }
+  return 0;
 }
 
-int memcpy_topa(uint64_t dst, void* src, size_t count, page_stats_t* out_stats, bool err_on_access_fail) {
-  return __memcpy_topa(dst, src, count, FM_NONE, out_stats, err_on_access_fail, false);
+static int __wbinvd(readalias_ctx_t* ctx) {
+  const struct pa_backend* b = __ctx_backend(ctx);
+  uint64_t t = metrics_start();
+  int ret = b ? b->wbinvd(ctx) : -1;
+  metrics_record(RA_OP_WBINVD, t, 0, ret != 0);
+  return ret;
 }
 
-int memcpy_topa_ext(uint64_t dst, void* src, size_t count, struct pamemcpy_cfg* cfg) {
-  return __memcpy_topa(dst, src, count, cfg->flush_method, &(cfg->out_stats), cfg->err_on_access_fail, cfg->access_reserved);
+static int __memcpy(readalias_ctx_t* ctx, bool to_pa, void* buf, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  const struct pa_backend* b = __ctx_backend(ctx);
+  uint64_t t = metrics_start();
+  int ret = b ? b->memcpy_range(ctx, to_pa, buf, pa, count, cfg) : -1;
+  metrics_record(RA_OP_MEMCPY, t, count, ret != 0);
+  return ret;
 }
 
-int memcpy_frompa(void* dst, uint64_t src, size_t count, page_stats_t* out_stats, bool err_on_access_fail) {
-  return __memcpy_frompa(dst, src, count, FM_NONE, out_stats, err_on_access_fail, false);
+/**
+ * @brief Copy with a cfg built from the arguments, i.e. the backend flushes the range according to `fm`, and add the
+ * access errors to `out_stats`
+ * @returns 0 on success
+*/
+static int __memcpy_stats(readalias_ctx_t* ctx, bool to_pa, void* buf, uint64_t pa, size_t count, enum flush_method fm,
+  page_stats_t* out_stats, bool err_on_access_fail, bool access_reserved) {
+  struct pamemcpy_cfg cfg = {
+    .out_stats = {0},
+    .err_on_access_fail = err_on_access_fail,
+    .access_reserved = access_reserved,
+    .flush_method = fm,
+    .cache_mode = CM_DEFAULT,
+    .access_mode = AM_DEFAULT,
+  };
+  int ret = __memcpy(ctx, to_pa, buf, pa, count, &cfg);
+  out_stats->reserved_pages += cfg.out_stats.reserved_pages;
+  out_stats->map_failed += cfg.out_stats.map_failed;
+  return ret;
 }
 
-int memcpy_frompa_ext(void* dst, uint64_t src, size_t count, struct pamemcpy_cfg* cfg) {
-  return __memcpy_frompa(dst, src , count , cfg->flush_method , &(cfg->out_stats) ,
-    cfg->err_on_access_fail , cfg->access_reserved );
+static int __flush(readalias_ctx_t* ctx, uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  if( cfg->flush_method == FM_NONE ) {
+    return 0;
+  }
+  const struct pa_backend* b = __ctx_backend(ctx);
+  uint64_t t = metrics_start();
+  int ret = b ? b->flush(ctx, pa, count, cfg) : -1;
+  metrics_record(RA_OP_FLUSH, t, count, ret != 0);
+  return ret;
 }
 
-int __clflush_range(uint64_t pa, size_t count, page_stats_t* out_stats, bool err_on_access_fail, bool access_reserved) {
-  if (kmod_fd < 0) {
+/**
+ * @brief Flush and access [pa, pa+len[ with the selected backend, which must not be the kernel module.
+ * Writes are flushed after, reads before the copy. `buf` is NULL for flush only accesses
+ * @returns 0 on success, RET_RESERVED or RET_MAPFAIL for the first inaccessible page and -1 on other errors
+*/
+static int __generic_access(readalias_ctx_t* ctx, bool to_pa, void* buf, uint64_t pa, size_t len, enum flush_method fm, bool access_reserved) {
+  struct pamemcpy_cfg cfg = {
+    .out_stats = {0},
+    .err_on_access_fail = true,
+    .access_reserved = access_reserved,
+    .flush_method = fm,
+  };
+  int ret = 0;
+  if( fm != FM_NONE && (!to_pa || !buf) ) {
+    ret = ctx->backend->flush(ctx, pa, len, &cfg);
+  }
+  if( !ret && buf ) {
+    ret = ctx->backend->memcpy_range(ctx, to_pa, buf, pa, len, &cfg);
+  }
+  if( !ret && buf && to_pa && fm != FM_NONE ) {
+    ret = ctx->backend->flush(ctx, pa, len, &cfg);
+  }
+  if( ret && cfg.out_stats.reserved_pages ) {
+    return RET_RESERVED;
+  }
+  if( ret && cfg.out_stats.map_failed ) {
+    return RET_MAPFAIL;
+  }
+  return ret ? -1 : 0;
+}
+
+static int __set_session_config(readalias_ctx_t* ctx, const struct pamemcpy_cfg* cfg) {
+  const struct pa_backend* b = __ctx_backend(ctx);
+  if( !b ) {
+    return -1;
+  }
+  if (ctx->fd < 0) {
     printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
     return -1;
   }
-
-  struct args args = {
-    .pa = pa,
-    .access_reserved = access_reserved,
+  struct session_config sc = {
+    .flush = cfg->flush_method,
+    .access_reserved = cfg->access_reserved,
+    .err_on_access_fail = cfg->err_on_access_fail,
+    .cache_mode = cfg->cache_mode,
+    .access_mode = cfg->access_mode,
   };
+  int ret = 0;
+  pthread_rwlock_wrlock(&ctx->session_lock);
+  if( b == &kmod_backend ) {
+    ret = __set_session(ctx, &sc);
+  } else {
+    //only used by `__generic_sendfile`
+    ctx->session = sc;
+  }
+  pthread_rwlock_unlock(&ctx->session_lock);
+  return ret;
+}
 
-  size_t remaining = count;
-  if (remaining % PAGE_SIZE == 0) remaining++;
+//bounce buffer size of `__generic_sendfile`
+#define SENDFILE_CHUNK (1 << 20)
 
-  while  (remaining != 0) {
-    // TODO: This might not be directly possible when the memory range is protected.
-    switch (ioctl(kmod_fd, FLUSH_PAGE, &args)) {
-      case 0:
-        break;
-      case 1:
-        out_stats->reserved_pages += 1;
-        if( err_on_access_fail ) {
-          return -1;
-        }
-        break;
-      case 2:
-        out_stats->map_failed += 1;
-        if( err_on_access_fail ) {
-          return -1;
-        }
-        break;
-      default:
-        return -1;
+/**
+ * @brief Emulate `sendfile_pa` by reading chunks with the selected backend
+ * @returns 0 on success
+*/
+static int __generic_sendfile(readalias_ctx_t* ctx, int out_fd, uint64_t pa, size_t count) {
+  int ret = 0;
+  uint8_t* buf = malloc(SENDFILE_CHUNK);
+  if( !buf ) {
+    err_log("failed to alloc bounce buffer\n");
+    return -1;
+  }
+  while( count ) {
+    size_t chunk = MIN(count, SENDFILE_CHUNK);
+    pthread_rwlock_rdlock(&ctx->session_lock);
+    struct pamemcpy_cfg cfg = {
+      .out_stats = {0},
+      .err_on_access_fail = ctx->session.err_on_access_fail,
+      .access_reserved = ctx->session.access_reserved,
+      .flush_method = ctx->session.flush,
+      .cache_mode = ctx->session.cache_mode,
+      .access_mode = ctx->session.access_mode,
+    };
+    pthread_rwlock_unlock(&ctx->session_lock);
+    if( ctx->backend->memcpy_range(ctx, false, buf, pa, chunk, &cfg) ) {
+      err_log("read at pa 0x%jx failed\n", pa);
+      ret = -1;
+      goto cleanup;
+    }
+    for(size_t done = 0; done < chunk; ) {
+      ssize_t written = write(out_fd, buf + done, chunk - done);
+      if( written <= 0 ) {
+        err_log("write failed : %s\n", written ? strerror(errno) : "no progress");
+        ret = -1;
+        goto cleanup;
+      }
+      done += written;
+    }
+    pa += chunk;
+    count -= chunk;
+  }
+cleanup:
+  free(buf);
+  return ret;
+}
+
+static int __sendfile_pa(readalias_ctx_t* ctx, int out_fd, uint64_t pa, size_t count) {
+  const struct pa_backend* b = __ctx_backend(ctx);
+  if( !b ) {
+    return -1;
+  }
+  if( b != &kmod_backend ) {
+    return __generic_sendfile(ctx, out_fd, pa, count);
+  }
+  if (ctx->fd < 0) {
+    printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
+    return -1;
+  }
+  off_t offset = pa;
+  //sendfile may transfer less than requested
+  while( count ) {
+    ssize_t sent = sendfile(out_fd, ctx->fd, &offset, count);
+    if( sent <= 0 ) {
+      err_log("sendfile at pa 0x%jx failed : %s\n", (uint64_t)offset, sent ? strerror(errno) : "no progress");
+      return -1;
     }
+    count -= sent;
+  }
+  return 0;
+}
+
+static void* __map_pa(readalias_ctx_t* ctx, uint64_t pa, size_t count, enum cache_mode cache_mode, bool access_reserved) {
+  const struct pa_backend* b = __ctx_backend(ctx);
+  if( !b ) {
+    return NULL;
+  }
+  if( b != &kmod_backend ) {
+    err_log("mapping physical memory is not supported by the %s backend\n", b->name);
+    return NULL;
+  }
+  if (ctx->fd < 0) {
+    printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
+    return NULL;
+  }
+  uint64_t aligned_pa = pa & ~((uint64_t)PAGE_SIZE - 1);
+  size_t offset = pa - aligned_pa;
+  size_t map_len = ((offset + count + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
 
-    remaining -= MIN(remaining, PAGE_SIZE);
-    args.pa = __next_page(args.pa);
+  void* mapping = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->fd,
+    MMAP_OFFSET(aligned_pa, cache_mode, access_reserved));
+  if( mapping == MAP_FAILED ) {
+    err_log("failed to map 0x%jx bytes at pa 0x%jx : %s\n", count, pa, strerror(errno));
+    return NULL;
   }
+  return (uint8_t*)mapping + offset;
+}
 
+int unmap_pa(void* mapping, size_t count) {
+  uintptr_t base = (uintptr_t)mapping & ~((uintptr_t)PAGE_SIZE - 1);
+  size_t offset = (uintptr_t)mapping - base;
+  size_t map_len = ((offset + count + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+  if( munmap((void*)base, map_len) ) {
+    err_log("munmap failed : %s\n", strerror(errno));
+    return -1;
+  }
   return 0;
 }
 
-int clflush_range(uint64_t pa, size_t count, page_stats_t* out_stats, bool err_on_access_fail) {
-  return __clflush_range(pa, count, out_stats, err_on_access_fail, false);
+void batch_init(pa_batch_t* batch) {
+  batch->descs = NULL;
+  batch->len = 0;
+  batch->cap = 0;
 }
 
-int flush_ext(uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
-  switch(cfg->flush_method) {
-    case FM_NONE:
-      return 0;
-    case FM_CLFLUSH:
-      return __clflush_range(pa, count, &(cfg->out_stats), cfg->err_on_access_fail, cfg->access_reserved);
-    case FM_WBINVD:
-      return wbinvd_ac();
-    default:
-      err_log("unknown flush method %d\n", cfg->flush_method);
-      return -1;
+void batch_free(pa_batch_t* batch) {
+  if( batch->descs ) {
+    free(batch->descs);
   }
+  batch_init(batch);
 }
 
-int check_alias(uint64_t source_pa, uint64_t alias_candidate, struct pamemcpy_cfg* memcpy_cfg, bool verbose) {
-    const size_t msg_len = 64;
-    uint8_t m1[msg_len], m2[msg_len], mxor[msg_len], buf1[msg_len], buf2[msg_len], bufxor[msg_len];
-    _get_rand_bytes(m1, msg_len);
-    _get_rand_bytes(m2, msg_len);
-    for(size_t i = 0; i < msg_len; i++) {
-        mxor[i] = m1[i] ^ m2[i];
-    }
+void batch_reset(pa_batch_t* batch) {
+  batch->len = 0;
+}
 
-    if( flush_ext(source_pa, msg_len, memcpy_cfg) ) {
-        if(verbose) err_log("flush_range for 0x%jx failed\n", source_pa);
-        return CHECK_ALIAS_ERR_ACCESS;
+/**
+ * @brief Append a descriptor to `batch`, growing the descriptor array if required
+ * @returns 0 on success
+*/
+static int _batch_add(pa_batch_t* batch, enum batch_op op, uint64_t pa, void* buf, size_t count, enum flush_method fm) {
+  if( batch->len == batch->cap ) {
+    size_t new_cap = batch->cap ? 2 * batch->cap : 32;
+    struct batch_desc* tmp = realloc(batch->descs, sizeof(struct batch_desc) * new_cap);
+    if( !tmp ) {
+      err_log("failed to grow batch to %ju entries\n", new_cap);
+      return -1;
     }
+    batch->descs = tmp;
+    batch->cap = new_cap;
+  }
+  batch->descs[batch->len] = (struct batch_desc){
+    .op = op,
+    .flush = fm,
+    .pa = pa,
+    .len = count,
+    .user_buf = buf,
+    //the kernel only overwrites this for descriptors that are executed
+    .status = -ECANCELED,
+  };
+  batch->len += 1;
+  return 0;
+}
 
-    if( memcpy_topa_ext(source_pa, m1, msg_len, memcpy_cfg) ) {
-        if(verbose) err_log("memcpy_topa for 0x%jx failed\n", source_pa);
-        return CHECK_ALIAS_ERR_ACCESS;
-    }
+int batch_add_topa(pa_batch_t* batch, uint64_t dst, void* src, size_t count, enum flush_method fm) {
+  return _batch_add(batch, BOP_TOPA, dst, src, count, fm);
+}
 
-    //read alias_candidate_pa
-    if( memcpy_frompa_ext(buf1, alias_candidate, msg_len, memcpy_cfg) ) {
-        if(verbose) err_log("memcpy_frompa for 0x%jx failed\n", alias_candidate);
-        return CHECK_ALIAS_ERR_ACCESS;
-    }
+int batch_add_frompa(pa_batch_t* batch, void* dst, uint64_t src, size_t count, enum flush_method fm) {
+  return _batch_add(batch, BOP_FROMPA, src, dst, count, fm);
+}
 
+int batch_add_flush(pa_batch_t* batch, uint64_t pa, size_t count, enum flush_method fm) {
+  return _batch_add(batch, BOP_FLUSH, pa, NULL, count, fm);
+}
 
-    //write m2 to source_pa
-    if( memcpy_topa_ext(source_pa, m2, msg_len, memcpy_cfg) ) {
-        if(verbose) err_log("memcpy_topa for source_pa 0x%jx failed\n", source_pa);
-        return CHECK_ALIAS_ERR_ACCESS;
+/**
+ * @brief Emulate BATCH_SUBMIT with the selected backend
+ * @returns number of executed descriptors
+*/
+static size_t __generic_batch(readalias_ctx_t* ctx, pa_batch_t* batch, bool access_reserved, bool stop_on_error) {
+  for(size_t i = 0; i < batch->len; i++) {
+    struct batch_desc* d = batch->descs + i;
+    switch( d->op ) {
+      case BOP_TOPA:
+      case BOP_FROMPA:
+        d->status = __generic_access(ctx, d->op == BOP_TOPA, d->user_buf, d->pa, d->len, d->flush, access_reserved);
+        break;
+      case BOP_FLUSH:
+        d->status = d->flush == FM_NONE ? 0 : __generic_access(ctx, false, NULL, d->pa, d->len, d->flush, access_reserved);
+        break;
+      default:
+        d->status = -EINVAL;
+        break;
     }
-
-    //read from target_pa
-    if( memcpy_frompa_ext(buf2, alias_candidate, msg_len, memcpy_cfg) ) {
-        if(verbose) err_log("memcpy_frompa for target_pa 0x%jx failed\n", alias_candidate);
-        return CHECK_ALIAS_ERR_ACCESS;
+    if( d->status && stop_on_error ) {
+      return i + 1;
     }
+  }
+  return batch->len;
+}
 
-    /*
-    * We wrote  m1 and m2 to source_pa and read them through alias_candidate_pa
-    * buf1 and buf2 contain the values read through surce_pa.
-    * To account for memory scrambling, we dont compare them directly but check if
-    * buf1^buf2 matches m1^m2
-    */
-
-//#define FIND_ALIAS_DEBUG
-#ifdef FIND_ALIAS_DEBUG
-    printf("alias_candidate: 0x%jx\n", alias_candidate);
-    printf("m1: ");
-    _hexdump(m1, msg_len);
-    printf("buf1: ");
-    _hexdump(buf1, msg_len);
+static int __batch_submit(readalias_ctx_t* ctx, pa_batch_t* batch, struct pamemcpy_cfg* cfg) {
+  const struct pa_backend* b = __ctx_backend(ctx);
+  if( !b ) {
+    return -1;
+  }
+  if( b == &kmod_backend && ctx->fd < 0 ) {
+    printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
+    return -1;
+  }
+  if( batch->len == 0 ) {
+    return 0;
+  }
 
+  struct batch_args args = {
+    .descs = batch->descs,
+    .count = batch->len,
+    .access_reserved = cfg->access_reserved,
+    .stop_on_error = cfg->err_on_access_fail,
+  };
+  int ret = 0;
+  uint64_t t = metrics_start();
+  if( b == &kmod_backend ) {
+    ret = __ioctl(ctx, BATCH_SUBMIT, &args);
+    if( ret < 0 ) {
+      err_log("BATCH_SUBMIT failed after %ju of %ju descriptors\n", args.out_completed, batch->len);
+    }
+  } else {
+    args.out_completed = __generic_batch(ctx, batch, cfg->access_reserved, cfg->err_on_access_fail);
+  }
+
+  bool all_ok = (ret == 0) && (args.out_completed == batch->len);
+  for(size_t i = 0; i < args.out_completed; i++) {
+    switch(batch->descs[i].status) {
+      case 0:
+        break;
+      case RET_RESERVED:
+        cfg->out_stats.reserved_pages += 1;
+        all_ok = false;
+        break;
+      case RET_MAPFAIL:
+        cfg->out_stats.map_failed += 1;
+        all_ok = false;
+        break;
+      default:
+        all_ok = false;
+        break;
+    }
+  }
+  metrics_record(RA_OP_BATCH, t, args.out_completed, !all_ok);
+  return all_ok ? 0 : -1;
+}
+
+//Number of batch descriptors queued by `_batch_add_check_alias`
+#define CHECK_ALIAS_OPS 5
+
+/**
+ * @brief Queue the memory accesses of the alias check protocol. See `check_alias`
+ * @returns 0 on success
+*/
+static int _batch_add_check_alias(pa_batch_t* batch, uint64_t source_pa, uint64_t alias_candidate, uint8_t* m1, uint8_t* m2,
+  uint8_t* buf1, uint8_t* buf2, size_t msg_len, enum flush_method fm) {
+    //write m1 to source_pa and read alias_candidate, then repeat with m2
+    if( batch_add_flush(batch, source_pa, msg_len, fm) ||
+        batch_add_topa(batch, source_pa, m1, msg_len, fm) ||
+        batch_add_frompa(batch, buf1, alias_candidate, msg_len, fm) ||
+        batch_add_topa(batch, source_pa, m2, msg_len, fm) ||
+        batch_add_frompa(batch, buf2, alias_candidate, msg_len, fm) ) {
+      return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check if any of the CHECK_ALIAS_OPS descriptors starting at `descs` failed
+*/
+static bool _check_alias_ops_failed(const struct batch_desc* descs) {
+  for(size_t i = 0; i < CHECK_ALIAS_OPS; i++) {
+    if( descs[i].status != 0 ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static int __probe_alias(readalias_ctx_t* ctx, uint64_t source_pa, const uint64_t* candidates, size_t len, struct pamemcpy_cfg* cfg, int* out_results,
+  bool verbose);
+
+/**
+ * @brief `check_alias` with the protocol queued as batch instead of a PROBE ioctl, which keeps the messages and the
+ * read buffers to print them
+ * @returns same as `check_alias`
+*/
+static int __check_alias_verbose(readalias_ctx_t* ctx, uint64_t source_pa, uint64_t alias_candidate, struct pamemcpy_cfg* memcpy_cfg) {
+    const size_t msg_len = 64;
+    uint8_t m1[msg_len], m2[msg_len], mxor[msg_len], buf1[msg_len], buf2[msg_len], bufxor[msg_len];
+    if( __rand_bytes(ctx, m1, msg_len) || __rand_bytes(ctx, m2, msg_len) ) {
+        err_log("failed to get random bytes\n");
+        return CHECK_ALIAS_ERR_ACCESS;
+    }
+    pa_batch_t batch;
+    batch_init(&batch);
+    if( _batch_add_check_alias(&batch, source_pa, alias_candidate, m1, m2, buf1, buf2, msg_len, memcpy_cfg->flush_method) ) {
+        err_log("failed to queue alias check for source_pa 0x%jx\n", source_pa);
+        batch_free(&batch);
+        return CHECK_ALIAS_ERR_ACCESS;
+    }
+    __batch_submit(ctx, &batch, memcpy_cfg);
+    bool failed = _check_alias_ops_failed(batch.descs);
+    batch_free(&batch);
+    if( failed ) {
+        err_log("failed to access source_pa 0x%jx or alias_candidate 0x%jx\n", source_pa, alias_candidate);
+        return CHECK_ALIAS_ERR_ACCESS;
+    }
+
+    /*
+    * We wrote  m1 and m2 to source_pa and read them through alias_candidate_pa
+    * To account for memory scrambling, we dont compare buf1 and buf2 directly but check if
+    * buf1^buf2 matches m1^m2
+    */
+    for(size_t i = 0; i < msg_len; i++) {
+        mxor[i] = m1[i] ^ m2[i];
+        bufxor[i] = buf1[i] ^ buf2[i];
+    }
+    if( memcmp(mxor, bufxor, msg_len) ) {
+        return CHECK_ALIAS_ERR_NO_ALIAS;
+    }
+    uint64_t pa_xor = source_pa ^ alias_candidate;
+    printf("Found alias for 0x%jx at 0x%jx! xor diff = 0x%jx\n", source_pa, alias_candidate, pa_xor);
+    printf("m1: ");
+    _hexdump(m1, msg_len);
+    printf("buf1: ");
+    _hexdump(buf1, msg_len);
     printf("m2: ");
     _hexdump(m2, msg_len);
     printf("buf2: ");
     _hexdump(buf2, msg_len);
-
-    printf("m1 ^ m2: ");
+    printf("got xor: ");
+    _hexdump(bufxor, msg_len);
+    printf("want xor: ");
     _hexdump(mxor, msg_len);
-#endif
-           
-    int found_matching_xor = 1;
+    printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n",
+        memcpy_cfg->out_stats.reserved_pages, memcpy_cfg->out_stats.map_failed);
+    return 0;
+}
+
+static int __check_alias(readalias_ctx_t* ctx, uint64_t source_pa, uint64_t alias_candidate, struct pamemcpy_cfg* memcpy_cfg, bool verbose) {
+    //the PROBE ioctl does not return the read buffers
+    if( verbose ) {
+        return __check_alias_verbose(ctx, source_pa, alias_candidate, memcpy_cfg);
+    }
+    //write m1, read alias_candidate, write m2, read alias_candidate with a single PROBE ioctl
+    int result;
+    if( __probe_alias(ctx, source_pa, &alias_candidate, 1, memcpy_cfg, &result, false) ) {
+        return CHECK_ALIAS_ERR_ACCESS;
+    }
+    return result;
+}
+
+static int __check_alias_batch(readalias_ctx_t* ctx, const uint64_t* source_pas, const uint64_t* alias_candidates, size_t len, struct pamemcpy_cfg* memcpy_cfg, int* out_results) {
+    const size_t msg_len = 64;
+    uint8_t m1[msg_len], m2[msg_len], mxor[msg_len];
+    if( __rand_bytes(ctx, m1, msg_len) || __rand_bytes(ctx, m2, msg_len) ) {
+        err_log("failed to get random bytes\n");
+        return -1;
+    }
     for(size_t i = 0; i < msg_len; i++) {
-        bufxor[i] = buf1[i] ^ buf2[i];
-        if( mxor[i] != bufxor[i]) {
-            found_matching_xor = 0;
+        mxor[i] = m1[i] ^ m2[i];
+    }
+
+    //buf1 and buf2 for each candidate
+    uint8_t* bufs = malloc(2 * msg_len * len);
+    if( !bufs ) {
+        err_log("failed to alloc read buffers for %ju candidates\n", len);
+        return -1;
+    }
+    pa_batch_t batch;
+    batch_init(&batch);
+    int ret = 0;
+    for(size_t i = 0; i < len; i++) {
+        uint8_t* buf1 = bufs + 2 * msg_len * i;
+        if( _batch_add_check_alias(&batch, source_pas[i], alias_candidates[i], m1, m2, buf1, buf1 + msg_len, msg_len, memcpy_cfg->flush_method) ) {
+            ret = -1;
+            goto cleanup;
         }
     }
-#ifdef FIND_ALIAS_DEBUG
-    printf("buf1 ^ buf2: ");
-    _hexdump(bufxor, msg_len);
-#endif
-
-    if( found_matching_xor ) {
-        if(verbose) {
-            uint64_t pa_xor = source_pa ^ alias_candidate;
-            printf("Found alias for 0x%jx at 0x%jx! xor diff = 0x%jx\n", source_pa, alias_candidate, pa_xor);
-            printf("buf1: ");
-            _hexdump(buf1, msg_len);
-            printf("buf2: ");
-            _hexdump(buf2, msg_len);
-             printf("got xor: ");
-            _hexdump(mxor, msg_len);
-            printf("want xor: ");
-            _hexdump(mxor, msg_len);
-
-            printf("Reserved Page Errors: %ju, Map Failed Errors: %ju\n",
-                memcpy_cfg->out_stats.reserved_pages, memcpy_cfg->out_stats.map_failed);
+
+    //Each candidate is evaluated individually, so we must not abort the
+    //whole batch on the first access error
+    struct pamemcpy_cfg batch_cfg = *memcpy_cfg;
+    batch_cfg.err_on_access_fail = false;
+    batch_cfg.out_stats = (page_stats_t){0};
+    __batch_submit(ctx, &batch, &batch_cfg);
+    memcpy_cfg->out_stats.reserved_pages += batch_cfg.out_stats.reserved_pages;
+    memcpy_cfg->out_stats.map_failed += batch_cfg.out_stats.map_failed;
+
+    //compare all candidates at once, the buffers of failed candidates are ignored
+    bool* eq = malloc(sizeof(bool) * len);
+    if( !eq ) {
+        err_log("failed to alloc compare results for %ju candidates\n", len);
+        ret = -1;
+        goto cleanup;
+    }
+    memeq_xor_batch(bufs, bufs + msg_len, 2 * msg_len, len, mxor, msg_len, eq);
+    for(size_t i = 0; i < len; i++) {
+        if( _check_alias_ops_failed(batch.descs + CHECK_ALIAS_OPS * i) ) {
+            out_results[i] = CHECK_ALIAS_ERR_ACCESS;
+        } else {
+            out_results[i] = eq[i] ? 0 : CHECK_ALIAS_ERR_NO_ALIAS;
         }
-        return 0;
     }
-    return CHECK_ALIAS_ERR_NO_ALIAS;
+    free(eq);
+
+cleanup:
+    batch_free(&batch);
+    free(bufs);
+    return ret;
+}
+
+/**
+ * @brief Emulate the SCAN ioctl with the selected backend. Same semantics as the kernel module
+ * @param mask : NULL to compare all bits of the marker
+ * @returns 0 on success
+*/
+static int __generic_scan(readalias_ctx_t* ctx, struct scan_args* args, const uint8_t* mask) {
+  uint8_t buf[SCAN_MAX_MARKER_LEN];
+  bool eq;
+  uint64_t cur_pfn = 0;
+  bool have_cur = false;
+  int cur_status = 0;
+  uint64_t pa;
+
+  for(pa = args->start_pa; pa < args->end_pa; pa += args->stride) {
+    if( !have_cur || (pa >> PAGE_SHIFT) != cur_pfn ) {
+      bool invalid, reserved;
+      cur_pfn = pa >> PAGE_SHIFT;
+      have_cur = true;
+      cur_status = ctx->backend->page_state(ctx, cur_pfn, args->access_reserved, &invalid, &reserved);
+      if( cur_status == RET_RESERVED ) {
+        args->out_reserved_pages += 1;
+      } else if( cur_status == RET_MAPFAIL ) {
+        args->out_map_failed += 1;
+      } else if( cur_status ) {
+        args->out_next_pa = pa;
+        return -1;
+      }
+    }
+    if( cur_status || __generic_access(ctx, false, buf, pa, args->marker_len, args->flush, args->access_reserved) ) {
+      goto next;
+    }
+    if( !memeq_batch(buf, 0, 1, args->marker, mask, args->marker_len, &eq) ) {
+      goto next;
+    }
+    if( args->out_match_count == args->max_matches ) {
+      break;
+    }
+    args->out_matches[args->out_match_count] = pa;
+    args->out_match_count += 1;
+  next:
+    //avoid an endless loop if end is close to the end of the address space
+    if( pa + args->stride < pa ) {
+      pa = args->end_pa;
+      break;
+    }
+  }
+  args->out_next_pa = pa;
+  return 0;
+}
+
+static int __scan_pa_range(readalias_ctx_t* ctx, uint64_t start, uint64_t end, uint64_t stride, const void* marker, const void* mask, size_t marker_len,
+  struct pamemcpy_cfg* cfg, uint64_t* out_matches, size_t max_matches, size_t* out_match_count, uint64_t* out_next_pa) {
+  const struct pa_backend* b = __ctx_backend(ctx);
+  if( !b ) {
+    return -1;
+  }
+  if( b == &kmod_backend && ctx->fd < 0 ) {
+    printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
+    return -1;
+  }
+  if( marker_len == 0 || marker_len > SCAN_MAX_MARKER_LEN ) {
+    err_log("invalid marker length %zu\n", marker_len);
+    return -1;
+  }
+
+  struct scan_args args = {
+    .start_pa = start,
+    .end_pa = end,
+    .stride = stride,
+    .marker_len = marker_len,
+    .use_mask = mask != NULL,
+    .flush = cfg->flush_method,
+    .access_reserved = cfg->access_reserved,
+    .out_matches = out_matches,
+    .max_matches = max_matches,
+  };
+  memcpy(args.marker, marker, marker_len);
+  if( mask ) {
+    memcpy(args.mask, mask, marker_len);
+  }
+
+  int ret;
+  uint64_t t = metrics_start();
+  if( b == &kmod_backend ) {
+    ret = __ioctl(ctx, SCAN, &args);
+  } else if( stride == 0 ) {
+    errno = EINVAL;
+    ret = -1;
+  } else {
+    args.out_next_pa = start;
+    ret = 0;
+    //flushing the whole cache once is sufficient
+    if( args.flush == FM_WBINVD ) {
+      args.flush = FM_NONE;
+      ret = b->wbinvd(ctx);
+    }
+    if( !ret ) {
+      ret = __generic_scan(ctx, &args, mask ? args.mask : NULL);
+    }
+  }
+  metrics_record(RA_OP_SCAN, t, stride && args.out_next_pa > start ? (args.out_next_pa - start + stride - 1) / stride : 0, ret != 0);
+  cfg->out_stats.reserved_pages += args.out_reserved_pages;
+  cfg->out_stats.map_failed += args.out_map_failed;
+  *out_match_count = args.out_match_count;
+  if( out_next_pa ) {
+    *out_next_pa = args.out_next_pa;
+  }
+  if( ret ) {
+    err_log("scan ioctl for [0x%jx,0x%jx[ failed at 0x%jx : %s\n", start, end, args.out_next_pa, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+//number of candidates per round of `__generic_probe`, the kernel module uses the same value
+#define GENERIC_PROBE_CHUNK 64
+
+/**
+ * @brief Emulate the PROBE ioctl with the selected backend. Same semantics as the kernel module
+ * @returns 0 on success, RET_RESERVED or RET_MAPFAIL if the source is not accessible and -1 on other errors
+*/
+static int __generic_probe(readalias_ctx_t* ctx, struct probe_args* args) {
+  uint8_t buf1[GENERIC_PROBE_CHUNK][PROBE_MAX_MSG_LEN], buf2[GENERIC_PROBE_CHUNK][PROBE_MAX_MSG_LEN];
+  uint8_t mxor[PROBE_MAX_MSG_LEN];
+  bool eq[GENERIC_PROBE_CHUNK];
+  uint64_t cand[GENERIC_PROBE_CHUNK];
+  int8_t status[GENERIC_PROBE_CHUNK];
+  const size_t len = args->msg_len;
+
+  for(size_t j = 0; j < len; j++) {
+    mxor[j] = args->m1[j] ^ args->m2[j];
+  }
+
+  for(uint64_t next = 0; next < args->count; next += GENERIC_PROBE_CHUNK) {
+    size_t n = MIN(args->count - next, GENERIC_PROBE_CHUNK);
+    for(size_t i = 0; i < n; i++) {
+      cand[i] = args->candidates ? args->candidates[next + i] : args->start_pa + (next + i) * args->stride;
+      if( (cand[i] % PAGE_SIZE) + len > PAGE_SIZE ) {
+        errno = EINVAL;
+        return -1;
+      }
+      //without this, the source would trivially be its own alias
+      status[i] = cand[i] == args->source_pa ? RET_NO_ALIAS : 0;
+    }
+    for(int second = 0; second < 2; second++) {
+      int ret = __generic_access(ctx, true, second ? args->m2 : args->m1, args->source_pa, len, args->flush, args->access_reserved);
+      if( ret ) {
+        return ret;
+      }
+      for(size_t i = 0; i < n; i++) {
+        if( status[i] ) {
+          continue;
+        }
+        status[i] = __generic_access(ctx, false, second ? buf2[i] : buf1[i], cand[i], len, args->flush, args->access_reserved);
+      }
+    }
+    //compare the whole chunk at once, the buffers of failed candidates are ignored
+    memeq_xor_batch(buf1, buf2, PROBE_MAX_MSG_LEN, n, mxor, len, eq);
+    for(size_t i = 0; i < n; i++) {
+      if( !status[i] && !eq[i] ) {
+        status[i] = RET_NO_ALIAS;
+      }
+    }
+
+    for(size_t i = 0; i < n; i++) {
+      if( status[i] == RET_RESERVED ) {
+        args->out_reserved_pages += 1;
+      } else if( status[i] == RET_MAPFAIL ) {
+        args->out_map_failed += 1;
+      } else if( status[i] < 0 ) {
+        return -1;
+      }
+    }
+    if( args->out_status ) {
+      memcpy(args->out_status + next, status, n);
+    }
+    size_t i;
+    for(i = 0; i < n; i++) {
+      if( status[i] || !args->out_matches ) {
+        continue;
+      }
+      //resume at the first match that did not fit
+      if( args->out_match_count == args->max_matches ) {
+        break;
+      }
+      args->out_matches[args->out_match_count] = cand[i];
+      args->out_match_count += 1;
+    }
+    args->out_next = next + i;
+    if( i < n ) {
+      break;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Fill in the random messages and the config of `args` and issue the PROBE ioctl
+ * @param verbose : if true, also log if the source page is reserved or cannot be mapped
+ * @returns 0 on success
+*/
+static int __probe(readalias_ctx_t* ctx, struct probe_args* args, struct pamemcpy_cfg* cfg, bool verbose) {
+  const struct pa_backend* b = __ctx_backend(ctx);
+  if( !b ) {
+    return -1;
+  }
+  if( b == &kmod_backend && ctx->fd < 0 ) {
+    printf("%s:%d: driver not openened\n", __FILE__, __LINE__);
+    return -1;
+  }
+  args->msg_len = PROBE_MAX_MSG_LEN;
+  if( __rand_bytes(ctx, args->m1, PROBE_MAX_MSG_LEN) || __rand_bytes(ctx, args->m2, PROBE_MAX_MSG_LEN) ) {
+    err_log("failed to get random bytes\n");
+    return -1;
+  }
+  args->flush = cfg->flush_method;
+  args->access_reserved = cfg->access_reserved;
+
+  uint64_t t = metrics_start();
+  int ret = b == &kmod_backend ? __ioctl(ctx, PROBE, args) : __generic_probe(ctx, args);
+  metrics_record(RA_OP_PROBE, t, args->candidates ? args->count : args->out_next, ret != 0);
+  cfg->out_stats.reserved_pages += args->out_reserved_pages;
+  cfg->out_stats.map_failed += args->out_map_failed;
+  switch (ret) {
+    case 0:
+      return 0;
+    case RET_RESERVED:
+    case RET_MAPFAIL:
+      if( verbose ) {
+        err_log("failed to access source_pa 0x%jx : %s\n", args->source_pa,
+          ret == RET_RESERVED ? "page is reserved" : "failed to map page");
+      }
+      return -1;
+    default:
+      err_log("probe ioctl for source_pa 0x%jx failed : %s\n", args->source_pa, strerror(errno));
+      return -1;
+  }
+}
+
+//candidates whose status fits on the stack, e.g. the single candidate of check_alias
+#define PROBE_STACK_STATUS 64
+
+static int __probe_alias(readalias_ctx_t* ctx, uint64_t source_pa, const uint64_t* candidates, size_t len, struct pamemcpy_cfg* cfg, int* out_results,
+  bool verbose) {
+  int8_t stack_status[PROBE_STACK_STATUS];
+  int8_t* status = len <= PROBE_STACK_STATUS ? stack_status : malloc(len);
+  if( !status ) {
+    err_log("failed to alloc status buffer for %zu candidates\n", len);
+    return -1;
+  }
+  struct probe_args args = {
+    .source_pa = source_pa,
+    .candidates = (uint64_t*)candidates,
+    .count = len,
+    .out_status = status,
+  };
+  int ret = __probe(ctx, &args, cfg, verbose);
+  if( ret == 0 ) {
+    for(size_t i = 0; i < len; i++) {
+      switch (status[i]) {
+        case 0:
+          out_results[i] = 0;
+          break;
+        case RET_NO_ALIAS:
+          out_results[i] = CHECK_ALIAS_ERR_NO_ALIAS;
+          break;
+        default:
+          out_results[i] = CHECK_ALIAS_ERR_ACCESS;
+          break;
+      }
+    }
+  }
+  if( status != stack_status ) {
+    free(status);
+  }
+  return ret;
+}
+
+static int __probe_alias_range(readalias_ctx_t* ctx, uint64_t source_pa, uint64_t start, uint64_t stride, size_t count, struct pamemcpy_cfg* cfg,
+  uint64_t* out_matches, size_t max_matches, size_t* out_match_count, size_t* out_next) {
+  struct probe_args args = {
+    .source_pa = source_pa,
+    .candidates = NULL,
+    .start_pa = start,
+    .stride = stride,
+    .count = count,
+    .out_matches = out_matches,
+    .max_matches = max_matches,
+  };
+  int ret = __probe(ctx, &args, cfg, false);
+  *out_match_count = args.out_match_count;
+  if( out_next ) {
+    *out_next = args.out_next;
+  }
+  return ret;
+}
+
+static int __get_pfn_state(readalias_ctx_t* ctx, uint64_t start_pa, size_t pages, bool access_reserved, uint64_t* out_invalid, uint64_t* out_reserved,
+  uint64_t* out_inaccessible, size_t* out_inaccessible_count) {
+  const struct pa_backend* b = __ctx_backend(ctx);
+  if( !b ) {
+    return -1;
+  }
+  uint64_t t = metrics_start();
+  if( b == &kmod_backend ) {
+    int ret = __kmod_pfn_state(ctx, start_pa, pages, access_reserved, out_invalid, out_reserved, out_inaccessible, out_inaccessible_count);
+    metrics_record(RA_OP_PFN_STATE, t, pages, ret != 0);
+    return ret;
+  }
+
+  size_t inaccessible_count = 0;
+  uint64_t* bitmaps[] = {out_invalid, out_reserved, out_inaccessible};
+  for(size_t i = 0; i < sizeof(bitmaps) / sizeof(bitmaps[0]); i++) {
+    if( bitmaps[i] ) {
+      memset(bitmaps[i], 0, PFN_BITMAP_WORDS(pages) * sizeof(uint64_t));
+    }
+  }
+  for(size_t i = 0; i < pages; i++) {
+    bool invalid = false, reserved = false;
+    int state = b->page_state(ctx, (start_pa >> PAGE_SHIFT) + i, access_reserved, &invalid, &reserved);
+    if( state < 0 ) {
+      err_log("page state for pa 0x%jx failed\n", start_pa + i * PAGE_SIZE);
+      metrics_record(RA_OP_PFN_STATE, t, i, true);
+      return -1;
+    }
+    uint64_t bit = 1ULL << (i % 64);
+    if( out_invalid && invalid ) {
+      out_invalid[i / 64] |= bit;
+    }
+    if( out_reserved && reserved ) {
+      out_reserved[i / 64] |= bit;
+    }
+    if( state ) {
+      inaccessible_count += 1;
+      if( out_inaccessible ) {
+        out_inaccessible[i / 64] |= bit;
+      }
+    }
+  }
+  if( out_inaccessible_count ) {
+    *out_inaccessible_count = inaccessible_count;
+  }
+  metrics_record(RA_OP_PFN_STATE, t, pages, false);
+  return 0;
+}
+
+//number of pages per PFN_STATE ioctl in `prune_inaccessible_pa`
+#define PRUNE_WINDOW_PAGES 4096
+
+static int __prune_inaccessible_pa(readalias_ctx_t* ctx, uint64_t* pas, size_t len, bool access_reserved, size_t* out_len) {
+  uint64_t inaccessible[PFN_BITMAP_WORDS(PRUNE_WINDOW_PAGES)];
+  //first pfn of the window described by `inaccessible`
+  uint64_t window_pfn = 0;
+  bool window_valid = false;
+  size_t next = 0;
+
+  for(size_t i = 0; i < len; i++) {
+    uint64_t pfn = pas[i] >> PAGE_SHIFT;
+    if( !window_valid || pfn < window_pfn || pfn >= window_pfn + PRUNE_WINDOW_PAGES ) {
+      window_pfn = pfn & ~((uint64_t)PRUNE_WINDOW_PAGES - 1);
+      if( __get_pfn_state(ctx, window_pfn << PAGE_SHIFT, PRUNE_WINDOW_PAGES, access_reserved, NULL, NULL, inaccessible, NULL) ) {
+        return -1;
+      }
+      window_valid = true;
+    }
+    if( !pfn_bitmap_test(inaccessible, pfn - window_pfn) ) {
+      pas[next] = pas[i];
+      next += 1;
+    }
+  }
+  *out_len = next;
+  return 0;
+}
+
+int open_kmod() {
+  return __ctx_open(&default_ctx);
+}
+
+void close_kmod() {
+  if( default_ctx.backend ) {
+    default_ctx.backend->close(&default_ctx);
+  }
+}
+
+int wbinvd_ac(void) {
+  return __wbinvd(&default_ctx);
+}
+
+void set_rand_seed(uint64_t seed) {
+  __set_seed(&default_ctx, seed);
+}
+
+uint64_t get_rand_seed(void) {
+  return __get_seed(&default_ctx);
+}
+
+int gen_rand_bytes(void* p, size_t len) {
+  return __rand_bytes(&default_ctx, p, len);
+}
+
+int __memcpy_topa(uint64_t dst, void* src, size_t count, enum flush_method fm, page_stats_t* out_stats, bool err_on_access_fail, bool access_reserved) {
+  return __memcpy_stats(&default_ctx, true, src, dst, count, fm, out_stats, err_on_access_fail, access_reserved);
+}
+
+int __memcpy_frompa(void* dst, uint64_t src, size_t count, enum flush_method fm, page_stats_t* out_stats, bool err_on_access_fail, bool access_reserved) {
+  return __memcpy_stats(&default_ctx, false, dst, src, count, fm, out_stats, err_on_access_fail, access_reserved);
+}
+
+int memcpy_topa(uint64_t dst, void* src, size_t count, page_stats_t* out_stats, bool err_on_access_fail) {
+  return __memcpy_topa(dst, src, count, FM_NONE, out_stats, err_on_access_fail, false);
+}
+
+int memcpy_topa_ext(uint64_t dst, void* src, size_t count, struct pamemcpy_cfg* cfg) {
+  return __memcpy(&default_ctx, true, src, dst, count, cfg);
+}
+
+int memcpy_frompa(void* dst, uint64_t src, size_t count, page_stats_t* out_stats, bool err_on_access_fail) {
+  return __memcpy_frompa(dst, src, count, FM_NONE, out_stats, err_on_access_fail, false);
+}
+
+int memcpy_frompa_ext(void* dst, uint64_t src, size_t count, struct pamemcpy_cfg* cfg) {
+  return __memcpy(&default_ctx, false, dst, src, count, cfg);
+}
+
+int flush_ext(uint64_t pa, size_t count, struct pamemcpy_cfg* cfg) {
+  return __flush(&default_ctx, pa, count, cfg);
+}
+
+int __clflush_range(uint64_t pa, size_t count, page_stats_t* out_stats, bool err_on_access_fail, bool access_reserved) {
+  struct pamemcpy_cfg cfg = {
+    .out_stats = {0},
+    .err_on_access_fail = err_on_access_fail,
+    .access_reserved = access_reserved,
+    .flush_method = FM_CLFLUSH,
+  };
+  int ret = __flush(&default_ctx, pa, count, &cfg);
+  out_stats->reserved_pages += cfg.out_stats.reserved_pages;
+  out_stats->map_failed += cfg.out_stats.map_failed;
+  return ret;
+}
+
+int clflush_range(uint64_t pa, size_t count, page_stats_t* out_stats, bool err_on_access_fail) {
+  return __clflush_range(pa, count, out_stats, err_on_access_fail, false);
+}
+
+int set_session_config(const struct pamemcpy_cfg* cfg) {
+  return __set_session_config(&default_ctx, cfg);
+}
+
+int sendfile_pa(int out_fd, uint64_t pa, size_t count) {
+  return __sendfile_pa(&default_ctx, out_fd, pa, count);
+}
+
+void* map_pa(uint64_t pa, size_t count, enum cache_mode cache_mode, bool access_reserved) {
+  return __map_pa(&default_ctx, pa, count, cache_mode, access_reserved);
+}
+
+int batch_submit(pa_batch_t* batch, struct pamemcpy_cfg* cfg) {
+  return __batch_submit(&default_ctx, batch, cfg);
+}
+
+int check_alias(uint64_t source_pa, uint64_t alias_candidate, struct pamemcpy_cfg* memcpy_cfg, bool verbose) {
+  return __check_alias(&default_ctx, source_pa, alias_candidate, memcpy_cfg, verbose);
+}
+
+int check_alias_batch(const uint64_t* source_pas, const uint64_t* alias_candidates, size_t len, struct pamemcpy_cfg* memcpy_cfg, int* out_results) {
+  return __check_alias_batch(&default_ctx, source_pas, alias_candidates, len, memcpy_cfg, out_results);
+}
+
+int probe_alias(uint64_t source_pa, const uint64_t* candidates, size_t len, struct pamemcpy_cfg* cfg, int* out_results) {
+  return __probe_alias(&default_ctx, source_pa, candidates, len, cfg, out_results, false);
+}
+
+int probe_alias_range(uint64_t source_pa, uint64_t start, uint64_t stride, size_t count, struct pamemcpy_cfg* cfg,
+  uint64_t* out_matches, size_t max_matches, size_t* out_match_count, size_t* out_next) {
+  return __probe_alias_range(&default_ctx, source_pa, start, stride, count, cfg, out_matches, max_matches, out_match_count, out_next);
+}
+
+int scan_pa_range(uint64_t start, uint64_t end, uint64_t stride, const void* marker, const void* mask, size_t marker_len,
+  struct pamemcpy_cfg* cfg, uint64_t* out_matches, size_t max_matches, size_t* out_match_count, uint64_t* out_next_pa) {
+  return __scan_pa_range(&default_ctx, start, end, stride, marker, mask, marker_len, cfg, out_matches, max_matches,
+    out_match_count, out_next_pa);
+}
+
+int get_pfn_state(uint64_t start_pa, size_t pages, bool access_reserved, uint64_t* out_invalid, uint64_t* out_reserved,
+  uint64_t* out_inaccessible, size_t* out_inaccessible_count) {
+  return __get_pfn_state(&default_ctx, start_pa, pages, access_reserved, out_invalid, out_reserved, out_inaccessible,
+    out_inaccessible_count);
+}
+
+int prune_inaccessible_pa(uint64_t* pas, size_t len, bool access_reserved, size_t* out_len) {
+  return __prune_inaccessible_pa(&default_ctx, pas, len, access_reserved, out_len);
+}
+
+readalias_ctx_t* ra_open(void) {
+  readalias_ctx_t* ctx = calloc(1, sizeof(*ctx));
+  if( !ctx ) {
+    err_log("failed to alloc context\n");
+    return NULL;
+  }
+  ctx->fd = -1;
+  pthread_rwlock_init(&ctx->session_lock, NULL);
+  ctx->cfg = (struct pamemcpy_cfg){
+    .out_stats = {0},
+    .err_on_access_fail = true,
+    .access_reserved = false,
+    .flush_method = FM_NONE,
+    .cache_mode = CM_DEFAULT,
+    .access_mode = AM_DEFAULT,
+  };
+  ctx->shared = false;
+  //seeded on first use or by `ra_seed`
+  ctx->rng.seeded = false;
+  if( __ctx_open(ctx) ) {
+    pthread_rwlock_destroy(&ctx->session_lock);
+    free(ctx);
+    return NULL;
+  }
+  return ctx;
+}
+
+void ra_close(readalias_ctx_t* ctx) {
+  if( !ctx ) {
+    return;
+  }
+  ctx->backend->close(ctx);
+  pthread_rwlock_destroy(&ctx->session_lock);
+  free(ctx);
+}
+
+void ra_set_config(readalias_ctx_t* ctx, const struct pamemcpy_cfg* cfg) {
+  page_stats_t stats = ctx->cfg.out_stats;
+  ctx->cfg = *cfg;
+  ctx->cfg.out_stats = stats;
+}
+
+void ra_get_config(readalias_ctx_t* ctx, struct pamemcpy_cfg* out_cfg) {
+  *out_cfg = ctx->cfg;
+}
+
+void ra_reset_stats(readalias_ctx_t* ctx) {
+  ctx->cfg.out_stats = (page_stats_t){0};
+}
+
+int ra_rand_bytes(readalias_ctx_t* ctx, void* p, size_t len) {
+  return __rand_bytes(ctx, p, len);
+}
+
+void ra_seed(readalias_ctx_t* ctx, uint64_t seed) {
+  __set_seed(ctx, seed);
+}
+
+uint64_t ra_get_seed(readalias_ctx_t* ctx) {
+  return __get_seed(ctx);
+}
+
+int ra_memcpy_topa(readalias_ctx_t* ctx, uint64_t dst, void* src, size_t count) {
+  return __memcpy(ctx, true, src, dst, count, &ctx->cfg);
+}
+
+int ra_memcpy_frompa(readalias_ctx_t* ctx, void* dst, uint64_t src, size_t count) {
+  return __memcpy(ctx, false, dst, src, count, &ctx->cfg);
+}
+
+int ra_flush(readalias_ctx_t* ctx, uint64_t pa, size_t count) {
+  return __flush(ctx, pa, count, &ctx->cfg);
+}
+
+int ra_wbinvd(readalias_ctx_t* ctx) {
+  return __wbinvd(ctx);
+}
+
+int ra_check_alias(readalias_ctx_t* ctx, uint64_t source_pa, uint64_t alias_candidate, bool verbose) {
+  return __check_alias(ctx, source_pa, alias_candidate, &ctx->cfg, verbose);
+}
+
+int ra_check_alias_batch(readalias_ctx_t* ctx, const uint64_t* source_pas, const uint64_t* alias_candidates, size_t len,
+  int* out_results) {
+  return __check_alias_batch(ctx, source_pas, alias_candidates, len, &ctx->cfg, out_results);
+}
+
+int ra_probe_alias(readalias_ctx_t* ctx, uint64_t source_pa, const uint64_t* candidates, size_t len, int* out_results) {
+  return __probe_alias(ctx, source_pa, candidates, len, &ctx->cfg, out_results, false);
+}
+
+int ra_probe_alias_range(readalias_ctx_t* ctx, uint64_t source_pa, uint64_t start, uint64_t stride, size_t count,
+  uint64_t* out_matches, size_t max_matches, size_t* out_match_count, size_t* out_next) {
+  return __probe_alias_range(ctx, source_pa, start, stride, count, &ctx->cfg, out_matches, max_matches, out_match_count, out_next);
+}
+
+int ra_scan_pa_range(readalias_ctx_t* ctx, uint64_t start, uint64_t end, uint64_t stride, const void* marker, const void* mask,
+  size_t marker_len, uint64_t* out_matches, size_t max_matches, size_t* out_match_count, uint64_t* out_next_pa) {
+  return __scan_pa_range(ctx, start, end, stride, marker, mask, marker_len, &ctx->cfg, out_matches, max_matches,
+    out_match_count, out_next_pa);
+}
+
+int ra_batch_submit(readalias_ctx_t* ctx, pa_batch_t* batch) {
+  return __batch_submit(ctx, batch, &ctx->cfg);
+}
+
+int ra_get_pfn_state(readalias_ctx_t* ctx, uint64_t start_pa, size_t pages, uint64_t* out_invalid, uint64_t* out_reserved,
+  uint64_t* out_inaccessible, size_t* out_inaccessible_count) {
+  return __get_pfn_state(ctx, start_pa, pages, ctx->cfg.access_reserved, out_invalid, out_reserved, out_inaccessible,
+    out_inaccessible_count);
+}
+
+int ra_prune_inaccessible_pa(readalias_ctx_t* ctx, uint64_t* pas, size_t len, size_t* out_len) {
+  return __prune_inaccessible_pa(ctx, pas, len, ctx->cfg.access_reserved, out_len);
+}
+
+int ra_sendfile_pa(readalias_ctx_t* ctx, int out_fd, uint64_t pa, size_t count) {
+  if( __set_session_config(ctx, &ctx->cfg) ) {
+    return -1;
+  }
+  return __sendfile_pa(ctx, out_fd, pa, count);
+}
+
+void* ra_map_pa(readalias_ctx_t* ctx, uint64_t pa, size_t count, enum cache_mode cache_mode) {
+  return __map_pa(ctx, pa, count, cache_mode, ctx->cfg.access_reserved);
 }
@@ -5,18 +5,13 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/random.h>
 
-static int randomfd = -1;
-
+//getrandom needs no lazily opened fd, i.e. this is thread safe
 int get_rand_bytes(void *p, size_t len) {
-  if (randomfd == -1) {
-    randomfd = open("/dev/urandom", O_RDWR);
-    if (randomfd < 0) return randomfd;
-  }
-
-  size_t nb_read = read(randomfd, p, len);
+  ssize_t nb_read = getrandom(p, len, 0);
 
-  return nb_read != len;
+  return nb_read < 0 || (size_t)nb_read != len;
 }
 
 void hexdump(uint8_t* a, const size_t n)
@@ -45,9 +40,22 @@ int do_stroul(char *str, int base, uint64_t *result)
     return 0;
 }
 
+uint64_t alias_fn_eval(const struct alias_fn* fn, uint64_t pa) {
+  //each output bit is the parity of a row and the pa, the 64 rows are independent of each other
+  uint64_t alias = 0;
+  for(size_t j = 0; j < 64; j++) {
+    alias |= (uint64_t)__builtin_parityll(fn->rows[j] & pa) << j;
+  }
+  return alias ^ fn->offset;
+}
+
 int get_alias(uint64_t pa, mem_range_t* mrs, uint64_t* alias_masks, size_t len, uint64_t* out_alias) {
   for(size_t i = 0; i < len; i++) {
     if( (pa >= mrs[i].start) && (pa < mrs[i].end) ) {
+      if( mrs[i].alias_fn ) {
+        *out_alias = alias_fn_eval(mrs[i].alias_fn, pa);
+        return 0;
+      }
       *out_alias = pa ^ alias_masks[i];
       return 0;
     }
@@ -9,7 +9,7 @@
 #define err_log(fmt, ...) fprintf(stderr, "%s:%d : " fmt, __FILE__, __LINE__, ##__VA_ARGS__);
 
 /**
- * @brief Read len random bytes from urandom into p
+ * @brief Read len random bytes from urandom into p. Thread safe
 */
 int get_rand_bytes(void *p, size_t len);
 
@@ -30,10 +30,24 @@ int do_stroul(char *str, int base, uint64_t *result);
 
 
 /**
- * @brief Compute the alias for the given pa
+ * @brief Alias function over GF(2) for memory ranges where the alias is not pa ^ alias mask for a
+ * fixed mask, i.e. alias = M * pa ^ offset. Bit j of the alias is parity(rows[j] & pa) ^ bit j of offset
+*/
+struct alias_fn {
+  uint64_t rows[64];
+  uint64_t offset;
+};
+
+/**
+ * @brief Evaluate `fn` for `pa`
+*/
+uint64_t alias_fn_eval(const struct alias_fn* fn, uint64_t pa);
+
+/**
+ * @brief Compute the alias for the given pa. If the memory range has an `alias_fn`, it is used instead of the alias mask
  * @brief mrs: memory range with known alias masks
  * @brief alias_masks: value to xor to an addr from the corresponding memory range to get the aliased pa
- * @rief len: length of mrs and alias_masks (i.e. both have this length)
+ * @brief len: length of mrs and alias_masks (i.e. both have this length)
  * @brief out_alias: Output param, filled with the alias pa
  * @returns: 0 on success
 */
@@ -0,0 +1,102 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//the journal is flushed to disk at most this often, unless a sync is forced
+#define JOURNAL_SYNC_INTERVAL_MS 1000
+
+enum journal_state {
+  JOURNAL_TODO = 0,
+  //work on the entry has started, `pos` is the resume point
+  JOURNAL_RUNNING,
+  JOURNAL_DONE,
+  JOURNAL_FAILED,
+};
+
+/**
+ * @brief One work item of a long running tool, e.g. a source pa of fai or a memory range of test-alias.
+ * Lives in the mmap'd journal file, i.e. writes to it are persisted by `journal_sync`. Update the result fields
+ * before `state`, so that a crash between two syncs never leaves a finished state with stale results
+*/
+struct journal_entry {
+  //identifies the item, e.g. the source pa or the start of the memory range
+  uint64_t key;
+  //enum journal_state
+  uint64_t state;
+  //resume point. Everything below this pa has been processed
+  uint64_t pos;
+  //result of the item, e.g. the alias pa
+  uint64_t result;
+  uint64_t reserved_pages;
+  uint64_t map_failed;
+  //tool specific counters
+  uint64_t counters[2];
+};
+
+typedef struct journal journal_t;
+
+enum journal_open_mode {
+  //fail if the file holds a journal with the same tag, i.e. never discard the progress of a run by accident
+  JOURNAL_CREATE = 0,
+  //keep the entries of a journal with the same tag
+  JOURNAL_RESUME,
+  //discard any existing journal
+  JOURNAL_RESTART,
+};
+
+/**
+ * @brief Open the journal at `path`. With JOURNAL_RESUME, the entries of a file that has been created with the same
+ * `tag` and `len` are kept. Otherwise, the file is (re-)created with `len` entries in state JOURNAL_TODO
+ * @param tag : identifies the configuration of the run, e.g. a `journal_hash` over the inputs. A journal with a
+ * different tag belongs to another run and is never resumed
+ * @returns NULL on error, including a journal of the same run with JOURNAL_CREATE
+*/
+journal_t* journal_open(const char* path, uint64_t tag, size_t len, enum journal_open_mode mode);
+
+/**
+ * @brief true if `journal_open` kept the entries of a previous run
+*/
+bool journal_resumed(const journal_t* j);
+
+size_t journal_len(const journal_t* j);
+
+/**
+ * @brief Entry `idx`, which has to be smaller than `journal_len`
+*/
+struct journal_entry* journal_entry(journal_t* j, size_t idx);
+
+/**
+ * @brief Record/return the index of the entry that is currently processed
+*/
+void journal_set_current(journal_t* j, size_t idx);
+size_t journal_current(const journal_t* j);
+
+/**
+ * @brief Flush the journal to disk if `force` is true or if the last flush is at least JOURNAL_SYNC_INTERVAL_MS ago.
+ * Cheap if no flush is due, i.e. this can be called after each small step. Thread safe
+ * @returns 0 on success
+*/
+int journal_sync(journal_t* j, bool force);
+
+/**
+ * @brief Flush and close the journal. Accepts NULL
+*/
+void journal_close(journal_t* j);
+
+/**
+ * @brief Close the journal and delete its file. Call this once the run is complete, so that a rerun starts over
+ * instead of resuming the finished run. Accepts NULL
+ * @returns 0 on success
+*/
+int journal_remove(journal_t* j);
+
+/**
+ * @brief FNV-1a over `data`, continuing from `h`. Start with JOURNAL_HASH_INIT
+*/
+#define JOURNAL_HASH_INIT 0xcbf29ce484222325ULL
+uint64_t journal_hash(uint64_t h, const void* data, size_t len);
+
+#endif
@@ -11,7 +11,8 @@
 
 
 /**
- * @brief Serialize the entries in `mr` to csv. 
+ * @brief Serialize the entries in `mr` to csv. Entries with an `alias_fn` additionally store
+ * their alias function in a separate section after the alias masks
  * @return 0 on success
 */
 int write_csv(char* path, mem_range_t* mr, uint64_t* alias_masks,  size_t len); 
@@ -19,7 +20,8 @@ int write_csv(char* path, mem_range_t* mr, uint64_t* alias_masks,  size_t len);
 /**
  * @brief Deserialize a csv file created with `write_csv` into mem_range_t and alias masks.
  * @param path : path to csv file
- * @param out_mr : Output parameter for the parsed memomory ranges. Caller must free
+ * @param out_mr : Output parameter for the parsed memomory ranges. Caller must free. Stored alias functions
+ * are attached via `alias_fn` and live in the same allocation
  * @param out_alias_masks : Output parameter for the parsed alias masks. Caller must free
  * @param out_len : Output parameter with length for `our_mr` and `our_alias_masks`
  * @return 0 on success
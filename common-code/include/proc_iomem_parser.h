@@ -14,12 +14,16 @@ typedef enum {
 	MT_OTHER,
 } memory_type_t;
 
+struct alias_fn;
+
 typedef struct{
     uint64_t start;
     uint64_t end;
     char name[256];
 	//describe the type of this memory region
 	memory_type_t mt;
+	//If not NULL, the alias function of this range. Otherwise the alias is pa ^ alias mask
+	const struct alias_fn* alias_fn;
 
 } mem_range_t;
 
@@ -0,0 +1,47 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "proc_iomem_parser.h"
+
+//the progress line and the metrics are updated this often
+#define PROGRESS_INTERVAL_MS 1000
+//if stdout is not a terminal, the progress line is printed this often instead of being redrawn
+#define PROGRESS_LOG_INTERVAL_MS 30000
+
+typedef struct progress progress_t;
+
+/**
+ * @brief Write a JSON value without newline to `f`, e.g. the metrics of the library that does the work
+ * @returns 0 on success. If it fails before writing anything, "null" is written instead
+*/
+typedef int (*progress_ops_fn)(FILE* f);
+
+/**
+ * @brief Start reporting the progress of a long running sweep over `total_bytes` bytes. A background thread
+ * redraws a progress line with the throughput and the ETA every PROGRESS_INTERVAL_MS. If `metrics` is not NULL,
+ * it also appends one JSON line per interval to it, with the progress, the reserved/map fail rates of each
+ * memory range and the value written by `ops` as "ops" member
+ * @param label : prefix of the progress line and "label" of the JSON lines. Must not contain quotes
+ * @param ranges : memory ranges for the per range statistics, copied. May be NULL
+ * @param metrics : JSON lines output, owned by the caller. May be NULL
+ * @param ops : Called from the background thread for each JSON line. May be NULL, "ops" is null then
+ * @returns NULL on error
+*/
+progress_t* progress_start(const char* label, uint64_t total_bytes, const mem_range_t* ranges, size_t ranges_len, FILE* metrics,
+  progress_ops_fn ops);
+
+/**
+ * @brief Add `bytes` processed bytes starting at `pa`, with the number of reserved pages and failed mappings
+ * that occured while processing them. Thread safe
+*/
+void progress_add(progress_t* p, uint64_t pa, uint64_t bytes, uint64_t reserved_pages, uint64_t map_failed);
+
+/**
+ * @brief Stop the background thread, print the final progress line and write the final JSON line. Accepts NULL
+*/
+void progress_stop(progress_t* p);
+
+#endif
@@ -0,0 +1,188 @@
+#include "include/journal.h"
+#include "include/helpers.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC 0x4c4e524a41494c41ULL
+#define JOURNAL_VERSION 1
+
+//file layout: header, followed by `len` entries. Both are 64 bytes, i.e. an entry never spans two pages
+struct journal_header {
+  uint64_t magic;
+  uint64_t version;
+  uint64_t tag;
+  uint64_t len;
+  uint64_t current;
+  uint64_t pad[3];
+};
+
+struct journal {
+  char* path;
+  int fd;
+  struct journal_header* hdr;
+  size_t map_bytes;
+  bool resumed;
+  pthread_mutex_t sync_lock;
+  uint64_t last_sync_ms;
+};
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+uint64_t journal_hash(uint64_t h, const void* data, size_t len) {
+  const uint8_t* p = data;
+  for(size_t i = 0; i < len; i++) {
+    h ^= p[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+journal_t* journal_open(const char* path, uint64_t tag, size_t len, enum journal_open_mode mode) {
+  journal_t* j = calloc(1, sizeof(*j));
+  if( !j ) {
+    err_log("failed to alloc journal\n");
+    return NULL;
+  }
+  j->fd = -1;
+  j->path = strdup(path);
+  if( !j->path ) {
+    err_log("failed to alloc journal path\n");
+    goto error;
+  }
+  j->map_bytes = sizeof(struct journal_header) + len * sizeof(struct journal_entry);
+
+  j->fd = open(path, O_RDWR | O_CREAT, 0644);
+  if( j->fd < 0 ) {
+    err_log("failed to open journal %s : %s\n", path, strerror(errno));
+    goto error;
+  }
+  struct stat st;
+  if( fstat(j->fd, &st) ) {
+    err_log("failed to stat journal %s : %s\n", path, strerror(errno));
+    goto error;
+  }
+  if( mode == JOURNAL_CREATE ) {
+    struct journal_header old;
+    if( pread(j->fd, &old, sizeof(old), 0) == (ssize_t)sizeof(old) && old.magic == JOURNAL_MAGIC &&
+      old.version == JOURNAL_VERSION && old.tag == tag ) {
+      err_log("journal %s holds the progress of the same run, resume or restart it explicitly\n", path);
+      goto error;
+    }
+  }
+  bool keep = mode == JOURNAL_RESUME && (size_t)st.st_size == j->map_bytes;
+  if( !keep ) {
+    //drop the old content, the new file reads as zero, i.e. all entries are JOURNAL_TODO
+    if( ftruncate(j->fd, 0) || ftruncate(j->fd, j->map_bytes) ) {
+      err_log("failed to resize journal %s : %s\n", path, strerror(errno));
+      goto error;
+    }
+  }
+  j->hdr = mmap(NULL, j->map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, j->fd, 0);
+  if( j->hdr == MAP_FAILED ) {
+    j->hdr = NULL;
+    err_log("failed to mmap journal %s : %s\n", path, strerror(errno));
+    goto error;
+  }
+  if( keep && (j->hdr->magic != JOURNAL_MAGIC || j->hdr->version != JOURNAL_VERSION || j->hdr->tag != tag ||
+    j->hdr->len != len) ) {
+    printf("Journal %s belongs to a different run, starting over\n", path);
+    keep = false;
+    memset(j->hdr, 0, j->map_bytes);
+  }
+  j->resumed = keep;
+  if( !keep ) {
+    j->hdr->magic = JOURNAL_MAGIC;
+    j->hdr->version = JOURNAL_VERSION;
+    j->hdr->tag = tag;
+    j->hdr->len = len;
+    j->hdr->current = 0;
+  }
+  pthread_mutex_init(&j->sync_lock, NULL);
+  if( journal_sync(j, true) ) {
+    pthread_mutex_destroy(&j->sync_lock);
+    goto error;
+  }
+  return j;
+
+error:
+  if( j->hdr ) {
+    munmap(j->hdr, j->map_bytes);
+  }
+  if( j->fd >= 0 ) {
+    close(j->fd);
+  }
+  free(j->path);
+  free(j);
+  return NULL;
+}
+
+bool journal_resumed(const journal_t* j) {
+  return j->resumed;
+}
+
+size_t journal_len(const journal_t* j) {
+  return j->hdr->len;
+}
+
+struct journal_entry* journal_entry(journal_t* j, size_t idx) {
+  return (struct journal_entry*)(j->hdr + 1) + idx;
+}
+
+void journal_set_current(journal_t* j, size_t idx) {
+  j->hdr->current = idx;
+}
+
+size_t journal_current(const journal_t* j) {
+  return j->hdr->current;
+}
+
+int journal_sync(journal_t* j, bool force) {
+  uint64_t now = now_ms();
+  pthread_mutex_lock(&j->sync_lock);
+  int ret = 0;
+  if( force || now - j->last_sync_ms >= JOURNAL_SYNC_INTERVAL_MS ) {
+    if( msync(j->hdr, j->map_bytes, MS_SYNC) ) {
+      err_log("failed to sync journal : %s\n", strerror(errno));
+      ret = -1;
+    }
+    j->last_sync_ms = now;
+  }
+  pthread_mutex_unlock(&j->sync_lock);
+  return ret;
+}
+
+void journal_close(journal_t* j) {
+  if( !j ) {
+    return;
+  }
+  journal_sync(j, true);
+  munmap(j->hdr, j->map_bytes);
+  close(j->fd);
+  pthread_mutex_destroy(&j->sync_lock);
+  free(j->path);
+  free(j);
+}
+
+int journal_remove(journal_t* j) {
+  if( !j ) {
+    return 0;
+  }
+  int ret = 0;
+  if( unlink(j->path) ) {
+    err_log("failed to remove journal %s : %s\n", j->path, strerror(errno));
+    ret = -1;
+  }
+  journal_close(j);
+  return ret;
+}
@@ -22,16 +22,83 @@ int write_csv(char* path, mem_range_t* mr, uint64_t* alias_masks,  size_t len) {
     }
   }
 
+  //ranges with an alias function get an additional row after all alias masks. Parsers that only
+  //know the alias masks stop at the header of this section
+  bool wrote_fn_header = false;
+  for(size_t i = 0; i < len; i++) {
+    const struct alias_fn* fn = mr[i].alias_fn;
+    if( !fn ) {
+      continue;
+    }
+    if( !wrote_fn_header && -1 == fprintf(f, "#alias functions: L, start pa, offset, rows 0 to 63 of the bit matrix\n") ) {
+      err_log("failed to write : %s\n", strerror(errno));
+      fclose(f);
+      return -1;
+    }
+    wrote_fn_header = true;
+    if( -1 == fprintf(f, "L,0x%jx,0x%jx", mr[i].start, fn->offset) ) {
+      err_log("failed to write : %s\n", strerror(errno));
+      fclose(f);
+      return -1;
+    }
+    for(size_t j = 0; j < 64; j++) {
+      if( -1 == fprintf(f, ",0x%jx", fn->rows[j]) ) {
+        err_log("failed to write : %s\n", strerror(errno));
+        fclose(f);
+        return -1;
+      }
+    }
+    if( -1 == fprintf(f, "\n") ) {
+      err_log("failed to write : %s\n", strerror(errno));
+      fclose(f);
+      return -1;
+    }
+  }
+
   fclose(f);
   return 0;
 }
 
+/**
+ * @brief Parse an alias function row written by `write_csv` and attach it to the memory range with the same start
+ * @param fns : storage for the alias function of each entry in `mr`
+ * @return 0 on success
+*/
+static int parse_alias_fn_row(char* line, mem_range_t* mr, struct alias_fn* fns, size_t len) {
+  uint64_t values[66];
+  char* pos = line + 1;
+  for(size_t i = 0; i < 66; i++) {
+    char* end;
+    if( *pos != ',' ) {
+      return -1;
+    }
+    errno = 0;
+    values[i] = strtoull(pos + 1, &end, 16);
+    if( end == pos + 1 || errno ) {
+      return -1;
+    }
+    pos = end;
+  }
+  for(size_t i = 0; i < len; i++) {
+    if( mr[i].start == values[0] ) {
+      fns[i].offset = values[1];
+      memcpy(fns[i].rows, values + 2, sizeof(fns[i].rows));
+      mr[i].alias_fn = fns + i;
+      return 0;
+    }
+  }
+  return -1;
+}
+
 
 int parse_csv(char* path, mem_range_t** out_mr, uint64_t** out_alias_masks, size_t* out_len) {
   FILE* f = fopen(path, "r");
   char* buf = NULL;
   mem_range_t* mr = NULL;
   uint64_t* alias_masks = NULL;
+  struct alias_fn* fns;
+  char* line = NULL;
+  size_t line_bytes = 0;
   size_t idx;
   int retval = 0;
   if(!f) {
@@ -71,7 +138,9 @@ int parse_csv(char* path, mem_range_t** out_mr, uint64_t** out_alias_masks, size
 
 
 
-  mr = (mem_range_t*)malloc(sizeof(mem_range_t) * len);
+  //the alias functions are stored behind the memory ranges, i.e. freeing `mr` frees them as well
+  mr = (mem_range_t*)malloc((sizeof(mem_range_t) + sizeof(struct alias_fn)) * len);
+  fns = (struct alias_fn*)(mr + len);
   alias_masks = (uint64_t*)malloc(sizeof(uint64_t) * len);
   idx = 0;
   if( fgets(buf, buf_bytes, f) == NULL ) {
@@ -85,6 +154,7 @@ int parse_csv(char* path, mem_range_t** out_mr, uint64_t** out_alias_masks, size
   while( 3 == fscanf(f, "0x%jx,0x%jx,0x%jx\n", &(mr[idx].start), &(mr[idx].end), &(alias_masks[idx]) ) ){
     char* dummy_name = "Not restored by parser\n";
     memcpy(mr[idx].name, dummy_name, strlen(dummy_name));
+    mr[idx].alias_fn = NULL;
     idx += 1;
   }
   if( ferror(f) ) {
@@ -95,6 +165,20 @@ int parse_csv(char* path, mem_range_t** out_mr, uint64_t** out_alias_masks, size
     err_log("Expected to read %ju entries but got %ju\n", len, idx);
     goto error;
   }
+  //optional alias functions after the alias masks
+  while( getline(&line, &line_bytes, f) != -1 ) {
+    if( line[0] != 'L' ) {
+      continue;
+    }
+    if( parse_alias_fn_row(line, mr, fns, len) ) {
+      err_log("Invalid alias function row in %s : %s", path, line);
+      goto error;
+    }
+  }
+  if( ferror(f) ) {
+    err_log("Error reading from %s : %s\n", path, strerror(errno));
+    goto error;
+  }
 
   *out_len = len;
   *out_mr =mr;
@@ -118,6 +202,9 @@ cleanup:
   if( buf ) {
     free(buf);
   }
+  if( line ) {
+    free(line);
+  }
   return retval;
   
 }
@@ -9,6 +9,7 @@ int _regexp_matches_to_mem_range(regmatch_t* matches, size_t matches_len, char*
         err_log( "expected 4 matches but got %lu\n", matches_len);
         return -1;
     }
+    result->alias_fn = NULL;
 
     for( size_t i = 0; i < matches_len; i++) {
         if( matches[i].rm_so == -1 ) {
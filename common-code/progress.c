@@ -0,0 +1,209 @@
+#include "include/progress.h"
+#include "include/helpers.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct range_stats {
+  uint64_t start;
+  uint64_t end;
+  uint64_t pages;
+  uint64_t reserved;
+  uint64_t map_failed;
+};
+
+struct progress {
+  char label[64];
+  uint64_t total_bytes;
+  FILE* metrics;
+  progress_ops_fn ops;
+  bool tty;
+  pthread_t thread;
+  //protects all fields below
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  bool stop;
+  uint64_t done_bytes;
+  struct range_stats* ranges;
+  size_t ranges_len;
+  uint64_t start_ms;
+  //state of the last tick, for the current throughput
+  uint64_t last_ms;
+  uint64_t last_bytes;
+  uint64_t last_log_ms;
+};
+
+static uint64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void format_duration(char* buf, size_t len, double s) {
+  uint64_t secs = (uint64_t)s;
+  snprintf(buf, len, "%ju:%02ju:%02ju", secs / 3600, (secs / 60) % 60, secs % 60);
+}
+
+/**
+ * @brief Print the progress line and write the JSON line. Caller must hold `p->lock`
+ * @param final : If true, print the line even if no update is due and end it with a newline
+*/
+static void tick(progress_t* p, bool final) {
+  uint64_t now = now_ms();
+  double elapsed = (now - p->start_ms) / 1000.0;
+  double interval = (now - p->last_ms) / 1000.0;
+  //the current throughput covers the last interval, the ETA uses the average of the whole run
+  double pages_per_s = interval > 0 ? (p->done_bytes - p->last_bytes) / 4096.0 / interval : 0;
+  double avg_bytes_per_s = elapsed > 0 ? p->done_bytes / elapsed : 0;
+  double eta = p->done_bytes && p->done_bytes < p->total_bytes ? (p->total_bytes - p->done_bytes) / avg_bytes_per_s : 0;
+  if( final ) {
+    pages_per_s = elapsed > 0 ? p->done_bytes / 4096.0 / elapsed : 0;
+    eta = 0;
+  }
+  p->last_ms = now;
+  p->last_bytes = p->done_bytes;
+
+  if( final || p->tty || now - p->last_log_ms >= PROGRESS_LOG_INTERVAL_MS ) {
+    char elapsed_str[32], eta_str[32];
+    format_duration(elapsed_str, sizeof(elapsed_str), elapsed);
+    format_duration(eta_str, sizeof(eta_str), eta);
+    uint64_t reserved = 0, map_failed = 0;
+    for(size_t i = 0; i < p->ranges_len; i++) {
+      reserved += p->ranges[i].reserved;
+      map_failed += p->ranges[i].map_failed;
+    }
+    printf("%s[%s] %5.1f%% %.2f of %.2f GiB, %.0f pages/s, elapsed %s, ETA %s, reserved %ju, map failed %ju%s",
+      p->tty ? "\r\033[K" : "", p->label, p->total_bytes ? 100.0 * p->done_bytes / p->total_bytes : 100.0,
+      (double)p->done_bytes / (1 << 30), (double)p->total_bytes / (1 << 30), pages_per_s, elapsed_str, eta_str,
+      reserved, map_failed, p->tty && !final ? "" : "\n");
+    fflush(stdout);
+    p->last_log_ms = now;
+  }
+
+  if( !p->metrics ) {
+    return;
+  }
+  fprintf(p->metrics, "{\"label\":\"%s\",\"final\":%s,\"elapsed_s\":%.3f,\"done_bytes\":%ju,\"total_bytes\":%ju,"
+    "\"pages_per_s\":%.1f,\"eta_s\":%.1f,\"ranges\":[", p->label, final ? "true" : "false", elapsed, p->done_bytes,
+    p->total_bytes, pages_per_s, eta);
+  bool first = true;
+  for(size_t i = 0; i < p->ranges_len; i++) {
+    const struct range_stats* r = p->ranges + i;
+    if( r->pages == 0 ) {
+      continue;
+    }
+    fprintf(p->metrics, "%s{\"start\":\"0x%jx\",\"end\":\"0x%jx\",\"pages\":%ju,\"reserved\":%ju,\"map_failed\":%ju,"
+      "\"reserved_rate\":%.6f,\"map_failed_rate\":%.6f}", first ? "" : ",", r->start, r->end, r->pages, r->reserved,
+      r->map_failed, (double)r->reserved / r->pages, (double)r->map_failed / r->pages);
+    first = false;
+  }
+  fputs("],\"ops\":", p->metrics);
+  if( !p->ops || p->ops(p->metrics) ) {
+    fputs("null", p->metrics);
+  }
+  fputs("}\n", p->metrics);
+  fflush(p->metrics);
+}
+
+static void* progress_main(void* arg) {
+  progress_t* p = arg;
+  pthread_mutex_lock(&p->lock);
+  while( !p->stop ) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += PROGRESS_INTERVAL_MS / 1000;
+    deadline.tv_nsec += (PROGRESS_INTERVAL_MS % 1000) * 1000000L;
+    if( deadline.tv_nsec >= 1000000000L ) {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    while( !p->stop && pthread_cond_timedwait(&p->cond, &p->lock, &deadline) == 0 ) {
+    }
+    if( !p->stop ) {
+      tick(p, false);
+    }
+  }
+  pthread_mutex_unlock(&p->lock);
+  return NULL;
+}
+
+progress_t* progress_start(const char* label, uint64_t total_bytes, const mem_range_t* ranges, size_t ranges_len, FILE* metrics,
+  progress_ops_fn ops) {
+  progress_t* p = calloc(1, sizeof(*p));
+  if( !p ) {
+    err_log("failed to alloc progress\n");
+    return NULL;
+  }
+  snprintf(p->label, sizeof(p->label), "%s", label);
+  p->total_bytes = total_bytes;
+  p->metrics = metrics;
+  p->ops = ops;
+  p->tty = isatty(STDOUT_FILENO);
+  if( ranges_len ) {
+    p->ranges = calloc(ranges_len, sizeof(struct range_stats));
+    if( !p->ranges ) {
+      err_log("failed to alloc range stats\n");
+      free(p);
+      return NULL;
+    }
+    for(size_t i = 0; i < ranges_len; i++) {
+      p->ranges[i].start = ranges[i].start;
+      p->ranges[i].end = ranges[i].end;
+    }
+    p->ranges_len = ranges_len;
+  }
+  p->start_ms = now_ms();
+  p->last_ms = p->start_ms;
+  p->last_log_ms = p->start_ms;
+
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&p->cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&p->lock, NULL);
+  if( pthread_create(&p->thread, NULL, progress_main, p) ) {
+    err_log("failed to start progress thread\n");
+    pthread_cond_destroy(&p->cond);
+    pthread_mutex_destroy(&p->lock);
+    free(p->ranges);
+    free(p);
+    return NULL;
+  }
+  return p;
+}
+
+void progress_add(progress_t* p, uint64_t pa, uint64_t bytes, uint64_t reserved_pages, uint64_t map_failed) {
+  pthread_mutex_lock(&p->lock);
+  p->done_bytes += bytes;
+  for(size_t i = 0; i < p->ranges_len; i++) {
+    struct range_stats* r = p->ranges + i;
+    if( pa >= r->start && pa < r->end ) {
+      r->pages += (bytes + 4095) / 4096;
+      r->reserved += reserved_pages;
+      r->map_failed += map_failed;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&p->lock);
+}
+
+void progress_stop(progress_t* p) {
+  if( !p ) {
+    return;
+  }
+  pthread_mutex_lock(&p->lock);
+  p->stop = true;
+  pthread_cond_signal(&p->cond);
+  pthread_mutex_unlock(&p->lock);
+  pthread_join(p->thread, NULL);
+
+  tick(p, true);
+  pthread_cond_destroy(&p->cond);
+  pthread_mutex_destroy(&p->lock);
+  free(p->ranges);
+  free(p);
+}
@@ -82,7 +82,12 @@ void sha256_hash(const uint8_t *input,size_t input_len, uint8_t *output) {
 int dump_tmr(struct app app) {
 	FILE* f = NULL;
 	uint8_t* tmr_content = NULL;
-	page_stats_t stats;
+	struct pamemcpy_cfg flush_cfg = {
+		.out_stats = {0},
+		.err_on_access_fail = true,
+		.access_reserved = false,
+		.flush_method = app.args.read_via_alias ? FM_NONE : FM_AUTO,
+	};
 	uint64_t tmr_pa = app.args.tmr_pa_start;
 	size_t tmr_bytes = app.args.tmr_bytes;
 	//depending to cli flag this is either the true pa or the alias
@@ -104,15 +109,15 @@ int dump_tmr(struct app app) {
 	tmr_content = (uint8_t*)malloc(app.args.tmr_bytes);
 	printf("Copying TMR via  0x%jx bytes 0x%jx aliased? %d\n", tmr_access_pa, tmr_bytes,
 		app.args.read_via_alias);
-	if(wbinvd_ac()) {
+	if(app.args.read_via_alias && wbinvd_ac()) {
 		err_log("wbivnd failed\n");
 		goto error;
 	}
-	if(memcpy_frompa(tmr_content, tmr_access_pa, tmr_bytes , &stats , true)) {
+	if(memcpy_frompa_ext(tmr_content, tmr_access_pa, tmr_bytes, &flush_cfg)) {
 		err_log("failed to read from tmr\n");
 		goto error;
 	}
-	if(wbinvd_ac()) {
+	if(app.args.read_via_alias && wbinvd_ac()) {
 		err_log("wbivnd failed\n");
 		goto error;
 	}
@@ -160,7 +165,19 @@ int mode_replay(struct app app) {
 
 	//keeps track if we need to unpause VM in cleanup path
 	bool vm_paused = false;
-	page_stats_t stats;
+	struct pamemcpy_cfg read_cfg = {
+		.out_stats = {0},
+		.err_on_access_fail = true,
+		.access_reserved = false,
+		.flush_method = app.args.read_via_alias ? FM_NONE : FM_AUTO,
+	};
+	//the replay always writes via the alias
+	struct pamemcpy_cfg write_cfg = {
+		.out_stats = {0},
+		.err_on_access_fail = true,
+		.access_reserved = false,
+		.flush_method = FM_NONE,
+	};
 	uint64_t tmr_pa = app.args.tmr_pa_start;
 	size_t tmr_bytes = app.args.tmr_bytes;
 	//depending to cli flag this is either the true pa or the alias
@@ -192,15 +209,15 @@ int mode_replay(struct app app) {
 	state_A_tmr_content = (uint8_t*)malloc(app.args.tmr_bytes);
 	printf("Copying TMR via  0x%jx bytes 0x%jx aliased? %d\n", tmr_read_pa, tmr_bytes,
 		app.args.read_via_alias);
-	if(wbinvd_ac()) {
+	if(app.args.read_via_alias && wbinvd_ac()) {
 		err_log("wbivnd failed\n");
 		goto error;
 	}
-	if(memcpy_frompa(state_A_tmr_content, tmr_read_pa, tmr_bytes , &stats , true)) {
+	if(memcpy_frompa_ext(state_A_tmr_content, tmr_read_pa, tmr_bytes, &read_cfg)) {
 		err_log("failed to read from tmr\n");
 		goto error;
 	}
-	if(wbinvd_ac()) {
+	if(app.args.read_via_alias && wbinvd_ac()) {
 		err_log("wbivnd failed\n");
 		goto error;
 	}
@@ -230,15 +247,15 @@ int mode_replay(struct app app) {
 	state_B_tmr_content = (uint8_t*)malloc(app.args.tmr_bytes);
 	printf("Copying TMR via  0x%jx bytes 0x%jx aliased? %d\n", tmr_read_pa, tmr_bytes,
 		app.args.read_via_alias);
-	if(wbinvd_ac()) {
+	if(app.args.read_via_alias && wbinvd_ac()) {
 		err_log("wbivnd failed\n");
 		goto error;
 	}
-	if(memcpy_frompa(state_B_tmr_content, tmr_read_pa, tmr_bytes , &stats , true)) {
+	if(memcpy_frompa_ext(state_B_tmr_content, tmr_read_pa, tmr_bytes, &read_cfg)) {
 		err_log("failed to read from tmr\n");
 		goto error;
 	}
-	if(wbinvd_ac()) {
+	if(app.args.read_via_alias && wbinvd_ac()) {
 		err_log("wbivnd failed\n");
 		goto error;
 	}
@@ -255,7 +272,11 @@ int mode_replay(struct app app) {
 	memset(state_A_tmr_content , 0x0, app.args.tmr_bytes);
 	
 
-	if(memcpy_topa(alias_tmr_pa, state_A_tmr_content, tmr_bytes , &stats , true)) {
+	if(wbinvd_ac()) {
+		err_log("wbivnd failed\n");
+		goto error;
+	}
+	if(memcpy_topa_ext(alias_tmr_pa, state_A_tmr_content, tmr_bytes, &write_cfg)) {
 		err_log("failed to read from tmr\n");
 		goto error;
 	}
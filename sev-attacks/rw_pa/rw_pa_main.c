@@ -94,7 +94,12 @@ int write_to_target(struct app app) {
 	
 	FILE* f = NULL;
 	uint8_t* buffer = NULL;
-	page_stats_t stats;
+	struct pamemcpy_cfg flush_cfg = {
+		.out_stats = {0},
+		.err_on_access_fail = true,
+		.access_reserved = false,
+		.flush_method = app.args.use_alias ? FM_NONE : FM_AUTO,
+	};
 	uint64_t target_pa = app.args.target_pa;
 	size_t target_bytes = app.args.target_bytes;
 	//depending to cli flag this is either the true pa or the alias
@@ -134,15 +139,15 @@ int write_to_target(struct app app) {
 	}
 
 	//copy data to target memory
-	if(wbinvd_ac()) {
+	if(app.args.use_alias && wbinvd_ac()) {
 		err_log("wbivnd failed\n");
 		goto error;
 	}
-	if(memcpy_topa(access_pa, buffer, target_bytes , &stats , true)) {
+	if(memcpy_topa_ext(access_pa, buffer, target_bytes, &flush_cfg)) {
 		err_log("failed to copy to 0x%jx bytes to pa 0x%jx\n", target_bytes, access_pa);
 		goto error;
 	}
-	if(wbinvd_ac()) {
+	if(app.args.use_alias && wbinvd_ac()) {
 		err_log("wbivnd failed\n");
 		goto error;
 	}
@@ -163,8 +168,12 @@ cleanup:
 */
 int dump_target(struct app app) {
 	FILE* f = NULL;
-	uint8_t* buffer = NULL;
-	page_stats_t stats;
+	struct pamemcpy_cfg flush_cfg = {
+		.out_stats = {0},
+		.err_on_access_fail = true,
+		.access_reserved = false,
+		.flush_method = app.args.use_alias ? FM_NONE : FM_AUTO,
+	};
 	uint64_t target_pa = app.args.target_pa;
 	size_t target_bytes = app.args.target_bytes;
 	//depending to cli flag this is either the true pa or the alias
@@ -184,28 +193,26 @@ int dump_target(struct app app) {
 	}
 
 
-	//copy data from target memory into buffer
-	buffer = (uint8_t*)malloc(app.args.target_bytes);
-	if(wbinvd_ac()) {
-		err_log("wbivnd failed\n");
+	f = fopen(app.args.file_path,"wb");
+	if(!f) {
+		err_log("failed to create file %s : %s\n", app.args.file_path, strerror(errno));
 		goto error;
 	}
-	if(memcpy_frompa(buffer, access_pa, target_bytes , &stats , true)) {
-		err_log("failed to read from tmr\n");
+	//stream target memory to the file inside the kernel
+	if(set_session_config(&flush_cfg)) {
+		err_log("failed to set session config\n");
 		goto error;
 	}
-	if(wbinvd_ac()) {
+	if(app.args.use_alias && wbinvd_ac()) {
 		err_log("wbivnd failed\n");
 		goto error;
 	}
-	
-	f = fopen(app.args.file_path,"wb");
-	if(!f) {
-		err_log("failed to create file %s : %s\n", app.args.file_path, strerror(errno));
+	if(sendfile_pa(fileno(f), access_pa, target_bytes)) {
+		err_log("failed to copy target memory to file\n");
 		goto error;
 	}
-	if( 1 != fwrite(buffer, target_bytes , 1 , f )) {
-		err_log("failed to write tmr content to file : %s", strerror(errno));
+	if(app.args.use_alias && wbinvd_ac()) {
+		err_log("wbivnd failed\n");
 		goto error;
 	}
 
@@ -216,7 +223,6 @@ error:
 	ret = -1;
 cleanup:
 	if(f) fclose(f);
-	if(buffer) free(buffer);
 	return ret;
 }
 
@@ -124,7 +124,12 @@ int main(int argc, char** argv) {
         goto cleanup;
     }
 
-    page_stats_t stats;
+    struct pamemcpy_cfg flush_cfg = {
+        .out_stats = {0},
+        .err_on_access_fail = true,
+        .access_reserved = false,
+        .flush_method = FM_NONE,
+    };
     const size_t captured_cipher_len = 4096;
     uint8_t* captured_cipher = malloc(captured_cipher_len);
     
@@ -134,7 +139,7 @@ int main(int argc, char** argv) {
         free(captured_cipher);
         goto cleanup;
     }
-    if(memcpy_frompa(captured_cipher, alias, captured_cipher_len, &stats, true )) {
+    if(memcpy_frompa_ext(captured_cipher, alias, captured_cipher_len, &flush_cfg)) {
         err_log("failed to read from alias 0x%jx\n", alias);
         exit_code = EXIT_CODE_ERR;
         free(captured_cipher);
@@ -151,7 +156,7 @@ int main(int argc, char** argv) {
         free(captured_cipher);
         goto cleanup;
     }
-    if(memcpy_topa(alias, captured_cipher, captured_cipher_len, &stats, true)) {
+    if(memcpy_topa_ext(alias, captured_cipher, captured_cipher_len, &flush_cfg)) {
         err_log("failed to write to alias 0x%jx\n", alias);
         exit_code = EXIT_CODE_ERR;
         free(captured_cipher);